@@ -34,7 +34,7 @@ void deallocate_bit_stream(BitStream* bit_stream) {
 
 void get_next_byte(BitStream* bit_stream) {
     if (bit_stream -> byte >= bit_stream -> size) {
-        error_print("exceed bitstream length: %d, with: %d\n", bit_stream -> size, bit_stream -> byte);
+        if (!(bit_stream -> is_input_open)) error_print("exceed bitstream length: %d, with: %d\n", bit_stream -> size, bit_stream -> byte);
         bit_stream -> error = EXCEEDED_LENGTH;
         bit_stream -> current_byte = 0;
         bit_stream -> bit = 0;
@@ -97,7 +97,7 @@ void skip_n_bits(BitStream* bit_stream, unsigned int bits) {
 }
 
 void set_byte(BitStream* bit_stream, unsigned int byte) {
-    if (byte >= bit_stream -> size) {
+    if (byte > bit_stream -> size) {
         error_print("Set byte to %u while the length of the BitStream is %u\n", byte, bit_stream -> size);
         return;
     }
@@ -2,45 +2,34 @@
 #define _CHUNK_H_
 
 #include <stdlib.h>
+#include <string.h>
 #include "./types.h"
 #include "./debug_print.h"
 #include "./bitstream.h"
+#include "./checksum.h"
+#include "./decoder_context.h"
 
-static void crc_byte(BitStream* bit_stream, unsigned int* crc_register, unsigned int* crc_table) {
-    unsigned char data = get_next_byte_uc(bit_stream);
-    unsigned int index = ((*crc_register) ^ data) & 0xFF;
-    *crc_register = crc_table[index] ^ (((*crc_register) >> 8) & 0X00FFFFFF);
-    return;
-}
+#define IS_CRITICAL_CHUNK(chunk_type) (!((chunk_type)[0] & 0x20))
 
-static unsigned int calculate_crc(BitStream* bit_stream, unsigned int length, unsigned int* crc_table) {
-    unsigned int crc_register = 0xFFFFFFFFL;
-    for (unsigned int ii = 0; ii < length ; ++ii) {
-        crc_byte(bit_stream, &crc_register, crc_table);
-    }
-    return (~crc_register);
-}
+/* -------------------------------------------------------------------------------------- */
 
-static unsigned int* generate_crc_table(void) {
-    unsigned int* crc_table = (unsigned int*) calloc(256, sizeof(unsigned int));
-    for (unsigned int ii = 0; ii < 256; ++ii) {
-        crc_table[ii] = ii;
-        for (unsigned int jj = 0 ; jj < 8; ++jj) {
-            if ((crc_table[ii] & 0x1) == 0) {
-                crc_table[ii] >>= 1;
-            } else {
-                crc_table[ii] = 0xEDB88320L ^ (crc_table[ii] >> 1) ;
-            }
-        }
-    }
-    return crc_table;
-}
+Chunks find_and_check_chunks(unsigned char* file_data, unsigned int file_length, ChecksumPolicy policy, bool is_idat_crc_deferred);
+bool check_idat_chunks(unsigned char* file_data, unsigned int file_length, unsigned int pos);
+void deallocate_chunks(Chunks chunks);
 
-Chunks find_and_check_chunks(unsigned char* file_data, unsigned int file_length, unsigned int* idat_chunks_count) {
+/* -------------------------------------------------------------------------------------- */
+
+// The crc of the IDAT chunks can be deferred to check_idat_chunks, so that it runs while the image is decoded
+Chunks find_and_check_chunks(unsigned char* file_data, unsigned int file_length, ChecksumPolicy policy, bool is_idat_crc_deferred) {
     Chunks chunks = (Chunks) {.chunks = NULL, .chunks_count = 0, .invalid_chunks = 0};
-    chunks.chunks = (Chunk*) calloc(1, sizeof(Chunk));
+    unsigned int capacity = 1;
+    if (decoder_context != NULL && decoder_context -> chunks != NULL) {
+        chunks.chunks = decoder_context -> chunks;
+        capacity = decoder_context -> chunks_capacity;
+    } else {
+        chunks.chunks = (Chunk*) calloc(capacity, sizeof(Chunk));
+    }
     BitStream* bit_stream = allocate_bit_stream(file_data, file_length, FALSE);
-    unsigned int* crc_table = generate_crc_table();
 
     // Skip the PNG magic number
     set_byte(bit_stream, 8);
@@ -54,15 +43,20 @@ Chunks find_and_check_chunks(unsigned char* file_data, unsigned int file_length,
             chunk.chunk_type[j] = get_next_byte_uc(bit_stream);
         }
 
-        if (!strcmp((char*) chunk.chunk_type, "IDAT")) {
-            (*idat_chunks_count)++;
+        chunk.pos = bit_stream -> byte;
+        if ((unsigned long long int) chunk.pos + chunk.length + 4 > file_length) {
+            warning_print("the chunk '%s' exceeds the file length!\n", chunk.chunk_type);
+            break;
         }
 
-        chunk.pos = bit_stream -> byte;
-        set_byte(bit_stream, bit_stream -> byte - 4);
-        unsigned int chunk_crc = calculate_crc(bit_stream, chunk.length + 4, crc_table);
+        set_byte(bit_stream, chunk.pos + chunk.length);
         unsigned int crc = get_next_bytes_ui(bit_stream);
 
+        // The crc covers the chunk type and the chunk data
+        bool verify_crc = (policy == VERIFY_ALL_CHECKSUMS) || (policy == VERIFY_CRITICAL_CHECKSUMS && IS_CRITICAL_CHUNK(chunk.chunk_type));
+        verify_crc = verify_crc && !(is_idat_crc_deferred && !memcmp(chunk.chunk_type, "IDAT", 4));
+        unsigned int chunk_crc = verify_crc ? update_crc32(0, file_data + chunk.pos - 4, chunk.length + 4) : crc;
+
         if (chunk_crc != crc) {
             warning_print("the current chunk may be corrupted!\n");
             debug_print(BLUE, "crc chunk value: ");
@@ -74,19 +68,49 @@ Chunks find_and_check_chunks(unsigned char* file_data, unsigned int file_length,
             continue;
         }
 
-        chunks.chunks = (Chunk*) realloc(chunks.chunks, sizeof(Chunk) * (chunks.chunks_count + 1));
+        if (chunks.chunks_count == capacity) {
+            capacity *= 2;
+            chunks.chunks = (Chunk*) realloc(chunks.chunks, sizeof(Chunk) * capacity);
+        }
         chunks.chunks[chunks.chunks_count] = chunk;
         chunks.chunks_count++;
     }
 
-    free(crc_table);
     free(bit_stream);
 
+    // The array stays with the decoder context, which lends it again to the next image
+    if (decoder_context != NULL) {
+        decoder_context -> chunks = chunks.chunks;
+        decoder_context -> chunks_capacity = capacity;
+    }
+
     return chunks;
 }
 
+// Verify the crc of the run of IDAT chunks whose first data starts at pos
+bool check_idat_chunks(unsigned char* file_data, unsigned int file_length, unsigned int pos) {
+    for (pos -= 8; (unsigned long long int) pos + 12 <= file_length && !memcmp(file_data + pos + 4, "IDAT", 4);) {
+        unsigned char* length_bytes = file_data + pos;
+        unsigned int length = ((unsigned int) length_bytes[0] << 24) | (length_bytes[1] << 16) | (length_bytes[2] << 8) | length_bytes[3];
+        if ((unsigned long long int) pos + length + 12 > file_length) break;
+
+        unsigned char* crc_bytes = file_data + pos + 8 + length;
+        unsigned int crc = ((unsigned int) crc_bytes[0] << 24) | (crc_bytes[1] << 16) | (crc_bytes[2] << 8) | crc_bytes[3];
+        if (update_crc32(0, file_data + pos + 4, length + 4) != crc) {
+            warning_print("the current chunk may be corrupted!\n");
+            return FALSE;
+        }
+
+        pos += length + 12;
+    }
+
+    return TRUE;
+}
+
 void deallocate_chunks(Chunks chunks) {
-	free(chunks.chunks);	
+    if (decoder_context == NULL || decoder_context -> chunks != chunks.chunks) {
+        free(chunks.chunks);
+    }
 	return;
 }
 
@@ -0,0 +1,626 @@
+#ifndef _COMPRESSOR_H_
+#define _COMPRESSOR_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_WINDOW_SIZE 0x8000
+#define DEFLATE_WINDOW_MASK 0x7FFF
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_SYMBOLS 0x8000 // Symbols collected before a block is written
+#define DEFLATE_MAX_STORED_LENGTH 0xFFFF
+#define DEFLATE_MAX_LEVEL 9
+
+const unsigned short int deflate_length_bases[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const unsigned char deflate_length_extra_bits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const unsigned short int deflate_distance_bases[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const unsigned char deflate_distance_extra_bits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+const unsigned char deflate_lengths_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+const unsigned char deflate_lengths_extra_bits[19] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+
+// Levels trade speed for ratio: longer hash chains, lazy matching from level 4 and dynamic huffman tables from level 3
+const unsigned short int deflate_max_chain[DEFLATE_MAX_LEVEL + 1] = {0, 1, 4, 8, 16, 32, 64, 256, 1024, 4096};
+const unsigned short int deflate_nice_length[DEFLATE_MAX_LEVEL + 1] = {0, 16, 32, 32, 32, 64, 128, 258, 258, 258};
+
+/* ---------------------------------------------------------------------------------------------------------- */
+
+static void reserve_bytes(BitWriter* writer, unsigned int count);
+static void put_bits(BitWriter* writer, unsigned int bits, unsigned char n_bits);
+static void align_bits(BitWriter* writer);
+void put_bytes(BitWriter* writer, const void* data, unsigned int length);
+static unsigned short int reverse_bits(unsigned short int code, unsigned char length);
+static void calculate_minimum_redundancy(unsigned int* weights, int count);
+static void assign_huffman_codes(HuffmanCode* code, unsigned short int count);
+static void build_huffman_code(const unsigned int* freqs, unsigned short int count, unsigned char max_length, HuffmanCode* code);
+static void build_fixed_codes(Deflater* deflater);
+static unsigned char get_length_code(unsigned short int length);
+static unsigned char get_distance_code(unsigned short int distance);
+static unsigned int hash_bytes(const unsigned char* data);
+static void insert_positions(Deflater* deflater, unsigned int end);
+static unsigned int get_match_length(const unsigned char* first, const unsigned char* second, unsigned int max_length);
+static unsigned int find_match(Deflater* deflater, unsigned int pos, unsigned short int* distance);
+static void emit_symbol(Deflater* deflater, unsigned short int symbol, unsigned short int distance);
+static void emit_literal(Deflater* deflater, unsigned char literal);
+static void emit_match(Deflater* deflater, unsigned short int length, unsigned short int distance);
+static unsigned int build_dynamic_header(const HuffmanCode* literals, const HuffmanCode* distances, DynamicHeader* header);
+static void write_dynamic_header(BitWriter* writer, const DynamicHeader* header);
+static void write_symbols(Deflater* deflater, const HuffmanCode* literals, const HuffmanCode* distances);
+static void write_stored_blocks(BitWriter* writer, const unsigned char* data, unsigned int length, bool is_final);
+static void flush_block(Deflater* deflater, unsigned int end, bool is_final);
+void deflate_band(BitWriter* writer, const unsigned char* data, unsigned int length, unsigned char level, bool is_final);
+
+/* ---------------------------------------------------------------------------------------------------------- */
+
+static void reserve_bytes(BitWriter* writer, unsigned int count) {
+    if (writer -> length + count <= writer -> capacity) {
+        return;
+    }
+
+    while (writer -> length + count > writer -> capacity) {
+        writer -> capacity = (writer -> capacity) ? writer -> capacity * 2 : 0x1000;
+    }
+    writer -> data = (unsigned char*) realloc(writer -> data, writer -> capacity);
+
+    return;
+}
+
+// Bits are packed starting from the least significant one, as the deflate format requires
+static void put_bits(BitWriter* writer, unsigned int bits, unsigned char n_bits) {
+    writer -> bit_buffer |= ((unsigned long long int) bits) << (writer -> bit_count);
+    writer -> bit_count += n_bits;
+
+    if (writer -> bit_count >= 32) {
+        reserve_bytes(writer, 4);
+        for (unsigned char i = 0; i < 4; ++i) {
+            (writer -> data)[(writer -> length)++] = (writer -> bit_buffer) & 0xFF;
+            writer -> bit_buffer >>= 8;
+        }
+        writer -> bit_count -= 32;
+    }
+
+    return;
+}
+
+// Flush the pending bits, padding the last byte with zeros
+static void align_bits(BitWriter* writer) {
+    reserve_bytes(writer, 8);
+    while (writer -> bit_count > 0) {
+        (writer -> data)[(writer -> length)++] = (writer -> bit_buffer) & 0xFF;
+        writer -> bit_buffer >>= 8;
+        writer -> bit_count = (writer -> bit_count > 8) ? writer -> bit_count - 8 : 0;
+    }
+    writer -> bit_buffer = 0;
+    return;
+}
+
+void put_bytes(BitWriter* writer, const void* data, unsigned int length) {
+    align_bits(writer);
+    reserve_bytes(writer, length);
+    memcpy(writer -> data + writer -> length, data, length);
+    writer -> length += length;
+    return;
+}
+
+static unsigned short int reverse_bits(unsigned short int code, unsigned char length) {
+    unsigned short int reversed = 0;
+    for (unsigned char i = 0; i < length; ++i, code >>= 1) {
+        reversed = (reversed << 1) | (code & 1);
+    }
+    return reversed;
+}
+
+// Moffat and Katajainen in-place algorithm: the weights sorted in increasing order are replaced by the code lengths
+static void calculate_minimum_redundancy(unsigned int* weights, int count) {
+    if (count == 0) {
+        return;
+    } else if (count == 1) {
+        weights[0] = 1;
+        return;
+    }
+
+    // Build the tree, each internal node stores the index of its parent
+    weights[0] += weights[1];
+    int root = 0;
+    int leaf = 2;
+    for (int next = 1; next < count - 1; ++next) {
+        if (leaf >= count || weights[root] < weights[leaf]) {
+            weights[next] = weights[root];
+            weights[root++] = next;
+        } else {
+            weights[next] = weights[leaf++];
+        }
+
+        if (leaf >= count || (root < next && weights[root] < weights[leaf])) {
+            weights[next] += weights[root];
+            weights[root++] = next;
+        } else {
+            weights[next] += weights[leaf++];
+        }
+    }
+
+    // Depth of the internal nodes
+    weights[count - 2] = 0;
+    for (int next = count - 3; next >= 0; --next) {
+        weights[next] = weights[weights[next]] + 1;
+    }
+
+    // Depth of the leaves
+    int available = 1;
+    int used = 0;
+    unsigned int depth = 0;
+    root = count - 2;
+    int next = count - 1;
+    while (available > 0) {
+        for (; root >= 0 && weights[root] == depth; --root) used++;
+        for (; available > used; --available) weights[next--] = depth;
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+
+    return;
+}
+
+static void assign_huffman_codes(HuffmanCode* code, unsigned short int count) {
+    unsigned short int bl_count[17] = {0};
+    unsigned short int next_code[17] = {0};
+    for (unsigned short int i = 0; i < count; ++i) {
+        bl_count[(code -> lengths)[i]]++;
+    }
+
+    bl_count[0] = 0;
+    for (unsigned char bits = 1; bits <= 16; ++bits) {
+        next_code[bits] = (next_code[bits - 1] + bl_count[bits - 1]) << 1;
+    }
+
+    for (unsigned short int i = 0; i < count; ++i) {
+        unsigned char length = (code -> lengths)[i];
+        (code -> codes)[i] = length ? reverse_bits(next_code[length]++, length) : 0;
+    }
+
+    return;
+}
+
+// Build a complete canonical code whose lengths don't exceed max_length
+static void build_huffman_code(const unsigned int* freqs, unsigned short int count, unsigned char max_length, HuffmanCode* code) {
+    unsigned short int symbols[288] = {0};
+    unsigned int weights[288] = {0};
+    unsigned short int used_count = 0;
+    memset(code -> lengths, 0, sizeof(code -> lengths));
+
+    // Sort the used symbols by frequency
+    for (unsigned short int i = 0; i < count; ++i) {
+        if (!freqs[i]) continue;
+        unsigned short int j = used_count++;
+        for (; j > 0 && weights[j - 1] > freqs[i]; --j) {
+            weights[j] = weights[j - 1];
+            symbols[j] = symbols[j - 1];
+        }
+        weights[j] = freqs[i];
+        symbols[j] = i;
+    }
+
+    // A single symbol still gets a sibling, so that the code is complete
+    if (used_count < 2) {
+        unsigned short int symbol = used_count ? symbols[0] : 0;
+        (code -> lengths)[symbol] = 1;
+        (code -> lengths)[symbol ? 0 : 1] = 1;
+        assign_huffman_codes(code, count);
+        return;
+    }
+
+    calculate_minimum_redundancy(weights, used_count);
+
+    // Move the codes longer than max_length up, then lengthen the shorter ones until the code is complete again
+    unsigned short int lengths_count[33] = {0};
+    for (unsigned short int i = 0; i < used_count; ++i) {
+        lengths_count[(weights[i] > max_length) ? max_length : weights[i]]++;
+    }
+
+    unsigned int kraft_sum = 0;
+    for (unsigned char i = 1; i <= max_length; ++i) {
+        kraft_sum += ((unsigned int) lengths_count[i]) << (max_length - i);
+    }
+
+    for (; kraft_sum > (1U << max_length); --kraft_sum) {
+        lengths_count[max_length]--;
+        for (unsigned char i = max_length - 1; i > 0; --i) {
+            if (lengths_count[i]) {
+                lengths_count[i]--;
+                lengths_count[i + 1] += 2;
+                break;
+            }
+        }
+    }
+
+    // The most frequent symbols take the shortest codes
+    int next = used_count - 1;
+    for (unsigned char length = 1; length <= max_length; ++length) {
+        for (unsigned short int i = 0; i < lengths_count[length]; ++i) {
+            (code -> lengths)[symbols[next--]] = length;
+        }
+    }
+
+    assign_huffman_codes(code, count);
+
+    return;
+}
+
+static void build_fixed_codes(Deflater* deflater) {
+    HuffmanCode* literals = &(deflater -> fixed_literals);
+    for (unsigned short int i = 0; i < 288; ++i) {
+        (literals -> lengths)[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    }
+    assign_huffman_codes(literals, 288);
+
+    HuffmanCode* distances = &(deflater -> fixed_distances);
+    memset(distances -> lengths, 5, 30);
+    assign_huffman_codes(distances, 30);
+
+    return;
+}
+
+static unsigned char get_length_code(unsigned short int length) {
+    unsigned char code = 28;
+    while (deflate_length_bases[code] > length) code--;
+    return code;
+}
+
+static unsigned char get_distance_code(unsigned short int distance) {
+    unsigned short int value = distance - 1;
+    if (value < 4) return value;
+
+    // Two codes for each power of two, told apart by the bit below the most significant one
+    unsigned char high_bit = 2;
+    while (value >> (high_bit + 1)) high_bit++;
+
+    return 2 * high_bit + ((value >> (high_bit - 1)) & 1);
+}
+
+static unsigned int hash_bytes(const unsigned char* data) {
+    unsigned int bytes = data[0] | (data[1] << 8) | (data[2] << 16);
+    return (bytes * 0x9E3779B1U) >> (32 - DEFLATE_HASH_BITS);
+}
+
+static void insert_positions(Deflater* deflater, unsigned int end) {
+    if (end + DEFLATE_MIN_MATCH > deflater -> length) {
+        end = (deflater -> length >= DEFLATE_MIN_MATCH) ? deflater -> length - DEFLATE_MIN_MATCH + 1 : 0;
+    }
+
+    for (; deflater -> inserted < end; (deflater -> inserted)++) {
+        unsigned int hash = hash_bytes(deflater -> data + deflater -> inserted);
+        (deflater -> previous)[(deflater -> inserted) & DEFLATE_WINDOW_MASK] = (deflater -> head)[hash];
+        (deflater -> head)[hash] = deflater -> inserted;
+    }
+
+    return;
+}
+
+static unsigned int get_match_length(const unsigned char* first, const unsigned char* second, unsigned int max_length) {
+    unsigned int length = 0;
+
+    // Compare eight bytes at a time, then find the first different one
+    for (; length + 8 <= max_length; length += 8) {
+        unsigned long long int first_bytes = 0;
+        unsigned long long int second_bytes = 0;
+        memcpy(&first_bytes, first + length, 8);
+        memcpy(&second_bytes, second + length, 8);
+        if (first_bytes != second_bytes) break;
+    }
+
+    while (length < max_length && first[length] == second[length]) length++;
+
+    return length;
+}
+
+// Walk the hash chain of pos, which must not be inserted yet, returns zero if no match is found
+static unsigned int find_match(Deflater* deflater, unsigned int pos, unsigned short int* distance) {
+    unsigned int max_length = deflater -> length - pos;
+    if (max_length < DEFLATE_MIN_MATCH) return 0;
+    if (max_length > DEFLATE_MAX_MATCH) max_length = DEFLATE_MAX_MATCH;
+
+    const unsigned char* data = deflater -> data;
+    unsigned int best_length = DEFLATE_MIN_MATCH - 1;
+    unsigned short int chain = deflate_max_chain[deflater -> level];
+    unsigned short int nice_length = deflate_nice_length[deflater -> level];
+    int candidate = (deflater -> head)[hash_bytes(data + pos)];
+
+    for (; candidate >= 0 && chain > 0; --chain) {
+        if (pos - candidate > DEFLATE_WINDOW_SIZE) break;
+
+        if (data[candidate + best_length] == data[pos + best_length]) {
+            unsigned int length = get_match_length(data + candidate, data + pos, max_length);
+            if (length > best_length) {
+                best_length = length;
+                *distance = pos - candidate;
+                if (length >= nice_length || length == max_length) break;
+            }
+        }
+
+        // The slots of the window are reused, so a newer position ends the chain
+        int previous = (deflater -> previous)[candidate & DEFLATE_WINDOW_MASK];
+        if (previous >= candidate) break;
+        candidate = previous;
+    }
+
+    return (best_length >= DEFLATE_MIN_MATCH) ? best_length : 0;
+}
+
+static void emit_symbol(Deflater* deflater, unsigned short int symbol, unsigned short int distance) {
+    (deflater -> symbols)[deflater -> symbols_count] = symbol;
+    (deflater -> distances)[deflater -> symbols_count] = distance;
+    (deflater -> symbols_count)++;
+    return;
+}
+
+static void emit_literal(Deflater* deflater, unsigned char literal) {
+    emit_symbol(deflater, literal, 0);
+    (deflater -> literals_freqs)[literal]++;
+    return;
+}
+
+static void emit_match(Deflater* deflater, unsigned short int length, unsigned short int distance) {
+    emit_symbol(deflater, length, distance);
+    (deflater -> literals_freqs)[257 + get_length_code(length)]++;
+    (deflater -> distances_freqs)[get_distance_code(distance)]++;
+    return;
+}
+
+// Run-length encode the code lengths of the two codes, returns the bits needed to write them
+static unsigned int build_dynamic_header(const HuffmanCode* literals, const HuffmanCode* distances, DynamicHeader* header) {
+    header -> literals_count = 286;
+    while (header -> literals_count > 257 && !(literals -> lengths)[header -> literals_count - 1]) (header -> literals_count)--;
+    header -> distances_count = 30;
+    while (header -> distances_count > 1 && !(distances -> lengths)[header -> distances_count - 1]) (header -> distances_count)--;
+
+    unsigned char lengths[316] = {0};
+    unsigned short int count = header -> literals_count + header -> distances_count;
+    memcpy(lengths, literals -> lengths, header -> literals_count);
+    memcpy(lengths + header -> literals_count, distances -> lengths, header -> distances_count);
+
+    unsigned int freqs[19] = {0};
+    header -> symbols_count = 0;
+
+#define PUSH_LENGTH_SYMBOL(symbol, extra)                                          \
+    do {                                                                           \
+        (header -> symbols)[header -> symbols_count] = (symbol);                  \
+        (header -> extra_bits)[(header -> symbols_count)++] = (extra);            \
+        freqs[(symbol)]++;                                                         \
+    } while (0)
+
+    for (unsigned short int i = 0; i < count;) {
+        unsigned char value = lengths[i];
+        unsigned short int run = 1;
+        while (i + run < count && lengths[i + run] == value) run++;
+        i += run;
+
+        if (value == 0) {
+            while (run >= 11) {
+                unsigned short int repeat = (run < 138) ? run : 138;
+                PUSH_LENGTH_SYMBOL(18, repeat - 11);
+                run -= repeat;
+            }
+            if (run >= 3) {
+                PUSH_LENGTH_SYMBOL(17, run - 3);
+                run = 0;
+            }
+        } else {
+            PUSH_LENGTH_SYMBOL(value, 0);
+            run--;
+            while (run >= 3) {
+                unsigned short int repeat = (run < 6) ? run : 6;
+                PUSH_LENGTH_SYMBOL(16, repeat - 3);
+                run -= repeat;
+            }
+        }
+
+        for (; run > 0; --run) PUSH_LENGTH_SYMBOL(value, 0);
+    }
+
+#undef PUSH_LENGTH_SYMBOL
+
+    build_huffman_code(freqs, 19, 7, &(header -> lengths_code));
+    header -> lengths_count = 19;
+    while (header -> lengths_count > 4 && !(header -> lengths_code).lengths[deflate_lengths_order[header -> lengths_count - 1]]) (header -> lengths_count)--;
+
+    unsigned int bits = 5 + 5 + 4 + 3 * header -> lengths_count;
+    for (unsigned char i = 0; i < 19; ++i) {
+        bits += freqs[i] * ((header -> lengths_code).lengths[i] + deflate_lengths_extra_bits[i]);
+    }
+
+    return bits;
+}
+
+static void write_dynamic_header(BitWriter* writer, const DynamicHeader* header) {
+    put_bits(writer, header -> literals_count - 257, 5);
+    put_bits(writer, header -> distances_count - 1, 5);
+    put_bits(writer, header -> lengths_count - 4, 4);
+
+    for (unsigned char i = 0; i < header -> lengths_count; ++i) {
+        put_bits(writer, (header -> lengths_code).lengths[deflate_lengths_order[i]], 3);
+    }
+
+    for (unsigned short int i = 0; i < header -> symbols_count; ++i) {
+        unsigned char symbol = (header -> symbols)[i];
+        put_bits(writer, (header -> lengths_code).codes[symbol], (header -> lengths_code).lengths[symbol]);
+        if (deflate_lengths_extra_bits[symbol]) put_bits(writer, (header -> extra_bits)[i], deflate_lengths_extra_bits[symbol]);
+    }
+
+    return;
+}
+
+static void write_symbols(Deflater* deflater, const HuffmanCode* literals, const HuffmanCode* distances) {
+    BitWriter* writer = &(deflater -> writer);
+
+    for (unsigned int i = 0; i < deflater -> symbols_count; ++i) {
+        unsigned short int symbol = (deflater -> symbols)[i];
+        unsigned short int distance = (deflater -> distances)[i];
+        if (!distance) {
+            put_bits(writer, (literals -> codes)[symbol], (literals -> lengths)[symbol]);
+            continue;
+        }
+
+        unsigned char length_code = get_length_code(symbol);
+        put_bits(writer, (literals -> codes)[257 + length_code], (literals -> lengths)[257 + length_code]);
+        put_bits(writer, symbol - deflate_length_bases[length_code], deflate_length_extra_bits[length_code]);
+
+        unsigned char distance_code = get_distance_code(distance);
+        put_bits(writer, (distances -> codes)[distance_code], (distances -> lengths)[distance_code]);
+        put_bits(writer, distance - deflate_distance_bases[distance_code], deflate_distance_extra_bits[distance_code]);
+    }
+
+    put_bits(writer, (literals -> codes)[256], (literals -> lengths)[256]);
+
+    return;
+}
+
+static void write_stored_blocks(BitWriter* writer, const unsigned char* data, unsigned int length, bool is_final) {
+    do {
+        unsigned short int block_length = (length > DEFLATE_MAX_STORED_LENGTH) ? DEFLATE_MAX_STORED_LENGTH : length;
+        length -= block_length;
+
+        put_bits(writer, is_final && !length, 1);
+        put_bits(writer, 0, 2);
+        unsigned char header[4] = {block_length & 0xFF, block_length >> 8, ~block_length & 0xFF, (~block_length >> 8) & 0xFF};
+        put_bytes(writer, header, 4);
+        put_bytes(writer, data, block_length);
+        data += block_length;
+    } while (length);
+
+    return;
+}
+
+// Write the collected symbols with the cheapest among fixed, dynamic and stored blocks
+static void flush_block(Deflater* deflater, unsigned int end, bool is_final) {
+    BitWriter* writer = &(deflater -> writer);
+    (deflater -> literals_freqs)[256]++;
+
+    unsigned long long int extra_bits = 0;
+    unsigned long long int fixed_bits = 3;
+    for (unsigned short int i = 0; i < 286; ++i) {
+        fixed_bits += (unsigned long long int) (deflater -> literals_freqs)[i] * (deflater -> fixed_literals).lengths[i];
+        if (i > 256) extra_bits += (unsigned long long int) (deflater -> literals_freqs)[i] * deflate_length_extra_bits[i - 257];
+    }
+    for (unsigned char i = 0; i < 30; ++i) {
+        fixed_bits += (unsigned long long int) (deflater -> distances_freqs)[i] * 5;
+        extra_bits += (unsigned long long int) (deflater -> distances_freqs)[i] * deflate_distance_extra_bits[i];
+    }
+    fixed_bits += extra_bits;
+
+    unsigned int stored_length = end - deflater -> block_start;
+    unsigned long long int stored_bits = ((unsigned long long int) stored_length + 5 * (stored_length / DEFLATE_MAX_STORED_LENGTH + 1)) * 8 + 7;
+
+    HuffmanCode literals = {0};
+    HuffmanCode distances = {0};
+    DynamicHeader header = {0};
+    unsigned long long int dynamic_bits = 0xFFFFFFFFFFFFFFFFULL;
+    if (deflater -> level >= 3) {
+        build_huffman_code(deflater -> literals_freqs, 286, 15, &literals);
+        build_huffman_code(deflater -> distances_freqs, 30, 15, &distances);
+        dynamic_bits = 3 + build_dynamic_header(&literals, &distances, &header) + extra_bits;
+        for (unsigned short int i = 0; i < 286; ++i) dynamic_bits += (unsigned long long int) (deflater -> literals_freqs)[i] * literals.lengths[i];
+        for (unsigned char i = 0; i < 30; ++i) dynamic_bits += (unsigned long long int) (deflater -> distances_freqs)[i] * distances.lengths[i];
+    }
+
+    if (stored_bits < fixed_bits && stored_bits < dynamic_bits) {
+        write_stored_blocks(writer, deflater -> data + deflater -> block_start, stored_length, is_final);
+    } else if (dynamic_bits < fixed_bits) {
+        put_bits(writer, is_final, 1);
+        put_bits(writer, 2, 2);
+        write_dynamic_header(writer, &header);
+        write_symbols(deflater, &literals, &distances);
+    } else {
+        put_bits(writer, is_final, 1);
+        put_bits(writer, 1, 2);
+        write_symbols(deflater, &(deflater -> fixed_literals), &(deflater -> fixed_distances));
+    }
+
+    memset(deflater -> literals_freqs, 0, sizeof(deflater -> literals_freqs));
+    memset(deflater -> distances_freqs, 0, sizeof(deflater -> distances_freqs));
+    deflater -> symbols_count = 0;
+    deflater -> block_start = end;
+
+    return;
+}
+
+// Compress the data without any previous history, ending either with the final block or with a full flush
+void deflate_band(BitWriter* writer, const unsigned char* data, unsigned int length, unsigned char level, bool is_final) {
+    if (level > DEFLATE_MAX_LEVEL) level = DEFLATE_MAX_LEVEL;
+
+    if (level == 0) {
+        write_stored_blocks(writer, data, length, is_final);
+    } else {
+        Deflater* deflater = (Deflater*) calloc(1, sizeof(Deflater));
+        deflater -> writer = *writer;
+        deflater -> data = data;
+        deflater -> length = length;
+        deflater -> level = level;
+        deflater -> head = (int*) malloc(sizeof(int) * DEFLATE_HASH_SIZE);
+        deflater -> previous = (int*) malloc(sizeof(int) * DEFLATE_WINDOW_SIZE);
+        deflater -> symbols = (unsigned short int*) calloc(DEFLATE_BLOCK_SYMBOLS, sizeof(unsigned short int));
+        deflater -> distances = (unsigned short int*) calloc(DEFLATE_BLOCK_SYMBOLS, sizeof(unsigned short int));
+        memset(deflater -> head, 0xFF, sizeof(int) * DEFLATE_HASH_SIZE);
+        build_fixed_codes(deflater);
+
+        bool is_lazy = (level >= 4);
+        unsigned int pos = 0;
+        while (pos < length) {
+            insert_positions(deflater, pos);
+            unsigned short int distance = 0;
+            unsigned int match_length = find_match(deflater, pos, &distance);
+
+            // Emit a literal if the match starting at the next byte is longer
+            if (is_lazy && match_length && match_length < deflate_nice_length[level]) {
+                insert_positions(deflater, pos + 1);
+                unsigned short int next_distance = 0;
+                unsigned int next_match_length = find_match(deflater, pos + 1, &next_distance);
+                if (next_match_length > match_length) {
+                    emit_literal(deflater, data[pos++]);
+                    match_length = next_match_length;
+                    distance = next_distance;
+                }
+            }
+
+            if (match_length) {
+                emit_match(deflater, match_length, distance);
+                pos += match_length;
+            } else {
+                emit_literal(deflater, data[pos++]);
+            }
+
+            // Room for the literal and the match of the next lazy step
+            if (deflater -> symbols_count + 2 > DEFLATE_BLOCK_SYMBOLS) {
+                flush_block(deflater, pos, is_final && pos == length);
+            }
+        }
+
+        if (deflater -> symbols_count || deflater -> block_start < length || length == 0) {
+            flush_block(deflater, length, is_final);
+        }
+
+        *writer = deflater -> writer;
+        free(deflater -> head);
+        free(deflater -> previous);
+        free(deflater -> symbols);
+        free(deflater -> distances);
+        free(deflater);
+    }
+
+    // A full flush ends with an empty stored block, leaving the next band byte aligned
+    if (!is_final) {
+        put_bits(writer, 0, 3);
+        const unsigned char flush_marker[4] = {0x00, 0x00, 0xFF, 0xFF};
+        put_bytes(writer, flush_marker, 4);
+    }
+
+    align_bits(writer);
+
+    return;
+}
+
+#endif //_COMPRESSOR_H_
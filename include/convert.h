@@ -0,0 +1,186 @@
+#ifndef _CONVERT_H_
+#define _CONVERT_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./simd.h"
+
+const unsigned char depth_scale_table[9] = {0x00, 0xFF, 0x55, 0x00, 0x11, 0x00, 0x00, 0x00, 0x01};
+
+/* -------------------------------------------------------------------------------------- */
+
+static void narrow_16_to_8(const unsigned char* samples, unsigned char* dest, unsigned int count);
+static void convert_grey_packed(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_grey_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_grey_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_grey_alpha_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_grey_alpha_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_truecolor_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_truecolor_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_truecolor_alpha_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_truecolor_alpha_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_indexed_packed(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+static void convert_indexed_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+void build_unpack_lut(PNGImage* image);
+ScanlineConverter select_scanline_converter(PNGType color_type, unsigned char bit_depth);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Keep only the most significant byte of each big-endian 16-bit sample
+static void narrow_16_to_8(const unsigned char* samples, unsigned char* dest, unsigned int count) {
+    unsigned int i = 0;
+
+#ifdef _USE_SSE2_
+    const __m128i high_bytes_mask = _mm_set1_epi16(0x00FF);
+    for (; i + 16 <= count; i += 16) {
+        __m128i first = _mm_and_si128(_mm_loadu_si128((const __m128i*) (samples + 2 * i)), high_bytes_mask);
+        __m128i second = _mm_and_si128(_mm_loadu_si128((const __m128i*) (samples + 2 * i + 16)), high_bytes_mask);
+        _mm_storeu_si128((__m128i*) (dest + i), _mm_packus_epi16(first, second));
+    }
+#endif //_USE_SSE2_
+
+    for (; i < count; ++i) {
+        dest[i] = samples[2 * i];
+    }
+
+    return;
+}
+
+static void convert_grey_packed(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    unsigned char samples_per_byte = 8 / (image -> bit_depth);
+
+    for (unsigned int x = 0; x < width; ++scanline) {
+        const unsigned char* samples = (image -> unpack_lut)[*scanline];
+        for (unsigned char i = 0; i < samples_per_byte && x < width; ++i, ++x, dest += 3) {
+            dest[0] = samples[i];
+            dest[1] = samples[i];
+            dest[2] = samples[i];
+        }
+    }
+
+    return;
+}
+
+static void convert_grey_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    for (unsigned int x = 0; x < width; ++x, dest += 3) {
+        dest[0] = scanline[x];
+        dest[1] = scanline[x];
+        dest[2] = scanline[x];
+    }
+    return;
+}
+
+static void convert_grey_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    for (unsigned int x = 0; x < width; ++x, dest += 3) {
+        dest[0] = scanline[2 * x];
+        dest[1] = scanline[2 * x];
+        dest[2] = scanline[2 * x];
+    }
+    return;
+}
+
+static void convert_grey_alpha_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    for (unsigned int x = 0; x < width; ++x, dest += 4, scanline += 2) {
+        dest[0] = scanline[0];
+        dest[1] = scanline[0];
+        dest[2] = scanline[0];
+        dest[3] = scanline[1];
+    }
+    return;
+}
+
+static void convert_grey_alpha_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    for (unsigned int x = 0; x < width; ++x, dest += 4, scanline += 4) {
+        dest[0] = scanline[0];
+        dest[1] = scanline[0];
+        dest[2] = scanline[0];
+        dest[3] = scanline[2];
+    }
+    return;
+}
+
+static void convert_truecolor_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    memcpy(dest, scanline, width * 3);
+    return;
+}
+
+static void convert_truecolor_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    narrow_16_to_8(scanline, dest, width * 3);
+    return;
+}
+
+static void convert_truecolor_alpha_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    memcpy(dest, scanline, width * 4);
+    return;
+}
+
+static void convert_truecolor_alpha_16(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    NOT_USED(image);
+    narrow_16_to_8(scanline, dest, width * 4);
+    return;
+}
+
+static void convert_indexed_packed(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    unsigned char samples_per_byte = 8 / (image -> bit_depth);
+
+    for (unsigned int x = 0; x < width; ++scanline) {
+        const unsigned char* indices = (image -> unpack_lut)[*scanline];
+        for (unsigned char i = 0; i < samples_per_byte && x < width; ++i, ++x, dest += 3) {
+            memcpy(dest, (image -> palette)[indices[i]], 3);
+        }
+    }
+
+    return;
+}
+
+static void convert_indexed_8(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width) {
+    if (width == 0) return;
+
+    // Copy the whole RGBA entry, the next pixel overwrites the alpha byte
+    for (unsigned int x = 0; x < width - 1; ++x, dest += 3) {
+        memcpy(dest, (image -> palette)[scanline[x]], 4);
+    }
+    memcpy(dest, (image -> palette)[scanline[width - 1]], 3);
+
+    return;
+}
+
+// Split each byte into its packed samples, greyscale ones are also scaled to 8 bits
+void build_unpack_lut(PNGImage* image) {
+    unsigned char bit_depth = image -> bit_depth;
+    if (bit_depth >= 8) return;
+
+    unsigned char samples_per_byte = 8 / bit_depth;
+    unsigned char mask = (1 << bit_depth) - 1;
+    unsigned char scale = (image -> color_type == GREYSCALE) ? depth_scale_table[bit_depth] : 1;
+
+    for (unsigned int value = 0; value < 256; ++value) {
+        for (unsigned char i = 0; i < samples_per_byte; ++i) {
+            (image -> unpack_lut)[value][i] = ((value >> (8 - bit_depth * (i + 1))) & mask) * scale;
+        }
+    }
+
+    return;
+}
+
+ScanlineConverter select_scanline_converter(PNGType color_type, unsigned char bit_depth) {
+    switch (color_type) {
+        case GREYSCALE: return (bit_depth == 16) ? convert_grey_16 : (bit_depth == 8) ? convert_grey_8 : convert_grey_packed;
+        case GREYSCALE_ALPHA: return (bit_depth == 16) ? convert_grey_alpha_16 : convert_grey_alpha_8;
+        case TRUECOLOR: return (bit_depth == 16) ? convert_truecolor_16 : convert_truecolor_8;
+        case TRUECOLOR_ALPHA: return (bit_depth == 16) ? convert_truecolor_alpha_16 : convert_truecolor_alpha_8;
+        case INDEXED_COLOR: return (bit_depth == 8) ? convert_indexed_8 : convert_indexed_packed;
+    }
+    return NULL;
+}
+
+#endif //_CONVERT_H_
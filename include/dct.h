@@ -2,6 +2,46 @@
 #define _DCT_H_
 
 #include <stdlib.h>
+#include "./types.h"
+#include "./simd.h"
+
+// Fixed point constants of the integer forward DCT (Loeffler, Ligtenberg and Moschytz), scaled by 2^FDCT_CONST_BITS
+#define FDCT_CONST_BITS 13
+#define FDCT_PASS1_BITS 2
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+#define FDCT_DESCALE(x, n) (((x) + (1 << ((n) - 1))) >> (n))
+
+/* -------------------------------------------------------------------------------------- */
+
+void mul_mat(int** mat, long double* mat_b, long double* mat_c, unsigned int size);
+#ifndef _USE_SSE2_
+static void fdct_pass(int* data, unsigned char stride, bool is_first_pass);
+static void fdct_scalar(short int* block);
+#endif //_USE_SSE2_
+#if defined(_USE_SSE2_) && !defined(_USE_AVX2_)
+static void fdct_pass_sse2(__m128i* rows, bool is_first_pass);
+static void transpose_8x8_epi16(__m128i* rows);
+static void fdct_sse2(short int* block);
+#endif //_USE_SSE2_ && !_USE_AVX2_
+#ifdef _USE_AVX2_
+static void fdct_pass_avx2(__m256i* rows, bool is_first_pass);
+static void transpose_8x8_epi32(__m256i* rows);
+static void fdct_avx2(short int* block);
+#endif //_USE_AVX2_
+void forward_dct(short int* block);
+
+/* -------------------------------------------------------------------------------------- */
 
 void mul_mat(int** mat, long double* mat_b, long double* mat_c, unsigned int size) {
     int* temp = (int*) calloc(size * size, sizeof(int));
@@ -26,4 +66,318 @@ void mul_mat(int** mat, long double* mat_b, long double* mat_c, unsigned int siz
     return;
 }
 
+// Only the widest kernel available is compiled, AVX2 implies SSE2
+#ifndef _USE_SSE2_
+
+// One dimensional DCT of the eight values spaced by stride, the first pass keeps PASS1_BITS more bits of precision for the second one
+static void fdct_pass(int* data, unsigned char stride, bool is_first_pass) {
+    unsigned char shift = is_first_pass ? FDCT_CONST_BITS - FDCT_PASS1_BITS : FDCT_CONST_BITS + FDCT_PASS1_BITS;
+
+    int tmp0 = data[0] + data[7 * stride];
+    int tmp7 = data[0] - data[7 * stride];
+    int tmp1 = data[stride] + data[6 * stride];
+    int tmp6 = data[stride] - data[6 * stride];
+    int tmp2 = data[2 * stride] + data[5 * stride];
+    int tmp5 = data[2 * stride] - data[5 * stride];
+    int tmp3 = data[3 * stride] + data[4 * stride];
+    int tmp4 = data[3 * stride] - data[4 * stride];
+
+    // Even part
+    int tmp10 = tmp0 + tmp3;
+    int tmp13 = tmp0 - tmp3;
+    int tmp11 = tmp1 + tmp2;
+    int tmp12 = tmp1 - tmp2;
+
+    data[0] = is_first_pass ? (tmp10 + tmp11) * (1 << FDCT_PASS1_BITS) : FDCT_DESCALE(tmp10 + tmp11, FDCT_PASS1_BITS);
+    data[4 * stride] = is_first_pass ? (tmp10 - tmp11) * (1 << FDCT_PASS1_BITS) : FDCT_DESCALE(tmp10 - tmp11, FDCT_PASS1_BITS);
+
+    int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+    data[2 * stride] = FDCT_DESCALE(z1 + tmp13 * FIX_0_765366865, shift);
+    data[6 * stride] = FDCT_DESCALE(z1 - tmp12 * FIX_1_847759065, shift);
+
+    // Odd part
+    z1 = tmp4 + tmp7;
+    int z2 = tmp5 + tmp6;
+    int z3 = tmp4 + tmp6;
+    int z4 = tmp5 + tmp7;
+    int z5 = (z3 + z4) * FIX_1_175875602;
+
+    tmp4 *= FIX_0_298631336;
+    tmp5 *= FIX_2_053119869;
+    tmp6 *= FIX_3_072711026;
+    tmp7 *= FIX_1_501321110;
+    z1 *= -FIX_0_899976223;
+    z2 *= -FIX_2_562915447;
+    z3 = z3 * -FIX_1_961570560 + z5;
+    z4 = z4 * -FIX_0_390180644 + z5;
+
+    data[7 * stride] = FDCT_DESCALE(tmp4 + z1 + z3, shift);
+    data[5 * stride] = FDCT_DESCALE(tmp5 + z2 + z4, shift);
+    data[3 * stride] = FDCT_DESCALE(tmp6 + z2 + z3, shift);
+    data[stride] = FDCT_DESCALE(tmp7 + z1 + z4, shift);
+
+    return;
+}
+
+static void fdct_scalar(short int* block) {
+    int workspace[64];
+    for (unsigned char i = 0; i < 64; ++i) workspace[i] = block[i];
+
+    for (unsigned char row = 0; row < 8; ++row) fdct_pass(workspace + row * 8, 1, TRUE);
+    for (unsigned char column = 0; column < 8; ++column) fdct_pass(workspace + column, 8, FALSE);
+
+    for (unsigned char i = 0; i < 64; ++i) block[i] = workspace[i];
+
+    return;
+}
+
+#endif //_USE_SSE2_
+
+#if defined(_USE_SSE2_) && !defined(_USE_AVX2_)
+
+// Two products summed in 32 bits for each lane: first * first_const + second * second_const
+#define MADD_PAIR(first, second, first_const, second_const, low, high)                                       \
+    do {                                                                                                     \
+        __m128i constants = _mm_setr_epi16(first_const, second_const, first_const, second_const,             \
+                                           first_const, second_const, first_const, second_const);            \
+        low = _mm_madd_epi16(_mm_unpacklo_epi16(first, second), constants);                                  \
+        high = _mm_madd_epi16(_mm_unpackhi_epi16(first, second), constants);                                 \
+    } while (0)
+
+// Same algorithm as fdct_pass on eight columns at once: the products are rearranged in pairs so that madd computes them in 32 bits
+static void fdct_pass_sse2(__m128i* rows, bool is_first_pass) {
+    unsigned char shift = is_first_pass ? FDCT_CONST_BITS - FDCT_PASS1_BITS : FDCT_CONST_BITS + FDCT_PASS1_BITS;
+    const __m128i rounding = _mm_set1_epi32(1 << (shift - 1));
+    const __m128i shift_count = _mm_cvtsi32_si128(shift);
+
+    __m128i tmp0 = _mm_add_epi16(rows[0], rows[7]);
+    __m128i tmp7 = _mm_sub_epi16(rows[0], rows[7]);
+    __m128i tmp1 = _mm_add_epi16(rows[1], rows[6]);
+    __m128i tmp6 = _mm_sub_epi16(rows[1], rows[6]);
+    __m128i tmp2 = _mm_add_epi16(rows[2], rows[5]);
+    __m128i tmp5 = _mm_sub_epi16(rows[2], rows[5]);
+    __m128i tmp3 = _mm_add_epi16(rows[3], rows[4]);
+    __m128i tmp4 = _mm_sub_epi16(rows[3], rows[4]);
+
+    // Even part
+    __m128i tmp10 = _mm_add_epi16(tmp0, tmp3);
+    __m128i tmp13 = _mm_sub_epi16(tmp0, tmp3);
+    __m128i tmp11 = _mm_add_epi16(tmp1, tmp2);
+    __m128i tmp12 = _mm_sub_epi16(tmp1, tmp2);
+
+    if (is_first_pass) {
+        rows[0] = _mm_slli_epi16(_mm_add_epi16(tmp10, tmp11), FDCT_PASS1_BITS);
+        rows[4] = _mm_slli_epi16(_mm_sub_epi16(tmp10, tmp11), FDCT_PASS1_BITS);
+    } else {
+        const __m128i pass1_rounding = _mm_set1_epi16(1 << (FDCT_PASS1_BITS - 1));
+        rows[0] = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(tmp10, tmp11), pass1_rounding), FDCT_PASS1_BITS);
+        rows[4] = _mm_srai_epi16(_mm_add_epi16(_mm_sub_epi16(tmp10, tmp11), pass1_rounding), FDCT_PASS1_BITS);
+    }
+
+    __m128i low = _mm_setzero_si128();
+    __m128i high = _mm_setzero_si128();
+#define DESCALE_PACK(low, high) _mm_packs_epi32(_mm_sra_epi32(_mm_add_epi32(low, rounding), shift_count), _mm_sra_epi32(_mm_add_epi32(high, rounding), shift_count))
+
+    MADD_PAIR(tmp13, tmp12, FIX_0_541196100 + FIX_0_765366865, FIX_0_541196100, low, high);
+    rows[2] = DESCALE_PACK(low, high);
+    MADD_PAIR(tmp13, tmp12, FIX_0_541196100, FIX_0_541196100 - FIX_1_847759065, low, high);
+    rows[6] = DESCALE_PACK(low, high);
+
+    // Odd part, with z3 and z4 already multiplied and added to z5
+    __m128i z3_low, z3_high, z4_low, z4_high;
+    MADD_PAIR(tmp4, tmp6, FIX_1_175875602 - FIX_1_961570560, FIX_1_175875602 - FIX_1_961570560, z3_low, z3_high);
+    MADD_PAIR(tmp5, tmp7, FIX_1_175875602, FIX_1_175875602, low, high);
+    z3_low = _mm_add_epi32(z3_low, low);
+    z3_high = _mm_add_epi32(z3_high, high);
+    MADD_PAIR(tmp4, tmp6, FIX_1_175875602, FIX_1_175875602, z4_low, z4_high);
+    MADD_PAIR(tmp5, tmp7, FIX_1_175875602 - FIX_0_390180644, FIX_1_175875602 - FIX_0_390180644, low, high);
+    z4_low = _mm_add_epi32(z4_low, low);
+    z4_high = _mm_add_epi32(z4_high, high);
+
+    MADD_PAIR(tmp4, tmp7, FIX_0_298631336 - FIX_0_899976223, -FIX_0_899976223, low, high);
+    rows[7] = DESCALE_PACK(_mm_add_epi32(low, z3_low), _mm_add_epi32(high, z3_high));
+    MADD_PAIR(tmp4, tmp7, -FIX_0_899976223, FIX_1_501321110 - FIX_0_899976223, low, high);
+    rows[1] = DESCALE_PACK(_mm_add_epi32(low, z4_low), _mm_add_epi32(high, z4_high));
+    MADD_PAIR(tmp5, tmp6, FIX_2_053119869 - FIX_2_562915447, -FIX_2_562915447, low, high);
+    rows[5] = DESCALE_PACK(_mm_add_epi32(low, z4_low), _mm_add_epi32(high, z4_high));
+    MADD_PAIR(tmp5, tmp6, -FIX_2_562915447, FIX_3_072711026 - FIX_2_562915447, low, high);
+    rows[3] = DESCALE_PACK(_mm_add_epi32(low, z3_low), _mm_add_epi32(high, z3_high));
+
+#undef DESCALE_PACK
+
+    return;
+}
+
+#undef MADD_PAIR
+
+static void transpose_8x8_epi16(__m128i* rows) {
+    __m128i a0 = _mm_unpacklo_epi16(rows[0], rows[1]);
+    __m128i a1 = _mm_unpackhi_epi16(rows[0], rows[1]);
+    __m128i a2 = _mm_unpacklo_epi16(rows[2], rows[3]);
+    __m128i a3 = _mm_unpackhi_epi16(rows[2], rows[3]);
+    __m128i a4 = _mm_unpacklo_epi16(rows[4], rows[5]);
+    __m128i a5 = _mm_unpackhi_epi16(rows[4], rows[5]);
+    __m128i a6 = _mm_unpacklo_epi16(rows[6], rows[7]);
+    __m128i a7 = _mm_unpackhi_epi16(rows[6], rows[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+    __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+    __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+    __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+    __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+    rows[0] = _mm_unpacklo_epi64(b0, b4);
+    rows[1] = _mm_unpackhi_epi64(b0, b4);
+    rows[2] = _mm_unpacklo_epi64(b1, b5);
+    rows[3] = _mm_unpackhi_epi64(b1, b5);
+    rows[4] = _mm_unpacklo_epi64(b2, b6);
+    rows[5] = _mm_unpackhi_epi64(b2, b6);
+    rows[6] = _mm_unpacklo_epi64(b3, b7);
+    rows[7] = _mm_unpackhi_epi64(b3, b7);
+
+    return;
+}
+
+// Each pass works across the vectors, so the block is transposed before both of them and ends up in its original layout
+static void fdct_sse2(short int* block) {
+    __m128i rows[8];
+    for (unsigned char i = 0; i < 8; ++i) rows[i] = _mm_loadu_si128((const __m128i*) (block + i * 8));
+
+    transpose_8x8_epi16(rows);
+    fdct_pass_sse2(rows, TRUE);
+    transpose_8x8_epi16(rows);
+    fdct_pass_sse2(rows, FALSE);
+
+    for (unsigned char i = 0; i < 8; ++i) _mm_storeu_si128((__m128i*) (block + i * 8), rows[i]);
+
+    return;
+}
+
+#endif //_USE_SSE2_ && !_USE_AVX2_
+
+#ifdef _USE_AVX2_
+
+// Same algorithm as fdct_pass on eight columns of 32-bit values at once
+static void fdct_pass_avx2(__m256i* rows, bool is_first_pass) {
+    unsigned char shift = is_first_pass ? FDCT_CONST_BITS - FDCT_PASS1_BITS : FDCT_CONST_BITS + FDCT_PASS1_BITS;
+    const __m256i rounding = _mm256_set1_epi32(1 << (shift - 1));
+    const __m128i shift_count = _mm_cvtsi32_si128(shift);
+
+#define MUL_CONST(value, constant) _mm256_mullo_epi32(value, _mm256_set1_epi32(constant))
+#define DESCALE(value) _mm256_sra_epi32(_mm256_add_epi32(value, rounding), shift_count)
+
+    __m256i tmp0 = _mm256_add_epi32(rows[0], rows[7]);
+    __m256i tmp7 = _mm256_sub_epi32(rows[0], rows[7]);
+    __m256i tmp1 = _mm256_add_epi32(rows[1], rows[6]);
+    __m256i tmp6 = _mm256_sub_epi32(rows[1], rows[6]);
+    __m256i tmp2 = _mm256_add_epi32(rows[2], rows[5]);
+    __m256i tmp5 = _mm256_sub_epi32(rows[2], rows[5]);
+    __m256i tmp3 = _mm256_add_epi32(rows[3], rows[4]);
+    __m256i tmp4 = _mm256_sub_epi32(rows[3], rows[4]);
+
+    // Even part
+    __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+    __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+    __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    if (is_first_pass) {
+        rows[0] = _mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), FDCT_PASS1_BITS);
+        rows[4] = _mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), FDCT_PASS1_BITS);
+    } else {
+        const __m256i pass1_rounding = _mm256_set1_epi32(1 << (FDCT_PASS1_BITS - 1));
+        rows[0] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(tmp10, tmp11), pass1_rounding), FDCT_PASS1_BITS);
+        rows[4] = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(tmp10, tmp11), pass1_rounding), FDCT_PASS1_BITS);
+    }
+
+    __m256i z1 = MUL_CONST(_mm256_add_epi32(tmp12, tmp13), FIX_0_541196100);
+    rows[2] = DESCALE(_mm256_add_epi32(z1, MUL_CONST(tmp13, FIX_0_765366865)));
+    rows[6] = DESCALE(_mm256_sub_epi32(z1, MUL_CONST(tmp12, FIX_1_847759065)));
+
+    // Odd part
+    z1 = MUL_CONST(_mm256_add_epi32(tmp4, tmp7), -FIX_0_899976223);
+    __m256i z2 = MUL_CONST(_mm256_add_epi32(tmp5, tmp6), -FIX_2_562915447);
+    __m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+    __m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+    __m256i z5 = MUL_CONST(_mm256_add_epi32(z3, z4), FIX_1_175875602);
+    z3 = _mm256_add_epi32(MUL_CONST(z3, -FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(MUL_CONST(z4, -FIX_0_390180644), z5);
+
+    rows[7] = DESCALE(_mm256_add_epi32(MUL_CONST(tmp4, FIX_0_298631336), _mm256_add_epi32(z1, z3)));
+    rows[5] = DESCALE(_mm256_add_epi32(MUL_CONST(tmp5, FIX_2_053119869), _mm256_add_epi32(z2, z4)));
+    rows[3] = DESCALE(_mm256_add_epi32(MUL_CONST(tmp6, FIX_3_072711026), _mm256_add_epi32(z2, z3)));
+    rows[1] = DESCALE(_mm256_add_epi32(MUL_CONST(tmp7, FIX_1_501321110), _mm256_add_epi32(z1, z4)));
+
+#undef MUL_CONST
+#undef DESCALE
+
+    return;
+}
+
+static void transpose_8x8_epi32(__m256i* rows) {
+    __m256i a0 = _mm256_unpacklo_epi32(rows[0], rows[1]);
+    __m256i a1 = _mm256_unpackhi_epi32(rows[0], rows[1]);
+    __m256i a2 = _mm256_unpacklo_epi32(rows[2], rows[3]);
+    __m256i a3 = _mm256_unpackhi_epi32(rows[2], rows[3]);
+    __m256i a4 = _mm256_unpacklo_epi32(rows[4], rows[5]);
+    __m256i a5 = _mm256_unpackhi_epi32(rows[4], rows[5]);
+    __m256i a6 = _mm256_unpacklo_epi32(rows[6], rows[7]);
+    __m256i a7 = _mm256_unpackhi_epi32(rows[6], rows[7]);
+
+    // Each 128-bit lane holds the columns i and i + 4
+    __m256i b0 = _mm256_unpacklo_epi64(a0, a2);
+    __m256i b1 = _mm256_unpackhi_epi64(a0, a2);
+    __m256i b2 = _mm256_unpacklo_epi64(a1, a3);
+    __m256i b3 = _mm256_unpackhi_epi64(a1, a3);
+    __m256i b4 = _mm256_unpacklo_epi64(a4, a6);
+    __m256i b5 = _mm256_unpackhi_epi64(a4, a6);
+    __m256i b6 = _mm256_unpacklo_epi64(a5, a7);
+    __m256i b7 = _mm256_unpackhi_epi64(a5, a7);
+
+    rows[0] = _mm256_permute2x128_si256(b0, b4, 0x20);
+    rows[1] = _mm256_permute2x128_si256(b1, b5, 0x20);
+    rows[2] = _mm256_permute2x128_si256(b2, b6, 0x20);
+    rows[3] = _mm256_permute2x128_si256(b3, b7, 0x20);
+    rows[4] = _mm256_permute2x128_si256(b0, b4, 0x31);
+    rows[5] = _mm256_permute2x128_si256(b1, b5, 0x31);
+    rows[6] = _mm256_permute2x128_si256(b2, b6, 0x31);
+    rows[7] = _mm256_permute2x128_si256(b3, b7, 0x31);
+
+    return;
+}
+
+static void fdct_avx2(short int* block) {
+    __m256i rows[8];
+    for (unsigned char i = 0; i < 8; ++i) rows[i] = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (block + i * 8)));
+
+    transpose_8x8_epi32(rows);
+    fdct_pass_avx2(rows, TRUE);
+    transpose_8x8_epi32(rows);
+    fdct_pass_avx2(rows, FALSE);
+
+    for (unsigned char i = 0; i < 8; ++i) {
+        __m128i row = _mm_packs_epi32(_mm256_castsi256_si128(rows[i]), _mm256_extracti128_si256(rows[i], 1));
+        _mm_storeu_si128((__m128i*) (block + i * 8), row);
+    }
+
+    return;
+}
+
+#endif //_USE_AVX2_
+
+// Forward DCT of a level shifted 8x8 block in place, the coefficients are scaled up by 8
+void forward_dct(short int* block) {
+#if defined(_USE_AVX2_)
+    fdct_avx2(block);
+#elif defined(_USE_SSE2_)
+    fdct_sse2(block);
+#else
+    fdct_scalar(block);
+#endif //_USE_AVX2_
+    return;
+}
+
 #endif //_DCT_H_
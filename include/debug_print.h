@@ -5,6 +5,8 @@
 #include <stdarg.h>
 #include "./types.h"
 
+#define NOT_USED(var) (void) var
+
 void error_print(const char* format, ...) {
     SET_COLOR(RED);
     printf("ERROR: ");
@@ -101,8 +103,6 @@ void debug_print(Colors color, const char* format, ...) {
 
 #else
 
-#define NOT_USED(var) (void) var
-
 void print_hex(Colors color, unsigned char val) {
     NOT_USED(color);
     NOT_USED(val);
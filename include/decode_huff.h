@@ -254,6 +254,7 @@ MCU generate_mcu(unsigned char components, BitStream* bit_stream, DataTables* da
     MCU mcu;
     mcu.comp_du_count = data_table -> comp_du_count;
     mcu.max_du = data_table -> max_du;
+    mcu.reduced_units = NULL;
 
     // Decode the data units and group them based on the subsampling factors
     mcu.components = components;
@@ -276,7 +277,7 @@ MCU generate_mcu(unsigned char components, BitStream* bit_stream, DataTables* da
 
             if (*err == LENGTH_EXCEEDED) {
                 // If data finish leave the mcu filled with zeros
-                warning_print("length exceeded, component: %u, data unit: %u\n", i, j);
+                if (!(bit_stream -> is_input_open)) warning_print("length exceeded, component: %u, data unit: %u\n", i, j);
 
                 unsigned char du_count = 0;
                 for (unsigned char s = 0; s < mcu.components; ++s) {
@@ -10,12 +10,13 @@
 #include "./bitstream.h"
 #include "./mcu.h"
 #include "./decode_huff.h"
+#include "./exif.h"
+#include "./pyramid.h"
+#include "./compressor.h"
 
 #define MARKER_FLAG(data, pos) ((data)[(pos)] == 0xFF)
 #define RESET_ERROR_FLAG(image) (((image)-> image_data).error = 0)
 #define CHECK_ERROR_FLAG(image) if (((image)-> image_data).error) return image -> image_data
-#define MARKER_PREFIX_CODE 0xFF
-#define MARKER_BASE_CODE 0xC0
 
 static const char* component_types[] = {"Y", "Cb", "Cr", "I", "Q"};
 
@@ -28,14 +29,34 @@ static void decode_app(JPEGImage* image, unsigned char marker_code);
 static void decode_dqt(JPEGImage* image, DataTables* data_tables);
 static unsigned char max_val(unsigned char* vec, unsigned char len);
 static void decode_sof(JPEGImage* image, DataTables* data_tables, unsigned char marker_code);
+static void decode_sos_header(JPEGImage* image, DataTables* data_tables);
 static void decode_sos(JPEGImage* image, DataTables* data_tables);
 static void decode_dri(JPEGImage* image);
+static void reset_predictors(JPEGImage* image, DataTables* data_tables);
 static void decode_rst(JPEGImage* image, unsigned char interval_count, unsigned int data_len, DataTables* data_tables);
 static void decode_dht(JPEGImage* image, DataTables* data_tables);
+static void decode_segment(JPEGImage* image, DataTables* data_tables, unsigned char marker_type);
 static void deallocate_data_table(DataTables* data_tables);
+static void set_mcus_grid(JPEGImage* image, DataTables* data_tables);
+static unsigned int get_interval_end(JPEGImage* image);
+static void decode_mcus(JPEGImage* image, DataTables* data_tables, BitStream* bit_stream, unsigned int mcus_count, long double* m, long double* t_m);
 static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char* image_data, unsigned int image_size);
 static DataTables* init_data_tables(void);
+static Image decode_jpeg_image(FileData* image_file, JPEGImage* image, Image* reduced_levels);
+static Image decode_oriented_jpeg(FileData* image_file, unsigned char orientation, Image* reduced_levels);
 Image decode_jpeg(FileData* image_file);
+Image decode_jpeg_streamed(FileData* image_file, RowsCallback callback, void* user_data);
+Image decode_exif_thumbnail(const unsigned char* data, unsigned int length);
+Image* decode_jpeg_pyramid(FileData* image_file, unsigned int* levels_count);
+static void place_jpeg_decoder_rows(unsigned int first_row, unsigned int rows_count, const unsigned char* pixels, unsigned int stride, void* user_data);
+static void start_jpeg_decoder_scan(JPEGDecoder* decoder, unsigned int start);
+static bool decode_jpeg_decoder_interval(JPEGDecoder* decoder);
+static bool decode_jpeg_decoder_segment(JPEGDecoder* decoder);
+static void end_jpeg_decoder_image(JPEGDecoder* decoder);
+static void drop_jpeg_decoder_bytes(JPEGDecoder* decoder);
+JPEGDecoder* allocate_jpeg_decoder(void);
+ImageError feed_jpeg_decoder(JPEGDecoder* decoder, const unsigned char* data, unsigned int length);
+Image finish_jpeg_decoder(JPEGDecoder* decoder);
 
 /* -------------------------------------------------------------------------------------- */
 
@@ -129,7 +150,11 @@ static void decode_app(JPEGImage* image, unsigned char marker_code) {
     free(identifier);
 
     if (image -> is_exif) {
-        debug_print(YELLOW, "Is Exif format skipping the Exif header!\n");
+        debug_print(YELLOW, "Is Exif format, reading the orientation!\n");
+        ExifInfo info = {0};
+        if (start + length <= bit_stream -> size && parse_exif(bit_stream -> stream + start + 2, length - 2, &info)) {
+            image -> orientation = info.orientation;
+        }
         set_byte(bit_stream, start + length);
         return;
     }
@@ -314,7 +339,8 @@ static void decode_sof(JPEGImage* image, DataTables* data_tables, unsigned char
     return;
 }
 
-static void decode_sos(JPEGImage* image, DataTables* data_tables) {
+// Read the tables used by each component of the scan, the bit stream is left at the entropy coded data
+static void decode_sos_header(JPEGImage* image, DataTables* data_tables) {
     BitStream* bit_stream = image -> bit_stream;
     debug_print(PURPLE, "SOS marker found at byte: %d: \n", bit_stream -> byte);
 
@@ -361,6 +387,16 @@ static void decode_sos(JPEGImage* image, DataTables* data_tables) {
     // Print the marker section (without the extra byte as it's not an FF of the next marker)
     print_line(bit_stream -> stream, bit_stream -> byte - length, length - 1);
 
+    return;
+}
+
+static void decode_sos(JPEGImage* image, DataTables* data_tables) {
+    BitStream* bit_stream = image -> bit_stream;
+    decode_sos_header(image, data_tables);
+    if ((image -> image_data).error) {
+        return;
+    }
+
     unsigned char* compressed_data = (unsigned char*) calloc(1, sizeof(unsigned char));
     unsigned int index = 0;
 
@@ -406,16 +442,21 @@ static void decode_dri(JPEGImage* image) {
     return;
 }
 
+// Each restart interval codes the DC coefficients from zero again
+static void reset_predictors(JPEGImage* image, DataTables* data_tables) {
+    for (unsigned char i = 0; i < (image -> image_data).components; ++i) {
+        (data_tables -> components)[i].pred = 0;
+    }
+    return;
+}
+
 static void decode_rst(JPEGImage* image, unsigned char interval_count, unsigned int data_len, DataTables* data_tables) {
     BitStream* bit_stream = image -> bit_stream;
 
     debug_print(PURPLE, "RST%d marker found at byte: %d: \n", interval_count, bit_stream -> byte);
     debug_print(YELLOW, "Decoding %u mcus for each of the %u components\n", image -> mcu_per_line, (image -> image_data).components);
 
-    // Reset the pred for each component
-    for (unsigned char i = 0; i < (image -> image_data).components; ++i) {
-        (data_tables -> components)[i].pred = 0;
-    }
+    reset_predictors(image, data_tables);
 
     // Retrieve data and decode it
     unsigned char* data_stream = get_next_n_byte_uc(bit_stream, data_len);
@@ -517,6 +558,64 @@ static void decode_dht(JPEGImage* image, DataTables* data_tables) {
     return;
 }
 
+// Decode the segment of any marker but SOS and RST, which are followed by entropy coded data: the bit stream is right
+// after the marker code
+static void decode_segment(JPEGImage* image, DataTables* data_tables, unsigned char marker_type) {
+    switch (marker_type) {
+        case 0xC0:
+        case 0xC1:
+        case 0xC2:
+        case 0xC3:
+        case 0xC5:
+        case 0xC6:
+        case 0xC7:
+        case 0xC9:
+        case 0xCA:
+        case 0xCB:
+        case 0xCD:
+        case 0xCE:
+        case 0xCF:
+            image -> jpeg_type = marker_type - 0xC0;
+            decode_sof(image, data_tables, marker_type);
+            break;
+
+        case 0xC4:
+            decode_dht(image, data_tables);
+            break;
+
+        case 0xDB:
+            decode_dqt(image, data_tables);
+            break;
+
+        case 0xDC:
+            debug_print(PURPLE, "DNL marker found at byte: %d: \n", (image -> bit_stream) -> byte);
+            debug_print(YELLOW, "length: %u\n", get_next_byte_uc(image -> bit_stream) | (get_next_byte_uc(image -> bit_stream) << 8));
+            debug_print(YELLOW, "Height: %u\n", get_next_byte_uc(image -> bit_stream) | (get_next_byte_uc(image -> bit_stream) << 8));
+            break;
+
+        case 0xDD:
+            decode_dri(image);
+            break;
+
+        case 0xFE:
+            decode_com(image);
+            break;
+
+        case 0xD9:
+            debug_print(PURPLE, "EOI marker found at byte: %d!\n", (image -> bit_stream) -> byte);
+            debug_print(YELLOW, "End of the image\n");
+            break;
+
+        default:
+            if ((marker_type >= 0xE0) && (marker_type <= 0xEF)) {
+                decode_app(image, marker_type);
+            }
+            break;
+    }
+
+    return;
+}
+
 static void deallocate_data_table(DataTables* data_tables) {
     debug_print(BLUE, "deallocating data table...\n");
 
@@ -564,11 +663,7 @@ static void deallocate_data_table(DataTables* data_tables) {
     return;
 }
 
-static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char* image_data, unsigned int image_size) {
-    unsigned short int err = 0;
-    unsigned char components = data_tables -> components_count;
-    BitStream* bit_stream = allocate_bit_stream(image_data, image_size, FALSE);
-
+static void set_mcus_grid(JPEGImage* image, DataTables* data_tables) {
     if ((image -> image_data).components == 1) {
         unsigned int pixels_x = 8 * (data_tables -> max_sf_h / (data_tables -> components)[0].sampling_factor_h);
         unsigned int pixels_y = 8 * (data_tables -> max_sf_v / (data_tables -> components)[0].sampling_factor_v);
@@ -578,18 +673,32 @@ static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char
         image -> mcu_x = ((image -> image_data).width + 8 * data_tables -> max_sf_h - 1) / (8 * data_tables -> max_sf_h);
         image -> mcu_y = ((image -> image_data).height + 8 * data_tables -> max_sf_v - 1) / (8 * data_tables -> max_sf_v);
     }
+    return;
+}
 
-    debug_print(BLUE, "\n");
-    debug_print(BLUE, "decoding data...\n");
+// MCUs decoded by the end of the restart interval starting now, or by the end of the scan without restart intervals
+static unsigned int get_interval_end(JPEGImage* image) {
+    return (image -> mcu_per_line) ? (image -> mcu_count + image -> mcu_per_line) : (image -> mcu_x * image -> mcu_y);
+}
 
-    long double* m = generate_m();
-    long double* t_m = generate_tm(m);
-    unsigned int mcus_count = (image -> mcu_per_line) ? (image -> mcu_count + image -> mcu_per_line) : (image -> mcu_x * image -> mcu_y);
+// Decode the MCUs up to mcus_count: while the input of the bit stream is open, the MCU whose data runs out is dropped
+// and the bit stream is left where it started, so that it's decoded again once more data is appended
+static void decode_mcus(JPEGImage* image, DataTables* data_tables, BitStream* bit_stream, unsigned int mcus_count, long double* m, long double* t_m) {
+    unsigned short int err = 0;
+    unsigned char components = data_tables -> components_count;
+    int* preds = (bit_stream -> is_input_open) ? (int*) calloc(components, sizeof(int)) : NULL;
 
-    // Decode all the MCUs inside the scan section
     while (err != DNL_MARKER_DETECTED && (image -> mcu_count < mcus_count)) {
+        BitStream mcu_start = *bit_stream;
+        for (unsigned char i = 0; preds != NULL && i < components; ++i) {
+            preds[i] = (data_tables -> components)[i].pred;
+        }
+
         image -> mcus = (MCU*) realloc(image -> mcus, sizeof(MCU) * (image -> mcu_count + 1));
         MCU mcu = generate_mcu(components, bit_stream, data_tables, &err);
+        if (image -> is_pyramid) {
+            mcu.reduced_units = (int*) calloc(data_tables -> sf_count * REDUCED_UNIT_LENGTH, sizeof(int));
+        }
 
         if (err == INVALID_BYTE_STUFFING) {
             error_print("Invalid byte stuffing at byte: %u\n", bit_stream -> byte);
@@ -601,8 +710,16 @@ static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char
 
             debug_print(YELLOW, "\n");
 
+            deallocate_mcu(mcu);
             (image -> image_data).error = DECODING_ERROR;
-            return;
+            break;
+        } else if (err == LENGTH_EXCEEDED && bit_stream -> is_input_open) {
+            deallocate_mcu(mcu);
+            *bit_stream = mcu_start;
+            for (unsigned char i = 0; i < components; ++i) {
+                (data_tables -> components)[i].pred = preds[i];
+            }
+            break;
         } else if (err == LENGTH_EXCEEDED) {
             decode_mcu(mcu, data_tables, t_m, m);
             (image -> mcus)[image -> mcu_count] = mcu;
@@ -613,13 +730,46 @@ static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char
         decode_mcu(mcu, data_tables, t_m, m);
         (image -> mcus)[image -> mcu_count] = mcu;
         (image -> mcu_count)++;
+
+        if (image -> rows_callback != NULL) {
+            emit_mcu_rows(image, data_tables);
+        }
+    }
+
+    free(preds);
+
+    return;
+}
+
+static void decode_data(JPEGImage* image, DataTables* data_tables, unsigned char* image_data, unsigned int image_size) {
+    BitStream* bit_stream = allocate_bit_stream(image_data, image_size, FALSE);
+    set_mcus_grid(image, data_tables);
+
+    debug_print(BLUE, "\n");
+    debug_print(BLUE, "decoding data...\n");
+
+    // The matrices are computed by the first image decoded with a decoder context, which keeps them
+    if (decoder_context != NULL && decoder_context -> m == NULL) {
+        decoder_context -> m = generate_m();
+        decoder_context -> t_m = generate_tm(decoder_context -> m);
+    }
+    long double* m = (decoder_context != NULL) ? decoder_context -> m : generate_m();
+    long double* t_m = (decoder_context != NULL) ? decoder_context -> t_m : generate_tm(m);
+
+    // Decode all the MCUs inside the scan section
+    decode_mcus(image, data_tables, bit_stream, get_interval_end(image), m, t_m);
+
+    if (!((image -> image_data).error) && image -> rows_callback != NULL) {
+        emit_mcu_rows(image, data_tables);
     }
 
     debug_print(YELLOW, "Bitstream: byte: %u, bits: %u, out of %u\n", bit_stream -> byte, bit_stream -> bit, bit_stream -> size);
     deallocate_bit_stream(bit_stream);
 
-    free(t_m);
-    free(m);
+    if (decoder_context == NULL) {
+        free(t_m);
+        free(m);
+    }
 
     return;
 }
@@ -636,15 +786,17 @@ static DataTables* init_data_tables(void) {
     return data_tables;
 }
 
-Image decode_jpeg(FileData* image_file) {
+// Decode with the options already set in the image, which is released: the levels scaled by 1/2, 1/4 and 1/8 are
+// also decoded when reduced_levels isn't NULL
+static Image decode_jpeg_image(FileData* image_file, JPEGImage* image, Image* reduced_levels) {
     // Init image struct
-    JPEGImage* image = (JPEGImage*) calloc(1, sizeof(JPEGImage));
     image -> image_file = *image_file;
     image -> mcu_count = 0;
     image -> mcus = (MCU*) calloc(1, sizeof(MCU));
     image -> bit_stream = allocate_bit_stream(image_file -> data, image_file -> length, FALSE);
     image -> mcu_per_line = 0;
 	image -> is_exif = 0;
+    image -> is_pyramid = (reduced_levels != NULL);
 
     // Init data tables
     DataTables* data_tables = init_data_tables();
@@ -676,62 +828,12 @@ Image decode_jpeg(FileData* image_file) {
 
         unsigned char marker_type = markers_table.marker_type[i];
 
-        switch (marker_type) {
-            case 0xC0:
-            case 0xC1:
-            case 0xC2:
-            case 0xC3:
-            case 0xC5:
-            case 0xC6:
-            case 0xC7:
-            case 0xC9:
-            case 0xCA:
-            case 0xCB:
-            case 0xCD:
-            case 0xCE:
-            case 0xCF:
-                image -> jpeg_type = marker_type - 0xC0;
-                decode_sof(image, data_tables, marker_type);
-                break;
-
-            case 0xC4:
-                decode_dht(image, data_tables);
-                break;
-
-            case 0xDB:
-                decode_dqt(image, data_tables);
-                break;
-
-            case 0xDC:
-                debug_print(PURPLE, "DNL marker found at byte: %d: \n", (image -> bit_stream) -> byte);
-                debug_print(YELLOW, "length: %u\n", get_next_byte_uc(image -> bit_stream) | (get_next_byte_uc(image -> bit_stream) << 8));
-                debug_print(YELLOW, "Height: %u\n", get_next_byte_uc(image -> bit_stream) | (get_next_byte_uc(image -> bit_stream) << 8));
-                break;
-
-            case 0xDD:
-                decode_dri(image);
-                break;
-
-            case 0xDA:
-                decode_sos(image, data_tables);
-                break;
-
-            case 0xFE:
-                decode_com(image);
-                break;
-
-            case 0xD9:
-                debug_print(PURPLE, "EOI marker found at byte: %d!\n", (image -> bit_stream) -> byte);
-                debug_print(YELLOW, "End of the image\n");
-                break;
-
-            default:
-                if ((marker_type >= 0xD0) && (marker_type <= 0xD7)) {
-                    decode_rst(image, marker_type - 0xD0, markers_table.positions[i + 1] - markers_table.positions[i] - 2, data_tables);
-                } else if ((marker_type >= 0xE0) && (marker_type <= 0xEF)) {
-                    decode_app(image, marker_type);
-                }
-                break;
+        if (marker_type == 0xDA) {
+            decode_sos(image, data_tables);
+        } else if ((marker_type >= 0xD0) && (marker_type <= 0xD7)) {
+            decode_rst(image, marker_type - 0xD0, markers_table.positions[i + 1] - markers_table.positions[i] - 2, data_tables);
+        } else {
+            decode_segment(image, data_tables, marker_type);
         }
 
         CHECK_ERROR_FLAG(image);
@@ -740,7 +842,19 @@ Image decode_jpeg(FileData* image_file) {
 
     debug_print(BLUE, "\n");
     debug_print(BLUE, "decoding image...\n");
-    if (mcus_to_image(image, data_tables)) {
+    image -> transform = apply_exif_orientation ? get_orientation_transform(image -> orientation) : TRANSFORM_NONE;
+    for (unsigned char level = 1; image -> is_pyramid && level <= JPEG_REDUCED_LEVELS; ++level) {
+        reduced_levels[level - 1] = reduced_mcus_to_image(image, data_tables, level);
+    }
+
+    // The rows were given to the callback, so the image only describes them: each pixel has 3 bytes, as in the decoded data
+    if (image -> rows_callback != NULL) {
+        if (image -> emitted_mcu_rows * 8 * data_tables -> max_sf_v < (image -> image_data).height) {
+            error_print("invalid mcu_count size: %u, expected: %u\n", image -> mcu_count, image -> mcu_x * image -> mcu_y);
+            (image -> image_data).error = DECODING_ERROR;
+        }
+        (image -> image_data).components = 3;
+    } else if (mcus_to_image(image, data_tables)) {
         (image -> image_data).error = 10;
         return image -> image_data;
     }
@@ -761,4 +875,303 @@ Image decode_jpeg(FileData* image_file) {
 	return image_data;
 }
 
+// The orientation is the one assumed when the image has no Exif segment of its own
+static Image decode_oriented_jpeg(FileData* image_file, unsigned char orientation, Image* reduced_levels) {
+    JPEGImage* image = (JPEGImage*) calloc(1, sizeof(JPEGImage));
+    image -> orientation = orientation;
+    return decode_jpeg_image(image_file, image, reduced_levels);
+}
+
+Image decode_jpeg(FileData* image_file) {
+    return decode_oriented_jpeg(image_file, 1, NULL);
+}
+
+// Give the callback each MCU row as soon as it's decoded and release it, so that only the coefficients of the MCU
+// row being decoded are held: the rows are given as they're stored, the Exif orientation isn't applied
+Image decode_jpeg_streamed(FileData* image_file, RowsCallback callback, void* user_data) {
+    JPEGImage* image = (JPEGImage*) calloc(1, sizeof(JPEGImage));
+    image -> orientation = 1;
+    image -> rows_callback = callback;
+    image -> rows_user_data = user_data;
+    return decode_jpeg_image(image_file, image, NULL);
+}
+
+// Decode only the thumbnail stored in the Exif segment of a JPEG file in memory, which inherits the orientation
+// of the main image: check has_exif_thumbnail first, to fall back to the full decoding
+Image decode_exif_thumbnail(const unsigned char* data, unsigned int length) {
+    Image image = {0};
+    unsigned int thumbnail_length = 0;
+    const unsigned char* thumbnail = get_exif_thumbnail(data, length, &thumbnail_length);
+    if (thumbnail == NULL) {
+        error_print("the image has no Exif thumbnail!\n");
+        image.error = DECODING_ERROR;
+        return image;
+    }
+
+    // The decoder takes ownership of the data, while the thumbnail lives inside the caller's buffer
+    FileData thumbnail_file = {.length = thumbnail_length, .file_type = JPEG};
+    thumbnail_file.data = (unsigned char*) calloc(thumbnail_length, sizeof(unsigned char));
+    memcpy(thumbnail_file.data, thumbnail, thumbnail_length);
+
+    return decode_oriented_jpeg(&thumbnail_file, read_exif_orientation(data, length), NULL);
+}
+
+// The levels down to 1/8 come from the IDCT of the lowest frequencies of each data unit, the deeper ones are halved
+// from the 1/8 level. The levels are always RGB, like the decoded data of the full image
+Image* decode_jpeg_pyramid(FileData* image_file, unsigned int* levels_count) {
+    Image reduced_levels[JPEG_REDUCED_LEVELS] = {0};
+    Image image = decode_oriented_jpeg(image_file, 1, reduced_levels);
+    *levels_count = (image.error || reduced_levels[0].decoded_data == NULL) ? 1 : get_pyramid_levels_count(image.width, image.height);
+
+    Image* levels = (Image*) calloc(*levels_count, sizeof(Image));
+    levels[0] = image;
+    levels[0].components = 3;
+    for (unsigned char level = 1; level <= JPEG_REDUCED_LEVELS; ++level) {
+        if (level < *levels_count) levels[level] = reduced_levels[level - 1];
+        else free(reduced_levels[level - 1].decoded_data);
+    }
+
+    unsigned int last_reduced_level = (*levels_count - 1 < JPEG_REDUCED_LEVELS) ? *levels_count - 1 : JPEG_REDUCED_LEVELS;
+    fill_pyramid_levels(levels, last_reduced_level, *levels_count);
+
+    return levels;
+}
+
+// Rows callback of the push decoder, which keeps them in the decoded data
+static void place_jpeg_decoder_rows(unsigned int first_row, unsigned int rows_count, const unsigned char* pixels, unsigned int stride, void* user_data) {
+    JPEGDecoder* decoder = (JPEGDecoder*) user_data;
+    memcpy((decoder -> image).image_data.decoded_data + (unsigned long long int) first_row * stride, pixels, (unsigned long long int) rows_count * stride);
+    decoder -> decoded_rows = first_row + rows_count;
+    return;
+}
+
+// The entropy coded data follows the SOS segment: its MCU rows go to the decoded data as soon as they're complete, unless
+// the Exif orientation is applied, which places the MCUs once they're all decoded
+static void start_jpeg_decoder_scan(JPEGDecoder* decoder, unsigned int start) {
+    JPEGImage* image = &(decoder -> image);
+    DataTables* data_tables = decoder -> data_tables;
+    if ((image -> image_data).error) {
+        return;
+    } else if (!(data_tables -> sf_count)) {
+        error_print("SOS marker found before the SOF one!\n");
+        (image -> image_data).error = DECODING_ERROR;
+        return;
+    }
+
+    set_mcus_grid(image, data_tables);
+    if (decoder -> m == NULL) {
+        decoder -> m = generate_m();
+        decoder -> t_m = generate_tm(decoder -> m);
+        image -> transform = apply_exif_orientation ? get_orientation_transform(image -> orientation) : TRANSFORM_NONE;
+        if (image -> transform == TRANSFORM_NONE) {
+            (image -> image_data).size = 3 * (image -> image_data).width * (image -> image_data).height;
+            (image -> image_data).decoded_data = allocate_image_buffer((image -> image_data).size);
+            image -> rows_callback = place_jpeg_decoder_rows;
+            image -> rows_user_data = decoder;
+        }
+    }
+
+    decoder -> mcus_count = get_interval_end(image);
+    decoder -> interval = (BitStream) {0};
+    decoder -> interval_start = start;
+    decoder -> pos = start;
+    decoder -> is_in_scan = TRUE;
+
+    return;
+}
+
+// Decode the MCUs of the restart interval whose data is received, the interval is complete once the marker ending it is
+// found: returns FALSE when more bytes are needed
+static bool decode_jpeg_decoder_interval(JPEGDecoder* decoder) {
+    JPEGImage* image = &(decoder -> image);
+    unsigned char* data = (decoder -> buffer).data;
+    unsigned int length = (decoder -> buffer).length;
+
+    // The interval ends at the first marker that isn't a stuffed zero or a fill byte, the search resumes where it stopped
+    unsigned int end = decoder -> pos;
+    while (end + 1 < length && (data[end] != MARKER_PREFIX_CODE || data[end + 1] < MARKER_BASE_CODE || data[end + 1] == MARKER_PREFIX_CODE)) {
+        end++;
+    }
+
+    bool is_marker_found = (end + 1 < length);
+    unsigned char marker_code = (is_marker_found) ? data[end + 1] : 0;
+    decoder -> pos = end;
+
+    // The DNL marker is left in the data, where it stops the decoding of the MCUs
+    BitStream* interval = &(decoder -> interval);
+    interval -> stream = data + decoder -> interval_start;
+    interval -> size = ((is_marker_found) ? end + ((marker_code == DNL_MARKER) ? 2 : 0) : length) - decoder -> interval_start;
+    interval -> is_input_open = !is_marker_found && !(decoder -> is_stream_ended);
+
+    decode_mcus(image, decoder -> data_tables, interval, decoder -> mcus_count, decoder -> m, decoder -> t_m);
+    if ((image -> image_data).error || interval -> is_input_open) {
+        return FALSE;
+    }
+
+    if (marker_code >= RST0_MARKER && marker_code <= RST0_MARKER + 7) {
+        debug_print(PURPLE, "RST%d marker found at byte: %d: \n", marker_code - RST0_MARKER, end + 2);
+        reset_predictors(image, decoder -> data_tables);
+        decoder -> mcus_count = get_interval_end(image);
+        decoder -> interval = (BitStream) {0};
+        decoder -> interval_start = end + 2;
+        decoder -> pos = end + 2;
+        return TRUE;
+    }
+
+    decoder -> is_in_scan = FALSE;
+    decoder -> pos = (is_marker_found) ? end : length;
+
+    return TRUE;
+}
+
+// Decode the segment of the next marker once it's complete, the bytes before the marker are skipped: returns FALSE when
+// more bytes are needed
+static bool decode_jpeg_decoder_segment(JPEGDecoder* decoder) {
+    JPEGImage* image = &(decoder -> image);
+    unsigned char* data = (decoder -> buffer).data;
+    unsigned int length = (decoder -> buffer).length;
+
+    unsigned int pos = decoder -> pos;
+    while (pos + 1 < length && (data[pos] != MARKER_PREFIX_CODE || data[pos + 1] < MARKER_BASE_CODE || data[pos + 1] == MARKER_PREFIX_CODE)) {
+        pos++;
+    }
+
+    decoder -> pos = pos;
+    if (pos + 1 >= length) {
+        return FALSE;
+    }
+
+    unsigned char marker_code = data[pos + 1];
+    if (marker_code == EOI_MARKER) {
+        debug_print(PURPLE, "EOI marker found at byte: %d!\n", pos + 2);
+        decoder -> pos = pos + 2;
+        end_jpeg_decoder_image(decoder);
+        return TRUE;
+    } else if (marker_code == SOI_MARKER || (marker_code >= RST0_MARKER && marker_code <= RST0_MARKER + 7)) {
+        decoder -> pos = pos + 2;
+        return TRUE;
+    }
+
+    if (pos + 4 > length) {
+        return FALSE;
+    }
+
+    unsigned int segment_length = (data[pos + 2] << 8) | data[pos + 3];
+    if (pos + 2 + segment_length > length) {
+        return FALSE;
+    }
+
+    decoder -> segment = (BitStream) {.stream = data, .byte = pos + 2, .size = length};
+    if (marker_code == SOS_MARKER) {
+        decode_sos_header(image, decoder -> data_tables);
+        start_jpeg_decoder_scan(decoder, pos + 2 + segment_length);
+    } else {
+        decode_segment(image, decoder -> data_tables, marker_code);
+        decoder -> pos = pos + 2 + segment_length;
+    }
+
+    if (!((image -> image_data).error) && !jpeg_type_is_supported(image -> jpeg_type)) {
+        (image -> image_data).error = UNSUPPORTED_JPEG_TYPE;
+    }
+
+    return TRUE;
+}
+
+// The MCUs kept for the Exif orientation are placed now, the image is complete
+static void end_jpeg_decoder_image(JPEGDecoder* decoder) {
+    JPEGImage* image = &(decoder -> image);
+    decoder -> is_done = TRUE;
+
+    if (decoder -> m == NULL) {
+        error_print("no SOS marker found!\n");
+        (image -> image_data).error = DECODING_ERROR;
+    } else if (image -> rows_callback == NULL) {
+        if (mcus_to_image(image, decoder -> data_tables)) {
+            (image -> image_data).error = DECODING_ERROR;
+            return;
+        }
+        decoder -> decoded_rows = (image -> image_data).height;
+    } else if (decoder -> decoded_rows < (image -> image_data).height) {
+        error_print("invalid mcu_count size: %u, expected: %u\n", image -> mcu_count, image -> mcu_x * image -> mcu_y);
+        (image -> image_data).error = DECODING_ERROR;
+    }
+
+    return;
+}
+
+// The bytes before the ones still needed are dropped only once they're half of the buffer, so that each byte is moved
+// a few times at most
+static void drop_jpeg_decoder_bytes(JPEGDecoder* decoder) {
+    BitWriter* buffer = &(decoder -> buffer);
+    if (decoder -> is_in_scan) {
+        decoder -> interval_start += (decoder -> interval).byte;
+        (decoder -> interval).byte = 0;
+    }
+
+    unsigned int count = (decoder -> is_in_scan && decoder -> interval_start < decoder -> pos) ? decoder -> interval_start : decoder -> pos;
+    if (!count || count < buffer -> length / 2) {
+        return;
+    }
+
+    memmove(buffer -> data, buffer -> data + count, buffer -> length - count);
+    buffer -> length -= count;
+    decoder -> pos -= count;
+    if (decoder -> is_in_scan) decoder -> interval_start -= count;
+
+    return;
+}
+
+JPEGDecoder* allocate_jpeg_decoder(void) {
+    JPEGDecoder* decoder = (JPEGDecoder*) calloc(1, sizeof(JPEGDecoder));
+    (decoder -> image).orientation = 1;
+    (decoder -> image).bit_stream = &(decoder -> segment);
+    decoder -> data_tables = init_data_tables();
+    return decoder;
+}
+
+// Push the next bytes of the stream, in pieces of any length: each segment is decoded once complete and each MCU once
+// its entropy coded data is received, so the MCU rows are placed as the bytes arrive
+ImageError feed_jpeg_decoder(JPEGDecoder* decoder, const unsigned char* data, unsigned int length) {
+    JPEGImage* image = &(decoder -> image);
+    if (length) {
+        put_bytes(&(decoder -> buffer), data, length);
+    }
+
+    while (!((image -> image_data).error) && !(decoder -> is_done)) {
+        bool is_decoded = (decoder -> is_in_scan) ? decode_jpeg_decoder_interval(decoder) : decode_jpeg_decoder_segment(decoder);
+        if (!is_decoded) break;
+    }
+
+    drop_jpeg_decoder_bytes(decoder);
+
+    return (image -> image_data).error;
+}
+
+// Release the decoder and return the image, the stream being complete: the entropy coded data without the marker that
+// ends it is decoded now
+Image finish_jpeg_decoder(JPEGDecoder* decoder) {
+    JPEGImage* image = &(decoder -> image);
+    // Nothing else is coming, so the MCUs at the end of the data can be decoded
+    if (!((image -> image_data).error) && !(decoder -> is_done)) {
+        decoder -> is_stream_ended = TRUE;
+        feed_jpeg_decoder(decoder, NULL, 0);
+    }
+
+    if (!((image -> image_data).error) && !(decoder -> is_done)) {
+        warning_print("missing EOI marker!\n");
+        end_jpeg_decoder_image(decoder);
+    }
+
+    deallocate_mcus(image);
+    deallocate_data_table(decoder -> data_tables);
+    free(decoder -> m);
+    free(decoder -> t_m);
+    free((decoder -> buffer).data);
+
+    Image image_data = image -> image_data;
+    free(decoder);
+
+    return image_data;
+}
+
 #endif //_DECODE_JPEG_H_
@@ -8,6 +8,12 @@
 #include "./debug_print.h"
 #include "./chunk.h"
 #include "./decompressor.h"
+#include "./defilter.h"
+#include "./convert.h"
+#include "./parallel_inflate.h"
+#include "./speculative_inflate.h"
+#include "./scanline_ring.h"
+#include "./resize.h"
 
 #define CHECK_VALID_BIT_DEPTH(bit_depth, start, len)                            \
                             for (unsigned char i = 0; i < len; ++i)             \
@@ -20,17 +26,34 @@
                                     index = i;                              \
 
 #define GET_INTERVAL_FROM_BIT_DEPTH(bit_depth) (1 + (bit_depth == 16))
+#define MIN_SEGMENT_LENGTH 0x2000 // Compressed bytes below which a segment isn't worth a thread
+#define PIPELINE_RING_LENGTH 0x40000 // Bytes of scanlines buffered between the inflate and the defilter stages
+#define PIPELINE_MIN_LENGTH 0x100000 // Inflated bytes below which starting the pipeline threads costs more than they save
 
-#define GET_PIXEL(decompressed_data, row, row_len, col) decompressed_data[row * (row_len) + col]
-#define GET_PIXEL_LEFT(decompressed_data, row, row_len, col, interval) ((col < interval) ? 0 : decompressed_data[row * row_len + col - interval])
-#define GET_PIXEL_ABOVE(decompressed_data, row, row_len, col) (!row ? 0 : decompressed_data[row_len * (row - 1) + col])
-#define GET_PIXEL_ABOVE_LEFT(decompressed_data, row, row_len, col, interval) ((!row || (col < interval)) ? 0 : decompressed_data[row_len * (row - 1) + col - interval])
-
+static const unsigned char png_magic_numbers[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
 const unsigned char valid_bit_depths[] = {1, 2, 4, 8, 16};
 const PNGType valid_color_types[] = {GREYSCALE, -1, TRUECOLOR, INDEXED_COLOR, GREYSCALE_ALPHA, -1, TRUECOLOR_ALPHA};
 const unsigned char color_types_starts[] = {0, 0, 3, 0, 3, 0, 3};
 const unsigned char color_types_lengths[] = {5, 0, 2, 4, 2, 0, 2};
-const unsigned char depth_scale_table[9] = {0x00, 0xFF, 0x55, 0x00, 0x11, 0x00, 0x00, 0x00, 0x01};
+// Adam7 passes, the last entry describes a non interlaced image as a single pass
+const unsigned char adam7_starting_col[8] = {0, 4, 0, 2, 0, 1, 0, 0};
+const unsigned char adam7_starting_row[8] = {0, 0, 4, 0, 2, 0, 1, 0};
+const unsigned char adam7_col_increment[8] = {8, 8, 4, 4, 2, 2, 1, 1};
+const unsigned char adam7_row_increment[8] = {8, 8, 8, 4, 4, 2, 2, 1};
+const unsigned char adam7_block_width[8] = {8, 4, 4, 2, 2, 1, 1, 1};
+const unsigned char adam7_block_height[8] = {8, 8, 4, 4, 2, 2, 1, 1};
+// Called after each Adam7 pass with the block replicated preview of the image decoded so far
+static ProgressiveCallback progressive_callback = NULL;
+static void* progressive_user_data = NULL;
+
+#ifndef _NO_THREADS_
+typedef struct InflateStage {
+    PNGImage* image;
+    Inflater* inflater;
+    ScanlineRing* ring;
+} InflateStage;
+#endif //_NO_THREADS_
+
 const char* months_names[] = {"", "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
 
 /* -------------------------------------------------------------------------------------- */
@@ -38,16 +61,56 @@ const char* months_names[] = {"", "January", "February", "March", "April", "May"
 static bool is_str_equal(unsigned char* str_a, unsigned char* str_b, unsigned int len);
 static bool is_valid_depth_color_combination(unsigned char bit_depth, PNGType color_type);
 static void assign_components_count(PNGImage* image);
-static unsigned char scale_to_8bits(unsigned char original_value, unsigned char bit_depth, unsigned char color_type);
-static void convert_to_RGB(PNGImage* image);
-static int paeth_predictor(unsigned char left, unsigned char above, unsigned char above_left);
+static void defilter(PNGImage* image, unsigned char* scanline, unsigned char* previous_scanline, unsigned int length);
+static void allocate_decoded_rows(PNGImage* image);
+static void output_scanline(PNGImage* image, const unsigned char* scanline, unsigned int row);
+static void finish_scaled_rows(PNGImage* image);
+static bool check_idat_crc(IdatReader* reader, unsigned int pos, unsigned int length);
+static DataSpan first_idat_span(IdatReader* reader, unsigned int pos, unsigned int chunk_end);
+static bool next_idat_span(void* source, DataSpan* span);
+static unsigned int get_band_end(unsigned int compressed_length, unsigned int bands_count, unsigned int band, unsigned int band_start);
+static FlushPoint* find_flush_points(PNGImage* image, Chunk idat_chunk, unsigned int bands_count, unsigned int* points_count);
+static void defilter_segment(InflateSegment* segment, void* user_data);
+static bool check_segments(PNGImage* image, InflateSegment* segments, unsigned int segments_count);
+static bool decode_segments(PNGImage* image, Chunk idat_chunk);
+static unsigned char* gather_idat_data(PNGImage* image, Chunk idat_chunk, unsigned int min_length, unsigned int* compressed_length, bool* is_copied);
+static bool decode_speculative(PNGImage* image, Chunk idat_chunk);
+static unsigned int get_pass_length(unsigned int size, unsigned char start, unsigned char increment);
+static void replicate_pass_row(PNGImage* image, unsigned int y, unsigned char pass);
+static void place_pass_scanline(PNGImage* image, unsigned char pass, unsigned int row, const unsigned char* scanline, unsigned char* pass_row);
+static bool decode_pass(PNGImage* image, Inflater* inflater, unsigned char pass, unsigned char* scanline, unsigned char* previous_scanline, unsigned char* pass_row);
+static void decode_scanlines(PNGImage* image, Inflater* inflater);
+#ifndef _NO_THREADS_
+static void* inflate_stage(void* arg);
+static void* check_idat_crc_stage(void* arg);
+#endif //_NO_THREADS_
+static bool decode_pipelined(PNGImage* image, Inflater* inflater);
+static void decode_idat_data(PNGImage* image, Chunk idat_chunk);
+void set_progressive_callback(ProgressiveCallback callback, void* user_data);
 void decode_ihdr(PNGImage* image, Chunk ihdr_chunk);
 void decode_plte(PNGImage* image, Chunk plte_chunk);
 void decode_idat(PNGImage* image, Chunk idat_chunk);
 void decode_iend(PNGImage* image, Chunk iend_chunk);
 void decode_time(PNGImage* image, Chunk time_chunk);
 void decode_text(PNGImage* image, Chunk text_chunk);
+static void decode_chunk(PNGImage* image, Chunk chunk);
+static Image decode_png_image(FileData* image_file, PNGImage* image);
 Image decode_png(FileData* image_file);
+Image decode_png_scaled(FileData* image_file, unsigned int width, unsigned int height);
+Image decode_png_rows(FileData* image_file, unsigned int first_row, unsigned int last_row);
+Image decode_png_streamed(FileData* image_file, RowsCallback callback, void* user_data);
+static bool is_chunk_kept(unsigned char* chunk_type);
+static bool is_chunk_crc_verified(unsigned char* chunk_type);
+static void start_decoder_pass(PNGDecoder* decoder, unsigned char pass);
+static void inflate_decoder_scanlines(PNGDecoder* decoder);
+static void append_idat_data(PNGDecoder* decoder, const unsigned char* data, unsigned int length);
+static void start_decoder_chunk(PNGDecoder* decoder);
+static void end_decoder_chunk(PNGDecoder* decoder);
+PNGDecoder* allocate_png_decoder(void);
+ImageError feed_png_decoder(PNGDecoder* decoder, const unsigned char* data, unsigned int length);
+unsigned int get_png_skippable_length(PNGDecoder* decoder);
+void skip_png_decoder_data(PNGDecoder* decoder, unsigned int length);
+Image finish_png_decoder(PNGDecoder* decoder);
 
 /* -------------------------------------------------------------------------------------- */
 
@@ -118,151 +181,653 @@ static void assign_components_count(PNGImage* image) {
     return;
 }
 
-static unsigned char scale_to_8bits(unsigned char original_value, unsigned char bit_depth, unsigned char color_type) {
-    if (original_value > ((1 << bit_depth) - 1)) debug_print(YELLOW, "invalid original_value: %u\n", original_value);
-    return CLAMP(((color_type == GREYSCALE || color_type == GREYSCALE_ALPHA) ? depth_scale_table[bit_depth] : 1) * original_value, 0, 255);
+static void defilter(PNGImage* image, unsigned char* scanline, unsigned char* previous_scanline, unsigned int length) {
+    unsigned char filter_type = scanline[0];
+
+    if (filter_type > 4) {
+        warning_print("invalid filter type: %u, row_len: %u\n", filter_type, length);
+        return;
+    }
+
+    // Skip the filter type byte, the first scanline is filtered against a zeroed one
+    (image -> defilter_kernels)[filter_type](scanline + 1, previous_scanline + 1, length);
+
+    return;
 }
 
-static void convert_to_RGB(PNGImage* image) {
-    unsigned char components = (image -> image_data).components;
-    unsigned char* decoded_data = (image -> image_data).decoded_data;
-    unsigned int size = (image -> image_data).size;
-    unsigned char bit_depth = image -> bit_depth;
-    unsigned char color_type = image -> color_type;
+// The whole image, or a single row when each row is pushed to the resizer (or given to the callback) as soon as it's
+// converted: only the range of rows is kept when the image isn't interlaced, otherwise it's taken from the whole image once decoded
+static void allocate_decoded_rows(PNGImage* image) {
+    unsigned int row_size = (image -> image_data).width * (image -> image_data).components;
+    unsigned int rows_count = (image -> rows_count && !(image -> interlace_method)) ? image -> rows_count : (image -> image_data).height;
+    if (image -> resizer != NULL || (image -> rows_callback != NULL && !(image -> interlace_method))) rows_count = 1;
+    free((image -> image_data).decoded_data);
+    (image -> image_data).decoded_data = allocate_image_buffer((unsigned long long int) row_size * rows_count);
+    (image -> image_data).size = row_size * rows_count;
+    return;
+}
+
+// Convert a defiltered scanline (without the filter type byte) into its row of the image, or into the row fed to the
+// resizer or given to the callback
+static void output_scanline(PNGImage* image, const unsigned char* scanline, unsigned int row) {
+    unsigned int row_size = (image -> image_data).width * (image -> image_data).components;
+    if (image -> resizer == NULL && (image -> rows_callback == NULL || image -> interlace_method)) {
+        (image -> convert_scanline)(image, scanline, (image -> image_data).decoded_data + (unsigned long long int) row * row_size, (image -> image_data).width);
+        return;
+    }
+
+    (image -> convert_scanline)(image, scanline, (image -> image_data).decoded_data, (image -> image_data).width);
+    if (image -> resizer != NULL) {
+        push_resizer_rows(image -> resizer, (image -> image_data).decoded_data, 1, row_size);
+    } else {
+        (image -> rows_callback)(row, 1, (image -> image_data).decoded_data, row_size, image -> rows_user_data);
+    }
+
+    return;
+}
+
+// The resized image takes the place of the single row, keeping the decoding error if any
+static void finish_scaled_rows(PNGImage* image) {
+    ImageError error = (image -> image_data).error;
+    free((image -> image_data).decoded_data);
+    image -> image_data = finish_resizer(image -> resizer);
+    image -> resizer = NULL;
+
+    if (error) {
+        (image -> image_data).error = error;
+    }
+
+    return;
+}
+
+// The crc follows the chunk data and covers the chunk type too
+static bool check_idat_crc(IdatReader* reader, unsigned int pos, unsigned int length) {
+    if (!(reader -> verify_crc)) {
+        return TRUE;
+    } else if ((unsigned long long int) pos + length + 4 > reader -> file_length) {
+        return FALSE;
+    }
+
+    unsigned char* crc_bytes = reader -> file_data + pos + length;
+    unsigned int crc = ((unsigned int) crc_bytes[0] << 24) | (crc_bytes[1] << 16) | (crc_bytes[2] << 8) | crc_bytes[3];
+
+    return update_crc32(0, reader -> file_data + pos - 4, length + 4) == crc;
+}
+
+static DataSpan first_idat_span(IdatReader* reader, unsigned int pos, unsigned int chunk_end) {
+    unsigned int end = (reader -> end_pos && reader -> end_pos < chunk_end) ? reader -> end_pos : chunk_end;
+    reader -> next_chunk_pos = chunk_end + 4;
+    return (DataSpan) {.data = reader -> file_data + pos, .length = end - pos};
+}
+
+static bool next_idat_span(void* source, DataSpan* span) {
+    IdatReader* reader = (IdatReader*) source;
+    unsigned int pos = reader -> next_chunk_pos;
+
+    // The compressed stream continues only if the chunk right after is another IDAT
+    if (pos + 8 > reader -> file_length || !is_str_equal((unsigned char*) "IDAT", reader -> file_data + pos + 4, 4)) {
+        return FALSE;
+    } else if (reader -> end_pos && pos + 8 >= reader -> end_pos) {
+        return FALSE;
+    }
+
+    unsigned char* length_bytes = reader -> file_data + pos;
+    unsigned int length = (length_bytes[0] << 24) | (length_bytes[1] << 16) | (length_bytes[2] << 8) | length_bytes[3];
+    if (length > reader -> file_length - pos - 8) {
+        warning_print("the IDAT chunk at %u exceeds the file length\n", pos);
+        return FALSE;
+    } else if (!check_idat_crc(reader, pos + 8, length)) {
+        warning_print("the IDAT chunk at %u is corrupted\n", pos);
+        return FALSE;
+    }
+
+    debug_print(YELLOW, "inflating the next IDAT chunk, length: %u, pos: %u\n", length, pos + 8);
+
+    *span = first_idat_span(reader, pos + 8, pos + 8 + length);
+
+    return TRUE;
+}
+
+// Smallest offset of the flush point ending the band, which must be past its share of the stream and leave both segments long enough
+static unsigned int get_band_end(unsigned int compressed_length, unsigned int bands_count, unsigned int band, unsigned int band_start) {
+    unsigned int target = ((unsigned long long int) compressed_length * (band + 1)) / bands_count;
+    return (target > band_start + MIN_SEGMENT_LENGTH) ? target : band_start + MIN_SEGMENT_LENGTH;
+}
+
+// Find the byte aligned empty stored blocks (00 00 FF FF) emitted by sync and full flushes that split the stream in bands of about
+// the same compressed length: only the bytes from each band target to the first flush following it are scanned
+static FlushPoint* find_flush_points(PNGImage* image, Chunk idat_chunk, unsigned int bands_count, unsigned int* points_count) {
+    IdatReader reader = (IdatReader) {.file_data = (image -> bit_stream) -> stream, .file_length = (image -> bit_stream) -> size};
+    DataSpan span = first_idat_span(&reader, idat_chunk.pos, idat_chunk.pos + idat_chunk.length);
+    unsigned int compressed_length = 0;
+    do {
+        compressed_length += span.length;
+    } while (next_idat_span(&reader, &span));
+
+    FlushPoint* points = (FlushPoint*) calloc(bands_count - 1, sizeof(FlushPoint));
+    *points_count = 0;
+    if (compressed_length < 2 * MIN_SEGMENT_LENGTH) {
+        return points;
+    }
+
+    unsigned int last_offset = compressed_length - MIN_SEGMENT_LENGTH;
+    unsigned int band_end = get_band_end(compressed_length, bands_count, 0, 0);
+    if (band_end > last_offset) {
+        return points;
+    }
+
+    unsigned int last_bytes = 0xFFFFFFFF;
+    unsigned int offset = 0;
+    span = first_idat_span(&reader, idat_chunk.pos, idat_chunk.pos + idat_chunk.length);
+
+    do {
+        unsigned int span_pos = span.data - reader.file_data;
+        unsigned int i = 0;
+
+        // The last bytes of the marker may be the first ones of the band end
+        if (band_end - 4 > offset) {
+            i = band_end - 4 - offset;
+            last_bytes = 0xFFFFFFFF;
+        }
+
+        for (; i < span.length && offset + i < last_offset; ++i) {
+            last_bytes = (last_bytes << 8) | span.data[i];
+            if (last_bytes != 0x0000FFFF || offset + i + 1 < band_end) continue;
+
+            points[(*points_count)++] = (FlushPoint) {.pos = span_pos + i + 1, .chunk_end = span_pos + span.length, .offset = offset + i + 1};
+            band_end = get_band_end(compressed_length, bands_count, *points_count, offset + i + 1);
+            if (*points_count == bands_count - 1 || band_end > last_offset) {
+                return points;
+            } else if (band_end - 4 > offset + i + 1) {
+                i = band_end - 4 - offset - 1;
+                last_bytes = 0xFFFFFFFF;
+            }
+        }
+
+        offset += span.length;
+    } while (offset < last_offset && next_idat_span(&reader, &span));
+
+    return points;
+}
+
+// Defilter the segment on its own thread when its first scanline doesn't depend on the previous segment
+static void defilter_segment(InflateSegment* segment, void* user_data) {
+    PNGImage* image = (PNGImage*) user_data;
+    unsigned int scanline_size = image -> scanline_length + 1;
+
+    if (segment -> length % scanline_size || (!(segment -> is_stream_start) && segment -> data[0] != 0 && segment -> data[0] != 1)) {
+        return;
+    }
+
+    unsigned char* empty_scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+    unsigned char* previous_scanline = empty_scanline;
+    for (unsigned int pos = 0; pos < segment -> length; pos += scanline_size) {
+        defilter(image, segment -> data + pos, previous_scanline, image -> scanline_length);
+        previous_scanline = segment -> data + pos;
+    }
+    free(empty_scanline);
+
+    segment -> is_processed = TRUE;
+
+    return;
+}
+
+static bool check_segments(PNGImage* image, InflateSegment* segments, unsigned int segments_count) {
+    unsigned int scanline_size = image -> scanline_length + 1;
+    unsigned long long int rows = 0;
+
+    // Each segment must end on a scanline boundary, and only the last one with the final block
+    for (unsigned int i = 0; i < segments_count; ++i) {
+        if (segments[i].length % scanline_size || segments[i].is_final != (i == segments_count - 1)) {
+            debug_print(YELLOW, "the segment %u doesn't end on a scanline boundary\n", i);
+            return FALSE;
+        }
+        rows += segments[i].length / scanline_size;
+    }
+
+    if (rows < (image -> image_data).height) {
+        return FALSE;
+    }
+
+    if (segments[0].verify_adler) {
+        unsigned int adler_register = segments[0].adler_register;
+        for (unsigned int i = 1; i < segments_count; ++i) {
+            adler_register = combine_adler32(adler_register, segments[i].adler_register, segments[i].length);
+        }
+
+        if (adler_register != segments[segments_count - 1].expected_adler) {
+            error_print("adler_register: 0x%x, adler_crc: 0x%x\n", adler_register, segments[segments_count - 1].expected_adler);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+// Inflate the segments delimited by flush points on multiple threads, returns FALSE if the image must be decoded sequentially
+static bool decode_segments(PNGImage* image, Chunk idat_chunk) {
+    unsigned int threads_count = get_decoding_threads();
+    if (image -> interlace_method || threads_count < 2) {
+        return FALSE;
+    }
+
+    unsigned int points_count = 0;
+    FlushPoint* points = find_flush_points(image, idat_chunk, threads_count, &points_count);
+    if (!points_count) {
+        free(points);
+        return FALSE;
+    }
+
+    // Split the stream in bands of about the same compressed length
+    unsigned int segments_count = points_count + 1;
+    InflateSegment* segments = (InflateSegment*) calloc(segments_count, sizeof(InflateSegment));
+    IdatReader* readers = (IdatReader*) calloc(segments_count, sizeof(IdatReader));
+    FlushPoint start = (FlushPoint) {.pos = idat_chunk.pos, .chunk_end = idat_chunk.pos + idat_chunk.length, .offset = 0};
+
+    for (unsigned int i = 0; i < segments_count; ++i) {
+        FlushPoint* end = (i < points_count) ? points + i : NULL;
+        readers[i] = (IdatReader) {.file_data = (image -> bit_stream) -> stream, .file_length = (image -> bit_stream) -> size, .end_pos = (end != NULL) ? end -> pos : 0};
+        segments[i] = (InflateSegment) {.next_span = next_idat_span, .source = readers + i, .is_stream_start = (i == 0), .verify_adler = (checksum_policy != SKIP_CHECKSUMS)};
+        segments[i].span = first_idat_span(readers + i, start.pos, start.chunk_end);
+        if (end != NULL) start = *end;
+    }
+
+    free(points);
+
+    debug_print(BLUE, "inflating %u segments in parallel...\n", segments_count);
+
+    bool is_decoded = inflate_segments(segments, segments_count, defilter_segment, image) && check_segments(image, segments, segments_count);
+
+    if (is_decoded) {
+        unsigned int height = (image -> image_data).height;
+        unsigned int scanline_size = image -> scanline_length + 1;
+        unsigned char* empty_scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+        unsigned char* previous_scanline = empty_scanline;
+        allocate_decoded_rows(image);
+
+        // The segments that depend on the previous one are defiltered now that it's complete
+        unsigned int row = 0;
+        for (unsigned int i = 0; i < segments_count && row < height; ++i) {
+            for (unsigned int pos = 0; pos < segments[i].length && row < height; pos += scanline_size, ++row) {
+                unsigned char* scanline = segments[i].data + pos;
+                if (!(segments[i].is_processed)) defilter(image, scanline, previous_scanline, image -> scanline_length);
+                output_scanline(image, scanline + 1, row);
+                previous_scanline = scanline;
+            }
+        }
+
+        free(empty_scanline);
+    } else {
+        debug_print(YELLOW, "falling back to the sequential inflate\n");
+    }
+
+    free(readers);
+    deallocate_segments(segments, segments_count);
+
+    return is_decoded;
+}
+
+// Join the data of consecutive IDAT chunks, a single chunk is used in place: NULL when the stream is shorter than min_length,
+// which is measured before anything is copied
+static unsigned char* gather_idat_data(PNGImage* image, Chunk idat_chunk, unsigned int min_length, unsigned int* compressed_length, bool* is_copied) {
+    IdatReader reader = (IdatReader) {.file_data = (image -> bit_stream) -> stream, .file_length = (image -> bit_stream) -> size};
+    DataSpan span = first_idat_span(&reader, idat_chunk.pos, idat_chunk.pos + idat_chunk.length);
+    unsigned char* first_span_data = span.data;
+    unsigned int spans_count = 0;
+    *compressed_length = 0;
+
+    do {
+        *compressed_length += span.length;
+        spans_count++;
+    } while (next_idat_span(&reader, &span));
+
+    *is_copied = FALSE;
+    if (*compressed_length < min_length) {
+        return NULL;
+    }
+
+    *is_copied = (spans_count > 1);
+    if (!(*is_copied)) {
+        return first_span_data;
+    }
+
+    unsigned char* data = (unsigned char*) calloc(*compressed_length, sizeof(unsigned char));
+    unsigned int offset = 0;
+    span = first_idat_span(&reader, idat_chunk.pos, idat_chunk.pos + idat_chunk.length);
+    do {
+        memcpy(data + offset, span.data, span.length);
+        offset += span.length;
+    } while (next_idat_span(&reader, &span));
+
+    return data;
+}
+
+// Inflate a stream without flush points on multiple threads by guessing where its blocks start, returns FALSE if the image must be decoded sequentially
+static bool decode_speculative(PNGImage* image, Chunk idat_chunk) {
+    unsigned int threads_count = get_decoding_threads();
+    if (!is_speculative_inflate_enabled || image -> interlace_method || threads_count < 2) {
+        return FALSE;
+    }
+
+    unsigned int compressed_length = 0;
+    bool is_copied = FALSE;
+    unsigned char* compressed_data = gather_idat_data(image, idat_chunk, SPECULATIVE_MIN_LENGTH, &compressed_length, &is_copied);
+    if (compressed_data == NULL) {
+        return FALSE;
+    }
+
+    unsigned int length = 0;
+    unsigned char* data = speculative_inflate(compressed_data, compressed_length, threads_count, checksum_policy != SKIP_CHECKSUMS, &length);
+
+    if (is_copied) {
+        free(compressed_data);
+    }
+
+    unsigned int height = (image -> image_data).height;
+    unsigned int scanline_size = image -> scanline_length + 1;
+    if (data == NULL || length / scanline_size < height) {
+        if (data != NULL) debug_print(YELLOW, "the inflated data is shorter than the image\n");
+        debug_print(YELLOW, "falling back to the sequential inflate\n");
+        free(data);
+        return FALSE;
+    }
+
+    unsigned char* empty_scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+    unsigned char* previous_scanline = empty_scanline;
+    allocate_decoded_rows(image);
+
+    for (unsigned int row = 0; row < height; ++row) {
+        unsigned char* scanline = data + row * scanline_size;
+        defilter(image, scanline, previous_scanline, image -> scanline_length);
+        output_scanline(image, scanline + 1, row);
+        previous_scanline = scanline;
+    }
+
+    free(empty_scanline);
+    free(data);
+
+    return TRUE;
+}
+
+static unsigned int get_pass_length(unsigned int size, unsigned char start, unsigned char increment) {
+    return (size > start) ? (size - start + increment - 1) / increment : 0;
+}
+
+// Fill the blocks of the pixels of the pass in row y, so that the preview is shown as coarse rectangles
+static void replicate_pass_row(PNGImage* image, unsigned int y, unsigned char pass) {
     unsigned int width = (image -> image_data).width;
     unsigned int height = (image -> image_data).height;
-    BitStream* bit_stream = allocate_bit_stream(decoded_data, size, FALSE);
-    unsigned int new_size = width * height;
-
-    RGBA rgba = (RGBA) {0};
-    rgba.R = (unsigned char*) calloc(new_size, sizeof(unsigned char));
-    rgba.G = (unsigned char*) calloc(new_size, sizeof(unsigned char));
-    rgba.B = (unsigned char*) calloc(new_size, sizeof(unsigned char));
-    if (components == 4) rgba.A = (unsigned char*) calloc(new_size, sizeof(unsigned char));
-
-    unsigned int bit_offset = image -> filter_interval * ((ceill(width / (8.0L / bit_depth)) * 8) - (width * bit_depth));
-    debug_print(WHITE, "bit offset: %u\n", bit_offset);
-
-    for (unsigned int index = 0, y = 0; y < height; ++y) {
-        for (unsigned int x = 0; x < width; ++x, ++index) {
-            unsigned char data = scale_to_8bits(get_next_n_bits(bit_stream, bit_depth, FALSE), bit_depth, color_type);
-            rgba.R[index] = data;
-            rgba.G[index] = (image -> is_palette_defined || color_type == GREYSCALE || color_type == GREYSCALE_ALPHA) ? data : scale_to_8bits(get_next_n_bits(bit_stream, bit_depth, FALSE), bit_depth, color_type);
-            rgba.B[index] = (image -> is_palette_defined || color_type == GREYSCALE || color_type == GREYSCALE_ALPHA) ? data : scale_to_8bits(get_next_n_bits(bit_stream, bit_depth, FALSE), bit_depth, color_type);
-            if (components == 4) rgba.A[index] = scale_to_8bits(get_next_n_bits(bit_stream, bit_depth, FALSE), bit_depth, color_type);
-            if (bit_stream -> error) {
-                (image -> image_data).error = DECODING_ERROR;
-                return;
-            }
+    unsigned char components = (image -> image_data).components;
+    unsigned int row_size = width * components;
+    unsigned char* row = (image -> image_data).decoded_data + y * row_size;
+
+    for (unsigned int x = adam7_starting_col[pass]; x < width; x += adam7_col_increment[pass]) {
+        for (unsigned int i = x + 1; i < x + adam7_block_width[pass] && i < width; ++i) {
+            memcpy(row + i * components, row + x * components, components);
         }
-        get_next_n_bits(bit_stream, bit_offset, FALSE);
     }
 
-    deallocate_bit_stream(bit_stream);
-    (image -> image_data).decoded_data = (unsigned char*) calloc(width * height * components, sizeof(unsigned char));
-    (image -> image_data).size = 0;
+    // The rows below the pass row hold no pixel of the previous passes yet
+    for (unsigned int i = y + 1; i < y + adam7_block_height[pass] && i < height; ++i) {
+        memcpy(row + (i - y) * row_size, row, row_size);
+    }
 
-    for (unsigned int i = 0, index = 0; i < (width * height * components); i += components, ++index, ((image -> image_data).size) += components) {
-        ((image -> image_data).decoded_data)[i] = (image -> is_palette_defined) ? (image -> palette).R[rgba.R[index]] : rgba.R[index];
-        ((image -> image_data).decoded_data)[i + 1] = (image -> is_palette_defined) ? (image -> palette).G[rgba.G[index]] : rgba.G[index];
-        ((image -> image_data).decoded_data)[i + 2] = (image -> is_palette_defined) ? (image -> palette).B[rgba.B[index]] : rgba.B[index];
-        if (components == 4) ((image -> image_data).decoded_data)[i + 3] = rgba.A[index];
+    return;
+}
+
+// Place the defiltered scanline (without the filter type byte) of a row of the pass, scattering its pixels when the image is interlaced
+static void place_pass_scanline(PNGImage* image, unsigned char pass, unsigned int row, const unsigned char* scanline, unsigned char* pass_row) {
+    unsigned char components = (image -> image_data).components;
+    unsigned int row_size = (image -> image_data).width * components;
+    unsigned int pass_width = get_pass_length((image -> image_data).width, adam7_starting_col[pass], adam7_col_increment[pass]);
+    unsigned int first_row = (pass == 7) ? image -> first_row : 0;
+    unsigned int y = adam7_starting_row[pass] + row * adam7_row_increment[pass];
+
+    if (row < first_row) {
+        // Skipped, but still needed to defilter the next scanline
+    } else if (adam7_col_increment[pass] == 1) {
+        output_scanline(image, scanline, y - first_row);
+    } else {
+        unsigned char* dest = (image -> image_data).decoded_data + y * row_size;
+        (image -> convert_scanline)(image, scanline, pass_row, pass_width);
+        for (unsigned int x = 0; x < pass_width; ++x) {
+            memcpy(dest + (adam7_starting_col[pass] + x * adam7_col_increment[pass]) * components, pass_row + x * components, components);
+        }
     }
 
-    free(rgba.R);
-    free(rgba.G);
-    free(rgba.B);
-    if (components == 4) free(rgba.A);
+    if (progressive_callback != NULL && pass < 7) {
+        replicate_pass_row(image, y, pass);
+    }
 
     return;
 }
 
-static int paeth_predictor(unsigned char left, unsigned char above, unsigned char above_left) {
-    int p = left + above - above_left;
-    int pa = abs(p - left);
-    int pb = abs(p - above);
-    int pc = abs(p - above_left);
+// Decode the reduced image of the pass, scattering its pixels into the decoded image
+static bool decode_pass(PNGImage* image, Inflater* inflater, unsigned char pass, unsigned char* scanline, unsigned char* previous_scanline, unsigned char* pass_row) {
+    unsigned int pass_width = get_pass_length((image -> image_data).width, adam7_starting_col[pass], adam7_col_increment[pass]);
+    unsigned int pass_height = get_pass_length((image -> image_data).height, adam7_starting_row[pass], adam7_row_increment[pass]);
+    unsigned char samples = (image -> color_type == TRUECOLOR) ? 3 : (image -> color_type == TRUECOLOR_ALPHA) ? 4 : (image -> color_type == GREYSCALE_ALPHA) ? 2 : 1;
+    unsigned int scanline_length = (((unsigned long long int) pass_width) * samples * (image -> bit_depth) + 7) / 8;
+
+    // Empty passes have no scanlines, not even the filter type byte
+    if (pass_width == 0 || pass_height == 0) {
+        return FALSE;
+    }
+
+    debug_print(WHITE, "pass: %u, width: %u, height: %u, scanline size: %u\n", pass + 1, pass_width, pass_height, scanline_length + 1);
+
+    // Without interlacing the scanlines after the range of rows aren't inflated, the ones before it are only defiltered
+    if (pass == 7 && image -> rows_count) {
+        pass_height = image -> first_row + image -> rows_count;
+    }
+
+    // Each reduced image is filtered on its own, so its first scanline is filtered against a zeroed one
+    memset(previous_scanline, 0, scanline_length + 1);
 
-    if ((pa <= pb) && (pa <= pc)) return left;
-    if (pb <= pc) return above;
-    return above_left;
+    for (unsigned int row = 0; row < pass_height; ++row) {
+        if (inflate_n_bytes(inflater, scanline, scanline_length + 1) != scanline_length + 1) {
+            error_print("%s", inflater -> error != NULL ? inflater -> error : "missing scanlines in the compressed data\n");
+            (image -> image_data).error = DECODING_ERROR;
+            return FALSE;
+        }
+
+        defilter(image, scanline, previous_scanline, scanline_length);
+        place_pass_scanline(image, pass, row, scanline + 1, pass_row);
+
+        unsigned char* temp = previous_scanline;
+        previous_scanline = scanline;
+        scanline = temp;
+    }
+
+    return TRUE;
 }
 
-static void defilter(PNGImage* image, unsigned char* decompressed_data, unsigned int decompressed_data_size, unsigned char bit_depth) {
-    unsigned char interval = image -> filter_interval;
-    unsigned int filtered_img_width = ceill((image -> image_data).width / (8.0L / bit_depth));
-    unsigned int row_len = filtered_img_width * interval;
-    unsigned int row = 0;
+static void decode_scanlines(PNGImage* image, Inflater* inflater) {
+    unsigned int scanline_size = image -> scanline_length + 1;
+    unsigned int row_size = (image -> image_data).width * (image -> image_data).components;
 
-    unsigned int none = 0;
-    unsigned int subtract = 0;
-    unsigned int up = 0;
-    unsigned int average = 0;
-    unsigned int paeth = 0;
-
-    BitStream* decompressed_stream = allocate_bit_stream(decompressed_data, decompressed_data_size, FALSE);
-    const unsigned short int bit_mask = 0xFF;
-    debug_print(WHITE, "decompressed_data size: %u, filtered_img_width: %u\n", decompressed_data_size, filtered_img_width);
-
-    for (unsigned int i = 0; i < decompressed_data_size; ++i, ++row) {
-        unsigned char filter_type = get_next_byte_uc(decompressed_stream);
-        unsigned int* size = &((image -> image_data).size);
-        (image -> image_data).decoded_data = (unsigned char*) realloc((image -> image_data).decoded_data, sizeof(unsigned char) * ((*size) + row_len));
-        switch (filter_type) {
-            case 0: {
-                for (unsigned int col = 0; col < row_len; ++i, ++col, ++(*size)) {
-                    (image -> image_data).decoded_data[*size] = get_next_byte_uc(decompressed_stream) & bit_mask;
-                }
-                none++;
-                break;
-            }
+    // Only the current scanline and the one above are needed to defilter, the rest is in the sliding window
+    unsigned char* scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+    unsigned char* previous_scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+    unsigned char* pass_row = (unsigned char*) calloc(row_size, sizeof(unsigned char));
+    allocate_decoded_rows(image);
 
-            case 1: {
-                for (unsigned int col = 0; col < row_len; ++i, ++col, ++(*size)) {
-                    unsigned char data = get_next_byte_uc(decompressed_stream);
-                    (image -> image_data).decoded_data[*size] = (data + (int) GET_PIXEL_LEFT((image -> image_data).decoded_data, row, row_len, col, interval)) & bit_mask;
-                }
-                subtract++;
-                break;
-            }
+    debug_print(WHITE, "scanline size: %u, row size: %u\n", scanline_size, row_size);
 
-            case 2: {
-                for (unsigned int col = 0; col < row_len; ++i, ++col, ++(*size)) {
-                    unsigned char data = get_next_byte_uc(decompressed_stream);
-                    (image -> image_data).decoded_data[*size] = (data + (int) GET_PIXEL_ABOVE((image -> image_data).decoded_data, row, row_len, col)) & bit_mask;
-                }
-                up++;
-                break;
+    if (image -> interlace_method) {
+        for (unsigned char pass = 0; pass < 7 && !((image -> image_data).error); ++pass) {
+            if (decode_pass(image, inflater, pass, scanline, previous_scanline, pass_row) && progressive_callback != NULL) {
+                progressive_callback(image -> image_data, pass + 1, progressive_user_data);
             }
+        }
+    } else {
+        decode_pass(image, inflater, 7, scanline, previous_scanline, pass_row);
+    }
 
-            case 3: {
-                for (unsigned int col = 0; col < row_len; ++i, ++col, ++(*size)) {
-                    unsigned char data = get_next_byte_uc(decompressed_stream);
-                    (image -> image_data).decoded_data[*size] = (data + ((int) GET_PIXEL_LEFT((image -> image_data).decoded_data, row, row_len, col, interval) + (int) GET_PIXEL_ABOVE((image -> image_data).decoded_data, row, row_len, col)) / 2) & bit_mask;
-                }
-                average++;
-                break;
-            }
+    // Reach the end of the compressed data to verify the adler crc, unless the decoding stopped at the last row of the range
+    unsigned char extra_data = 0;
+    bool is_stream_read = !(image -> rows_count) || image -> interlace_method;
+    while (is_stream_read && !((image -> image_data).error) && !(inflater -> is_done) && inflater -> error == NULL) {
+        if (inflate_n_bytes(inflater, &extra_data, 1)) {
+            debug_print(YELLOW, "ignoring extra data after the last scanline\n");
+        }
+    }
 
-            case 4: {
-                for (unsigned int col = 0; col < row_len; ++i, ++col, ++(*size)) {
-                    unsigned char data = get_next_byte_uc(decompressed_stream);
-                    (image -> image_data).decoded_data[*size] = (data + paeth_predictor(GET_PIXEL_LEFT((image -> image_data).decoded_data, row, row_len, col, interval), GET_PIXEL_ABOVE((image -> image_data).decoded_data, row, row_len, col), GET_PIXEL_ABOVE_LEFT((image -> image_data).decoded_data, row, row_len, col, interval))) & bit_mask;
-                }
-                paeth++;
-                break;
-            }
+    if (!((image -> image_data).error) && inflater -> error != NULL) {
+        error_print("%s", inflater -> error);
+        (image -> image_data).error = DECODING_ERROR;
+    }
 
-            default: {
-                warning_print("invalid filter type: %u, row: %u, row_len: %u, i: %u\n", filter_type, row + 1, row_len, i);
-                break;
-            }
+    free(scanline);
+    free(previous_scanline);
+    free(pass_row);
+
+    return;
+}
+
+#ifndef _NO_THREADS_
+
+// Inflate the scanlines into the ring, then reach the end of the compressed data to verify the adler crc
+static void* inflate_stage(void* arg) {
+    InflateStage* stage = (InflateStage*) arg;
+    Inflater* inflater = stage -> inflater;
+    unsigned int height = ((stage -> image) -> image_data).height;
+    unsigned int scanline_size = (stage -> image) -> scanline_length + 1;
+    unsigned int row = 0;
+
+    for (; row < height; ++row) {
+        unsigned char* scanline = reserve_scanline(stage -> ring);
+        if (inflate_n_bytes(inflater, scanline, scanline_size) != scanline_size) break;
+        commit_scanline(stage -> ring);
+    }
+
+    unsigned char extra_data = 0;
+    while (row == height && !(inflater -> is_done) && inflater -> error == NULL) {
+        if (inflate_n_bytes(inflater, &extra_data, 1)) {
+            debug_print(YELLOW, "ignoring extra data after the last scanline\n");
         }
     }
 
-    debug_print(YELLOW, "none: %u, subtract: %u, up: %u, average: %u, paeth: %u\n", none, subtract, up, average, paeth);
+    close_scanline_ring(stage -> ring);
+
+    return NULL;
+}
+
+static void* check_idat_crc_stage(void* arg) {
+    IdatCrcCheck* check = (IdatCrcCheck*) arg;
+    check -> is_valid = check_idat_chunks(check -> file_data, check -> file_length, check -> pos);
+    return NULL;
+}
+
+#endif //_NO_THREADS_
+
+// Inflate on its own thread while this one defilters and converts, returns FALSE if the stages can't be started or the image
+// is too small for them to pay off
+static bool decode_pipelined(PNGImage* image, Inflater* inflater) {
+#ifdef _NO_THREADS_
+    NOT_USED(image);
+    NOT_USED(inflater);
+    return FALSE;
+#else
+    unsigned int height = (image -> image_data).height;
+    unsigned int scanline_size = image -> scanline_length + 1;
+    if (image -> interlace_method || image -> rows_count || get_decoding_threads() < 2 || (unsigned long long int) height * scanline_size < PIPELINE_MIN_LENGTH) {
+        return FALSE;
+    }
+
+    unsigned int row_size = (image -> image_data).width * (image -> image_data).components;
+
+    // The consumer holds the scanline above the current one, so at least two slots are needed
+    ScanlineRing ring = {0};
+    init_scanline_ring(&ring, scanline_size, CLAMP(PIPELINE_RING_LENGTH / scanline_size, 4, height + 1));
+
+    InflateStage stage = (InflateStage) {.image = image, .inflater = inflater, .ring = &ring};
+    pthread_t inflate_thread;
+    if (pthread_create(&inflate_thread, NULL, inflate_stage, &stage)) {
+        deallocate_scanline_ring(&ring);
+        return FALSE;
+    }
 
-    deallocate_bit_stream(decompressed_stream);
+    debug_print(WHITE, "scanline size: %u, row size: %u, ring slots: %u\n", scanline_size, row_size, ring.slots_count);
+
+    unsigned char* empty_scanline = (unsigned char*) calloc(scanline_size, sizeof(unsigned char));
+    unsigned char* previous_scanline = empty_scanline;
+    allocate_decoded_rows(image);
+
+    unsigned int row = 0;
+    for (; row < height; ++row) {
+        unsigned char* scanline = acquire_scanline(&ring, row);
+        if (scanline == NULL) break;
+
+        defilter(image, scanline, previous_scanline, image -> scanline_length);
+        output_scanline(image, scanline + 1, row);
+
+        // Only the scanline just defiltered is still needed
+        release_scanlines(&ring, row);
+        previous_scanline = scanline;
+    }
+    release_scanlines(&ring, row);
+
+    pthread_join(inflate_thread, NULL);
+
+    if (row < height || inflater -> error != NULL) {
+        error_print("%s", inflater -> error != NULL ? inflater -> error : "missing scanlines in the compressed data\n");
+        (image -> image_data).error = DECODING_ERROR;
+    }
+
+    free(empty_scanline);
+    deallocate_scanline_ring(&ring);
+
+    return TRUE;
+#endif //_NO_THREADS_
+}
+
+static void decode_idat_data(PNGImage* image, Chunk idat_chunk) {
+    // Decoding to a target size, each row is resized as soon as it's converted instead of keeping the whole image:
+    // the interlaced images are resized once complete, as each pass adds pixels to all the rows
+    if (image -> target_width && !(image -> interlace_method)) {
+        Image* image_data = &(image -> image_data);
+        image -> resizer = allocate_resizer(image_data -> width, image_data -> height, image_data -> components, image -> target_width, image -> target_height, RESAMPLE_BOX);
+    }
+
+    // Decoding a range of rows, the scanlines are inflated only up to the last one
+    if (image -> first_row >= (image -> image_data).height) {
+        error_print("invalid first row: %u, the image has %u rows\n", image -> first_row, (image -> image_data).height);
+        (image -> image_data).error = INVALID_IMAGE_SIZE;
+        return;
+    } else if (image -> rows_count > (image -> image_data).height - image -> first_row) {
+        image -> rows_count = (image -> image_data).height - image -> first_row;
+    }
+
+    // Independently compressed segments are inflated in parallel, otherwise the block boundaries are guessed: both hold
+    // the whole inflated image, so the rows fed to the resizer or to the callback (or a range of rows) are inflated sequentially
+    if (image -> resizer == NULL && image -> rows_callback == NULL && !(image -> rows_count) && (decode_segments(image, idat_chunk) || decode_speculative(image, idat_chunk))) {
+        debug_print(WHITE, "decoded data len: %u\n", (image -> image_data).size);
+        return;
+    }
+
+    // Inflate, defilter and convert one scanline at a time, reading the IDAT data in place
+    image -> idat_reader = (IdatReader) {.file_data = (image -> bit_stream) -> stream, .file_length = (image -> bit_stream) -> size, .verify_crc = image -> is_idat_crc_lazy};
+    DataSpan span = first_idat_span(&(image -> idat_reader), idat_chunk.pos, idat_chunk.pos + idat_chunk.length);
+    Inflater* inflater = allocate_inflater(span, next_idat_span, &(image -> idat_reader));
+    inflater -> verify_adler = (checksum_policy != SKIP_CHECKSUMS);
+
+    if (!check_idat_crc(&(image -> idat_reader), idat_chunk.pos, idat_chunk.length)) {
+        error_print("corrupted IDAT chunk\n");
+        (image -> image_data).error = DECODING_ERROR;
+    } else if (inflater -> error != NULL) {
+        error_print("%s\n", inflater -> error);
+        (image -> image_data).error = DECODING_ERROR;
+    } else {
+        if (!decode_pipelined(image, inflater)) decode_scanlines(image, inflater);
+        debug_print(WHITE, "decoded data len: %u\n", (image -> image_data).size);
+    }
+
+    deallocate_inflater(inflater);
+
+    if (image -> resizer != NULL) {
+        finish_scaled_rows(image);
+    }
 
     return;
 }
@@ -303,6 +868,12 @@ void decode_ihdr(PNGImage* image, Chunk ihdr_chunk) {
 
     assign_components_count(image);
     assign_filter_interval(image);
+    select_defilter_kernels(image -> defilter_kernels, image -> filter_interval);
+    image -> convert_scanline = select_scanline_converter(image -> color_type, image -> bit_depth);
+    build_unpack_lut(image);
+
+    unsigned char samples = (image -> color_type == TRUECOLOR) ? 3 : (image -> color_type == TRUECOLOR_ALPHA) ? 4 : (image -> color_type == GREYSCALE_ALPHA) ? 2 : 1;
+    image -> scanline_length = (((unsigned long long int) (image -> image_data).width) * samples * (image -> bit_depth) + 7) / 8;
 
     debug_print(YELLOW, "components: %u\n", (image -> image_data).components);
     debug_print(YELLOW, "filter interval: %u\n", image -> filter_interval);
@@ -343,7 +914,7 @@ void decode_plte(PNGImage* image, Chunk plte_chunk) {
         error_print("invalid length as it should be divisible by 3\n");
         (image -> image_data).error = DECODING_ERROR;
         return;
-    } else if ((image -> palette).R != NULL) {
+    } else if (image -> is_palette_defined) {
         error_print("there's should be only one PLTE chunk\n");
         (image -> image_data).error = DECODING_ERROR;
         return;
@@ -366,14 +937,11 @@ void decode_plte(PNGImage* image, Chunk plte_chunk) {
         return;
     }
 
-    (image -> palette).R = (unsigned char*) calloc(palette_size, sizeof(unsigned char));
-    (image -> palette).G = (unsigned char*) calloc(palette_size, sizeof(unsigned char));
-    (image -> palette).B = (unsigned char*) calloc(palette_size, sizeof(unsigned char));
-
     for (unsigned int i = 0; i < palette_size; ++i) {
-        (image -> palette).R[i] = get_next_byte_uc(image -> bit_stream);
-        (image -> palette).G[i] = get_next_byte_uc(image -> bit_stream);
-        (image -> palette).B[i] = get_next_byte_uc(image -> bit_stream);
+        (image -> palette)[i][0] = get_next_byte_uc(image -> bit_stream);
+        (image -> palette)[i][1] = get_next_byte_uc(image -> bit_stream);
+        (image -> palette)[i][2] = get_next_byte_uc(image -> bit_stream);
+        (image -> palette)[i][3] = 0xFF;
     }
 
     image -> is_palette_defined = TRUE;
@@ -392,46 +960,33 @@ void decode_idat(PNGImage* image, Chunk idat_chunk) {
         return;
     }
 
-    set_byte(image -> bit_stream, idat_chunk.pos);
-
-    // Check that there's no other IDAT chunks before this one
-    if (image -> idat_chunk_count >= image -> current_idat_chunk) {
-        debug_print(YELLOW, "idat_chunk: %u of %u\n", image -> current_idat_chunk, image -> idat_chunk_count);
-
-        unsigned char* compressed_data = get_next_n_byte_uc(image -> bit_stream, idat_chunk.length);
-        debug_print(YELLOW, "read: %u, length: %u\n", (image -> bit_stream) -> byte, idat_chunk.length + idat_chunk.pos);
-
-        // append the current block data to the compressed stream
-        if (image -> current_idat_chunk == 0) image -> compressed_stream = allocate_bit_stream(compressed_data, idat_chunk.length, FALSE);
-        else append_n_bytes(image -> compressed_stream, compressed_data, idat_chunk.length);
-
-        (image -> current_idat_chunk)++;
-
-        if (image -> idat_chunk_count > image -> current_idat_chunk) return;
+    // The first IDAT chunk starts the decoding, the following ones are read by the inflater itself
+    if (image -> is_idat_decoded) {
+        debug_print(YELLOW, "IDAT chunk already inflated\n\n");
+        return;
     }
 
-    debug_print(BLUE, "init deflating...\n");
+    image -> is_idat_decoded = TRUE;
 
-    unsigned char err = 0;
-    unsigned int stream_length = 0;
-    unsigned char* decompressed_stream = inflate(image -> compressed_stream, &err, &stream_length);
-    deallocate_bit_stream(image -> compressed_stream);
+    debug_print(BLUE, "init inflating...\n");
 
-    if (err) {
-        error_print((char*) decompressed_stream);
-        (image -> image_data).error = DECODING_ERROR;
-        return;
-    }
+    // The crc of the IDAT chunks is verified on its own thread while they're decoded
+    IdatCrcCheck crc_check = (IdatCrcCheck) {.file_data = (image -> bit_stream) -> stream, .file_length = (image -> bit_stream) -> size, .pos = idat_chunk.pos, .is_valid = TRUE};
+#ifndef _NO_THREADS_
+    pthread_t crc_thread;
+    bool is_crc_running = image -> is_idat_crc_deferred && !pthread_create(&crc_thread, NULL, check_idat_crc_stage, &crc_check);
+    if (image -> is_idat_crc_deferred && !is_crc_running) check_idat_crc_stage(&crc_check);
+#endif //_NO_THREADS_
 
-    debug_print(YELLOW, "\n");
-    debug_print(BLUE, "starting defiltering...\n");
-    defilter(image, decompressed_stream, stream_length, image -> bit_depth);
-    debug_print(WHITE, "defiltered data len: %u\n", (image -> image_data).size);
+    decode_idat_data(image, idat_chunk);
 
-    if (image -> interlace_method) {
-        error_print("implement the interlacing Adam 7 method...\n");
+#ifndef _NO_THREADS_
+    if (is_crc_running) pthread_join(crc_thread, NULL);
+#endif //_NO_THREADS_
+
+    if (!(crc_check.is_valid) && !((image -> image_data).error)) {
+        error_print("corrupted IDAT chunk\n");
         (image -> image_data).error = DECODING_ERROR;
-        return;
     }
 
     debug_print(YELLOW, "\n");
@@ -481,12 +1036,39 @@ void decode_text(PNGImage* image, Chunk text_chunk) {
 	return;
 }
 
-Image decode_png(FileData* image_file) {
-    PNGImage* image = (PNGImage*) calloc(1, sizeof(PNGImage));
-    image -> idat_chunk_count = 0;
-    Chunks chunks = find_and_check_chunks(image_file -> data, image_file -> length, &(image -> idat_chunk_count));
+void set_progressive_callback(ProgressiveCallback callback, void* user_data) {
+    progressive_callback = callback;
+    progressive_user_data = user_data;
+    return;
+}
+
+static void decode_chunk(PNGImage* image, Chunk chunk) {
+    if (is_str_equal((unsigned char*) "IHDR", chunk.chunk_type, 4)) {
+        decode_ihdr(image, chunk);
+    } else if (is_str_equal((unsigned char*) "PLTE", chunk.chunk_type, 4)) {
+        decode_plte(image, chunk);
+    } else if (is_str_equal((unsigned char*) "IDAT", chunk.chunk_type, 4)) {
+        decode_idat(image, chunk);
+    } else if (is_str_equal((unsigned char*) "IEND", chunk.chunk_type, 4)) {
+        decode_iend(image, chunk);
+    } else if (is_str_equal((unsigned char*) "tIME", chunk.chunk_type, 4)) {
+        decode_time(image, chunk);
+    } else if (is_str_equal((unsigned char*) "tEXt", chunk.chunk_type, 4)) {
+        decode_text(image, chunk);
+    } else {
+        debug_print(PURPLE, "unknown type: %s, length: %u, pos: %u\n\n", chunk.chunk_type, chunk.length, chunk.pos);
+    }
+    return;
+}
+
+// Decode with the options already set in the image, which is released
+static Image decode_png_image(FileData* image_file, PNGImage* image) {
+    // With more threads the crc of the IDAT chunks is hidden behind their decoding, while decoding a range of rows
+    // it's verified for each chunk reached by the inflater
+    image -> is_idat_crc_lazy = (checksum_policy != SKIP_CHECKSUMS) && image -> rows_count;
+    image -> is_idat_crc_deferred = (checksum_policy != SKIP_CHECKSUMS) && !(image -> rows_count) && get_decoding_threads() > 1;
+    Chunks chunks = find_and_check_chunks(image_file -> data, image_file -> length, checksum_policy, image -> is_idat_crc_deferred || image -> is_idat_crc_lazy);
     image -> bit_stream = allocate_bit_stream(image_file -> data, image_file -> length, FALSE);
-    image -> palette = (RGBA) { .R = NULL, .G = NULL, .B = NULL, .A = NULL };
     image -> is_palette_defined = FALSE;
     (image -> image_data).decoded_data = (unsigned char*) calloc(1, sizeof(unsigned char));
     (image -> image_data).size = 0;
@@ -494,28 +1076,12 @@ Image decode_png(FileData* image_file) {
     debug_print(BLUE, "image_size: %u\n\n", image_file -> length);
 
     for (unsigned int i = 0; i < chunks.chunks_count && !((image -> image_data).error); ++i) {
-        Chunk chunk = (chunks.chunks)[i];
-        if (is_str_equal((unsigned char*) "IHDR", chunk.chunk_type, 4)) {
-            decode_ihdr(image, chunk);
-            continue;
-        } else if (is_str_equal((unsigned char*) "PLTE", chunk.chunk_type, 4)) {
-            decode_plte(image, chunk);
-            continue;
-        } else if (is_str_equal((unsigned char*) "IDAT", chunk.chunk_type, 4)) {
-            decode_idat(image, chunk);
-            continue;
-        } else if (is_str_equal((unsigned char*) "IEND", chunk.chunk_type, 4)) {
-            decode_iend(image, chunk);
-            continue;
-        } else if (is_str_equal((unsigned char*) "tIME", chunk.chunk_type, 4)) {
-            decode_time(image, chunk);
-            continue;
-        } else if (is_str_equal((unsigned char*) "tEXt", chunk.chunk_type, 4)) {
-            decode_text(image, chunk);
-            continue;
-        }
+        decode_chunk(image, (chunks.chunks)[i]);
+    }
 
-        debug_print(PURPLE, "unknown type: %s, length: %u, pos: %u\n\n", chunk.chunk_type, chunk.length, chunk.pos);
+    if (!((image -> image_data).error) && !((image -> image_data).size)) {
+        error_print("no IDAT chunk found\n");
+        (image -> image_data).error = DECODING_ERROR;
     }
 
     if ((image -> image_data).error) {
@@ -524,15 +1090,416 @@ Image decode_png(FileData* image_file) {
 
     debug_print(YELLOW, "\n");
 
-    convert_to_RGB(image);
-
     // Deallocate stuff
     deallocate_bit_stream(image -> bit_stream);
 	deallocate_chunks(chunks);
 
 	Image image_data = image -> image_data;
+    unsigned int row_size = image_data.width * image_data.components;
+    if (image -> rows_count) {
+        // The interlaced images are decoded whole, as each pass adds pixels to all the rows
+        if (image -> interlace_method) {
+            memmove(image_data.decoded_data, image_data.decoded_data + (unsigned long long int) (image -> first_row) * row_size, (unsigned long long int) (image -> rows_count) * row_size);
+        }
+        image_data.height = image -> rows_count;
+        image_data.size = row_size * image_data.height;
+    }
+
+    // The interlaced images are complete only after the last pass, so they're given to the callback at once
+    if (image -> rows_callback != NULL) {
+        if (image -> interlace_method) {
+            (image -> rows_callback)(0, image_data.height, image_data.decoded_data, row_size, image -> rows_user_data);
+        }
+        free(image_data.decoded_data);
+        image_data.decoded_data = NULL;
+        image_data.size = 0;
+    }
+
+    unsigned int target_width = image -> target_width;
+    unsigned int target_height = image -> target_height;
 	free(image);
 
+    if (target_width && (image_data.width != target_width || image_data.height != target_height)) {
+        Image resized_data = resize_image(image_data, target_width, target_height, RESAMPLE_BOX);
+        free(image_data.decoded_data);
+        image_data = resized_data;
+    }
+
+    return image_data;
+}
+
+Image decode_png(FileData* image_file) {
+    PNGImage* image = (PNGImage*) calloc(1, sizeof(PNGImage));
+    return decode_png_image(image_file, image);
+}
+
+// Decode the image straight to the given size with a box filter, without ever holding it at full size
+Image decode_png_scaled(FileData* image_file, unsigned int width, unsigned int height) {
+    if (width == 0 || height == 0) {
+        error_print("invalid target size: %u x %u\n", width, height);
+        free(image_file -> data);
+        return (Image) {.error = INVALID_IMAGE_SIZE};
+    }
+
+    PNGImage* image = (PNGImage*) calloc(1, sizeof(PNGImage));
+    image -> target_width = width;
+    image -> target_height = height;
+
+    return decode_png_image(image_file, image);
+}
+
+// Decode only the rows from first_row to last_row (included): the compressed data after the last one isn't read,
+// so its checksums aren't verified
+Image decode_png_rows(FileData* image_file, unsigned int first_row, unsigned int last_row) {
+    if (first_row > last_row) {
+        error_print("invalid range of rows: from %u to %u\n", first_row, last_row);
+        free(image_file -> data);
+        return (Image) {.error = INVALID_IMAGE_SIZE};
+    }
+
+    PNGImage* image = (PNGImage*) calloc(1, sizeof(PNGImage));
+    image -> first_row = first_row;
+    image -> rows_count = last_row - first_row + 1;
+
+    return decode_png_image(image_file, image);
+}
+
+// Give the callback each row as soon as it's converted, so that only the row being decoded is held besides the
+// inflate window: the image returned has no decoded data
+Image decode_png_streamed(FileData* image_file, RowsCallback callback, void* user_data) {
+    PNGImage* image = (PNGImage*) calloc(1, sizeof(PNGImage));
+    image -> rows_callback = callback;
+    image -> rows_user_data = user_data;
+    return decode_png_image(image_file, image);
+}
+
+// The chunks decoded once their data is complete, the data of the others isn't kept
+static bool is_chunk_kept(unsigned char* chunk_type) {
+    const char* kept_types[] = {"IHDR", "PLTE", "IEND", "tIME", "tEXt"};
+    for (unsigned char i = 0; i < 5; ++i) {
+        if (is_str_equal((unsigned char*) kept_types[i], chunk_type, 4)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static bool is_chunk_crc_verified(unsigned char* chunk_type) {
+    return (checksum_policy == VERIFY_ALL_CHECKSUMS) || (checksum_policy == VERIFY_CRITICAL_CHECKSUMS && IS_CRITICAL_CHUNK(chunk_type));
+}
+
+// Start the pass, or the first non empty one after it: each reduced image is filtered on its own
+static void start_decoder_pass(PNGDecoder* decoder, unsigned char pass) {
+    PNGImage* image = &(decoder -> image);
+    unsigned char last_pass = (image -> interlace_method) ? 6 : 7;
+    unsigned int pass_width = 0;
+    for (; pass <= last_pass; ++pass) {
+        pass_width = get_pass_length((image -> image_data).width, adam7_starting_col[pass], adam7_col_increment[pass]);
+        decoder -> pass_height = get_pass_length((image -> image_data).height, adam7_starting_row[pass], adam7_row_increment[pass]);
+        if (pass_width && decoder -> pass_height) break;
+    }
+
+    if (pass > last_pass) {
+        decoder -> is_scanlines_done = TRUE;
+        decoder -> decoded_rows = (image -> image_data).height;
+        return;
+    }
+
+    unsigned char samples = (image -> color_type == TRUECOLOR) ? 3 : (image -> color_type == TRUECOLOR_ALPHA) ? 4 : (image -> color_type == GREYSCALE_ALPHA) ? 2 : 1;
+    decoder -> pass = pass;
+    decoder -> pass_row_index = 0;
+    decoder -> scanline_size = (((unsigned long long int) pass_width) * samples * (image -> bit_depth) + 7) / 8 + 1;
+    decoder -> scanline_filled = 0;
+    memset(decoder -> previous_scanline, 0, decoder -> scanline_size);
+
+    debug_print(WHITE, "pass: %u, width: %u, height: %u, scanline size: %u\n", pass + 1, pass_width, decoder -> pass_height, decoder -> scanline_size);
+
+    return;
+}
+
+// Inflate and place the scanlines whose compressed data was received, the one left incomplete is resumed by the next push
+static void inflate_decoder_scanlines(PNGDecoder* decoder) {
+    PNGImage* image = &(decoder -> image);
+    Inflater* inflater = decoder -> inflater;
+
+    while (!(decoder -> is_scanlines_done) && inflater -> error == NULL) {
+        decoder -> scanline_filled += inflate_n_bytes(inflater, decoder -> scanline + decoder -> scanline_filled, decoder -> scanline_size - decoder -> scanline_filled);
+        if (decoder -> scanline_filled < decoder -> scanline_size) break;
+
+        unsigned char pass = decoder -> pass;
+        defilter(image, decoder -> scanline, decoder -> previous_scanline, decoder -> scanline_size - 1);
+        place_pass_scanline(image, pass, decoder -> pass_row_index, decoder -> scanline + 1, decoder -> pass_row);
+
+        unsigned char* temp = decoder -> previous_scanline;
+        decoder -> previous_scanline = decoder -> scanline;
+        decoder -> scanline = temp;
+        decoder -> scanline_filled = 0;
+        (decoder -> pass_row_index)++;
+
+        // The interlaced images have complete rows only after the last pass
+        if (pass == 7) {
+            decoder -> decoded_rows = decoder -> pass_row_index;
+        }
+
+        if (decoder -> pass_row_index == decoder -> pass_height) {
+            if (pass < 7 && progressive_callback != NULL) progressive_callback(image -> image_data, pass + 1, progressive_user_data);
+            start_decoder_pass(decoder, pass + 1);
+        }
+    }
+
+    // Reach the end of the compressed data to verify the adler crc
+    unsigned char extra_data = 0;
+    while (decoder -> is_scanlines_done && !(inflater -> is_done) && inflater -> error == NULL) {
+        if (!inflate_n_bytes(inflater, &extra_data, 1)) break;
+        debug_print(YELLOW, "ignoring extra data after the last scanline\n");
+    }
+
+    if (inflater -> error != NULL) {
+        error_print("%s", inflater -> error);
+        (image -> image_data).error = DECODING_ERROR;
+    } else if (inflater -> is_done && !(decoder -> is_scanlines_done)) {
+        error_print("missing scanlines in the compressed data\n");
+        (image -> image_data).error = DECODING_ERROR;
+    } else if (inflater -> is_done) {
+        decoder -> is_done = TRUE;
+    }
+
+    return;
+}
+
+// Append the data of an IDAT chunk after the compressed data the inflater didn't read yet
+static void append_idat_data(PNGDecoder* decoder, const unsigned char* data, unsigned int length) {
+    unsigned int consumed = (decoder -> inflater != NULL) ? (decoder -> inflater) -> span_pos : 0;
+    if (consumed) {
+        decoder -> compressed_length -= consumed;
+        memmove(decoder -> compressed, decoder -> compressed + consumed, decoder -> compressed_length);
+    }
+
+    decoder -> compressed = (unsigned char*) realloc(decoder -> compressed, sizeof(unsigned char) * (decoder -> compressed_length + length));
+    memcpy(decoder -> compressed + decoder -> compressed_length, data, length);
+    decoder -> compressed_length += length;
+
+    if (decoder -> inflater != NULL) {
+        (decoder -> inflater) -> span = (DataSpan) {.data = decoder -> compressed, .length = decoder -> compressed_length};
+        (decoder -> inflater) -> span_pos = 0;
+    }
+
+    return;
+}
+
+// The length and the type of the chunk are received: the first IDAT chunk starts the decoding, the first chunk after
+// the IDAT chunks ends the compressed data
+static void start_decoder_chunk(PNGDecoder* decoder) {
+    PNGImage* image = &(decoder -> image);
+    Chunk* chunk = &(decoder -> chunk);
+    unsigned char* header = decoder -> header;
+    *chunk = (Chunk) {.pos = 0, .length = ((unsigned int) header[0] << 24) | (header[1] << 16) | (header[2] << 8) | header[3]};
+    memcpy(chunk -> chunk_type, header + 4, 4);
+    decoder -> chunk_received = 0;
+    decoder -> chunk_crc = update_crc32(0, header + 4, 4);
+
+    if (chunk -> length > 0x7FFFFFFF) {
+        error_print("invalid length of the chunk '%s': %u\n", chunk -> chunk_type, chunk -> length);
+        (image -> image_data).error = INVALID_CHUNK_LENGTH;
+        return;
+    }
+
+    if (!is_str_equal((unsigned char*) "IDAT", chunk -> chunk_type, 4)) {
+        if (decoder -> is_idat_started && !(decoder -> is_idat_ended)) {
+            decoder -> is_idat_ended = TRUE;
+            if (decoder -> inflater != NULL) (decoder -> inflater) -> is_input_open = FALSE;
+        }
+        if (is_chunk_kept(chunk -> chunk_type)) decoder -> chunk_data = (unsigned char*) calloc(chunk -> length + 1, sizeof(unsigned char));
+        return;
+    } else if (decoder -> is_idat_started) {
+        if (decoder -> is_idat_ended) debug_print(YELLOW, "IDAT chunk after the compressed data, ignored\n\n");
+        return;
+    }
+
+    if (!((image -> image_data).width)) {
+        error_print("the IHDR chunk should come before the IDAT chunk\n");
+        (image -> image_data).error = DECODING_ERROR;
+        return;
+    } else if (((image -> color_type) == INDEXED_COLOR) && (!image -> is_palette_defined)) {
+        error_print("the palette should be defined before the IDAT chunk\n");
+        (image -> image_data).error = DECODING_ERROR;
+        return;
+    }
+
+    debug_print(BLUE, "init inflating...\n");
+
+    decoder -> is_idat_started = TRUE;
+    decoder -> scanline = (unsigned char*) calloc(image -> scanline_length + 1, sizeof(unsigned char));
+    decoder -> previous_scanline = (unsigned char*) calloc(image -> scanline_length + 1, sizeof(unsigned char));
+    decoder -> pass_row = (unsigned char*) calloc((image -> image_data).width * (image -> image_data).components, sizeof(unsigned char));
+    allocate_decoded_rows(image);
+    start_decoder_pass(decoder, (image -> interlace_method) ? 0 : 7);
+
+    return;
+}
+
+// The crc of the chunk is received: the IDAT data is already inflated, so a corrupted IDAT chunk fails the decoding
+static void end_decoder_chunk(PNGDecoder* decoder) {
+    PNGImage* image = &(decoder -> image);
+    Chunk chunk = decoder -> chunk;
+    unsigned char* crc_bytes = decoder -> crc_bytes;
+    unsigned int crc = ((unsigned int) crc_bytes[0] << 24) | (crc_bytes[1] << 16) | (crc_bytes[2] << 8) | crc_bytes[3];
+    bool is_idat = is_str_equal((unsigned char*) "IDAT", chunk.chunk_type, 4);
+    decoder -> header_length = 0;
+
+    if (is_chunk_crc_verified(chunk.chunk_type) && decoder -> chunk_crc != crc) {
+        warning_print("the current chunk may be corrupted!\n");
+        if (is_idat && !(decoder -> is_idat_ended)) {
+            error_print("corrupted IDAT chunk\n");
+            (image -> image_data).error = DECODING_ERROR;
+        }
+        free(decoder -> chunk_data);
+        decoder -> chunk_data = NULL;
+        return;
+    }
+
+    if (decoder -> chunk_data != NULL) {
+        image -> bit_stream = allocate_bit_stream(decoder -> chunk_data, chunk.length, FALSE);
+        decode_chunk(image, chunk);
+        deallocate_bit_stream(image -> bit_stream);
+        image -> bit_stream = NULL;
+        decoder -> chunk_data = NULL;
+    } else if (!is_idat) {
+        debug_print(PURPLE, "unknown type: %s, length: %u\n\n", chunk.chunk_type, chunk.length);
+    }
+
+    return;
+}
+
+PNGDecoder* allocate_png_decoder(void) {
+    PNGDecoder* decoder = (PNGDecoder*) calloc(1, sizeof(PNGDecoder));
+    return decoder;
+}
+
+// Push the next bytes of the stream, in pieces of any length: the scanlines are inflated as soon as their compressed
+// data is received, and the chunks following the compressed data aren't read
+ImageError feed_png_decoder(PNGDecoder* decoder, const unsigned char* data, unsigned int length) {
+    PNGImage* image = &(decoder -> image);
+    unsigned int pos = 0;
+
+    while (pos < length && !((image -> image_data).error) && !(decoder -> is_done)) {
+        unsigned int count = length - pos;
+        Chunk chunk = decoder -> chunk;
+
+        // The signature, then the length and the type of each chunk
+        if (decoder -> header_length < 8) {
+            if (count > 8u - decoder -> header_length) count = 8 - decoder -> header_length;
+            memcpy(decoder -> header + decoder -> header_length, data + pos, count);
+            decoder -> header_length += count;
+            pos += count;
+            if (decoder -> header_length < 8) break;
+
+            if (decoder -> is_signature_read) {
+                start_decoder_chunk(decoder);
+            } else if (memcmp(decoder -> header, png_magic_numbers, sizeof(png_magic_numbers))) {
+                error_print("invalid png magic numbers!\n");
+                (image -> image_data).error = INVALID_FILE_TYPE;
+            } else {
+                decoder -> is_signature_read = TRUE;
+                decoder -> header_length = 0;
+            }
+            continue;
+        }
+
+        // The data of the chunk, then its crc
+        if (decoder -> chunk_received < chunk.length) {
+            if (count > chunk.length - decoder -> chunk_received) count = chunk.length - decoder -> chunk_received;
+            if (is_chunk_crc_verified(chunk.chunk_type)) decoder -> chunk_crc = update_crc32(decoder -> chunk_crc, data + pos, count);
+            if (decoder -> chunk_data != NULL) {
+                memcpy(decoder -> chunk_data + decoder -> chunk_received, data + pos, count);
+            } else if (decoder -> is_idat_started && !(decoder -> is_idat_ended) && is_str_equal((unsigned char*) "IDAT", chunk.chunk_type, 4)) {
+                append_idat_data(decoder, data + pos, count);
+            }
+        } else {
+            unsigned int crc_pos = decoder -> chunk_received - chunk.length;
+            if (count > 4 - crc_pos) count = 4 - crc_pos;
+            memcpy(decoder -> crc_bytes + crc_pos, data + pos, count);
+        }
+
+        decoder -> chunk_received += count;
+        pos += count;
+
+        if (decoder -> chunk_received == chunk.length + 4) {
+            end_decoder_chunk(decoder);
+        }
+    }
+
+    if ((image -> image_data).error || decoder -> is_done) {
+        return (image -> image_data).error;
+    }
+
+    // The inflater starts once the zlib header is received, or when the compressed data ends before it
+    if (decoder -> inflater == NULL && decoder -> is_idat_started && (decoder -> compressed_length >= 2 || decoder -> is_idat_ended)) {
+        decoder -> inflater = allocate_inflater((DataSpan) {.data = decoder -> compressed, .length = decoder -> compressed_length}, NULL, NULL);
+        (decoder -> inflater) -> is_input_open = !(decoder -> is_idat_ended);
+        (decoder -> inflater) -> verify_adler = (checksum_policy != SKIP_CHECKSUMS);
+    }
+
+    if (decoder -> inflater != NULL) {
+        inflate_decoder_scanlines(decoder);
+    }
+
+    return (image -> image_data).error;
+}
+
+// Bytes of the current chunk that the decoder would drop unread: the data of the chunks that aren't kept, aren't part of
+// the compressed data and whose crc isn't verified
+unsigned int get_png_skippable_length(PNGDecoder* decoder) {
+    Chunk chunk = decoder -> chunk;
+    if (!(decoder -> is_signature_read) || decoder -> header_length < 8 || decoder -> chunk_received >= chunk.length) {
+        return 0;
+    } else if (decoder -> chunk_data != NULL || is_chunk_crc_verified(chunk.chunk_type)) {
+        return 0;
+    } else if (decoder -> is_idat_started && !(decoder -> is_idat_ended) && is_str_equal((unsigned char*) "IDAT", chunk.chunk_type, 4)) {
+        return 0;
+    }
+    return chunk.length - decoder -> chunk_received;
+}
+
+// Account for the bytes the source skipped, at most get_png_skippable_length of them
+void skip_png_decoder_data(PNGDecoder* decoder, unsigned int length) {
+    unsigned int skippable_length = get_png_skippable_length(decoder);
+    decoder -> chunk_received += (length > skippable_length) ? skippable_length : length;
+    return;
+}
+
+// Release the decoder and return the image, which is flagged if the stream ended before the last row
+Image finish_png_decoder(PNGDecoder* decoder) {
+    PNGImage* image = &(decoder -> image);
+
+    // Nothing else is coming, so the last bytes of the compressed data can be inflated
+    if (!((image -> image_data).error) && !(decoder -> is_done) && decoder -> is_idat_started && !(decoder -> is_idat_ended)) {
+        decoder -> is_idat_ended = TRUE;
+        if (decoder -> inflater != NULL) (decoder -> inflater) -> is_input_open = FALSE;
+        feed_png_decoder(decoder, NULL, 0);
+    }
+
+    if (!((image -> image_data).error) && !(decoder -> is_idat_started)) {
+        error_print("no IDAT chunk found\n");
+        (image -> image_data).error = DECODING_ERROR;
+    } else if (!((image -> image_data).error) && !(decoder -> is_done)) {
+        error_print("the png stream ended after %u rows out of %u!\n", decoder -> decoded_rows, (image -> image_data).height);
+        (image -> image_data).error = EXCEEDED_LENGTH;
+    }
+
+    if (decoder -> inflater != NULL) {
+        deallocate_inflater(decoder -> inflater);
+    }
+
+    free(decoder -> compressed);
+    free(decoder -> chunk_data);
+    free(decoder -> scanline);
+    free(decoder -> previous_scanline);
+    free(decoder -> pass_row);
+
+    Image image_data = image -> image_data;
+    free(decoder);
+
     return image_data;
 }
 
@@ -2,53 +2,256 @@
 #define _DECODE_PPM_H_
 
 #include <stdlib.h>
+#include <string.h>
 #include "./types.h"
-#include "./bitstream.h"
+#include "./debug_print.h"
+#include "./simd.h"
 
-#define ARR_LEN(arr) sizeof(arr) / sizeof(arr[0])
+#define IS_PPM_WHITESPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n' || (c) == '\v' || (c) == '\f')
+#define PPM_DECODE_BAND_LENGTH 0x40000 // Bytes of the rows given at once to the rows callback
 
-const char str_terminators[] = {' ', '\0', '\t', '\r', '\n'};
+/* -------------------------------------------------------------------------------------- */
 
-Image decode_ppm(FileData* image_file) {
-    PPMImage* image = (PPMImage*) calloc(1, sizeof(PPMImage));
-    image -> bit_stream = allocate_bit_stream(image_file -> data, image_file -> length, FALSE);
-    (image -> image_data).size = 0;
-    (image -> image_data).components = 3;
+static unsigned int read_ppm_token(const unsigned char* data, unsigned int length, unsigned int* pos, const unsigned char** token);
+static bool read_ppm_number(const unsigned char* data, unsigned int length, unsigned int* pos, unsigned int* value);
+static bool parse_pam_header(PPMImage* image, const unsigned char* data, unsigned int length, unsigned int* pos);
+static bool parse_ppm_header(PPMImage* image, const unsigned char* data, unsigned int length);
+static void narrow_ppm_samples(const unsigned char* input, unsigned char* output, unsigned int count, unsigned short int max_value);
+Image decode_ppm(FileData* image_file);
+Image decode_ppm_streamed(FileData* image_file, RowsCallback callback, void* user_data);
+Image view_ppm_image(unsigned char* data, unsigned int length);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Skip the whitespaces and the comments, which go from a '#' to the end of the line, and return the length of the next token
+static unsigned int read_ppm_token(const unsigned char* data, unsigned int length, unsigned int* pos, const unsigned char** token) {
+    while (*pos < length) {
+        if (data[*pos] == '#') {
+            while (*pos < length && data[*pos] != '\n' && data[*pos] != '\r') (*pos)++;
+        } else if (IS_PPM_WHITESPACE(data[*pos])) {
+            (*pos)++;
+        } else break;
+    }
+
+    *token = data + *pos;
+    unsigned int start = *pos;
+    while (*pos < length && !IS_PPM_WHITESPACE(data[*pos]) && data[*pos] != '#') (*pos)++;
+
+    return *pos - start;
+}
+
+static bool read_ppm_number(const unsigned char* data, unsigned int length, unsigned int* pos, unsigned int* value) {
+    const unsigned char* token = NULL;
+    unsigned int token_length = read_ppm_token(data, length, pos, &token);
+    if (token_length == 0 || token_length > 9) {
+        return FALSE;
+    }
+
+    *value = 0;
+    for (unsigned int i = 0; i < token_length; ++i) {
+        if (token[i] < '0' || token[i] > '9') return FALSE;
+        *value = *value * 10 + (token[i] - '0');
+    }
+
+    return TRUE;
+}
+
+// The PAM header is a list of lines with a keyword and a value, closed by ENDHDR
+static bool parse_pam_header(PPMImage* image, const unsigned char* data, unsigned int length, unsigned int* pos) {
+    unsigned int max_value = 0;
+    unsigned int depth = 0;
+    const unsigned char* token = NULL;
+    unsigned int token_length = 0;
 
-    set_byte(image -> bit_stream, 3);
+    while ((token_length = read_ppm_token(data, length, pos, &token))) {
+        if (token_length == 6 && !memcmp(token, "ENDHDR", 6)) {
+            while (*pos < length && data[*pos] != '\n') (*pos)++;
+            (*pos)++;
+            image -> max_value = max_value;
+            (image -> image_data).components = depth;
+            return depth >= 1 && depth <= 4;
+        } else if (token_length == 5 && !memcmp(token, "WIDTH", 5)) {
+            if (!read_ppm_number(data, length, pos, &((image -> image_data).width))) return FALSE;
+        } else if (token_length == 6 && !memcmp(token, "HEIGHT", 6)) {
+            if (!read_ppm_number(data, length, pos, &((image -> image_data).height))) return FALSE;
+        } else if (token_length == 5 && !memcmp(token, "DEPTH", 5)) {
+            if (!read_ppm_number(data, length, pos, &depth)) return FALSE;
+        } else if (token_length == 6 && !memcmp(token, "MAXVAL", 6)) {
+            if (!read_ppm_number(data, length, pos, &max_value)) return FALSE;
+        } else if (token_length == 8 && !memcmp(token, "TUPLTYPE", 8)) {
+            // The layout of the samples follows from the depth alone
+            read_ppm_token(data, length, pos, &token);
+        } else {
+            return FALSE;
+        }
+    }
 
-    char* width_str = get_str(image -> bit_stream, (unsigned char*) str_terminators, ARR_LEN(str_terminators));
-    (image -> image_data).width = atoi(width_str);
-    free(width_str);
+    return FALSE;
+}
 
-    char* height_str = get_str(image -> bit_stream, (unsigned char*) str_terminators, ARR_LEN(str_terminators));
-    (image -> image_data).height = atoi(height_str);
-    free(height_str);
+static bool parse_ppm_header(PPMImage* image, const unsigned char* data, unsigned int length) {
+    unsigned int pos = 2;
+    bool is_valid = FALSE;
+    if (length > 2 && data[1] == '7') {
+        is_valid = parse_pam_header(image, data, length, &pos);
+    } else if (length > 2 && (data[1] == '5' || data[1] == '6')) {
+        unsigned int max_value = 0;
+        is_valid = read_ppm_number(data, length, &pos, &((image -> image_data).width)) && read_ppm_number(data, length, &pos, &((image -> image_data).height)) && read_ppm_number(data, length, &pos, &max_value);
+        image -> max_value = max_value;
+        (image -> image_data).components = (data[1] == '5') ? 1 : 3;
+        pos++; // A single whitespace separates the header from the samples
+    }
+
+    if (!is_valid) {
+        error_print("invalid ppm header!\n");
+        (image -> image_data).error = DECODING_ERROR;
+        return FALSE;
+    }
 
     debug_print(WHITE, "width: %u\n", (image -> image_data).width);
     debug_print(WHITE, "height: %u\n", (image -> image_data).height);
+    debug_print(WHITE, "components: %u\n", (image -> image_data).components);
+    debug_print(WHITE, "max value: %u\n", image -> max_value);
 
-    char* max_rgb_value_str = get_str(image -> bit_stream, (unsigned char*) str_terminators, ARR_LEN(str_terminators));
-    unsigned short int max_rgb_value = atoi(max_rgb_value_str);
-    free(max_rgb_value_str);
-
-    if (max_rgb_value != 255) {
+    if (image -> max_value == 0 || image -> max_value > 0xFFFF) {
+        error_print("invalid max value: %u!\n", image -> max_value);
         (image -> image_data).error = DECODING_ERROR;
-        error_print("invalid max rgb value, expected 255 instead of %u!\n", max_rgb_value);
-        return image -> image_data;
+        return FALSE;
     }
 
-    debug_print(WHITE, "max rgb value: %u\n", max_rgb_value);
+    unsigned long long int samples_count = (unsigned long long int) (image -> image_data).width * (image -> image_data).height * (image -> image_data).components;
+    image -> sample_length = (image -> max_value > 255) ? 2 : 1;
+    if (samples_count == 0 || samples_count * image -> sample_length > 0xFFFFFFFF) {
+        error_print("invalid image size: %u x %u!\n", (image -> image_data).width, (image -> image_data).height);
+        (image -> image_data).error = INVALID_IMAGE_SIZE;
+        return FALSE;
+    }
+
+    (image -> image_data).size = samples_count;
+    image -> payload_offset = pos;
+    if ((unsigned long long int) pos + samples_count * image -> sample_length > length) {
+        error_print("the ppm samples exceed the file length!\n");
+        (image -> image_data).error = EXCEEDED_LENGTH;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+// Scale the samples to 8 bits, rounding to the nearest value: the samples wider than a byte are big endian.
+// The output may overlap the start of the input, as it never gets ahead of it
+static void narrow_ppm_samples(const unsigned char* input, unsigned char* output, unsigned int count, unsigned short int max_value) {
+    unsigned int i = 0;
+    if (max_value <= 255) {
+        for (; i < count; ++i) {
+            unsigned int value = (input[i] > max_value) ? max_value : input[i];
+            output[i] = (value * 255 + max_value / 2) / max_value;
+        }
+        return;
+    }
 
-    (image -> image_data).size = (image -> image_data).width * (image -> image_data).height * (image -> image_data).components;
-    (image -> image_data).decoded_data = get_next_n_byte_uc(image -> bit_stream, (image -> image_data).size);
+#ifdef _USE_SSE2_
+    // The division of the single precision floats, truncated, is exact for every 16-bit max value
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps((float) (max_value / 2));
+    const __m128 divisor = _mm_set1_ps((float) max_value);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i first = _mm_loadu_si128((const __m128i*) (input + 2 * i));
+        __m128i second = _mm_loadu_si128((const __m128i*) (input + 2 * i + 16));
+        first = _mm_or_si128(_mm_slli_epi16(first, 8), _mm_srli_epi16(first, 8));
+        second = _mm_or_si128(_mm_slli_epi16(second, 8), _mm_srli_epi16(second, 8));
+
+        __m128i words[4] = {_mm_unpacklo_epi16(first, zero), _mm_unpackhi_epi16(first, zero), _mm_unpacklo_epi16(second, zero), _mm_unpackhi_epi16(second, zero)};
+        for (unsigned char j = 0; j < 4; ++j) {
+            __m128 value = _mm_min_ps(_mm_cvtepi32_ps(words[j]), divisor);
+            value = _mm_div_ps(_mm_add_ps(_mm_mul_ps(value, scale), half), divisor);
+            words[j] = _mm_cvttps_epi32(value);
+        }
+
+        __m128i narrowed = _mm_packus_epi16(_mm_packs_epi32(words[0], words[1]), _mm_packs_epi32(words[2], words[3]));
+        _mm_storeu_si128((__m128i*) (output + i), narrowed);
+    }
+#endif //_USE_SSE2_
+
+    for (; i < count; ++i) {
+        unsigned int value = (input[2 * i] << 8) | input[2 * i + 1];
+        if (value > max_value) value = max_value;
+        output[i] = (value * 255 + max_value / 2) / max_value;
+    }
+
+    return;
+}
+
+// P5 (grey), P6 (RGB) and P7 (PAM, from 1 to 4 channels), the samples of 8-bit images are moved to the start of
+// the file buffer, which becomes the decoded data, the others are narrowed in place
+Image decode_ppm(FileData* image_file) {
+    PPMImage image = {0};
+    if (!parse_ppm_header(&image, image_file -> data, image_file -> length)) {
+        free(image_file -> data);
+        return image.image_data;
+    }
+
+    if (image.max_value == 255) {
+        memmove(image_file -> data, image_file -> data + image.payload_offset, image.image_data.size);
+    } else {
+        narrow_ppm_samples(image_file -> data + image.payload_offset, image_file -> data, image.image_data.size, image.max_value);
+    }
+
+    image.image_data.decoded_data = (unsigned char*) realloc(image_file -> data, image.image_data.size);
+
+    return image.image_data;
+}
+
+// Give the callback the rows in fixed size bands: the 8-bit samples are given straight from the file buffer, the
+// others narrowed one band at a time. The image returned has no decoded data
+Image decode_ppm_streamed(FileData* image_file, RowsCallback callback, void* user_data) {
+    PPMImage image = {0};
+    if (!parse_ppm_header(&image, image_file -> data, image_file -> length)) {
+        free(image_file -> data);
+        return image.image_data;
+    }
+
+    unsigned int row_length = image.image_data.width * image.image_data.components;
+    unsigned int band_rows = (PPM_DECODE_BAND_LENGTH > row_length) ? PPM_DECODE_BAND_LENGTH / row_length : 1;
+    unsigned char* samples = image_file -> data + image.payload_offset;
+    unsigned char* band = (image.max_value == 255) ? NULL : (unsigned char*) calloc((unsigned long long int) band_rows * row_length, sizeof(unsigned char));
+
+    for (unsigned int y = 0; y < image.image_data.height; y += band_rows) {
+        unsigned int rows_count = (image.image_data.height - y < band_rows) ? image.image_data.height - y : band_rows;
+        unsigned char* rows = samples + (unsigned long long int) y * row_length * image.sample_length;
+        if (band != NULL) {
+            narrow_ppm_samples(rows, band, rows_count * row_length, image.max_value);
+            rows = band;
+        }
+        callback(y, rows_count, rows, row_length, user_data);
+    }
+
+    free(band);
+    free(image_file -> data);
+    image.image_data.size = 0;
+
+    return image.image_data;
+}
+
+// Decode a P5, P6 or P7 image with 8-bit samples without copying them: the decoded data points inside the given
+// buffer, so the image must not be deallocated and lives as long as the buffer
+Image view_ppm_image(unsigned char* data, unsigned int length) {
+    PPMImage image = {0};
+    if (!parse_ppm_header(&image, data, length)) {
+        return image.image_data;
+    }
+
+    if (image.max_value != 255) {
+        error_print("the samples need to be scaled, use decode_image instead!\n");
+        image.image_data.error = INVALID_DEPTH_COLOR_COMBINATION;
+        image.image_data.size = 0;
+        return image.image_data;
+    }
 
-    deallocate_bit_stream(image -> bit_stream);
-	
-	Image image_data = image -> image_data;
-	free(image);
+    image.image_data.decoded_data = data + image.payload_offset;
 
-    return image_data;
+    return image.image_data;
 }
 
 #endif //_DECODE_PPM_H_
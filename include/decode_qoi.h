@@ -0,0 +1,204 @@
+#ifndef _DECODE_QOI_H_
+#define _DECODE_QOI_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./decoder_context.h"
+
+#define QOI_HEADER_LENGTH 14
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xC0
+#define QOI_OP_RGB 0xFE
+#define QOI_OP_RGBA 0xFF
+#define QOI_HASH(px) (((px)[0] * 3 + (px)[1] * 5 + (px)[2] * 7 + (px)[3] * 11) & 63)
+
+static const unsigned char qoi_magic_numbers[] = {'q', 'o', 'i', 'f'};
+static const unsigned char qoi_end_marker[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+/* -------------------------------------------------------------------------------------- */
+
+static unsigned int read_be32(const unsigned char* data);
+static unsigned char get_qoi_op_length(unsigned char tag);
+static bool parse_qoi_header(QOIDecoder* decoder);
+static unsigned int decode_qoi_ops(QOIDecoder* decoder, const unsigned char* data, unsigned int length);
+QOIDecoder* allocate_qoi_decoder(void);
+ImageError feed_qoi_decoder(QOIDecoder* decoder, const unsigned char* data, unsigned int length);
+Image finish_qoi_decoder(QOIDecoder* decoder);
+Image decode_qoi(FileData* image_file);
+
+/* -------------------------------------------------------------------------------------- */
+
+static unsigned int read_be32(const unsigned char* data) {
+    return ((unsigned int) data[0] << 24) | ((unsigned int) data[1] << 16) | ((unsigned int) data[2] << 8) | data[3];
+}
+
+static unsigned char get_qoi_op_length(unsigned char tag) {
+    if (tag == QOI_OP_RGBA) return 5;
+    else if (tag == QOI_OP_RGB) return 4;
+    else if ((tag & 0xC0) == QOI_OP_LUMA) return 2;
+    return 1;
+}
+
+static bool parse_qoi_header(QOIDecoder* decoder) {
+    unsigned char* header = decoder -> header;
+    if (memcmp(header, qoi_magic_numbers, sizeof(qoi_magic_numbers))) {
+        error_print("invalid qoi magic numbers!\n");
+        (decoder -> image).error = INVALID_FILE_TYPE;
+        return FALSE;
+    }
+
+    (decoder -> image).width = read_be32(header + 4);
+    (decoder -> image).height = read_be32(header + 8);
+    (decoder -> image).components = header[12];
+
+    debug_print(WHITE, "width: %u\n", (decoder -> image).width);
+    debug_print(WHITE, "height: %u\n", (decoder -> image).height);
+    debug_print(WHITE, "channels: %u, colorspace: %u\n", header[12], header[13]);
+
+    if ((decoder -> image).components != 3 && (decoder -> image).components != 4) {
+        error_print("invalid number of channels: %u!\n", (decoder -> image).components);
+        (decoder -> image).error = DECODING_ERROR;
+        return FALSE;
+    }
+
+    // The size of the decoded image must fit the size field
+    decoder -> pixels_count = (unsigned long long int) (decoder -> image).width * (decoder -> image).height;
+    if (decoder -> pixels_count == 0 || decoder -> pixels_count * (decoder -> image).components > 0xFFFFFFFF) {
+        error_print("invalid image size: %u x %u!\n", (decoder -> image).width, (decoder -> image).height);
+        (decoder -> image).error = INVALID_IMAGE_SIZE;
+        return FALSE;
+    }
+
+    (decoder -> image).size = decoder -> pixels_count * (decoder -> image).components;
+    (decoder -> image).decoded_data = allocate_image_buffer((decoder -> image).size);
+
+    return TRUE;
+}
+
+// Decode the complete operations at the start of data, returns the number of bytes consumed
+static unsigned int decode_qoi_ops(QOIDecoder* decoder, const unsigned char* data, unsigned int length) {
+    unsigned char components = (decoder -> image).components;
+    unsigned char* output = (decoder -> image).decoded_data + decoder -> decoded_pixels * components;
+    unsigned long long int remaining = decoder -> pixels_count - decoder -> decoded_pixels;
+    unsigned char* pixel = decoder -> pixel;
+    unsigned int pos = 0;
+
+    while (remaining && pos < length) {
+        unsigned char tag = data[pos];
+        unsigned char op_length = get_qoi_op_length(tag);
+        if (pos + op_length > length) break;
+
+        unsigned int run = 1;
+        if (tag == QOI_OP_RGB) {
+            memcpy(pixel, data + pos + 1, 3);
+        } else if (tag == QOI_OP_RGBA) {
+            memcpy(pixel, data + pos + 1, 4);
+        } else if ((tag & 0xC0) == QOI_OP_INDEX) {
+            memcpy(pixel, (decoder -> index)[tag], 4);
+        } else if ((tag & 0xC0) == QOI_OP_DIFF) {
+            pixel[0] += ((tag >> 4) & 3) - 2;
+            pixel[1] += ((tag >> 2) & 3) - 2;
+            pixel[2] += (tag & 3) - 2;
+        } else if ((tag & 0xC0) == QOI_OP_LUMA) {
+            int green_diff = (tag & 0x3F) - 32;
+            unsigned char next = data[pos + 1];
+            pixel[0] += green_diff - 8 + (next >> 4);
+            pixel[1] += green_diff;
+            pixel[2] += green_diff - 8 + (next & 0x0F);
+        } else {
+            run = (tag & 0x3F) + 1;
+            if (run > remaining) run = remaining;
+        }
+        pos += op_length;
+
+        memcpy((decoder -> index)[QOI_HASH(pixel)], pixel, 4);
+        remaining -= run;
+        if (components == 4) {
+            for (; run; --run, output += 4) memcpy(output, pixel, 4);
+        } else {
+            for (; run; --run, output += 3) memcpy(output, pixel, 3);
+        }
+    }
+
+    decoder -> decoded_pixels = decoder -> pixels_count - remaining;
+
+    return pos;
+}
+
+QOIDecoder* allocate_qoi_decoder(void) {
+    QOIDecoder* decoder = (QOIDecoder*) calloc(1, sizeof(QOIDecoder));
+    (decoder -> pixel)[3] = 255;
+    return decoder;
+}
+
+// Push the next bytes of the stream, in pieces of any length: the pixels are decoded as soon as their operations are complete
+ImageError feed_qoi_decoder(QOIDecoder* decoder, const unsigned char* data, unsigned int length) {
+    if ((decoder -> image).error || decoder -> is_done) {
+        return (decoder -> image).error;
+    }
+
+    unsigned int pos = 0;
+    if ((decoder -> image).decoded_data == NULL) {
+        unsigned int count = QOI_HEADER_LENGTH - decoder -> header_length;
+        if (count > length) count = length;
+        memcpy(decoder -> header + decoder -> header_length, data, count);
+        decoder -> header_length += count;
+        pos += count;
+        if (decoder -> header_length < QOI_HEADER_LENGTH) return NO_ERROR;
+        if (!parse_qoi_header(decoder)) return (decoder -> image).error;
+    }
+
+    // Complete the operation split by the previous push
+    if (decoder -> pending_length) {
+        unsigned char op_length = get_qoi_op_length((decoder -> pending)[0]);
+        unsigned int count = op_length - decoder -> pending_length;
+        if (count > length - pos) count = length - pos;
+        memcpy(decoder -> pending + decoder -> pending_length, data + pos, count);
+        decoder -> pending_length += count;
+        pos += count;
+        if (decoder -> pending_length < op_length) return NO_ERROR;
+        decode_qoi_ops(decoder, decoder -> pending, op_length);
+        decoder -> pending_length = 0;
+    }
+
+    pos += decode_qoi_ops(decoder, data + pos, length - pos);
+
+    if (decoder -> decoded_pixels == decoder -> pixels_count) {
+        decoder -> is_done = TRUE;
+    } else if (pos < length) {
+        decoder -> pending_length = length - pos;
+        memcpy(decoder -> pending, data + pos, decoder -> pending_length);
+    }
+
+    return NO_ERROR;
+}
+
+// Release the decoder and return the image, which is flagged if the stream ended before the last pixel
+Image finish_qoi_decoder(QOIDecoder* decoder) {
+    Image image = decoder -> image;
+    if (!image.error && !(decoder -> is_done)) {
+        error_print("the qoi stream ended after %llu pixels out of %llu!\n", decoder -> decoded_pixels, decoder -> pixels_count);
+        image.error = EXCEEDED_LENGTH;
+    }
+    free(decoder);
+    return image;
+}
+
+Image decode_qoi(FileData* image_file) {
+    QOIDecoder* decoder = allocate_qoi_decoder();
+    feed_qoi_decoder(decoder, image_file -> data, image_file -> length);
+
+    if (image_file -> length < QOI_HEADER_LENGTH + sizeof(qoi_end_marker) || memcmp(image_file -> data + image_file -> length - sizeof(qoi_end_marker), qoi_end_marker, sizeof(qoi_end_marker))) {
+        warning_print("missing qoi end marker!\n");
+    }
+
+    free(image_file -> data);
+
+    return finish_qoi_decoder(decoder);
+}
+
+#endif //_DECODE_QOI_H_
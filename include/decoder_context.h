@@ -0,0 +1,168 @@
+#ifndef _DECODER_CONTEXT_H_
+#define _DECODER_CONTEXT_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+
+// Context of the decoding running on the current thread, set by idl_decode_with: NULL when each image allocates everything
+static _Thread_local IdlDecoder* decoder_context = NULL;
+
+/* -------------------------------------------------------------------------------------- */
+
+static void drop_lent_buffer(IdlDecoder* context, unsigned int index);
+static void lend_image_buffer(IdlDecoder* context, unsigned char* buffer, unsigned int size);
+static unsigned char* allocate_image_buffer(unsigned long long int size);
+static inline void keep_lent_buffer(IdlDecoder* context, unsigned int first_lent, unsigned char* buffer);
+IdlDecoder* allocate_idl_decoder(unsigned int pool_capacity);
+bool idl_release_image(IdlDecoder* decoder, Image image);
+void deallocate_idl_decoder(IdlDecoder* decoder);
+
+/* -------------------------------------------------------------------------------------- */
+
+static void drop_lent_buffer(IdlDecoder* context, unsigned int index) {
+    (context -> lent_count)--;
+    (context -> lent_buffers)[index] = (context -> lent_buffers)[context -> lent_count];
+    (context -> lent_sizes)[index] = (context -> lent_sizes)[context -> lent_count];
+    return;
+}
+
+// Remember the size a buffer was allocated with, so that the whole buffer goes back to the pool once it's released
+static void lend_image_buffer(IdlDecoder* context, unsigned char* buffer, unsigned int size) {
+    // A buffer freed without being released may come back from the allocator, its old entry is no longer valid
+    for (unsigned int i = 0; i < context -> lent_count; ++i) {
+        if ((context -> lent_buffers)[i] == buffer) {
+            drop_lent_buffer(context, i);
+            break;
+        }
+    }
+
+    if (context -> lent_count == context -> lent_capacity) {
+        context -> lent_capacity = (context -> lent_capacity) ? 2 * context -> lent_capacity : 4;
+        context -> lent_buffers = (unsigned char**) realloc(context -> lent_buffers, context -> lent_capacity * sizeof(unsigned char*));
+        context -> lent_sizes = (unsigned int*) realloc(context -> lent_sizes, context -> lent_capacity * sizeof(unsigned int));
+    }
+
+    (context -> lent_buffers)[context -> lent_count] = buffer;
+    (context -> lent_sizes)[context -> lent_count] = size;
+    (context -> lent_count)++;
+
+    return;
+}
+
+// Zeroed buffer for the pixels of a decoded image: the smallest buffer large enough is taken from the pool of the
+// decoder context, when there's one
+static unsigned char* allocate_image_buffer(unsigned long long int size) {
+    IdlDecoder* context = decoder_context;
+    if (context == NULL) {
+        return (unsigned char*) calloc(size, sizeof(unsigned char));
+    }
+
+    unsigned int best = context -> pool_count;
+    for (unsigned int i = 0; i < context -> pool_count; ++i) {
+        if ((context -> pool_sizes)[i] >= size && (best == context -> pool_count || (context -> pool_sizes)[i] < (context -> pool_sizes)[best])) {
+            best = i;
+        }
+    }
+
+    if (best == context -> pool_count) {
+        unsigned char* buffer = (unsigned char*) calloc(size, sizeof(unsigned char));
+        if (buffer != NULL) lend_image_buffer(context, buffer, size);
+        return buffer;
+    }
+
+    unsigned char* buffer = (context -> pool_buffers)[best];
+    lend_image_buffer(context, buffer, (context -> pool_sizes)[best]);
+    (context -> pool_count)--;
+    (context -> pool_buffers)[best] = (context -> pool_buffers)[context -> pool_count];
+    (context -> pool_sizes)[best] = (context -> pool_sizes)[context -> pool_count];
+    memset(buffer, 0, size);
+
+    return buffer;
+}
+
+// Once an image is decoded only the buffer it holds stays lent, the others taken from first_lent on were freed or
+// replaced while decoding it
+static inline void keep_lent_buffer(IdlDecoder* context, unsigned int first_lent, unsigned char* buffer) {
+    for (unsigned int i = context -> lent_count; i > first_lent; --i) {
+        if (buffer == NULL || (context -> lent_buffers)[i - 1] != buffer) {
+            drop_lent_buffer(context, i - 1);
+        } else {
+            buffer = NULL;
+        }
+    }
+    return;
+}
+
+// Context that keeps the tables and the scratch buffers between the images decoded with idl_decode_with, and up to
+// pool_capacity buffers of the images released with idl_release_image
+IdlDecoder* allocate_idl_decoder(unsigned int pool_capacity) {
+    IdlDecoder* decoder = (IdlDecoder*) calloc(1, sizeof(IdlDecoder));
+    decoder -> pool_capacity = pool_capacity;
+    decoder -> pool_buffers = (unsigned char**) calloc(pool_capacity, sizeof(unsigned char*));
+    decoder -> pool_sizes = (unsigned int*) calloc(pool_capacity, sizeof(unsigned int));
+    return decoder;
+}
+
+// Give back the buffer of an image decoded with the context to the pool, which drops its smallest buffer when it's full.
+// Returns FALSE, leaving the buffer to the caller, when it wasn't taken from the context (e.g. the images decoded without
+// it, the resized ones and the ones given by view_ppm_image, which point into the data of the file)
+bool idl_release_image(IdlDecoder* decoder, Image image) {
+    unsigned int lent = decoder -> lent_count;
+    for (unsigned int i = 0; i < decoder -> lent_count; ++i) {
+        if ((decoder -> lent_buffers)[i] == image.decoded_data) {
+            lent = i;
+            break;
+        }
+    }
+
+    if (image.decoded_data == NULL || lent == decoder -> lent_count) {
+        return FALSE;
+    }
+
+    // The buffer goes back with the size it was allocated with, which can be larger than the image it held
+    unsigned int size = (decoder -> lent_sizes)[lent];
+    drop_lent_buffer(decoder, lent);
+
+    if (decoder -> pool_count < decoder -> pool_capacity) {
+        (decoder -> pool_buffers)[decoder -> pool_count] = image.decoded_data;
+        (decoder -> pool_sizes)[decoder -> pool_count] = size;
+        (decoder -> pool_count)++;
+        return TRUE;
+    }
+
+    unsigned int smallest = 0;
+    for (unsigned int i = 1; i < decoder -> pool_count; ++i) {
+        if ((decoder -> pool_sizes)[i] < (decoder -> pool_sizes)[smallest]) smallest = i;
+    }
+
+    if (decoder -> pool_count && (decoder -> pool_sizes)[smallest] < size) {
+        free((decoder -> pool_buffers)[smallest]);
+        (decoder -> pool_buffers)[smallest] = image.decoded_data;
+        (decoder -> pool_sizes)[smallest] = size;
+    } else {
+        free(image.decoded_data);
+    }
+
+    return TRUE;
+}
+
+void deallocate_idl_decoder(IdlDecoder* decoder) {
+    debug_print(BLUE, "deallocating decoder context...\n");
+    for (unsigned int i = 0; i < decoder -> pool_count; ++i) {
+        free((decoder -> pool_buffers)[i]);
+    }
+    free(decoder -> pool_buffers);
+    free(decoder -> pool_sizes);
+    free(decoder -> lent_buffers);
+    free(decoder -> lent_sizes);
+    free(decoder -> chunks);
+    free(decoder -> window);
+    free(decoder -> m);
+    free(decoder -> t_m);
+    free(decoder);
+    return;
+}
+
+#endif //_DECODER_CONTEXT_H_
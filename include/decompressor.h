@@ -6,9 +6,13 @@
 #include "./types.h"
 #include "./debug_print.h"
 #include "./bitstream.h"
+#include "./checksum.h"
+#include "./decoder_context.h"
 
 #define SLIDING_WINDOW_SIZE 0x8000
 #define SLIDING_WINDOW_MASK 0x7FFF
+#define INFLATE_MAX_HEADER_BITS 2321 // Block header with the largest dynamic tables: 3 + 14 + 19 * 3 + 320 * 7, plus the extra bits of a last repeat code
+#define INFLATE_MAX_SYMBOL_BITS 48 // Length code and extra bits, followed by the distance code and extra bits
 
 // Fixed huffman literal/lengths codes
 const unsigned short int fixed_val_ptr[] = {256, 0, 280, 144};
@@ -20,23 +24,90 @@ const unsigned short int fixed_distance_maxs[] = {0x1F};
 
 /* ---------------------------------------------------------------------------------------------------------- */
 
+static void refill_bits(Inflater* inflater);
+static unsigned int get_bits(Inflater* inflater, unsigned char n_bits);
+static void align_to_byte(Inflater* inflater);
+static bool is_input_exhausted(Inflater* inflater);
+static bool is_input_short(Inflater* inflater, unsigned int n_bits);
 static void deallocate_dynamic_hf(DynamicHF* hf);
 static unsigned char max_value(unsigned char* vec, unsigned short int len);
 static void generate_codes(DynamicHF* hf);
-static unsigned short int decode_hf_fixed(BitStream* bit_stream, unsigned short int code, const unsigned short int* mins, const unsigned short int* maxs, const unsigned short int* val_ptr, unsigned char bit_length);
-static unsigned short int decode_hf(BitStream* bit_stream, unsigned short int code, DynamicHF hf);
-static void decode_lengths(BitStream* bit_stream, DynamicHF decoder_hf, DynamicHF* literals_hf, DynamicHF* distance_hf);
-static void copy_data(SlidingWindow* sliding_window, unsigned char** dest, unsigned int* index, unsigned short int length, unsigned short int distance);
-static unsigned short int get_length(BitStream* bit_stream, unsigned short int value);
-static unsigned short int get_distance(BitStream* bit_stream, unsigned short int value);
-static void update_adler_crc(unsigned char value, unsigned int* adler_register);
-static char* read_zlib_header(BitStream* bit_stream);
-static unsigned char read_uncompressed_data(BitStream* bit_stream, unsigned char** decompressed_data, unsigned int* decompressed_data_length);
-static void decode_dynamic_huffman_tables(BitStream* bit_stream, DynamicHF* literals_hf, DynamicHF* distance_hf);
+static unsigned short int decode_hf_fixed(Inflater* inflater, unsigned short int code, const unsigned short int* mins, const unsigned short int* maxs, const unsigned short int* val_ptr, unsigned char bit_length);
+static unsigned short int decode_hf(Inflater* inflater, unsigned short int code, DynamicHF hf);
+static void decode_lengths(Inflater* inflater, DynamicHF decoder_hf, DynamicHF* literals_hf, DynamicHF* distance_hf);
+static void write_to_window(SlidingWindow* sliding_window, unsigned char value);
+static unsigned int copy_data(SlidingWindow* sliding_window, unsigned char* dest, unsigned short int* length, unsigned short int distance, unsigned int dest_space);
+static unsigned short int get_length(Inflater* inflater, unsigned short int value);
+static unsigned short int get_distance(Inflater* inflater, unsigned short int value);
+static char* read_zlib_header(Inflater* inflater);
+static bool read_uncompressed_header(Inflater* inflater, unsigned int* stored_length);
+static void decode_dynamic_huffman_tables(Inflater* inflater, DynamicHF* literals_hf, DynamicHF* distance_hf);
+static unsigned char* lend_sliding_window(IdlDecoder** owner);
+static void return_sliding_window(IdlDecoder* owner);
+static Inflater* create_inflater(DataSpan span, NextSpanCallback next_span, void* source);
+Inflater* allocate_inflater(DataSpan span, NextSpanCallback next_span, void* source);
+Inflater* allocate_segment_inflater(DataSpan span, NextSpanCallback next_span, void* source, bool is_stream_start);
+void deallocate_inflater(Inflater* inflater);
+static void open_block(Inflater* inflater);
+static void close_block(Inflater* inflater);
+static unsigned int inflate_symbol(Inflater* inflater, unsigned char* dest);
+unsigned int inflate_n_bytes(Inflater* inflater, unsigned char* dest, unsigned int n);
 unsigned char* inflate(BitStream* bit_stream, unsigned char* err, unsigned int* decompressed_data_length);
 
 /* ---------------------------------------------------------------------------------------------------------- */
 
+static void refill_bits(Inflater* inflater) {
+    // Load whole bytes into the bit buffer, moving to the next span once the current one is consumed
+    while (inflater -> bit_count <= 56) {
+        if (inflater -> span_pos >= (inflater -> span).length) {
+            if (inflater -> next_span == NULL || !(inflater -> next_span)(inflater -> source, &(inflater -> span))) break;
+            inflater -> span_pos = 0;
+            continue;
+        }
+
+        inflater -> bit_buffer |= ((unsigned long long int) ((inflater -> span).data)[inflater -> span_pos]) << (inflater -> bit_count);
+        (inflater -> span_pos)++;
+        (inflater -> bit_count) += 8;
+    }
+
+    return;
+}
+
+static unsigned int get_bits(Inflater* inflater, unsigned char n_bits) {
+    if (inflater -> bit_count < n_bits) {
+        refill_bits(inflater);
+        if (inflater -> bit_count < n_bits) {
+            inflater -> error = "unexpected end of the compressed data\n";
+            return 0;
+        }
+    }
+
+    unsigned int bits = (inflater -> bit_buffer) & ((1ULL << n_bits) - 1);
+    (inflater -> bit_buffer) >>= n_bits;
+    (inflater -> bit_count) -= n_bits;
+
+    return bits;
+}
+
+static void align_to_byte(Inflater* inflater) {
+    // Only whole bytes enter the bit buffer, so the bits of a partially read byte are the count modulo 8
+    get_bits(inflater, (inflater -> bit_count) & 7);
+    return;
+}
+
+static bool is_input_exhausted(Inflater* inflater) {
+    refill_bits(inflater);
+    return inflater -> bit_count == 0;
+}
+
+// While more compressed data can be appended, nothing is read unless the whole next step is available
+static bool is_input_short(Inflater* inflater, unsigned int n_bits) {
+    if (!(inflater -> is_input_open)) {
+        return FALSE;
+    }
+    return inflater -> bit_count + 8ULL * ((inflater -> span).length - inflater -> span_pos) < n_bits;
+}
+
 static void deallocate_dynamic_hf(DynamicHF* hf) {
     debug_print(CYAN, "deallocating dynamic hf...\n");
     for (unsigned char i = 1; i <= hf -> bit_length; ++i) {
@@ -61,7 +132,7 @@ static unsigned char max_value(unsigned char* vec, unsigned short int len) {
 
 static void generate_codes(DynamicHF* hf) {
     hf -> bit_length = max_value(hf -> lengths, hf -> size);
-    unsigned char* bl_count = (unsigned char*) calloc((hf -> bit_length) + 1, sizeof(unsigned char));
+    unsigned short int* bl_count = (unsigned short int*) calloc((hf -> bit_length) + 1, sizeof(unsigned short int));
     for (unsigned short int i = 0; i < hf -> size; ++i) {
         bl_count[(hf -> lengths)[i]]++;
     }
@@ -83,7 +154,7 @@ static void generate_codes(DynamicHF* hf) {
 
     free(bl_count);
 
-    unsigned char* values_index = (unsigned char*) calloc((hf -> bit_length) + 1, sizeof(unsigned char));
+    unsigned short int* values_index = (unsigned short int*) calloc((hf -> bit_length) + 1, sizeof(unsigned short int));
     for (unsigned short int i = 0; i < hf -> size; ++i) {
         if ((hf -> lengths)[i] != 0) {
             unsigned char value_bit_len = (hf -> lengths)[i];
@@ -97,9 +168,9 @@ static void generate_codes(DynamicHF* hf) {
     return;
 }
 
-static unsigned short int decode_hf_fixed(BitStream* bit_stream, unsigned short int code, const unsigned short int* mins, const unsigned short int* maxs, const unsigned short int* val_ptr, unsigned char bit_length) {
+static unsigned short int decode_hf_fixed(Inflater* inflater, unsigned short int code, const unsigned short int* mins, const unsigned short int* maxs, const unsigned short int* val_ptr, unsigned char bit_length) {
     for (unsigned char i = 0; i < (bit_length == 4 ? 6 : 4); ++i) {
-        code = (code << 1) + get_next_bit(bit_stream, TRUE);
+        code = (code << 1) + get_bits(inflater, 1);
     }
 
     for (unsigned char i = 0; i < bit_length; ++i) {
@@ -108,21 +179,21 @@ static unsigned short int decode_hf_fixed(BitStream* bit_stream, unsigned short
         }
 
         if ((i != 1)) {
-            code = (code << 1) + get_next_bit(bit_stream, TRUE);
+            code = (code << 1) + get_bits(inflater, 1);
         }
     }
 
     return 0xFFFF;
 }
 
-static unsigned short int decode_hf(BitStream* bit_stream, unsigned short int code, DynamicHF hf) {
+static unsigned short int decode_hf(Inflater* inflater, unsigned short int code, DynamicHF hf) {
     for (unsigned char i = 1; i <= hf.bit_length; ++i) {
         if (hf.max_codes[i] > code) {
             return hf.values[i][code - hf.min_codes[i]];
         }
-        code = (code << 1) + get_next_bit(bit_stream, TRUE);
+        code = (code << 1) + get_bits(inflater, 1);
 
-        if (bit_stream -> error) {
+        if (inflater -> error != NULL) {
             break;
         }
     }
@@ -133,14 +204,14 @@ static unsigned short int decode_hf(BitStream* bit_stream, unsigned short int co
     return 0xFFFF;
 }
 
-static void decode_lengths(BitStream* bit_stream, DynamicHF decoder_hf, DynamicHF* literals_hf, DynamicHF* distance_hf) {
+static void decode_lengths(Inflater* inflater, DynamicHF decoder_hf, DynamicHF* literals_hf, DynamicHF* distance_hf) {
     literals_hf -> lengths = (unsigned char*) calloc(286, sizeof(unsigned char));
     distance_hf -> lengths = (unsigned char*) calloc(30, sizeof(unsigned char));
     unsigned short int index = 0;
 
-    while (index < (literals_hf -> size + distance_hf -> size)) {
-        unsigned short int code = get_next_bit(bit_stream, TRUE);
-        unsigned short int value = decode_hf(bit_stream, code, decoder_hf);
+    while (index < (literals_hf -> size + distance_hf -> size) && inflater -> error == NULL) {
+        unsigned short int code = get_bits(inflater, 1);
+        unsigned short int value = decode_hf(inflater, code, decoder_hf);
 
         if (value < 16) {
             if (index < literals_hf -> size) (literals_hf -> lengths)[index] = value;
@@ -148,85 +219,90 @@ static void decode_lengths(BitStream* bit_stream, DynamicHF decoder_hf, DynamicH
             index++;
         } else if (value == 16) {
             if (!index) {
-                warning_print("shouldn't repeat elements with index 0\n");
+                debug_print(YELLOW, "shouldn't repeat elements with index 0\n");
+                inflater -> error = "invalid code lengths\n";
+                break;
             }
-            unsigned char count = 3 + get_next_n_bits(bit_stream, 2, TRUE);
-            unsigned char value = (index < literals_hf -> size) ? (literals_hf -> lengths)[index - 1] : (distance_hf -> lengths)[index - literals_hf -> size - 1];
+            unsigned char count = 3 + get_bits(inflater, 2);
+            unsigned char value = (index - 1 < literals_hf -> size) ? (literals_hf -> lengths)[index - 1] : (distance_hf -> lengths)[index - literals_hf -> size - 1];
+            if (index + count > (literals_hf -> size + distance_hf -> size)) break;
             for (unsigned char i = 0; i < count; ++i, ++index) {
                 if (index < literals_hf -> size) (literals_hf -> lengths)[index] = value;
                 else (distance_hf -> lengths)[index - literals_hf -> size] = value;
             }
         } else if (value == 17) {
-            unsigned char count = 3 + get_next_n_bits(bit_stream, 3, TRUE);
+            unsigned char count = 3 + get_bits(inflater, 3);
+            if (index + count > (literals_hf -> size + distance_hf -> size)) break;
             for (unsigned char i = 0; i < count; ++i, ++index) {
                 if (index < literals_hf -> size) (literals_hf -> lengths)[index] = 0;
                 else (distance_hf -> lengths)[index - literals_hf -> size] = 0;
             }
         } else if (value == 18) {
-            unsigned char count = 11 + get_next_n_bits(bit_stream, 7, TRUE);
+            unsigned char count = 11 + get_bits(inflater, 7);
+            if (index + count > (literals_hf -> size + distance_hf -> size)) break;
             for (unsigned char i = 0; i < count; ++i, ++index) {
                 if (index < literals_hf -> size) (literals_hf -> lengths)[index] = 0;
                 else (distance_hf -> lengths)[index - literals_hf -> size] = 0;
             }
         } else {
-            warning_print("invalid value: %u\n", value);
+            debug_print(YELLOW, "invalid value: %u\n", value);
+            inflater -> error = "invalid code lengths\n";
         }
     }
 
+    if (index != (literals_hf -> size + distance_hf -> size) && inflater -> error == NULL) {
+        inflater -> error = "code lengths exceed the declared count\n";
+    }
+
     return;
 }
 
-static void copy_data(SlidingWindow* sliding_window, unsigned char** dest, unsigned int* index, unsigned short int length, unsigned short int distance) {
-    *dest = (unsigned char*) realloc(*dest, sizeof(unsigned char) * ((*index) + length));
+static void write_to_window(SlidingWindow* sliding_window, unsigned char value) {
+    (sliding_window -> window)[sliding_window -> out_pos] = value;
+    sliding_window -> out_pos = ((sliding_window -> out_pos) + 1) & (SLIDING_WINDOW_MASK);
+    return;
+}
+
+static unsigned int copy_data(SlidingWindow* sliding_window, unsigned char* dest, unsigned short int* length, unsigned short int distance, unsigned int dest_space) {
     unsigned int cur_pos = (SLIDING_WINDOW_SIZE + (sliding_window -> out_pos) - distance);
     cur_pos = (cur_pos) & (SLIDING_WINDOW_MASK);
+    unsigned int copied = 0;
 
-    // Copy from the sliding window
-    for (unsigned short int i = 0; i < length; ++i, ++(*index)) {
-        (*dest)[*index] = ((sliding_window -> window)[cur_pos]);
-        ((sliding_window -> window)[sliding_window -> out_pos]) = ((sliding_window -> window)[cur_pos]);
+    // Copy from the sliding window, stopping early if the destination is full (the rest is kept as pending)
+    for (; (*length) > 0 && copied < dest_space; --(*length), ++copied) {
+        dest[copied] = ((sliding_window -> window)[cur_pos]);
+        write_to_window(sliding_window, dest[copied]);
 
         // Advance to the next byte to copy
         cur_pos = ((cur_pos) + 1) & (SLIDING_WINDOW_MASK);
-        sliding_window -> out_pos = ((sliding_window -> out_pos) + 1) & (SLIDING_WINDOW_MASK);
     }
 
-    return;
+    return copied;
 }
 
-static unsigned short int get_length(BitStream* bit_stream, unsigned short int value) {
+static unsigned short int get_length(Inflater* inflater, unsigned short int value) {
     const unsigned short int base_values[] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
     const unsigned char extra_bits[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
 
     unsigned short int length = base_values[value - 257];
-    unsigned char extra = get_next_n_bits(bit_stream, extra_bits[value - 257], TRUE);
+    unsigned char extra = get_bits(inflater, extra_bits[value - 257]);
 
     return (length + extra);
 }
 
-static unsigned short int get_distance(BitStream* bit_stream, unsigned short int value) {
+static unsigned short int get_distance(Inflater* inflater, unsigned short int value) {
     const unsigned short int base_values[] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
     const unsigned char extra_bits[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
 
     unsigned short int distance = base_values[value];
-    unsigned short int extra = get_next_n_bits(bit_stream, extra_bits[value], TRUE);
+    unsigned short int extra = get_bits(inflater, extra_bits[value]);
 
     return (distance + extra);
 }
 
-static void update_adler_crc(unsigned char value, unsigned int* adler_register) {
-    const unsigned int PRIME = 65521L;
-    unsigned int low = (*adler_register) & 0X0000FFFFL;
-    unsigned int high = ((*adler_register) >> 16) & 0X0000FFFFL;
-    low = (low + value) % PRIME;
-    high = (low + high) % PRIME;
-    *adler_register = (high << 16) | low ;
-    return;
-}
-
-static char* read_zlib_header(BitStream* bit_stream) {
-    unsigned char zlib_compress_data = get_next_byte_uc(bit_stream);
-    unsigned char zlib_flags = get_next_byte_uc(bit_stream);
+static char* read_zlib_header(Inflater* inflater) {
+    unsigned char zlib_compress_data = get_bits(inflater, 8);
+    unsigned char zlib_flags = get_bits(inflater, 8);
     unsigned char compression_method = zlib_compress_data & 0x0F;
     unsigned char window_size = (zlib_compress_data & 0xF0) >> 4;
     unsigned char preset_dictionary = ((zlib_flags & 0x20) >> 5) & 0x01;
@@ -250,9 +326,11 @@ static char* read_zlib_header(BitStream* bit_stream) {
     return NULL;
 }
 
-static unsigned char read_uncompressed_data(BitStream* bit_stream, unsigned char** decompressed_data, unsigned int* decompressed_data_length) {
-    unsigned short int length = get_next_bytes_us(bit_stream);
-    unsigned short int length_c = get_next_bytes_us(bit_stream);
+static bool read_uncompressed_header(Inflater* inflater, unsigned int* stored_length) {
+    // LEN and NLEN are stored in little endian, starting from the next byte boundary
+    align_to_byte(inflater);
+    unsigned short int length = get_bits(inflater, 16);
+    unsigned short int length_c = get_bits(inflater, 16);
     unsigned short int check = ((length ^ length_c) + 1) & 0xFFFF;
     debug_print(YELLOW, "block length: %u, check: %u\n", length, check);
 
@@ -260,30 +338,29 @@ static unsigned char read_uncompressed_data(BitStream* bit_stream, unsigned char
         return TRUE;
     }
 
-    unsigned char* next_bytes = get_next_n_byte_uc(bit_stream, length);
-    *decompressed_data = (unsigned char*) realloc(*decompressed_data, sizeof(unsigned char) * (*decompressed_data_length + length));
+    *stored_length = length;
 
-    for (unsigned int i = 0; i < length; ++i, ++(*decompressed_data_length)) {
-        (*decompressed_data)[*decompressed_data_length] = next_bytes[i];
-    }
-
-    free(next_bytes);
     return FALSE;
 }
 
-static void decode_dynamic_huffman_tables(BitStream* bit_stream, DynamicHF* literals_hf, DynamicHF* distance_hf) {
+static void decode_dynamic_huffman_tables(Inflater* inflater, DynamicHF* literals_hf, DynamicHF* distance_hf) {
     DynamicHF decoder_hf = (DynamicHF) {0};
-    literals_hf -> size = get_next_n_bits(bit_stream, 5, TRUE) + 257;
-    distance_hf -> size = get_next_n_bits(bit_stream, 5, TRUE) + 1;
-    decoder_hf.size = get_next_n_bits(bit_stream, 4, TRUE) + 4;
+    literals_hf -> size = get_bits(inflater, 5) + 257;
+    distance_hf -> size = get_bits(inflater, 5) + 1;
+    decoder_hf.size = get_bits(inflater, 4) + 4;
     debug_print(YELLOW, "literal_lengths: %u, distance_lengths: %u, lengths: %u\n", literals_hf -> size, distance_hf -> size, decoder_hf.size);
 
+    if (literals_hf -> size > 286 || distance_hf -> size > 30) {
+        inflater -> error = "invalid number of literal or distance codes\n";
+        return;
+    }
+
     // Retrieve the length to build the huffman tree to decode the other two huffman trees (Literals and Distance)
     const unsigned char order_of_code_lengths[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
     decoder_hf.lengths = (unsigned char*) calloc(19, sizeof(unsigned char));
 
     for (unsigned char i = 0; i < decoder_hf.size; ++i) {
-        (decoder_hf.lengths)[order_of_code_lengths[i]] = get_next_n_bits(bit_stream, 3, TRUE);
+        (decoder_hf.lengths)[order_of_code_lengths[i]] = get_bits(inflater, 3);
     }
 
     decoder_hf.size = 19; // The real size of the lengths is 19 as the amount alloced
@@ -291,7 +368,7 @@ static void decode_dynamic_huffman_tables(BitStream* bit_stream, DynamicHF* lite
     // Build the huffman tree from the distances
     generate_codes(&decoder_hf);
 
-    decode_lengths(bit_stream, decoder_hf, literals_hf, distance_hf);
+    decode_lengths(inflater, decoder_hf, literals_hf, distance_hf);
     deallocate_dynamic_hf(&decoder_hf);
 
     literals_hf -> size = 286;
@@ -303,122 +380,245 @@ static void decode_dynamic_huffman_tables(BitStream* bit_stream, DynamicHF* lite
     return;
 }
 
-unsigned char* inflate(BitStream* bit_stream, unsigned char* err, unsigned int* decompressed_data_length) {
-    // Initialize decompressed data
-    SlidingWindow sliding_window = (SlidingWindow) {.out_pos = 0};
-    sliding_window.window = (unsigned char*) calloc(SLIDING_WINDOW_SIZE, sizeof(unsigned char));
-    unsigned char* decompressed_data = (unsigned char*) calloc(1, sizeof(unsigned char));
-    *decompressed_data_length = 0;
+// The window of the decoder context goes to a single inflater at a time, the others allocate their own
+static unsigned char* lend_sliding_window(IdlDecoder** owner) {
+    IdlDecoder* context = decoder_context;
+    if (context == NULL || context -> is_window_lent) {
+        *owner = NULL;
+        return (unsigned char*) calloc(SLIDING_WINDOW_SIZE, sizeof(unsigned char));
+    }
 
-    char* error = read_zlib_header(bit_stream);
-    if (error != NULL) {
-        *err = 1;
-        free(decompressed_data);
-        free(sliding_window.window);
-        return (unsigned char*) error;
+    if (context -> window == NULL) {
+        context -> window = (unsigned char*) calloc(SLIDING_WINDOW_SIZE, sizeof(unsigned char));
+    } else {
+        memset(context -> window, 0, SLIDING_WINDOW_SIZE);
     }
 
-    unsigned short int counter = 0;
-    unsigned char final = 0;
-    while (!final) {
-        final = get_next_bit(bit_stream, TRUE);
-        unsigned char type = get_next_n_bits(bit_stream, 2, TRUE);
-        debug_print(YELLOW, "\n");
-        debug_print(YELLOW, "final: %u, type: %u\n\n", final, type);
-        debug_print(WHITE, "START OF COMPRESSED BLOCK [%u]\n", counter + 1);
-        counter++;
-
-        if (type == 0) {
-            if ((*err = read_uncompressed_data(bit_stream, &decompressed_data, decompressed_data_length))) {
-                free(sliding_window.window);
-                free(decompressed_data);
-                return ((unsigned char*) "corrupted compressed block\n");
-            }
-            continue;
-        } else if (type == 3) {
-            *err = 1;
-            free(sliding_window.window);
-            free(decompressed_data);
-            return ((unsigned char*) "invalid compression type\n");
-        }
+    context -> is_window_lent = TRUE;
+    *owner = context;
 
-        DynamicHF literals_hf = (DynamicHF) {0};
-        DynamicHF distance_hf = (DynamicHF) {0};
+    return context -> window;
+}
 
-        // Select between the two huffman tables
-        if (type == 2) {
-            decode_dynamic_huffman_tables(bit_stream, &literals_hf, &distance_hf);
-        } else {
-            literals_hf.bit_length = 4;
-            distance_hf.bit_length = 1;
+static void return_sliding_window(IdlDecoder* owner) {
+    owner -> is_window_lent = FALSE;
+    return;
+}
+
+static Inflater* create_inflater(DataSpan span, NextSpanCallback next_span, void* source) {
+    Inflater* inflater = (Inflater*) calloc(1, sizeof(Inflater));
+    inflater -> span = span;
+    inflater -> next_span = next_span;
+    inflater -> source = source;
+    inflater -> sliding_window = (SlidingWindow) {.out_pos = 0};
+    (inflater -> sliding_window).window = lend_sliding_window(&(inflater -> window_owner));
+    inflater -> adler_register = 1;
+    inflater -> verify_adler = TRUE;
+    return inflater;
+}
+
+Inflater* allocate_inflater(DataSpan span, NextSpanCallback next_span, void* source) {
+    Inflater* inflater = create_inflater(span, next_span, source);
+    const char* error = read_zlib_header(inflater);
+    if (inflater -> error == NULL) inflater -> error = error;
+    return inflater;
+}
+
+// Inflate a segment delimited by flush points, only the first one of the stream starts with the zlib header
+Inflater* allocate_segment_inflater(DataSpan span, NextSpanCallback next_span, void* source, bool is_stream_start) {
+    Inflater* inflater = is_stream_start ? allocate_inflater(span, next_span, source) : create_inflater(span, next_span, source);
+    inflater -> is_segment = TRUE;
+    return inflater;
+}
+
+void deallocate_inflater(Inflater* inflater) {
+    debug_print(BLUE, "deallocating inflater...\n");
+    if (inflater -> is_block_open && inflater -> block_type == 2) {
+        deallocate_dynamic_hf(&(inflater -> literals_hf));
+        deallocate_dynamic_hf(&(inflater -> distance_hf));
+    }
+    if (inflater -> window_owner != NULL) {
+        return_sliding_window(inflater -> window_owner);
+    } else {
+        free((inflater -> sliding_window).window);
+    }
+    free(inflater);
+    return;
+}
+
+static void open_block(Inflater* inflater) {
+    inflater -> is_final_block = get_bits(inflater, 1);
+    inflater -> block_type = get_bits(inflater, 2);
+    debug_print(YELLOW, "\n");
+    debug_print(YELLOW, "final: %u, type: %u\n\n", inflater -> is_final_block, inflater -> block_type);
+    debug_print(WHITE, "START OF COMPRESSED BLOCK\n");
+
+    inflater -> is_flush_block = FALSE;
+    if (inflater -> block_type == 0) {
+        if (read_uncompressed_header(inflater, &(inflater -> stored_length))) {
+            inflater -> error = "corrupted compressed block\n";
+            return;
         }
+        inflater -> is_flush_block = !(inflater -> stored_length);
+    } else if (inflater -> block_type == 3) {
+        inflater -> error = "invalid compression type\n";
+        return;
+    } else if (inflater -> block_type == 2) {
+        // Select between the two huffman tables
+        inflater -> literals_hf = (DynamicHF) {0};
+        inflater -> distance_hf = (DynamicHF) {0};
+        decode_dynamic_huffman_tables(inflater, &(inflater -> literals_hf), &(inflater -> distance_hf));
+    } else {
+        (inflater -> literals_hf).bit_length = 4;
+        (inflater -> distance_hf).bit_length = 1;
+    }
+
+    inflater -> is_block_open = TRUE;
+
+    return;
+}
+
+static void close_block(Inflater* inflater) {
+    debug_print(WHITE, "END OF COMPRESSED BLOCK\n");
+    if (inflater -> block_type == 2) {
+        deallocate_dynamic_hf(&(inflater -> literals_hf));
+        deallocate_dynamic_hf(&(inflater -> distance_hf));
+    }
+    inflater -> is_block_open = FALSE;
+    return;
+}
+
+static unsigned int inflate_symbol(Inflater* inflater, unsigned char* dest) {
+    unsigned short int code = get_bits(inflater, 1);
+    unsigned short int decoded_value = 0;
+    if (inflater -> block_type == 1) decoded_value = decode_hf_fixed(inflater, code, fixed_mins, fixed_maxs, fixed_val_ptr, (inflater -> literals_hf).bit_length);
+    else decoded_value = decode_hf(inflater, code, inflater -> literals_hf);
+
+    if (inflater -> error != NULL) {
+        return 0;
+    } else if (decoded_value == 0xFFFF || decoded_value > 285) {
+        inflater -> error = "invalid decoded value\n";
+        return 0;
+    }
+
+    if (decoded_value < 256) {
+        *dest = decoded_value;
+        write_to_window(&(inflater -> sliding_window), decoded_value);
+        return 1;
+    } else if (decoded_value == 256) {
+        close_block(inflater);
+        return 0;
+    }
+
+    // Remember the back-reference, it will be copied by the caller as the destination allows
+    inflater -> copy_length = get_length(inflater, decoded_value);
+    unsigned short int distance_code = get_bits(inflater, 1);
+    unsigned short int decoded_distance = 0;
+    if (inflater -> block_type == 1) decoded_distance = decode_hf_fixed(inflater, distance_code, fixed_distance_mins, fixed_distance_maxs, fixed_distance_val_ptr, (inflater -> distance_hf).bit_length);
+    else decoded_distance = decode_hf(inflater, distance_code, inflater -> distance_hf);
+
+    if (decoded_distance == 0xFFFF || decoded_distance > 29) {
+        inflater -> error = "invalid decoded distance\n";
+        return 0;
+    }
+
+    inflater -> copy_distance = get_distance(inflater, decoded_distance);
+
+    return 0;
+}
 
-        // Decode compressed data, remember to keep adding elements to the sliding window
-        unsigned short int code = 0;
-        while (TRUE) {
-            code = get_next_n_bits(bit_stream, 1, TRUE);
-            unsigned short int decoded_value = 0;
-            if (type == 1) decoded_value = decode_hf_fixed(bit_stream, code, fixed_mins, fixed_maxs, fixed_val_ptr, literals_hf.bit_length);
-            else decoded_value = decode_hf(bit_stream, code, literals_hf);
-            //debug_print(WHITE, "decoded_value: %u\n", decoded_value);
-
-            if (decoded_value == 0xFFFF) {
-                *err = 1;
-                free(sliding_window.window);
-                free(decompressed_data);
-                return ((unsigned char*) "invalid decoded value\n");
+unsigned int inflate_n_bytes(Inflater* inflater, unsigned char* dest, unsigned int n) {
+    unsigned int produced = 0;
+
+    while (produced < n && !(inflater -> is_done) && inflater -> error == NULL) {
+        if (!(inflater -> is_block_open)) {
+            if (inflater -> is_final_block || is_input_short(inflater, INFLATE_MAX_HEADER_BITS)) break;
+
+            // A segment ends with its compressed data, right after the empty stored block of the flush: ending after any
+            // other block means that the segment was split where the bytes only looked like a flush
+            if (inflater -> is_segment && is_input_exhausted(inflater)) {
+                if (!(inflater -> is_flush_block)) inflater -> error = "the segment doesn't end with a flush\n";
+                inflater -> is_done = TRUE;
+                break;
             }
 
-            if (decoded_value < 256) {
-                decompressed_data = (unsigned char*) realloc(decompressed_data, sizeof(unsigned char) * ((*decompressed_data_length) + 1));
-                decompressed_data[*decompressed_data_length] = decoded_value;
-                (*decompressed_data_length)++;
-                sliding_window.window[sliding_window.out_pos] = decoded_value;
-                sliding_window.out_pos = (sliding_window.out_pos + 1) & SLIDING_WINDOW_MASK;
-            } else if (decoded_value == 256) {
-                debug_print(WHITE, "END OF COMPRESSED BLOCK\n");
+            open_block(inflater);
+        } else if (inflater -> copy_length) {
+            if ((inflater -> copy_distance) > (inflater -> total_out) + produced) {
+                inflater -> error = "invalid distance too far back\n";
                 break;
-            } else {
-                unsigned short int length = get_length(bit_stream, decoded_value);
-                unsigned short int distance_code = get_next_n_bits(bit_stream, 1, TRUE);
-                unsigned short int decoded_distance = 0;
-                if (type == 1) decoded_distance = decode_hf_fixed(bit_stream, distance_code, fixed_distance_mins, fixed_distance_maxs, fixed_distance_val_ptr, distance_hf.bit_length);
-                else decoded_distance = decode_hf(bit_stream, distance_code, distance_hf);
-                if (decoded_distance == 0xFFFF) {
-                    *err = 1;
-                    free(sliding_window.window);
-                    free(decompressed_data);
-                    return ((unsigned char*) "invalid decoded distance\n");
-                }
-                unsigned short int distance = get_distance(bit_stream, decoded_distance);
-                copy_data(&sliding_window, &decompressed_data, decompressed_data_length, length, distance);
             }
+            produced += copy_data(&(inflater -> sliding_window), dest + produced, &(inflater -> copy_length), inflater -> copy_distance, n - produced);
+        } else if (inflater -> block_type == 0) {
+            if (!(inflater -> stored_length)) {
+                close_block(inflater);
+                continue;
+            } else if (is_input_short(inflater, 8)) {
+                break;
+            }
+            dest[produced] = get_bits(inflater, 8);
+            write_to_window(&(inflater -> sliding_window), dest[produced]);
+            (inflater -> stored_length)--;
+            produced++;
+        } else if (is_input_short(inflater, INFLATE_MAX_SYMBOL_BITS)) {
+            break;
+        } else {
+            produced += inflate_symbol(inflater, dest + produced);
         }
+    }
+
+    // Calculate the crc of the produced bytes
+    if (inflater -> verify_adler) {
+        inflater -> adler_register = update_adler32(inflater -> adler_register, dest, produced);
+    }
 
-        if (type == 2) {
-            deallocate_dynamic_hf(&literals_hf);
-            deallocate_dynamic_hf(&distance_hf);
+    inflater -> total_out += produced;
+
+    // Once the last block is closed the adler crc follows
+    if (!(inflater -> is_block_open) && inflater -> is_final_block && !(inflater -> is_done) && inflater -> error == NULL && !is_input_short(inflater, ((inflater -> bit_count) & 7) + 32)) {
+        align_to_byte(inflater);
+        unsigned int adler_crc = get_bits(inflater, 8) << 24;
+        adler_crc |= get_bits(inflater, 8) << 16;
+        adler_crc |= get_bits(inflater, 8) << 8;
+        adler_crc |= get_bits(inflater, 8);
+        inflater -> expected_adler = adler_crc;
+
+        // The adler crc of a segment covers the whole stream, so it's verified by whoever joins the segments
+        if (!(inflater -> is_segment) && inflater -> verify_adler && adler_crc != inflater -> adler_register) {
+            error_print("adler_register: 0x%x, adler_crc: 0x%x\n", inflater -> adler_register, adler_crc);
+            inflater -> error = "corrupted compressed data blocks";
         }
+        inflater -> is_done = TRUE;
     }
 
-    // Read the adler_crc
-    unsigned int adler_crc = get_next_bytes_ui(bit_stream);
-    unsigned int adler_register = 1;
+    return produced;
+}
 
-    // Calculate the crc of the blocks
-    for (unsigned int i = 0; i < (*decompressed_data_length); ++i) {
-        update_adler_crc(decompressed_data[i], &adler_register);
-    }
+unsigned char* inflate(BitStream* bit_stream, unsigned char* err, unsigned int* decompressed_data_length) {
+    DataSpan span = (DataSpan) {.data = bit_stream -> stream + bit_stream -> byte, .length = bit_stream -> size - bit_stream -> byte};
+    Inflater* inflater = allocate_inflater(span, NULL, NULL);
+    unsigned int capacity = SLIDING_WINDOW_SIZE;
+    unsigned char* decompressed_data = (unsigned char*) calloc(capacity, sizeof(unsigned char));
+    *decompressed_data_length = 0;
 
-    free(sliding_window.window);
+    while (!(inflater -> is_done) && inflater -> error == NULL) {
+        if (*decompressed_data_length == capacity) {
+            capacity *= 2;
+            decompressed_data = (unsigned char*) realloc(decompressed_data, sizeof(unsigned char) * capacity);
+        }
+        *decompressed_data_length += inflate_n_bytes(inflater, decompressed_data + *decompressed_data_length, capacity - *decompressed_data_length);
+    }
 
-    if (adler_crc != adler_register) {
+    if (inflater -> error != NULL) {
         *err = 1;
+        char* error = (char*) inflater -> error;
         free(decompressed_data);
-        error_print("adler_register: 0x%x, adler_crc: 0x%x\n", adler_register, adler_crc);
-        return ((unsigned char*) "corrupted compressed data blocks");
+        deallocate_inflater(inflater);
+        return (unsigned char*) error;
     }
 
+    deallocate_inflater(inflater);
+
     return decompressed_data;
 }
 
@@ -0,0 +1,249 @@
+#ifndef _DEFILTER_H_
+#define _DEFILTER_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./simd.h"
+
+// Generate the Sub, Average and Paeth kernels specialized for a number of bytes per pixel
+#define DEFINE_DEFILTER_KERNELS(bpp)                                                                                                                                                    \
+                            static void defilter_sub_##bpp(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length) {                                     \
+                                defilter_sub(scanline, previous_scanline, length, bpp);                                                                                                \
+                            }                                                                                                                                                           \
+                            static void defilter_average_##bpp(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length) {                                 \
+                                defilter_average(scanline, previous_scanline, length, bpp);                                                                                            \
+                            }                                                                                                                                                           \
+                            static void defilter_paeth_##bpp(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length) {                                   \
+                                defilter_paeth(scanline, previous_scanline, length, bpp);                                                                                              \
+                            }                                                                                                                                                           \
+
+/* -------------------------------------------------------------------------------------- */
+
+static inline unsigned char paeth_predictor(unsigned char left, unsigned char above, unsigned char above_left);
+static void defilter_none(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length);
+static void defilter_up(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length);
+static inline void defilter_sub(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp);
+static inline void defilter_average(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp);
+static inline void defilter_paeth(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp);
+void select_defilter_kernels(DefilterKernel* kernels, unsigned char bpp);
+
+/* -------------------------------------------------------------------------------------- */
+
+static inline unsigned char paeth_predictor(unsigned char left, unsigned char above, unsigned char above_left) {
+    // Distances of the initial estimate (left + above - above_left) from each neighbour
+    int pa = above - above_left;
+    int pb = left - above_left;
+    int pc = pa + pb;
+    pa = (pa < 0) ? -pa : pa;
+    pb = (pb < 0) ? -pb : pb;
+    pc = (pc < 0) ? -pc : pc;
+
+    // Ties favour left, then above: written as selects so that they compile to conditional moves
+    unsigned char nearest_above = (pb <= pc) ? above : above_left;
+    return ((pa <= pb) && (pa <= pc)) ? left : nearest_above;
+}
+
+#ifdef _USE_SSE2_
+
+static inline __m128i load_pixel(const unsigned char* pixel, unsigned char bpp) {
+    unsigned long long int data = 0;
+    memcpy(&data, pixel, bpp);
+    return _mm_loadl_epi64((const __m128i*) &data);
+}
+
+static inline void store_pixel(unsigned char* pixel, __m128i value, unsigned char bpp) {
+    unsigned long long int data = 0;
+    _mm_storel_epi64((__m128i*) &data, value);
+    memcpy(pixel, &data, bpp);
+    return;
+}
+
+static inline __m128i abs_epi16(__m128i value) {
+#ifdef _USE_SSSE3_
+    return _mm_abs_epi16(value);
+#else
+    return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+#endif //_USE_SSSE3_
+}
+
+static inline __m128i select_epi16(__m128i mask, __m128i if_true, __m128i if_false) {
+    return _mm_or_si128(_mm_and_si128(mask, if_true), _mm_andnot_si128(mask, if_false));
+}
+
+#endif //_USE_SSE2_
+
+static void defilter_none(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length) {
+    NOT_USED(scanline);
+    NOT_USED(previous_scanline);
+    NOT_USED(length);
+    return;
+}
+
+static void defilter_up(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length) {
+    unsigned int i = 0;
+
+#ifdef _USE_SSE2_
+    for (; i + 16 <= length; i += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i*) (scanline + i));
+        __m128i above = _mm_loadu_si128((const __m128i*) (previous_scanline + i));
+        _mm_storeu_si128((__m128i*) (scanline + i), _mm_add_epi8(data, above));
+    }
+#endif //_USE_SSE2_
+
+    for (; i < length; ++i) {
+        scanline[i] += previous_scanline[i];
+    }
+
+    return;
+}
+
+static inline void defilter_sub(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp) {
+    NOT_USED(previous_scanline);
+
+#ifdef _USE_SSE2_
+    // A whole pixel is reconstructed at once, as each one depends on the pixel on its left
+    if (bpp >= 3) {
+        __m128i left = _mm_setzero_si128();
+        for (unsigned int i = 0; i < length; i += bpp) {
+            left = _mm_add_epi8(load_pixel(scanline + i, bpp), left);
+            store_pixel(scanline + i, left, bpp);
+        }
+        return;
+    }
+#endif //_USE_SSE2_
+
+    for (unsigned int i = bpp; i < length; ++i) {
+        scanline[i] += scanline[i - bpp];
+    }
+
+    return;
+}
+
+static inline void defilter_average(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp) {
+#ifdef _USE_SSE2_
+    if (bpp >= 3) {
+        // avg_epu8 rounds up, so subtract the lost bit to get floor((left + above) / 2)
+        const __m128i ones = _mm_set1_epi8(1);
+        __m128i left = _mm_setzero_si128();
+        for (unsigned int i = 0; i < length; i += bpp) {
+            __m128i above = load_pixel(previous_scanline + i, bpp);
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, above), _mm_and_si128(_mm_xor_si128(left, above), ones));
+            left = _mm_add_epi8(load_pixel(scanline + i, bpp), average);
+            store_pixel(scanline + i, left, bpp);
+        }
+        return;
+    }
+#endif //_USE_SSE2_
+
+    for (unsigned int i = 0; i < bpp && i < length; ++i) {
+        scanline[i] += previous_scanline[i] >> 1;
+    }
+
+    for (unsigned int i = bpp; i < length; ++i) {
+        scanline[i] += (scanline[i - bpp] + previous_scanline[i]) >> 1;
+    }
+
+    return;
+}
+
+static inline void defilter_paeth(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length, unsigned char bpp) {
+#ifdef _USE_SSE2_
+    if (bpp >= 3) {
+        // Work on 16-bit lanes so that the distances can't overflow
+        const __m128i zero = _mm_setzero_si128();
+        __m128i left = zero;
+        __m128i above_left = zero;
+        for (unsigned int i = 0; i < length; i += bpp) {
+            __m128i above = _mm_unpacklo_epi8(load_pixel(previous_scanline + i, bpp), zero);
+            __m128i pa = _mm_sub_epi16(above, above_left);
+            __m128i pb = _mm_sub_epi16(left, above_left);
+            __m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+            pa = abs_epi16(pa);
+            pb = abs_epi16(pb);
+
+            __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            __m128i nearest = select_epi16(_mm_cmpeq_epi16(smallest, pa), left, select_epi16(_mm_cmpeq_epi16(smallest, pb), above, above_left));
+
+            __m128i data = _mm_add_epi8(load_pixel(scanline + i, bpp), _mm_packus_epi16(nearest, nearest));
+            store_pixel(scanline + i, data, bpp);
+
+            left = _mm_unpacklo_epi8(data, zero);
+            above_left = above;
+        }
+        return;
+    }
+#endif //_USE_SSE2_
+
+    // On the first pixel left and above_left are zero, so the predictor is always above
+    for (unsigned int i = 0; i < bpp && i < length; ++i) {
+        scanline[i] += previous_scanline[i];
+    }
+
+    for (unsigned int i = bpp; i < length; ++i) {
+        scanline[i] += paeth_predictor(scanline[i - bpp], previous_scanline[i], previous_scanline[i - bpp]);
+    }
+
+    return;
+}
+
+DEFINE_DEFILTER_KERNELS(1)
+DEFINE_DEFILTER_KERNELS(2)
+DEFINE_DEFILTER_KERNELS(3)
+DEFINE_DEFILTER_KERNELS(4)
+DEFINE_DEFILTER_KERNELS(6)
+DEFINE_DEFILTER_KERNELS(8)
+
+void select_defilter_kernels(DefilterKernel* kernels, unsigned char bpp) {
+    kernels[0] = defilter_none;
+    kernels[2] = defilter_up;
+
+    switch (bpp) {
+        case 1: {
+            kernels[1] = defilter_sub_1;
+            kernels[3] = defilter_average_1;
+            kernels[4] = defilter_paeth_1;
+            break;
+        }
+
+        case 2: {
+            kernels[1] = defilter_sub_2;
+            kernels[3] = defilter_average_2;
+            kernels[4] = defilter_paeth_2;
+            break;
+        }
+
+        case 3: {
+            kernels[1] = defilter_sub_3;
+            kernels[3] = defilter_average_3;
+            kernels[4] = defilter_paeth_3;
+            break;
+        }
+
+        case 4: {
+            kernels[1] = defilter_sub_4;
+            kernels[3] = defilter_average_4;
+            kernels[4] = defilter_paeth_4;
+            break;
+        }
+
+        case 6: {
+            kernels[1] = defilter_sub_6;
+            kernels[3] = defilter_average_6;
+            kernels[4] = defilter_paeth_6;
+            break;
+        }
+
+        case 8: {
+            kernels[1] = defilter_sub_8;
+            kernels[3] = defilter_average_8;
+            kernels[4] = defilter_paeth_8;
+            break;
+        }
+    }
+
+    return;
+}
+
+#endif //_DEFILTER_H_
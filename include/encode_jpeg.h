@@ -0,0 +1,592 @@
+#ifndef _ENCODE_JPEG_H_
+#define _ENCODE_JPEG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./markers.h"
+#include "./mcu.h"
+#include "./dct.h"
+#include "./compressor.h"
+#include "./parallel_inflate.h"
+
+#define JPEG_MAX_DIMENSION 0xFFFF
+#define JPEG_DEFAULT_QUALITY 90
+
+// Tables from the Annex K of the standard, the quantization ones in natural order
+static const unsigned char luminance_quantization[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const unsigned char chrominance_quantization[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const unsigned char dc_luminance_bits[17] = {0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char dc_chrominance_bits[17] = {0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const unsigned char dc_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const unsigned char ac_luminance_bits[17] = {0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+static const unsigned char ac_luminance_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA
+};
+
+static const unsigned char ac_chrominance_bits[17] = {0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const unsigned char ac_chrominance_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA
+};
+
+/* -------------------------------------------------------------------------------------- */
+
+static void init_huffman_codes(JPEGHuffmanTable* table);
+static void load_standard_table(JPEGHuffmanTable* table, const unsigned char* bits, const unsigned char* values);
+static void build_optimal_table(JPEGHuffmanTable* table, unsigned int* freqs);
+static void scale_quantization_table(JPEGEncoder* encoder, unsigned char table_id, const unsigned char* base_table, unsigned char quality);
+static void convert_mcu_samples(JPEGEncoder* encoder, unsigned int mcu_x, unsigned int mcu_y, unsigned char samples[3][256]);
+static void fetch_block(JPEGEncoder* encoder, const unsigned char* samples, unsigned char component, unsigned char block_x, unsigned char block_y, short int* block);
+static void quantize_block(const short int* block, const unsigned short int* divisors, short int* output);
+static void transform_band(void* task);
+static void put_entropy_bits(BitWriter* writer, unsigned int bits, unsigned char n_bits);
+static void pad_entropy_bits(BitWriter* writer);
+static unsigned char get_magnitude_category(int value);
+static void code_symbol(JPEGIntervals* intervals, JPEGHuffmanTable* table, unsigned int* freqs, unsigned char symbol);
+static void code_block(JPEGIntervals* intervals, const short int* block, int* pred, unsigned char table_id);
+static void code_intervals(void* task);
+static void write_marker_segment(BitWriter* writer, unsigned char marker, const unsigned char* data, unsigned short int length);
+static void write_jpeg_headers(JPEGEncoder* encoder, BitWriter* writer);
+unsigned char* encode_jpeg(Image image, unsigned char quality, ChromaSubsampling subsampling, unsigned short int restart_interval, bool optimize_tables, unsigned int* length);
+bool create_jpeg_image(Image image, const char* filename, unsigned char quality, ChromaSubsampling subsampling, unsigned short int restart_interval, bool optimize_tables);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Canonical codes assigned as in the Annex C of the standard
+static void init_huffman_codes(JPEGHuffmanTable* table) {
+    memset(table -> lengths, 0, sizeof(table -> lengths));
+
+    unsigned short int code = 0;
+    unsigned short int index = 0;
+    for (unsigned char length = 1; length <= 16; ++length, code <<= 1) {
+        for (unsigned char i = 0; i < (table -> bits)[length]; ++i) {
+            unsigned char symbol = (table -> values)[index++];
+            (table -> codes)[symbol] = code++;
+            (table -> lengths)[symbol] = length;
+        }
+    }
+
+    return;
+}
+
+static void load_standard_table(JPEGHuffmanTable* table, const unsigned char* bits, const unsigned char* values) {
+    unsigned short int values_count = 0;
+    for (unsigned char i = 1; i <= 16; ++i) values_count += bits[i];
+
+    memcpy(table -> bits, bits, 17);
+    memcpy(table -> values, values, values_count);
+    init_huffman_codes(table);
+
+    return;
+}
+
+// The reserved symbol 256 takes the longest code, so that no symbol gets a code made only of ones
+static void build_optimal_table(JPEGHuffmanTable* table, unsigned int* freqs) {
+    freqs[256] = 1;
+
+    HuffmanCode code = {0};
+    build_huffman_code(freqs, 257, 16, &code);
+
+    unsigned char max_length = 0;
+    for (unsigned short int i = 0; i < 257; ++i) {
+        if (code.lengths[i] > max_length) max_length = code.lengths[i];
+    }
+
+    for (unsigned short int i = 0; i < 256 && code.lengths[256] < max_length; ++i) {
+        if (code.lengths[i] == max_length) {
+            code.lengths[i] = code.lengths[256];
+            code.lengths[256] = max_length;
+        }
+    }
+
+    memset(table -> bits, 0, sizeof(table -> bits));
+    unsigned short int values_count = 0;
+    for (unsigned char length = 1; length <= 16; ++length) {
+        for (unsigned short int i = 0; i < 256; ++i) {
+            if (code.lengths[i] != length) continue;
+            (table -> values)[values_count++] = i;
+            (table -> bits)[length]++;
+        }
+    }
+
+    init_huffman_codes(table);
+
+    return;
+}
+
+// Same quality scaling as the IJG library: 50 keeps the tables of the standard
+static void scale_quantization_table(JPEGEncoder* encoder, unsigned char table_id, const unsigned char* base_table, unsigned char quality) {
+    unsigned int scale = (quality < 50) ? 5000 / quality : 200 - 2 * quality;
+
+    for (unsigned char i = 0; i < 64; ++i) {
+        unsigned int value = (base_table[i] * scale + 50) / 100;
+        value = CLAMP(value, 1, 255);
+        (encoder -> quantization_tables)[table_id][i] = value;
+        (encoder -> divisors)[table_id][i] = value * 8;
+    }
+
+    return;
+}
+
+// YCbCr samples of the MCU, the pixels past the edges of the image repeat the last column and row
+static void convert_mcu_samples(JPEGEncoder* encoder, unsigned int mcu_x, unsigned int mcu_y, unsigned char samples[3][256]) {
+    Image image = encoder -> image;
+    unsigned char width = encoder -> max_sf_h * 8;
+    unsigned char height = encoder -> max_sf_v * 8;
+
+    for (unsigned char y = 0; y < height; ++y) {
+        unsigned int image_y = mcu_y * height + y;
+        if (image_y >= image.height) image_y = image.height - 1;
+
+        for (unsigned char x = 0; x < width; ++x) {
+            unsigned int image_x = mcu_x * width + x;
+            if (image_x >= image.width) image_x = image.width - 1;
+
+            const unsigned char* pixel = image.decoded_data + ((unsigned long long int) image_y * image.width + image_x) * image.components;
+            unsigned short int index = y * width + x;
+            if (encoder -> components_count == 1) {
+                samples[0][index] = pixel[0];
+                continue;
+            }
+
+            int r = pixel[0];
+            int g = pixel[1];
+            int b = pixel[2];
+            samples[0][index] = (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+            samples[1][index] = (-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32767) >> 16;
+            samples[2][index] = (32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32767) >> 16;
+        }
+    }
+
+    return;
+}
+
+// Level shifted block of the component, the subsampled components average the samples they cover
+static void fetch_block(JPEGEncoder* encoder, const unsigned char* samples, unsigned char component, unsigned char block_x, unsigned char block_y, short int* block) {
+    unsigned char width = encoder -> max_sf_h * 8;
+    unsigned char scale_x = encoder -> max_sf_h / (encoder -> sampling_factor_h)[component];
+    unsigned char scale_y = encoder -> max_sf_v / (encoder -> sampling_factor_v)[component];
+    unsigned char count = scale_x * scale_y;
+
+    for (unsigned char y = 0; y < 8; ++y) {
+        for (unsigned char x = 0; x < 8; ++x) {
+            unsigned short int sum = 0;
+            const unsigned char* first = samples + ((block_y * 8 + y) * scale_y) * width + (block_x * 8 + x) * scale_x;
+            for (unsigned char dy = 0; dy < scale_y; ++dy) {
+                for (unsigned char dx = 0; dx < scale_x; ++dx) {
+                    sum += first[dy * width + dx];
+                }
+            }
+            block[y * 8 + x] = (sum + count / 2) / count - 128;
+        }
+    }
+
+    return;
+}
+
+static void quantize_block(const short int* block, const unsigned short int* divisors, short int* output) {
+    for (unsigned char i = 0; i < 64; ++i) {
+        int value = block[i];
+        int divisor = divisors[i];
+        output[zigzag[i]] = (value < 0) ? -((divisor / 2 - value) / divisor) : (value + divisor / 2) / divisor;
+    }
+    return;
+}
+
+// Color conversion, forward DCT and quantization of a band of MCU rows
+static void transform_band(void* task) {
+    JPEGBand* band = (JPEGBand*) task;
+    JPEGEncoder* encoder = band -> encoder;
+    unsigned char samples[3][256];
+    short int block[64];
+
+    for (unsigned int mcu_y = band -> first_row; mcu_y < band -> first_row + band -> rows_count; ++mcu_y) {
+        for (unsigned int mcu_x = 0; mcu_x < encoder -> mcu_x; ++mcu_x) {
+            convert_mcu_samples(encoder, mcu_x, mcu_y, samples);
+            short int* output = encoder -> coefficients + ((unsigned long long int) mcu_y * encoder -> mcu_x + mcu_x) * encoder -> blocks_per_mcu * 64;
+
+            for (unsigned char component = 0; component < encoder -> components_count; ++component) {
+                for (unsigned char block_y = 0; block_y < (encoder -> sampling_factor_v)[component]; ++block_y) {
+                    for (unsigned char block_x = 0; block_x < (encoder -> sampling_factor_h)[component]; ++block_x, output += 64) {
+                        fetch_block(encoder, samples[component], component, block_x, block_y, block);
+                        forward_dct(block);
+                        quantize_block(block, (encoder -> divisors)[component ? 1 : 0], output);
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+// Bits are packed starting from the most significant one, each 0xFF byte is followed by a stuffed zero
+static void put_entropy_bits(BitWriter* writer, unsigned int bits, unsigned char n_bits) {
+    writer -> bit_buffer = (writer -> bit_buffer << n_bits) | bits;
+    writer -> bit_count += n_bits;
+
+    while (writer -> bit_count >= 8) {
+        writer -> bit_count -= 8;
+        unsigned char byte = (writer -> bit_buffer >> writer -> bit_count) & 0xFF;
+        reserve_bytes(writer, 2);
+        (writer -> data)[(writer -> length)++] = byte;
+        if (byte == 0xFF) (writer -> data)[(writer -> length)++] = 0x00;
+    }
+
+    return;
+}
+
+// Fill the last byte with ones, as the standard requires before a marker
+static void pad_entropy_bits(BitWriter* writer) {
+    if (writer -> bit_count) {
+        unsigned char padding = 8 - writer -> bit_count;
+        put_entropy_bits(writer, (1 << padding) - 1, padding);
+    }
+    writer -> bit_buffer = 0;
+    return;
+}
+
+static unsigned char get_magnitude_category(int value) {
+    unsigned int magnitude = (value < 0) ? -value : value;
+    unsigned char category = 0;
+    for (; magnitude; magnitude >>= 1) category++;
+    return category;
+}
+
+static void code_symbol(JPEGIntervals* intervals, JPEGHuffmanTable* table, unsigned int* freqs, unsigned char symbol) {
+    if (intervals -> is_counting) {
+        freqs[symbol]++;
+    } else {
+        put_entropy_bits(&(intervals -> writer), (table -> codes)[symbol], (table -> lengths)[symbol]);
+    }
+    return;
+}
+
+static void code_block(JPEGIntervals* intervals, const short int* block, int* pred, unsigned char table_id) {
+    JPEGEncoder* encoder = intervals -> encoder;
+    JPEGHuffmanTable* dc_table = (encoder -> dc_tables) + table_id;
+    JPEGHuffmanTable* ac_table = (encoder -> ac_tables) + table_id;
+    bool is_writing = !(intervals -> is_counting);
+
+    int difference = block[0] - *pred;
+    *pred = block[0];
+    unsigned char category = get_magnitude_category(difference);
+    code_symbol(intervals, dc_table, (intervals -> dc_freqs)[table_id], category);
+    if (is_writing && category) put_entropy_bits(&(intervals -> writer), (difference - (difference < 0)) & ((1 << category) - 1), category);
+
+    unsigned char run = 0;
+    for (unsigned char k = 1; k < 64; ++k) {
+        if (block[k] == 0) {
+            run++;
+            continue;
+        }
+
+        // Runs longer than 15 zeros are split by ZRL symbols
+        for (; run > 15; run -= 16) code_symbol(intervals, ac_table, (intervals -> ac_freqs)[table_id], 0xF0);
+
+        category = get_magnitude_category(block[k]);
+        code_symbol(intervals, ac_table, (intervals -> ac_freqs)[table_id], (run << 4) | category);
+        if (is_writing) put_entropy_bits(&(intervals -> writer), (block[k] - (block[k] < 0)) & ((1 << category) - 1), category);
+        run = 0;
+    }
+
+    // End of block
+    if (run) code_symbol(intervals, ac_table, (intervals -> ac_freqs)[table_id], 0x00);
+
+    return;
+}
+
+// Entropy code a range of restart intervals, each one resets the DC predictions and ends with the next RST marker
+static void code_intervals(void* task) {
+    JPEGIntervals* intervals = (JPEGIntervals*) task;
+    JPEGEncoder* encoder = intervals -> encoder;
+    unsigned int mcus_count = encoder -> mcu_x * encoder -> mcu_y;
+    unsigned int interval_length = (encoder -> restart_interval) ? encoder -> restart_interval : mcus_count;
+
+    for (unsigned int interval = intervals -> first_interval; interval < intervals -> first_interval + intervals -> intervals_count; ++interval) {
+        int preds[3] = {0};
+        unsigned int first_mcu = interval * interval_length;
+        unsigned int last_mcu = (mcus_count - first_mcu < interval_length) ? mcus_count : first_mcu + interval_length;
+
+        const short int* block = encoder -> coefficients + (unsigned long long int) first_mcu * encoder -> blocks_per_mcu * 64;
+        for (unsigned int mcu = first_mcu; mcu < last_mcu; ++mcu) {
+            for (unsigned char component = 0; component < encoder -> components_count; ++component) {
+                unsigned char blocks_count = (encoder -> sampling_factor_h)[component] * (encoder -> sampling_factor_v)[component];
+                for (unsigned char i = 0; i < blocks_count; ++i, block += 64) {
+                    code_block(intervals, block, preds + component, component ? 1 : 0);
+                }
+            }
+        }
+
+        if (intervals -> is_counting) continue;
+
+        pad_entropy_bits(&(intervals -> writer));
+        if (interval + 1 < encoder -> intervals_count) {
+            BitWriter* writer = &(intervals -> writer);
+            reserve_bytes(writer, 2);
+            (writer -> data)[(writer -> length)++] = MARKER_PREFIX_CODE;
+            (writer -> data)[(writer -> length)++] = RST0_MARKER + (interval & 7);
+        }
+    }
+
+    return;
+}
+
+static void write_marker_segment(BitWriter* writer, unsigned char marker, const unsigned char* data, unsigned short int length) {
+    unsigned char header[4] = {MARKER_PREFIX_CODE, marker, (length + 2) >> 8, (length + 2) & 0xFF};
+    put_bytes(writer, header, 4);
+    put_bytes(writer, data, length);
+    return;
+}
+
+static void write_jpeg_headers(JPEGEncoder* encoder, BitWriter* writer) {
+    unsigned char tables_count = (encoder -> components_count == 1) ? 1 : 2;
+    unsigned char segment[1024] = {0};
+    unsigned short int length = 0;
+
+    const unsigned char start_of_image[2] = {MARKER_PREFIX_CODE, SOI_MARKER};
+    put_bytes(writer, start_of_image, 2);
+
+    // JFIF 1.01 without units nor thumbnail
+    const unsigned char jfif[14] = {'J', 'F', 'I', 'F', '\0', 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    write_marker_segment(writer, APP0_MARKER, jfif, 14);
+
+    for (unsigned char table_id = 0; table_id < tables_count; ++table_id) {
+        segment[length++] = table_id;
+        for (unsigned char i = 0; i < 64; ++i) {
+            segment[length + zigzag[i]] = (encoder -> quantization_tables)[table_id][i];
+        }
+        length += 64;
+    }
+    write_marker_segment(writer, DQT_MARKER, segment, length);
+
+    length = 0;
+    segment[length++] = 8;
+    segment[length++] = (encoder -> image).height >> 8;
+    segment[length++] = (encoder -> image).height & 0xFF;
+    segment[length++] = (encoder -> image).width >> 8;
+    segment[length++] = (encoder -> image).width & 0xFF;
+    segment[length++] = encoder -> components_count;
+    for (unsigned char component = 0; component < encoder -> components_count; ++component) {
+        segment[length++] = component + 1;
+        segment[length++] = ((encoder -> sampling_factor_h)[component] << 4) | (encoder -> sampling_factor_v)[component];
+        segment[length++] = component ? 1 : 0;
+    }
+    write_marker_segment(writer, SOF0_MARKER, segment, length);
+
+    length = 0;
+    for (unsigned char table_id = 0; table_id < tables_count; ++table_id) {
+        JPEGHuffmanTable* tables[2] = {(encoder -> dc_tables) + table_id, (encoder -> ac_tables) + table_id};
+        for (unsigned char table_class = 0; table_class < 2; ++table_class) {
+            segment[length++] = (table_class << 4) | table_id;
+            unsigned short int values_count = 0;
+            for (unsigned char i = 1; i <= 16; ++i) {
+                segment[length++] = (tables[table_class] -> bits)[i];
+                values_count += (tables[table_class] -> bits)[i];
+            }
+            memcpy(segment + length, tables[table_class] -> values, values_count);
+            length += values_count;
+        }
+    }
+    write_marker_segment(writer, DHT_MARKER, segment, length);
+
+    if (encoder -> restart_interval) {
+        const unsigned char restart_interval[2] = {encoder -> restart_interval >> 8, encoder -> restart_interval & 0xFF};
+        write_marker_segment(writer, DRI_MARKER, restart_interval, 2);
+    }
+
+    length = 0;
+    segment[length++] = encoder -> components_count;
+    for (unsigned char component = 0; component < encoder -> components_count; ++component) {
+        segment[length++] = component + 1;
+        segment[length++] = component ? 0x11 : 0x00;
+    }
+    segment[length++] = 0;
+    segment[length++] = 63;
+    segment[length++] = 0;
+    write_marker_segment(writer, SOS_MARKER, segment, length);
+
+    return;
+}
+
+// Baseline JPEG of an 8-bit image (the alpha channel is dropped), the restart intervals are entropy coded in parallel
+unsigned char* encode_jpeg(Image image, unsigned char quality, ChromaSubsampling subsampling, unsigned short int restart_interval, bool optimize_tables, unsigned int* length) {
+    *length = 0;
+    if (image.decoded_data == NULL || image.width == 0 || image.height == 0 || image.width > JPEG_MAX_DIMENSION || image.height > JPEG_MAX_DIMENSION || image.components == 0 || image.components > 4) {
+        error_print("invalid image to encode!\n");
+        return NULL;
+    }
+
+    quality = CLAMP(quality, 1, 100);
+
+    JPEGEncoder* encoder = (JPEGEncoder*) calloc(1, sizeof(JPEGEncoder));
+    encoder -> image = image;
+    encoder -> components_count = (image.components < 3) ? 1 : 3;
+    encoder -> restart_interval = restart_interval;
+
+    // Only the luma is sampled at full resolution when the chroma is subsampled
+    for (unsigned char component = 0; component < encoder -> components_count; ++component) {
+        bool is_color_luma = component == 0 && encoder -> components_count == 3;
+        (encoder -> sampling_factor_h)[component] = (is_color_luma && subsampling != SUBSAMPLING_444) ? 2 : 1;
+        (encoder -> sampling_factor_v)[component] = (is_color_luma && subsampling == SUBSAMPLING_420) ? 2 : 1;
+        encoder -> blocks_per_mcu += (encoder -> sampling_factor_h)[component] * (encoder -> sampling_factor_v)[component];
+    }
+    encoder -> max_sf_h = (encoder -> sampling_factor_h)[0];
+    encoder -> max_sf_v = (encoder -> sampling_factor_v)[0];
+    encoder -> mcu_x = (image.width + encoder -> max_sf_h * 8 - 1) / (encoder -> max_sf_h * 8);
+    encoder -> mcu_y = (image.height + encoder -> max_sf_v * 8 - 1) / (encoder -> max_sf_v * 8);
+
+    unsigned int mcus_count = encoder -> mcu_x * encoder -> mcu_y;
+    encoder -> intervals_count = (restart_interval) ? (mcus_count + restart_interval - 1) / restart_interval : 1;
+    encoder -> coefficients = (short int*) calloc((unsigned long long int) mcus_count * encoder -> blocks_per_mcu * 64, sizeof(short int));
+
+    scale_quantization_table(encoder, 0, luminance_quantization, quality);
+    scale_quantization_table(encoder, 1, chrominance_quantization, quality);
+
+    // Transform bands of MCU rows in parallel
+    unsigned int threads_count = get_decoding_threads();
+    unsigned int bands_count = (encoder -> mcu_y < threads_count) ? encoder -> mcu_y : threads_count;
+    JPEGBand* bands = (JPEGBand*) calloc(bands_count, sizeof(JPEGBand));
+    for (unsigned int i = 0; i < bands_count; ++i) {
+        unsigned int first_row = (unsigned long long int) encoder -> mcu_y * i / bands_count;
+        unsigned int last_row = (unsigned long long int) encoder -> mcu_y * (i + 1) / bands_count;
+        bands[i] = (JPEGBand) {.encoder = encoder, .first_row = first_row, .rows_count = last_row - first_row};
+    }
+    run_parallel_tasks(transform_band, bands, sizeof(JPEGBand), bands_count);
+    free(bands);
+
+    // Then split the restart intervals among the threads
+    unsigned int tasks_count = (encoder -> intervals_count < threads_count) ? encoder -> intervals_count : threads_count;
+    JPEGIntervals* tasks = (JPEGIntervals*) calloc(tasks_count, sizeof(JPEGIntervals));
+    for (unsigned int i = 0; i < tasks_count; ++i) {
+        unsigned int first_interval = (unsigned long long int) encoder -> intervals_count * i / tasks_count;
+        unsigned int last_interval = (unsigned long long int) encoder -> intervals_count * (i + 1) / tasks_count;
+        tasks[i] = (JPEGIntervals) {.encoder = encoder, .first_interval = first_interval, .intervals_count = last_interval - first_interval, .is_counting = optimize_tables};
+    }
+
+    if (optimize_tables) {
+        debug_print(BLUE, "counting the symbols of %u intervals...\n", encoder -> intervals_count);
+        run_parallel_tasks(code_intervals, tasks, sizeof(JPEGIntervals), tasks_count);
+
+        for (unsigned char table_id = 0; table_id < 2; ++table_id) {
+            unsigned int dc_freqs[257] = {0};
+            unsigned int ac_freqs[257] = {0};
+            for (unsigned int i = 0; i < tasks_count; ++i) {
+                for (unsigned short int symbol = 0; symbol < 256; ++symbol) {
+                    dc_freqs[symbol] += tasks[i].dc_freqs[table_id][symbol];
+                    ac_freqs[symbol] += tasks[i].ac_freqs[table_id][symbol];
+                }
+                tasks[i].is_counting = FALSE;
+            }
+            build_optimal_table((encoder -> dc_tables) + table_id, dc_freqs);
+            build_optimal_table((encoder -> ac_tables) + table_id, ac_freqs);
+        }
+    } else {
+        load_standard_table((encoder -> dc_tables), dc_luminance_bits, dc_values);
+        load_standard_table((encoder -> ac_tables), ac_luminance_bits, ac_luminance_values);
+        load_standard_table((encoder -> dc_tables) + 1, dc_chrominance_bits, dc_values);
+        load_standard_table((encoder -> ac_tables) + 1, ac_chrominance_bits, ac_chrominance_values);
+    }
+
+    debug_print(BLUE, "coding %u intervals on %u threads...\n", encoder -> intervals_count, tasks_count);
+    run_parallel_tasks(code_intervals, tasks, sizeof(JPEGIntervals), tasks_count);
+
+    BitWriter writer = {0};
+    write_jpeg_headers(encoder, &writer);
+    for (unsigned int i = 0; i < tasks_count; ++i) {
+        put_bytes(&writer, tasks[i].writer.data, tasks[i].writer.length);
+        free(tasks[i].writer.data);
+    }
+
+    const unsigned char end_of_image[2] = {MARKER_PREFIX_CODE, EOI_MARKER};
+    put_bytes(&writer, end_of_image, 2);
+
+    free(tasks);
+    free(encoder -> coefficients);
+    free(encoder);
+
+    *length = writer.length;
+
+    return writer.data;
+}
+
+bool create_jpeg_image(Image image, const char* filename, unsigned char quality, ChromaSubsampling subsampling, unsigned short int restart_interval, bool optimize_tables) {
+    if (image.size == 0) {
+        error_print("the image size is zero!\n");
+        return INVALID_IMAGE_SIZE;
+    }
+
+    unsigned int length = 0;
+    unsigned char* data = encode_jpeg(image, quality, subsampling, restart_interval, optimize_tables, &length);
+    if (data == NULL) {
+        return INVALID_IMAGE_SIZE;
+    }
+
+    FILE* file = fopen(filename, "wb");
+
+    // Check for errors while opening the file
+    if (file == NULL) {
+        free(data);
+        error_print("file not found!\n");
+        return FILE_NOT_FOUND;
+    }
+
+    fwrite(data, sizeof(unsigned char), length, file);
+    free(data);
+
+    // Check for errors
+    if (ferror(file)) {
+        fclose(file);
+        error_print("an error occured while writing the file!\n");
+        return FILE_ERROR;
+    }
+
+    fclose(file);
+
+    return NO_ERROR;
+}
+
+#endif //_ENCODE_JPEG_H_
@@ -0,0 +1,240 @@
+#ifndef _ENCODE_PNG_H_
+#define _ENCODE_PNG_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./checksum.h"
+#include "./compressor.h"
+#include "./defilter.h"
+#include "./parallel_inflate.h"
+
+#define PNG_IDAT_LENGTH 0x100000 // Compressed bytes stored in each IDAT chunk
+#define PNG_MIN_BAND_LENGTH 0x40000 // Filtered bytes below which a band isn't worth a thread
+#define PNG_DEFAULT_LEVEL 6
+
+static const unsigned char png_signature[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A};
+static const unsigned char png_color_types[] = {0, 4, 2, 6}; // Indexed by the number of components minus one
+
+/* -------------------------------------------------------------------------------------- */
+
+static void write_be32(unsigned char* data, unsigned int value);
+static void filter_row(unsigned char filter, const unsigned char* row, const unsigned char* previous_row, unsigned char* filtered, unsigned int length, unsigned char bpp);
+static unsigned int filter_cost(const unsigned char* filtered, unsigned int length);
+static void filter_band(PNGBand* band, unsigned char* filtered);
+static void compress_band(void* task);
+static void write_png_chunk(BitWriter* writer, const char* type, const unsigned char* data, unsigned int length);
+unsigned char* encode_png(Image image, unsigned char level, unsigned int* length);
+bool create_png_image(Image image, const char* filename, unsigned char level);
+
+/* -------------------------------------------------------------------------------------- */
+
+static void write_be32(unsigned char* data, unsigned int value) {
+    data[0] = (value >> 24) & 0xFF;
+    data[1] = (value >> 16) & 0xFF;
+    data[2] = (value >> 8) & 0xFF;
+    data[3] = value & 0xFF;
+    return;
+}
+
+// Inverse of the defilter kernels, the previous row is all zeros for the first one
+static void filter_row(unsigned char filter, const unsigned char* row, const unsigned char* previous_row, unsigned char* filtered, unsigned int length, unsigned char bpp) {
+    for (unsigned int i = 0; i < length; ++i) {
+        unsigned char left = (i >= bpp) ? row[i - bpp] : 0;
+        unsigned char above = previous_row[i];
+        unsigned char above_left = (i >= bpp) ? previous_row[i - bpp] : 0;
+
+        switch (filter) {
+            case 0: filtered[i] = row[i]; break;
+            case 1: filtered[i] = row[i] - left; break;
+            case 2: filtered[i] = row[i] - above; break;
+            case 3: filtered[i] = row[i] - ((left + above) >> 1); break;
+            case 4: filtered[i] = row[i] - paeth_predictor(left, above, above_left); break;
+        }
+    }
+
+    return;
+}
+
+// Sum of the filtered bytes taken as signed, the usual heuristic to guess which filter compresses better
+static unsigned int filter_cost(const unsigned char* filtered, unsigned int length) {
+    unsigned int cost = 0;
+    for (unsigned int i = 0; i < length; ++i) {
+        cost += (filtered[i] < 128) ? filtered[i] : 256 - filtered[i];
+    }
+    return cost;
+}
+
+static void filter_band(PNGBand* band, unsigned char* filtered) {
+    Image image = band -> image;
+    unsigned int row_length = image.width * image.components;
+    unsigned char* zero_row = (unsigned char*) calloc(row_length, sizeof(unsigned char));
+    unsigned char* candidate = (unsigned char*) calloc(row_length, sizeof(unsigned char));
+
+    for (unsigned int y = band -> first_row; y < band -> first_row + band -> rows_count; ++y) {
+        const unsigned char* row = image.decoded_data + (unsigned long long int) y * row_length;
+        const unsigned char* previous_row = y ? row - row_length : zero_row;
+        unsigned char* output = filtered + (unsigned long long int) (y - band -> first_row) * (row_length + 1);
+
+        // The first row of a band only depends on itself, so that the bands can also be defiltered in parallel
+        unsigned char filters_count = (band -> level == 0) ? 1 : (y == band -> first_row && y) ? 2 : 5;
+        unsigned int best_cost = 0xFFFFFFFF;
+        for (unsigned char filter = 0; filter < filters_count; ++filter) {
+            filter_row(filter, row, previous_row, candidate, row_length, image.components);
+            unsigned int cost = filter_cost(candidate, row_length);
+            if (cost < best_cost) {
+                best_cost = cost;
+                output[0] = filter;
+                memcpy(output + 1, candidate, row_length);
+            }
+        }
+    }
+
+    free(zero_row);
+    free(candidate);
+
+    return;
+}
+
+static void compress_band(void* task) {
+    PNGBand* band = (PNGBand*) task;
+    band -> filtered_length = band -> rows_count * (band -> image.width * band -> image.components + 1);
+    unsigned char* filtered = (unsigned char*) calloc(band -> filtered_length, sizeof(unsigned char));
+    filter_band(band, filtered);
+
+    band -> adler_register = update_adler32(1, filtered, band -> filtered_length);
+
+    BitWriter writer = {0};
+    deflate_band(&writer, filtered, band -> filtered_length, band -> level, band -> is_final);
+    band -> data = writer.data;
+    band -> length = writer.length;
+
+    free(filtered);
+
+    return;
+}
+
+static void write_png_chunk(BitWriter* writer, const char* type, const unsigned char* data, unsigned int length) {
+    unsigned char field[4] = {0};
+    write_be32(field, length);
+    put_bytes(writer, field, 4);
+    put_bytes(writer, type, 4);
+    if (length) put_bytes(writer, data, length);
+
+    unsigned int crc = update_crc32(0, (const unsigned char*) type, 4);
+    crc = update_crc32(crc, data, length);
+    write_be32(field, crc);
+    put_bytes(writer, field, 4);
+
+    return;
+}
+
+// Encode an 8-bit image with 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA) components, levels go from 0 (stored) to 9
+unsigned char* encode_png(Image image, unsigned char level, unsigned int* length) {
+    *length = 0;
+    if (image.decoded_data == NULL || image.width == 0 || image.height == 0 || image.components == 0 || image.components > 4) {
+        error_print("invalid image to encode!\n");
+        return NULL;
+    }
+
+    if (level > DEFLATE_MAX_LEVEL) level = DEFLATE_MAX_LEVEL;
+
+    // Split the rows in bands compressed independently on their own thread
+    unsigned int row_length = image.width * image.components + 1;
+    unsigned int threads_count = get_decoding_threads();
+    unsigned int band_rows = (image.height + threads_count - 1) / threads_count;
+    unsigned int min_band_rows = (PNG_MIN_BAND_LENGTH + row_length - 1) / row_length;
+    if (band_rows < min_band_rows) band_rows = min_band_rows;
+    unsigned int bands_count = (image.height + band_rows - 1) / band_rows;
+
+    PNGBand* bands = (PNGBand*) calloc(bands_count, sizeof(PNGBand));
+    for (unsigned int i = 0; i < bands_count; ++i) {
+        unsigned int first_row = i * band_rows;
+        unsigned int rows_count = (image.height - first_row < band_rows) ? image.height - first_row : band_rows;
+        bands[i] = (PNGBand) {.image = image, .first_row = first_row, .rows_count = rows_count, .level = level, .is_final = (i == bands_count - 1)};
+    }
+
+    debug_print(BLUE, "compressing %u bands...\n", bands_count);
+    run_parallel_tasks(compress_band, bands, sizeof(PNGBand), bands_count);
+
+    // zlib header, with the compression level hint and the check bits
+    BitWriter zlib_stream = {0};
+    unsigned char compression_flag = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+    unsigned char zlib_header[2] = {0x78, compression_flag << 6};
+    zlib_header[1] += (31 - ((zlib_header[0] << 8) | zlib_header[1]) % 31) % 31;
+    put_bytes(&zlib_stream, zlib_header, 2);
+
+    unsigned int adler_register = 1;
+    for (unsigned int i = 0; i < bands_count; ++i) {
+        put_bytes(&zlib_stream, bands[i].data, bands[i].length);
+        adler_register = i ? combine_adler32(adler_register, bands[i].adler_register, bands[i].filtered_length) : bands[i].adler_register;
+        free(bands[i].data);
+    }
+    free(bands);
+
+    unsigned char adler_field[4] = {0};
+    write_be32(adler_field, adler_register);
+    put_bytes(&zlib_stream, adler_field, 4);
+
+    BitWriter writer = {0};
+    put_bytes(&writer, png_signature, sizeof(png_signature));
+
+    unsigned char ihdr[13] = {0};
+    write_be32(ihdr, image.width);
+    write_be32(ihdr + 4, image.height);
+    ihdr[8] = 8;
+    ihdr[9] = png_color_types[image.components - 1];
+    write_png_chunk(&writer, "IHDR", ihdr, 13);
+
+    for (unsigned int pos = 0; pos < zlib_stream.length; pos += PNG_IDAT_LENGTH) {
+        unsigned int chunk_length = (zlib_stream.length - pos < PNG_IDAT_LENGTH) ? zlib_stream.length - pos : PNG_IDAT_LENGTH;
+        write_png_chunk(&writer, "IDAT", zlib_stream.data + pos, chunk_length);
+    }
+    free(zlib_stream.data);
+
+    write_png_chunk(&writer, "IEND", NULL, 0);
+
+    *length = writer.length;
+
+    return writer.data;
+}
+
+bool create_png_image(Image image, const char* filename, unsigned char level) {
+    if (image.size == 0) {
+        error_print("the image size is zero!\n");
+        return INVALID_IMAGE_SIZE;
+    }
+
+    unsigned int length = 0;
+    unsigned char* data = encode_png(image, level, &length);
+    if (data == NULL) {
+        return INVALID_IMAGE_SIZE;
+    }
+
+    FILE* file = fopen(filename, "wb");
+
+    // Check for errors while opening the file
+    if (file == NULL) {
+        free(data);
+        error_print("file not found!\n");
+        return FILE_NOT_FOUND;
+    }
+
+    fwrite(data, sizeof(unsigned char), length, file);
+    free(data);
+
+    // Check for errors
+    if (ferror(file)) {
+        fclose(file);
+        error_print("an error occured while writing the file!\n");
+        return FILE_ERROR;
+    }
+
+    fclose(file);
+
+    return NO_ERROR;
+}
+
+#endif //_ENCODE_PNG_H_
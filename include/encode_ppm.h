@@ -0,0 +1,192 @@
+#ifndef _ENCODE_PPM_H_
+#define _ENCODE_PPM_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./compressor.h"
+
+#ifdef _WIN32
+#include <io.h>
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <unistd.h>
+#include <sys/uio.h>
+#endif //_WIN32
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif //IOV_MAX
+
+#define PPM_MAX_VECTORS (IOV_MAX < 256 ? IOV_MAX : 256) // Rows written by each writev
+#define PPM_BAND_LENGTH 0x40000 // Bytes of the rows asked to the row callback before writing them
+
+/* -------------------------------------------------------------------------------------- */
+
+static bool write_vectors(int fd, struct iovec* vectors, unsigned int count);
+static void write_ppm_header(PPMWriter* writer);
+PPMWriter* open_ppm_writer(int fd, unsigned int width, unsigned int height, unsigned char components);
+bool write_ppm_rows(PPMWriter* writer, const unsigned char* rows, unsigned int rows_count, unsigned int stride);
+bool write_ppm_rows_from(PPMWriter* writer, PPMRowCallback callback, void* user_data);
+bool close_ppm_writer(PPMWriter* writer, unsigned char** data, unsigned int* length);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Write all the vectors, resuming after the partial writes and the interrupted calls
+static bool write_vectors(int fd, struct iovec* vectors, unsigned int count) {
+    while (count) {
+#ifdef _WIN32
+        int written = _write(fd, vectors -> iov_base, vectors -> iov_len);
+#else
+        ssize_t written = writev(fd, vectors, count);
+#endif //_WIN32
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+
+        while (count && (size_t) written >= vectors -> iov_len) {
+            written -= vectors -> iov_len;
+            vectors++;
+            count--;
+        }
+
+        if (count) {
+            vectors -> iov_base = (unsigned char*) vectors -> iov_base + written;
+            vectors -> iov_len -= written;
+        }
+    }
+
+    return TRUE;
+}
+
+// P5 for grey, P6 for RGB and P7 (PAM) for the images with an alpha channel
+static void write_ppm_header(PPMWriter* writer) {
+    if (writer -> components == 1 || writer -> components == 3) {
+        writer -> header_length = snprintf(writer -> header, sizeof(writer -> header), "P%c\n%u %u\n255\n", (writer -> components == 1) ? '5' : '6', writer -> width, writer -> height);
+        return;
+    }
+
+    const char* tuple_type = (writer -> components == 2) ? "GRAYSCALE_ALPHA" : "RGB_ALPHA";
+    writer -> header_length = snprintf(writer -> header, sizeof(writer -> header), "P7\nWIDTH %u\nHEIGHT %u\nDEPTH %u\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n", writer -> width, writer -> height, writer -> components, tuple_type);
+
+    return;
+}
+
+// Start a PPM stream into an open file descriptor, or into a memory buffer when fd is negative
+PPMWriter* open_ppm_writer(int fd, unsigned int width, unsigned int height, unsigned char components) {
+    if (width == 0 || height == 0 || components == 0 || components > 4) {
+        error_print("invalid image to encode!\n");
+        return NULL;
+    }
+
+    PPMWriter* writer = (PPMWriter*) calloc(1, sizeof(PPMWriter));
+    writer -> fd = fd;
+    writer -> width = width;
+    writer -> height = height;
+    writer -> components = components;
+    write_ppm_header(writer);
+
+    return writer;
+}
+
+// Push the next band of rows, each one stride bytes after the previous one: the header goes out with the first band
+bool write_ppm_rows(PPMWriter* writer, const unsigned char* rows, unsigned int rows_count, unsigned int stride) {
+    if (writer -> error) {
+        return writer -> error;
+    }
+
+    if (rows_count > writer -> height - writer -> written_rows) {
+        error_print("too many rows: %u, only %u are left!\n", rows_count, writer -> height - writer -> written_rows);
+        rows_count = writer -> height - writer -> written_rows;
+    }
+
+    unsigned int row_length = writer -> width * writer -> components;
+    if (writer -> fd < 0) {
+        if (writer -> header_length) put_bytes(&(writer -> buffer), writer -> header, writer -> header_length);
+        for (unsigned int i = 0; i < rows_count; ++i) {
+            put_bytes(&(writer -> buffer), rows + (unsigned long long int) i * stride, row_length);
+        }
+        writer -> header_length = 0;
+        writer -> written_rows += rows_count;
+        return NO_ERROR;
+    }
+
+    // Contiguous rows are a single vector, the others one vector each
+    struct iovec vectors[PPM_MAX_VECTORS];
+    unsigned int row = 0;
+    while (row < rows_count || writer -> header_length) {
+        unsigned int count = 0;
+        if (writer -> header_length) {
+            vectors[count++] = (struct iovec) {.iov_base = writer -> header, .iov_len = writer -> header_length};
+        }
+
+        if (stride == row_length && row < rows_count) {
+            vectors[count++] = (struct iovec) {.iov_base = (void*) rows, .iov_len = (size_t) rows_count * row_length};
+            row = rows_count;
+        }
+
+        for (; row < rows_count && count < PPM_MAX_VECTORS; ++row) {
+            vectors[count++] = (struct iovec) {.iov_base = (void*) (rows + (unsigned long long int) row * stride), .iov_len = row_length};
+        }
+
+        if (!write_vectors(writer -> fd, vectors, count)) {
+            error_print("an error occured while writing the file!\n");
+            writer -> error = FILE_ERROR;
+            return FILE_ERROR;
+        }
+        writer -> header_length = 0;
+    }
+
+    writer -> written_rows += rows_count;
+
+    return NO_ERROR;
+}
+
+// Ask the callback for each one of the remaining rows, writing them in bands
+bool write_ppm_rows_from(PPMWriter* writer, PPMRowCallback callback, void* user_data) {
+    unsigned int row_length = writer -> width * writer -> components;
+    unsigned int band_rows = (PPM_BAND_LENGTH > row_length) ? PPM_BAND_LENGTH / row_length : 1;
+    unsigned char* band = (unsigned char*) calloc((unsigned long long int) band_rows * row_length, sizeof(unsigned char));
+
+    while (!(writer -> error) && writer -> written_rows < writer -> height) {
+        unsigned int rows_count = (writer -> height - writer -> written_rows < band_rows) ? writer -> height - writer -> written_rows : band_rows;
+        for (unsigned int i = 0; i < rows_count; ++i) {
+            callback(writer -> written_rows + i, band + (unsigned long long int) i * row_length, user_data);
+        }
+        write_ppm_rows(writer, band, rows_count, row_length);
+    }
+
+    free(band);
+
+    return writer -> error;
+}
+
+// Release the writer, the memory buffer is returned in data: the file descriptor is left open
+bool close_ppm_writer(PPMWriter* writer, unsigned char** data, unsigned int* length) {
+    bool error = writer -> error;
+    if (!error && writer -> written_rows < writer -> height) {
+        error_print("only %u rows out of %u were written!\n", writer -> written_rows, writer -> height);
+        error = EXCEEDED_LENGTH;
+    }
+
+    if (data != NULL) {
+        *data = (writer -> buffer).data;
+        *length = (writer -> buffer).length;
+    } else {
+        free((writer -> buffer).data);
+    }
+    free(writer);
+
+    return error;
+}
+
+#endif //_ENCODE_PPM_H_
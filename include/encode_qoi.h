@@ -0,0 +1,179 @@
+#ifndef _ENCODE_QOI_H_
+#define _ENCODE_QOI_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./compressor.h"
+#include "./decode_qoi.h"
+
+#define QOI_MAX_RUN 62
+#define QOI_BAND_PIXELS 0x10000 // Pixels encoded before the output is flushed to the file
+
+/* -------------------------------------------------------------------------------------- */
+
+static bool init_qoi_encoder(QOIEncoder* encoder, Image image);
+static void encode_qoi_pixels(QOIEncoder* encoder, unsigned long long int pixels_count);
+unsigned char* encode_qoi(Image image, unsigned int* length);
+bool create_qoi_image(Image image, const char* filename);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Gray images are written as RGB and gray with alpha as RGBA, as QOI only has 3 or 4 channels
+static bool init_qoi_encoder(QOIEncoder* encoder, Image image) {
+    if (image.decoded_data == NULL || image.width == 0 || image.height == 0 || image.components == 0 || image.components > 4) {
+        error_print("invalid image to encode!\n");
+        return FALSE;
+    }
+
+    *encoder = (QOIEncoder) {.image = image, .pixel = {0, 0, 0, 255}};
+    encoder -> channels = (image.components == 2 || image.components == 4) ? 4 : 3;
+    encoder -> pixels_count = (unsigned long long int) image.width * image.height;
+
+    unsigned char header[14] = {'q', 'o', 'i', 'f'};
+    for (unsigned char i = 0; i < 4; ++i) {
+        header[4 + i] = (image.width >> (24 - 8 * i)) & 0xFF;
+        header[8 + i] = (image.height >> (24 - 8 * i)) & 0xFF;
+    }
+    header[12] = encoder -> channels;
+    header[13] = 0; // sRGB with linear alpha
+    put_bytes(&(encoder -> writer), header, sizeof(header));
+
+    return TRUE;
+}
+
+// Append the operations of the next pixels to the writer, the end marker follows the last pixel
+static void encode_qoi_pixels(QOIEncoder* encoder, unsigned long long int pixels_count) {
+    if (pixels_count > encoder -> pixels_count - encoder -> encoded_pixels) pixels_count = encoder -> pixels_count - encoder -> encoded_pixels;
+
+    BitWriter* writer = &(encoder -> writer);
+    reserve_bytes(writer, pixels_count * 5 + sizeof(qoi_end_marker));
+    unsigned char* output = writer -> data + writer -> length;
+
+    unsigned char components = (encoder -> image).components;
+    const unsigned char* input = (encoder -> image).decoded_data + encoder -> encoded_pixels * components;
+    unsigned char* previous = encoder -> pixel;
+    unsigned char pixel[4] = {0, 0, 0, 255};
+
+    for (unsigned long long int i = 0; i < pixels_count; ++i, input += components) {
+        if (components < 3) {
+            pixel[0] = pixel[1] = pixel[2] = input[0];
+            if (components == 2) pixel[3] = input[1];
+        } else {
+            memcpy(pixel, input, components);
+        }
+
+        bool is_last = (encoder -> encoded_pixels + i + 1 == encoder -> pixels_count);
+        if (!memcmp(pixel, previous, 4)) {
+            encoder -> run++;
+            if (encoder -> run == QOI_MAX_RUN || is_last) {
+                *output++ = QOI_OP_RUN | (encoder -> run - 1);
+                encoder -> run = 0;
+            }
+            continue;
+        }
+
+        if (encoder -> run) {
+            *output++ = QOI_OP_RUN | (encoder -> run - 1);
+            encoder -> run = 0;
+        }
+
+        unsigned char hash = QOI_HASH(pixel);
+        if (!memcmp((encoder -> index)[hash], pixel, 4)) {
+            *output++ = QOI_OP_INDEX | hash;
+        } else if (pixel[3] == previous[3]) {
+            memcpy((encoder -> index)[hash], pixel, 4);
+            signed char red_diff = pixel[0] - previous[0];
+            signed char green_diff = pixel[1] - previous[1];
+            signed char blue_diff = pixel[2] - previous[2];
+            signed char red_green = red_diff - green_diff;
+            signed char blue_green = blue_diff - green_diff;
+
+            if (red_diff > -3 && red_diff < 2 && green_diff > -3 && green_diff < 2 && blue_diff > -3 && blue_diff < 2) {
+                *output++ = QOI_OP_DIFF | ((red_diff + 2) << 4) | ((green_diff + 2) << 2) | (blue_diff + 2);
+            } else if (red_green > -9 && red_green < 8 && green_diff > -33 && green_diff < 32 && blue_green > -9 && blue_green < 8) {
+                *output++ = QOI_OP_LUMA | (green_diff + 32);
+                *output++ = ((red_green + 8) << 4) | (blue_green + 8);
+            } else {
+                *output++ = QOI_OP_RGB;
+                memcpy(output, pixel, 3);
+                output += 3;
+            }
+        } else {
+            memcpy((encoder -> index)[hash], pixel, 4);
+            *output++ = QOI_OP_RGBA;
+            memcpy(output, pixel, 4);
+            output += 4;
+        }
+
+        memcpy(previous, pixel, 4);
+    }
+
+    encoder -> encoded_pixels += pixels_count;
+    if (encoder -> encoded_pixels == encoder -> pixels_count) {
+        memcpy(output, qoi_end_marker, sizeof(qoi_end_marker));
+        output += sizeof(qoi_end_marker);
+    }
+
+    writer -> length = output - writer -> data;
+
+    return;
+}
+
+// Encode an 8-bit image with 1 (gray), 2 (gray and alpha), 3 (RGB) or 4 (RGBA) components in a single pass
+unsigned char* encode_qoi(Image image, unsigned int* length) {
+    *length = 0;
+    QOIEncoder encoder = {0};
+    if (!init_qoi_encoder(&encoder, image)) {
+        return NULL;
+    }
+
+    encode_qoi_pixels(&encoder, encoder.pixels_count);
+    *length = encoder.writer.length;
+
+    return encoder.writer.data;
+}
+
+bool create_qoi_image(Image image, const char* filename) {
+    if (image.size == 0) {
+        error_print("the image size is zero!\n");
+        return INVALID_IMAGE_SIZE;
+    }
+
+    QOIEncoder encoder = {0};
+    if (!init_qoi_encoder(&encoder, image)) {
+        return INVALID_IMAGE_SIZE;
+    }
+
+    FILE* file = fopen(filename, "wb");
+
+    // Check for errors while opening the file
+    if (file == NULL) {
+        free(encoder.writer.data);
+        error_print("file not found!\n");
+        return FILE_NOT_FOUND;
+    }
+
+    // Stream the image in bands, so that the output buffer stays small
+    while (encoder.encoded_pixels < encoder.pixels_count) {
+        encode_qoi_pixels(&encoder, QOI_BAND_PIXELS);
+        fwrite(encoder.writer.data, sizeof(unsigned char), encoder.writer.length, file);
+        encoder.writer.length = 0;
+    }
+    free(encoder.writer.data);
+
+    // Check for errors
+    if (ferror(file)) {
+        fclose(file);
+        error_print("an error occured while writing the file!\n");
+        return FILE_ERROR;
+    }
+
+    fclose(file);
+
+    return NO_ERROR;
+}
+
+#endif //_ENCODE_QOI_H_
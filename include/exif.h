@@ -0,0 +1,192 @@
+#ifndef _EXIF_H_
+#define _EXIF_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./markers.h"
+
+#define EXIF_HEADER_LENGTH 6 // "Exif" followed by two zeros, the TIFF header comes next
+#define EXIF_ORIENTATION_TAG 0x0112
+#define EXIF_THUMBNAIL_OFFSET_TAG 0x0201 // JPEGInterchangeFormat, in IFD1
+#define EXIF_THUMBNAIL_LENGTH_TAG 0x0202 // JPEGInterchangeFormatLength, in IFD1
+#define EXIF_SEARCH_LENGTH (2 + 2 * (0xFFFF + 2)) // The SOI marker followed by an APP0 and an APP1 segment of the largest size
+
+// Transform that makes upright an image stored with each of the Exif orientations (from 1 to 8)
+static const ImageTransform orientation_transforms[] = {TRANSFORM_NONE, TRANSFORM_NONE, TRANSFORM_FLIP_VERTICALLY, TRANSFORM_ROTATE_180, TRANSFORM_FLIP_HORIZONTALLY, TRANSFORM_TRANSPOSE, TRANSFORM_ROTATE_90, TRANSFORM_TRANSVERSE, TRANSFORM_ROTATE_270};
+
+// Applied by the JPEG decoder while it places the blocks, set through set_exif_orientation
+static bool apply_exif_orientation = FALSE;
+
+/* -------------------------------------------------------------------------------------- */
+
+static unsigned int read_tiff_value(const unsigned char* data, unsigned char size, bool is_big_endian);
+static bool find_ifd_tag(const unsigned char* tiff, unsigned int tiff_length, unsigned int ifd_offset, unsigned short int tag, bool is_big_endian, unsigned int* value);
+static unsigned int get_next_ifd_offset(const unsigned char* tiff, unsigned int tiff_length, unsigned int ifd_offset, bool is_big_endian);
+static bool parse_exif(const unsigned char* payload, unsigned int length, ExifInfo* info);
+static bool find_exif_segment(const unsigned char* data, unsigned int length, unsigned int* payload_offset, unsigned int* payload_length);
+unsigned char read_exif_orientation(const unsigned char* data, unsigned int length);
+const unsigned char* get_exif_thumbnail(const unsigned char* data, unsigned int length, unsigned int* thumbnail_length);
+bool has_exif_thumbnail(const unsigned char* data, unsigned int length);
+ImageTransform get_orientation_transform(unsigned char orientation);
+void set_exif_orientation(bool enable);
+
+/* -------------------------------------------------------------------------------------- */
+
+static unsigned int read_tiff_value(const unsigned char* data, unsigned char size, bool is_big_endian) {
+    unsigned int value = 0;
+    for (unsigned char i = 0; i < size; ++i) {
+        value |= (unsigned int) data[is_big_endian ? i : size - i - 1] << (8 * (size - i - 1));
+    }
+    return value;
+}
+
+// Look for a tag in an IFD, whose value (or offset, when it doesn't fit in 4 bytes) is returned as it is
+static bool find_ifd_tag(const unsigned char* tiff, unsigned int tiff_length, unsigned int ifd_offset, unsigned short int tag, bool is_big_endian, unsigned int* value) {
+    // The offsets come from the file, so they're compared with what's left of the segment instead of being added up
+    if (ifd_offset < 8 || ifd_offset > tiff_length - 2) {
+        return FALSE;
+    }
+
+    unsigned short int entries_count = read_tiff_value(tiff + ifd_offset, 2, is_big_endian);
+    unsigned int max_entries = (tiff_length - ifd_offset - 2) / 12;
+    for (unsigned int i = 0; i < entries_count && i < max_entries; ++i) {
+        const unsigned char* entry = tiff + ifd_offset + 2 + 12 * i;
+        if (read_tiff_value(entry, 2, is_big_endian) != tag) continue;
+
+        // SHORT values are left aligned in the value field
+        unsigned short int type = read_tiff_value(entry + 2, 2, is_big_endian);
+        *value = (type == 3) ? read_tiff_value(entry + 8, 2, is_big_endian) : read_tiff_value(entry + 8, 4, is_big_endian);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// The offset of the next IFD follows the entries of the current one, 0 when it's the last one
+static unsigned int get_next_ifd_offset(const unsigned char* tiff, unsigned int tiff_length, unsigned int ifd_offset, bool is_big_endian) {
+    if (ifd_offset < 8 || ifd_offset > tiff_length - 6) {
+        return 0;
+    }
+
+    // The entries and the link after them must fit in what's left of the segment, checked without adding up the file offsets
+    unsigned short int entries_count = read_tiff_value(tiff + ifd_offset, 2, is_big_endian);
+    if (entries_count > (tiff_length - ifd_offset - 6) / 12) {
+        return 0;
+    }
+
+    return read_tiff_value(tiff + ifd_offset + 2 + 12 * entries_count, 4, is_big_endian);
+}
+
+// The payload starts right after the length of the APP1 segment
+static bool parse_exif(const unsigned char* payload, unsigned int length, ExifInfo* info) {
+    *info = (ExifInfo) {.orientation = 1};
+    if (length < EXIF_HEADER_LENGTH + 8 || memcmp(payload, "Exif\0\0", EXIF_HEADER_LENGTH)) {
+        return FALSE;
+    }
+
+    const unsigned char* tiff = payload + EXIF_HEADER_LENGTH;
+    unsigned int tiff_length = length - EXIF_HEADER_LENGTH;
+    bool is_big_endian = (tiff[0] == 'M');
+    if ((tiff[0] != 'M' && tiff[0] != 'I') || tiff[1] != tiff[0] || read_tiff_value(tiff + 2, 2, is_big_endian) != 42) {
+        warning_print("invalid TIFF header in the Exif segment!\n");
+        return FALSE;
+    }
+
+    unsigned int ifd0_offset = read_tiff_value(tiff + 4, 4, is_big_endian);
+    unsigned int orientation = 1;
+    if (find_ifd_tag(tiff, tiff_length, ifd0_offset, EXIF_ORIENTATION_TAG, is_big_endian, &orientation) && orientation >= 1 && orientation <= 8) {
+        info -> orientation = orientation;
+    }
+
+    // IFD1 describes the thumbnail, its offset is relative to the TIFF header as every other one
+    unsigned int ifd1_offset = get_next_ifd_offset(tiff, tiff_length, ifd0_offset, is_big_endian);
+    unsigned int thumbnail_offset = 0;
+    unsigned int thumbnail_length = 0;
+    if (find_ifd_tag(tiff, tiff_length, ifd1_offset, EXIF_THUMBNAIL_OFFSET_TAG, is_big_endian, &thumbnail_offset) && find_ifd_tag(tiff, tiff_length, ifd1_offset, EXIF_THUMBNAIL_LENGTH_TAG, is_big_endian, &thumbnail_length)) {
+        if (thumbnail_length > 2 && thumbnail_offset < tiff_length && thumbnail_length <= tiff_length - thumbnail_offset && tiff[thumbnail_offset] == MARKER_PREFIX_CODE && tiff[thumbnail_offset + 1] == SOI_MARKER) {
+            info -> thumbnail_offset = EXIF_HEADER_LENGTH + thumbnail_offset;
+            info -> thumbnail_length = thumbnail_length;
+        } else {
+            warning_print("invalid Exif thumbnail at %u, with length %u!\n", thumbnail_offset, thumbnail_length);
+        }
+    }
+
+    debug_print(YELLOW, "Exif orientation: %u\n", info -> orientation);
+    debug_print(YELLOW, "Exif thumbnail length: %u\n", info -> thumbnail_length);
+
+    return TRUE;
+}
+
+// Walk the segments before the first scan looking for the APP1 one with the Exif identifier
+static bool find_exif_segment(const unsigned char* data, unsigned int length, unsigned int* payload_offset, unsigned int* payload_length) {
+    unsigned int pos = 2;
+    while (pos + 4 <= length && data[pos] == MARKER_PREFIX_CODE) {
+        unsigned char marker_code = data[pos + 1];
+        if (marker_code == MARKER_PREFIX_CODE) {
+            pos++;
+            continue;
+        } else if (marker_code == SOS_MARKER || marker_code == EOI_MARKER) {
+            break;
+        }
+
+        unsigned int segment_length = (data[pos + 2] << 8) | data[pos + 3];
+        if (segment_length < 2 || pos + 2 + segment_length > length) break;
+
+        if (marker_code == APP1_MARKER && segment_length >= 2 + EXIF_HEADER_LENGTH && !memcmp(data + pos + 4, "Exif\0\0", EXIF_HEADER_LENGTH)) {
+            *payload_offset = pos + 4;
+            *payload_length = segment_length - 2;
+            return TRUE;
+        }
+
+        pos += 2 + segment_length;
+    }
+
+    return FALSE;
+}
+
+// Orientation of a JPEG file in memory, 1 (upright) when there's no Exif segment or it has no orientation
+unsigned char read_exif_orientation(const unsigned char* data, unsigned int length) {
+    unsigned int payload_offset = 0;
+    unsigned int payload_length = 0;
+    ExifInfo info = {.orientation = 1};
+    if (length > 2 && data[0] == MARKER_PREFIX_CODE && data[1] == SOI_MARKER && find_exif_segment(data, length, &payload_offset, &payload_length)) {
+        parse_exif(data + payload_offset, payload_length, &info);
+    }
+    return info.orientation;
+}
+
+// The JPEG thumbnail stored in IFD1, returned without copying it: NULL when the image doesn't have one
+const unsigned char* get_exif_thumbnail(const unsigned char* data, unsigned int length, unsigned int* thumbnail_length) {
+    unsigned int payload_offset = 0;
+    unsigned int payload_length = 0;
+    ExifInfo info = {.orientation = 1};
+    *thumbnail_length = 0;
+    if (length <= 2 || data[0] != MARKER_PREFIX_CODE || data[1] != SOI_MARKER || !find_exif_segment(data, length, &payload_offset, &payload_length)) {
+        return NULL;
+    } else if (!parse_exif(data + payload_offset, payload_length, &info) || info.thumbnail_length == 0) {
+        return NULL;
+    }
+
+    *thumbnail_length = info.thumbnail_length;
+
+    return data + payload_offset + info.thumbnail_offset;
+}
+
+bool has_exif_thumbnail(const unsigned char* data, unsigned int length) {
+    unsigned int thumbnail_length = 0;
+    return get_exif_thumbnail(data, length, &thumbnail_length) != NULL;
+}
+
+ImageTransform get_orientation_transform(unsigned char orientation) {
+    return (orientation <= 8) ? orientation_transforms[orientation] : TRANSFORM_NONE;
+}
+
+// Decode the JPEG images upright, placing the blocks where their Exif orientation wants them
+void set_exif_orientation(bool enable) {
+    apply_exif_orientation = enable;
+    return;
+}
+
+#endif //_EXIF_H_
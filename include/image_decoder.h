@@ -0,0 +1,238 @@
+#ifndef _IMAGE_DECODER_H_
+#define _IMAGE_DECODER_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./markers.h"
+#include "./compressor.h"
+#include "./decode_jpeg.h"
+#include "./decode_png.h"
+#include "./decode_ppm.h"
+#include "./decode_qoi.h"
+
+#define CHECK_JPEG(data) ((data)[0] == 0xFF && (data)[1] == 0xD8)
+#define IMAGE_DECODER_HEADER_LENGTH 8 // Enough to tell the type of any image
+
+/* -------------------------------------------------------------------------------------- */
+
+static bool is_file_png(unsigned char* image_file_data);
+static bool is_file_ppm(unsigned char* image_file_data);
+static bool is_file_qoi(unsigned char* image_file_data);
+static bool check_image_file(FileData* image_file);
+static void decode_buffered_image(ImageDecoder* decoder, unsigned int length);
+static void push_image_data(ImageDecoder* decoder, const unsigned char* data, unsigned int length);
+static bool start_image_decoder(ImageDecoder* decoder);
+ImageDecoder* allocate_image_decoder(void);
+DecoderStatus feed_image_decoder(ImageDecoder* decoder, const unsigned char* data, unsigned int length);
+unsigned int get_decoded_rows(ImageDecoder* decoder, Image* image);
+static inline unsigned int get_skippable_length(ImageDecoder* decoder);
+static inline void skip_image_data(ImageDecoder* decoder, unsigned int length);
+static inline void reserve_image_data(ImageDecoder* decoder, long long int length);
+Image finish_image_decoder(ImageDecoder* decoder);
+
+/* -------------------------------------------------------------------------------------- */
+
+static bool is_file_png(unsigned char* image_file_data) {
+    bool is_png = TRUE;
+    for (unsigned char i = 0; i < 8; ++i) {
+        if ((image_file_data)[i] != png_magic_numbers[i]) {
+            is_png = FALSE;
+            break;
+        }
+    }
+    return is_png;
+}
+
+static bool is_file_ppm(unsigned char* image_file_data) {
+    return image_file_data[0] == 'P' && image_file_data[1] >= '5' && image_file_data[1] <= '7';
+}
+
+static bool is_file_qoi(unsigned char* image_file_data) {
+    return is_str_equal((unsigned char*) "qoif", image_file_data, 4);
+}
+
+static bool check_image_file(FileData* image_file) {
+    if (CHECK_JPEG(image_file -> data)) {
+        image_file -> file_type = JPEG;
+        return TRUE;
+    } else if (is_file_png(image_file -> data)) {
+        image_file -> file_type = PNG;
+        return TRUE;
+    } else if (is_file_ppm(image_file -> data)) {
+        image_file -> file_type = PPM;
+        return TRUE;
+    } else if (is_file_qoi(image_file -> data)) {
+        image_file -> file_type = QOI;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+// The buffered bytes are decoded at once, the decoder takes their ownership
+static void decode_buffered_image(ImageDecoder* decoder, unsigned int length) {
+    FileData image_file = (FileData) {.length = length, .data = (decoder -> buffer).data, .file_type = decoder -> file_type};
+    decoder -> image = decode_ppm(&image_file);
+    decoder -> buffer = (BitWriter) {0};
+    decoder -> error = (decoder -> image).error;
+    decoder -> is_done = TRUE;
+    return;
+}
+
+// PNG, QOI and JPEG are decoded as the bytes arrive, PPM is buffered up to the end of the stream
+static void push_image_data(ImageDecoder* decoder, const unsigned char* data, unsigned int length) {
+    if (decoder -> file_type == PNG) {
+        decoder -> error = feed_png_decoder(decoder -> png_decoder, data, length);
+        decoder -> is_done = (decoder -> png_decoder) -> is_done;
+    } else if (decoder -> file_type == QOI) {
+        decoder -> error = feed_qoi_decoder(decoder -> qoi_decoder, data, length);
+        decoder -> is_done = (decoder -> qoi_decoder) -> is_done;
+    } else if (decoder -> file_type == JPEG) {
+        decoder -> error = feed_jpeg_decoder(decoder -> jpeg_decoder, data, length);
+        decoder -> is_done = (decoder -> jpeg_decoder) -> is_done;
+    } else {
+        put_bytes(&(decoder -> buffer), data, length);
+    }
+    return;
+}
+
+// Tell the type of the image from the first bytes, which are then pushed as any other
+static bool start_image_decoder(ImageDecoder* decoder) {
+    FileData image_file = (FileData) {.length = decoder -> header_length, .data = decoder -> header};
+    if (!check_image_file(&image_file)) {
+        error_print("invalid type of file!\n");
+        decoder -> error = INVALID_FILE_TYPE;
+        return FALSE;
+    }
+
+    debug_print(GREEN, "The current image stream is a %s image!\n\n", file_types[image_file.file_type]);
+
+    decoder -> file_type = image_file.file_type;
+    if (decoder -> file_type == PNG) {
+        decoder -> png_decoder = allocate_png_decoder();
+    } else if (decoder -> file_type == QOI) {
+        decoder -> qoi_decoder = allocate_qoi_decoder();
+    } else if (decoder -> file_type == JPEG) {
+        decoder -> jpeg_decoder = allocate_jpeg_decoder();
+    }
+
+    push_image_data(decoder, decoder -> header, decoder -> header_length);
+
+    return TRUE;
+}
+
+ImageDecoder* allocate_image_decoder(void) {
+    ImageDecoder* decoder = (ImageDecoder*) calloc(1, sizeof(ImageDecoder));
+    return decoder;
+}
+
+// Push the next bytes of the stream, in pieces of any length: ROWS_READY tells that more rows at the top of the image
+// were decoded since the previous push, see get_decoded_rows
+DecoderStatus feed_image_decoder(ImageDecoder* decoder, const unsigned char* data, unsigned int length) {
+    if (decoder -> error) {
+        return DECODING_FAILED;
+    } else if (decoder -> is_done) {
+        return DONE;
+    }
+
+    if (decoder -> header_length < IMAGE_DECODER_HEADER_LENGTH) {
+        unsigned int count = IMAGE_DECODER_HEADER_LENGTH - decoder -> header_length;
+        if (count > length) count = length;
+        memcpy(decoder -> header + decoder -> header_length, data, count);
+        decoder -> header_length += count;
+        data += count;
+        length -= count;
+        if (decoder -> header_length < IMAGE_DECODER_HEADER_LENGTH) return NEED_MORE_DATA;
+        if (!start_image_decoder(decoder)) return DECODING_FAILED;
+    }
+
+    if (length && !(decoder -> error) && !(decoder -> is_done)) {
+        push_image_data(decoder, data, length);
+    }
+
+    Image image = {0};
+    unsigned int rows_count = get_decoded_rows(decoder, &image);
+    bool is_new_rows = (rows_count > decoder -> reported_rows);
+    decoder -> reported_rows = rows_count;
+
+    if (decoder -> error) {
+        return DECODING_FAILED;
+    } else if (decoder -> is_done) {
+        return DONE;
+    }
+
+    return is_new_rows ? ROWS_READY : NEED_MORE_DATA;
+}
+
+// The rows from the top of the image decoded so far, the image is still owned by the decoder: its size is known once
+// the header of the image is received
+unsigned int get_decoded_rows(ImageDecoder* decoder, Image* image) {
+    if (decoder -> png_decoder != NULL) {
+        *image = ((decoder -> png_decoder) -> image).image_data;
+        return (decoder -> png_decoder) -> decoded_rows;
+    } else if (decoder -> qoi_decoder != NULL) {
+        *image = (decoder -> qoi_decoder) -> image;
+        return (image -> width) ? (decoder -> qoi_decoder) -> decoded_pixels / image -> width : 0;
+    } else if (decoder -> jpeg_decoder != NULL) {
+        *image = ((decoder -> jpeg_decoder) -> image).image_data;
+        return (decoder -> jpeg_decoder) -> decoded_rows;
+    }
+
+    *image = decoder -> image;
+
+    return (decoder -> is_done && !(image -> error)) ? image -> height : 0;
+}
+
+// Bytes coming next in the stream that the decoder doesn't need, so a source that can seek doesn't have to read them
+static inline unsigned int get_skippable_length(ImageDecoder* decoder) {
+    return (decoder -> png_decoder != NULL && !(decoder -> error) && !(decoder -> is_done)) ? get_png_skippable_length(decoder -> png_decoder) : 0;
+}
+
+static inline void skip_image_data(ImageDecoder* decoder, unsigned int length) {
+    if (decoder -> png_decoder != NULL) {
+        skip_png_decoder_data(decoder -> png_decoder, length);
+    }
+    return;
+}
+
+// The PPM bytes are buffered, so the buffer takes the length left in the stream at once when it's known
+static inline void reserve_image_data(ImageDecoder* decoder, long long int length) {
+    if (decoder -> header_length < IMAGE_DECODER_HEADER_LENGTH || decoder -> error || decoder -> is_done || decoder -> file_type != PPM) {
+        return;
+    } else if (length > 0 && length < 0x7FFFFFFF) {
+        reserve_bytes(&(decoder -> buffer), length);
+    }
+    return;
+}
+
+// Release the decoder and return the image, the stream being complete: the PPM images are decoded now
+Image finish_image_decoder(ImageDecoder* decoder) {
+    if (decoder -> header_length < IMAGE_DECODER_HEADER_LENGTH && !(decoder -> error)) {
+        start_image_decoder(decoder);
+    }
+
+    Image image = decoder -> image;
+    if (decoder -> png_decoder != NULL) {
+        image = finish_png_decoder(decoder -> png_decoder);
+    } else if (decoder -> qoi_decoder != NULL) {
+        image = finish_qoi_decoder(decoder -> qoi_decoder);
+    } else if (decoder -> jpeg_decoder != NULL) {
+        image = finish_jpeg_decoder(decoder -> jpeg_decoder);
+    } else if (!(decoder -> error) && !(decoder -> is_done)) {
+        decode_buffered_image(decoder, (decoder -> buffer).length);
+        image = decoder -> image;
+    }
+
+    if (!(image.error)) {
+        image.error = decoder -> error;
+    }
+
+    free((decoder -> buffer).data);
+    free(decoder);
+
+    return image;
+}
+
+#endif //_IMAGE_DECODER_H_
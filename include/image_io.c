@@ -3,22 +3,91 @@
 
 Image decode_image(const char* file_path) {
     Image image = {0};
+    FileData* image_file = open_image_file(file_path, &image);
+    if (image_file == NULL) {
+        return image;
+    }
+
+    return decode_image_file(image_file);
+}
+
+// Decode an image straight to the given size: the PNG rows are resized while they're decoded, the other images once decoded
+Image decode_image_scaled(const char* file_path, unsigned int width, unsigned int height) {
+    Image image = {0};
+    FileData* image_file = open_image_file(file_path, &image);
+    if (image_file == NULL) {
+        return image;
+    }
+
+    if (image_file -> file_type == PNG) {
+        image = decode_png_scaled(image_file, width, height);
+        deallocate_file_data(image_file, FALSE);
+        return image;
+    }
+
+    image = decode_image_file(image_file);
+
+    if (!(image.error) && (image.width != width || image.height != height)) {
+        Image resized_image = resize_image(image, width, height, RESAMPLE_BOX);
+        deallocate_image(image);
+        image = resized_image;
+    }
+
+    return image;
+}
+
+// Decode only the rows from first_row to last_row (included): the PNG decoding stops at the last one, the other images are cropped once decoded
+Image decode_image_rows(const char* file_path, unsigned int first_row, unsigned int last_row) {
+    Image image = {0};
+    FileData* image_file = open_image_file(file_path, &image);
+    if (image_file == NULL) {
+        return image;
+    }
+
+    if (image_file -> file_type == PNG) {
+        image = decode_png_rows(image_file, first_row, last_row);
+        deallocate_file_data(image_file, FALSE);
+        return image;
+    }
+
+    image = decode_image_file(image_file);
+
+    if (!(image.error) && (first_row > last_row || first_row >= image.height)) {
+        error_print("invalid range of rows: from %u to %u, the image has %u rows\n", first_row, last_row, image.height);
+        image.error = INVALID_IMAGE_SIZE;
+    } else if (!(image.error)) {
+        // The grey JPEG images keep one component but are decoded to RGB, so the row length comes from the decoded size
+        unsigned int row_size = image.size / image.height;
+        image.height = (last_row < image.height) ? last_row - first_row + 1 : image.height - first_row;
+        image.size = row_size * image.height;
+        memmove(image.decoded_data, image.decoded_data + (unsigned long long int) first_row * row_size, image.size);
+    }
 
-    // Read the given file
-    bool status = 0;
-    FileData* image_file = (FileData*) calloc(1, sizeof(FileData));
-    if ((status = read_image_file(image_file, file_path))) {
-        image.error = status;
-        deallocate_file_data(image_file, TRUE);
+    return image;
+}
+
+// Give the callback the rows of an image in bands as soon as they're decoded, without keeping them: JPEG gives an MCU
+// row at a time, PNG a scanline (the whole image when interlaced), PPM fixed size bands and QOI the whole image.
+// The image returned only describes the rows, its decoded data is NULL
+Image decode_image_streamed(const char* file_path, RowsCallback callback, void* user_data) {
+    Image image = {0};
+    FileData* image_file = open_image_file(file_path, &image);
+    if (image_file == NULL) {
         return image;
     }
 
     if (image_file -> file_type == JPEG) {
-        image = decode_jpeg(image_file);
+        image = decode_jpeg_streamed(image_file, callback, user_data);
     } else if (image_file -> file_type == PNG) {
-        image = decode_png(image_file);
+        image = decode_png_streamed(image_file, callback, user_data);
     } else if (image_file -> file_type == PPM) {
-        image = decode_ppm(image_file);
+        image = decode_ppm_streamed(image_file, callback, user_data);
+    } else if (image_file -> file_type == QOI) {
+        image = decode_qoi(image_file);
+        if (!(image.error)) callback(0, image.height, image.decoded_data, image.width * image.components, user_data);
+        deallocate_image(image);
+        image.decoded_data = NULL;
+        image.size = 0;
     }
 
     deallocate_file_data(image_file, FALSE);
@@ -26,86 +95,139 @@ Image decode_image(const char* file_path) {
     return image;
 }
 
-bool create_ppm_image(Image image, const char* filename) {
-    if (image.size == 0) {
-        error_print("the image size is zero!\n");
-        return INVALID_IMAGE_SIZE;
+// Decode an image reusing the tables and the scratch buffers kept by the decoder context, the buffer of the image is
+// taken from the pool of the context when a large enough one was released
+Image idl_decode_with(IdlDecoder* decoder, const char* file_path) {
+    IdlDecoder* previous_context = decoder_context;
+    unsigned int first_lent = decoder -> lent_count;
+    decoder_context = decoder;
+    Image image = decode_image(file_path);
+    decoder_context = previous_context;
+    keep_lent_buffer(decoder, first_lent, image.decoded_data);
+    return image;
+}
+
+// Decode an image pulled from a source in blocks of SOURCE_BLOCK_LENGTH bytes, without reading it whole first: the reading
+// stops once the image is complete, and the PNG data that isn't needed is skipped when the source can seek
+Image decode_image_from(IdlSource* source) {
+    ImageDecoder* decoder = allocate_image_decoder();
+    unsigned char* block = (unsigned char*) calloc(SOURCE_BLOCK_LENGTH, sizeof(unsigned char));
+    long long int length_left = (source -> size != NULL) ? source -> size(source -> handle) : -1;
+    DecoderStatus status = NEED_MORE_DATA;
+    bool is_read_failed = FALSE;
+
+    while (status == NEED_MORE_DATA || status == ROWS_READY) {
+        unsigned int skippable_length = get_skippable_length(decoder);
+        if (skippable_length && skip_source(source, skippable_length)) {
+            skip_image_data(decoder, skippable_length);
+            continue;
+        }
+
+        int length = source -> read(source -> handle, block, SOURCE_BLOCK_LENGTH);
+        if (length < 0) {
+            error_print("an error occured while reading the source!\n");
+            is_read_failed = TRUE;
+            break;
+        } else if (length == 0) {
+            break;
+        }
+
+        bool is_type_known = (decoder -> header_length == IMAGE_DECODER_HEADER_LENGTH);
+        status = feed_image_decoder(decoder, block, length);
+        if (!is_type_known && length_left > length) reserve_image_data(decoder, length_left - length);
+    }
+
+    free(block);
+
+    Image image = finish_image_decoder(decoder);
+    if (is_read_failed) {
+        image.error = FILE_ERROR;
     }
 
-    FILE* file = fopen(filename, "wb");
+    return image;
+}
+
+// Decode an image together with its halvings down to 1 x 1, the first level is the full image
+Image* decode_image_pyramid(const char* file_path, unsigned int* levels_count) {
+    Image image = {0};
+    FileData* image_file = open_image_file(file_path, &image);
+    if (image_file == NULL) {
+        return build_image_pyramid(image, levels_count);
+    } else if (image_file -> file_type == JPEG) {
+        Image* levels = decode_jpeg_pyramid(image_file, levels_count);
+        deallocate_file_data(image_file, FALSE);
+        return levels;
+    }
 
-    debug_print(YELLOW, "\n");
+    return build_image_pyramid(decode_image_file(image_file), levels_count);
+}
+
+// Read only the start of a JPEG file and decode the thumbnail in its Exif segment, without touching the rest of the file
+Image decode_image_thumbnail(const char* file_path) {
+    Image image = {0};
+    FILE* file = fopen(file_path, "rb");
 
     // Check for errors while opening the file
     if (file == NULL) {
-        error_print("file not found!\n");
-        return FILE_NOT_FOUND;
+        error_print("file '%s' not found!\n", file_path);
+        image.error = FILE_NOT_FOUND;
+        return image;
     }
 
-    fwrite("P6\n", sizeof(char), 3, file);
+    unsigned char* data = (unsigned char*) calloc(EXIF_SEARCH_LENGTH, sizeof(unsigned char));
+    unsigned int length = fread(data, sizeof(unsigned char), EXIF_SEARCH_LENGTH, file);
 
     // Check for errors
     if (ferror(file)) {
-        error_print("an error occured while writing the file!\n");
-        return FILE_ERROR;
+        error_print("an error occured while reading the file!\n");
+        image.error = FILE_ERROR;
+    } else if (length <= 2 || !CHECK_JPEG(data)) {
+        error_print("only the JPEG images have an Exif thumbnail!\n");
+        image.error = INVALID_FILE_TYPE;
+    } else {
+        image = decode_exif_thumbnail(data, length);
     }
 
-    char size_info[35];
-    unsigned int info_len = snprintf(size_info, 35, "%d %d\n255\n", image.width, image.height);
-    fwrite(size_info, sizeof(char), info_len, file);
+    fclose(file);
+    free(data);
 
-    // Check for errors
-    if (ferror(file)) {
-        error_print("an error occured while writing the file!\n");
-        return FILE_ERROR;
+    return image;
+}
+
+bool create_ppm_image(Image image, const char* filename) {
+    if (image.size == 0) {
+        error_print("the image size is zero!\n");
+        return INVALID_IMAGE_SIZE;
     }
 
-    unsigned int b_w = fwrite(image.decoded_data, 1, image.size, file);
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
 
-    if (b_w != image.size) {
-        debug_print(PURPLE, "Diff in size: %u - %u\n", b_w, image.size);
+    // Check for errors while opening the file
+    if (fd < 0) {
+        error_print("file not found!\n");
+        return FILE_NOT_FOUND;
     }
 
+    PPMWriter* writer = open_ppm_writer(fd, image.width, image.height, image.components);
+    if (writer == NULL) {
+        close(fd);
+        return INVALID_IMAGE_SIZE;
+    }
+
+    write_ppm_rows(writer, image.decoded_data, image.height, image.width * image.components);
+    bool error = close_ppm_writer(writer, NULL, NULL);
+
     // Check for errors
-    if (ferror(file)) {
+    if (close(fd) || error) {
         error_print("an error occured while writing the file!\n");
         return FILE_ERROR;
     }
 
-    fclose(file);
-
     debug_print(GREEN, "file %s successfully created!\n", filename);
-    debug_print(GREEN, "copied %u bytes out of the expected %u\n\n", b_w, image.components * image.width * image.height);
 
     return NO_ERROR;
 }
 
-void flip_image_horizontally(Image image) {
-    unsigned int half_image_size = (unsigned int) floorl(image.size / 2.0L);
-    for (unsigned int i = 0; i < half_image_size; ++i) {
-        unsigned char temp = image.decoded_data[i];
-        image.decoded_data[i] = image.decoded_data[image.size - i];
-        image.decoded_data[image.size - i] = temp;
-    }
-    return;
-}
-
-void flip_image_vertically(Image image) {
-    for (unsigned int h = 0; h < image.height; ++h) {
-        unsigned int half_width_size = (unsigned int) floorl(image.width / 2.0L);
-        for (unsigned int w = 0; w < half_width_size; ++w) {
-            unsigned int first = ((h * image.width) + w) * 3;
-            unsigned int second = (((h + 1) * image.width) - (w + 1)) * 3;
-            for (unsigned char i = 0; i < image.components; ++i) {
-                unsigned char temp = image.decoded_data[first + i];
-                image.decoded_data[first + i] = image.decoded_data[second + i];
-                image.decoded_data[second + i] = temp;
-            }
-        }
-    }
-    return;
-}
-
 void deallocate_image(Image image) {
     debug_print(BLUE, "deallocating image...\n");
     free(image.decoded_data);
@@ -5,6 +5,11 @@
 #include "./types.h"
 #include "./bitstream.h"
 
+#define MARKER_PREFIX_CODE 0xFF
+#define MARKER_BASE_CODE 0xC0
+
+typedef enum MarkerCode {SOF0_MARKER = 0xC0, DHT_MARKER = 0xC4, RST0_MARKER = 0xD0, SOI_MARKER = 0xD8, EOI_MARKER, SOS_MARKER, DQT_MARKER, DNL_MARKER, DRI_MARKER, APP0_MARKER = 0xE0, APP1_MARKER, COM_MARKER = 0xFE} MarkerCode;
+
 static const char* markers_types[256] = {[0xC0] = "SOF0", "SOF1", "SOF2", "SOF3", "DHT", "SOF5", "SOF6", "SOF7", "JPG", "SOF9", "SOF10", "SOF11", "DAC", "SOF13", "SOF14", "SOF15", "RSTm0", "RSTm1", "RSTm2", "RSTm3", "RSTm4", "RSTm5", "RSTm6", "RSTm7", "SOI", "EOI", "SOS", "DQT", "DNL", "DRI", "DHP", "EXP", "APP0", "APP1", "APP2", "APP3", "APP4", "APP5", "APP6", "APP7", "APP8", "APP9", "APPA", "APPB", "APPC", "APPD", "APPE", "APPF", "JPG0", "JPG1", "JPG2", "JPG3", "JPG4", "JPG5", "JPG6", "JPG7", "JPG8", "JPG9", "JPGA", "JPGB", "JPGC", "JPGD", "COM"};
 static const unsigned char markers_codes[] = {0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xCB, 0xCC, 0xCD, 0xCE, 0xCF, 0xDA, 0xDB, 0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xEB, 0xEC, 0xED, 0xEE, 0xEF, 0xFE};
 
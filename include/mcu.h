@@ -7,10 +7,30 @@
 #include "./types.h"
 #include "./debug_print.h"
 #include "./dct.h"
+#include "./decoder_context.h"
 
 #define COMPUTE_IDCT(data_unit, t_m, m) mul_mat(data_unit, t_m, m, 8)
 #define PI 3.14159265358979323846L
 #define SQRT2 1.4142135623730951L
+#define JPEG_REDUCED_LEVELS 3 // Halvings of the image computed from the coefficients, down to a pixel for each block
+#define REDUCED_UNIT_LENGTH (16 + 4 + 1)
+
+// Offset of the block of each reduced level in the reduced data units
+const unsigned char reduced_unit_offsets[JPEG_REDUCED_LEVELS + 1] = {0, 0, 16, 20};
+
+// 4 and 2 point IDCT with the same scaling of the 8 point one (the first row is 1 / (2 * sqrt(2)), the others
+// cos((2 * k + 1) * u * PI / (2 * N)) / 2), so that each output sample lands on the centre of the pixels it replaces
+const double reduced_idct_4[16] = {
+    0.353553390593274, 0.353553390593274, 0.353553390593274, 0.353553390593274,
+    0.461939766255643, 0.191341716182545, -0.191341716182545, -0.461939766255643,
+    0.353553390593274, -0.353553390593274, -0.353553390593274, 0.353553390593274,
+    0.191341716182545, -0.461939766255643, 0.461939766255643, -0.191341716182545
+};
+
+const double reduced_idct_2[4] = {
+    0.353553390593274, 0.353553390593274,
+    0.353553390593274, -0.353553390593274
+};
 
 const unsigned char zigzag[64] = {
     0, 1, 5, 6, 14, 15, 27, 28,
@@ -29,14 +49,22 @@ static void unzigzag_vec(int** data);
 static void dequantize_data_unit(int* data_unit, unsigned char* quantization_table);
 long double* generate_m(void);
 long double* generate_tm(long double* m);
+static void reduce_block(const int* data_unit, const double* idct, unsigned char size, int* output);
+static void reduce_data_unit(const int* data_unit, int* reduced);
 static long double round_colour(long double val);
 static void ycbcr_to_rgb(int* y, int* cb, int* cr, RGB* rgb);
+static void ycbcr_to_pixel(int y, int cb, int cr, unsigned char* pixel);
 static void ycbcr_to_greyscale(int* y, RGB* rgb);
 static float bilinear_interpolation(float x, float y, float q11, float q12, float q21, float q22);
 static int** upsample(unsigned char sf_h, unsigned char sf_v, int* data);
 static RGB* mcu_to_rgb(MCU mcu, DataTables* data_table);
 void decode_mcu(MCU mcu, DataTables* data_table, long double* t_m, long double* m);
+static bool get_placement_steps(ImageTransform transform, unsigned int width, unsigned int height, long long int* origin, long long int* step_x, long long int* step_y);
+static void place_mcu_row(JPEGImage* image, DataTables* data_table, RGB** rgbs, unsigned int r, unsigned char* output_data, long long int step_x, long long int step_y);
+static void deallocate_rgbs(RGB* rgb, unsigned char max_du);
 unsigned char mcus_to_image(JPEGImage* image, DataTables* data_table);
+void emit_mcu_rows(JPEGImage* image, DataTables* data_table);
+Image reduced_mcus_to_image(JPEGImage* image, DataTables* data_table, unsigned char level);
 void deallocate_mcu(MCU mcu);
 void deallocate_mcus(JPEGImage* image);
 
@@ -95,6 +123,38 @@ long double* generate_tm(long double* m) {
     return t_m;
 }
 
+// IDCT of the size x size lowest frequencies of a dequantized data unit, done by rows then by columns
+static void reduce_block(const int* data_unit, const double* idct, unsigned char size, int* output) {
+    double rows[16] = {0};
+    for (unsigned char u = 0; u < size; ++u) {
+        for (unsigned char l = 0; l < size; ++l) {
+            for (unsigned char v = 0; v < size; ++v) {
+                rows[u * size + l] += data_unit[u * 8 + v] * idct[v * size + l];
+            }
+        }
+    }
+
+    for (unsigned char k = 0; k < size; ++k) {
+        for (unsigned char l = 0; l < size; ++l) {
+            double sum = 0.0;
+            for (unsigned char u = 0; u < size; ++u) {
+                sum += idct[u * size + k] * rows[u * size + l];
+            }
+            output[k * size + l] = (int) lround(sum);
+        }
+    }
+
+    return;
+}
+
+// The 1x1 block is the mean of the data unit, its DC coefficient divided by 8
+static void reduce_data_unit(const int* data_unit, int* reduced) {
+    reduce_block(data_unit, reduced_idct_4, 4, reduced + reduced_unit_offsets[1]);
+    reduce_block(data_unit, reduced_idct_2, 2, reduced + reduced_unit_offsets[2]);
+    reduced[reduced_unit_offsets[3]] = (int) lround(data_unit[0] / 8.0);
+    return;
+}
+
 static long double round_colour(long double val) {
     return ceill(val + 0.5L);
 }
@@ -114,6 +174,17 @@ static void ycbcr_to_rgb(int* y, int* cb, int* cr, RGB* rgb) {
     return;
 }
 
+static void ycbcr_to_pixel(int y, int cb, int cr, unsigned char* pixel) {
+    y += 128;
+    int R = round_colour(y + (1.40200L * cr));
+    int G = round_colour(y - (0.344136L * cb) - (0.714136L * cr));
+    int B = round_colour(y + (1.77200L * cb));
+    pixel[0] = (unsigned char) CLAMP(R, 0, 255);
+    pixel[1] = (unsigned char) CLAMP(G, 0, 255);
+    pixel[2] = (unsigned char) CLAMP(B, 0, 255);
+    return;
+}
+
 static void ycbcr_to_greyscale(int* y, RGB* rgb) {
     for (unsigned char j = 0; j < 64; ++j) {
         (rgb -> R)[j] = CLAMP(y[j] + 128, 0, 255);
@@ -212,6 +283,11 @@ void decode_mcu(MCU mcu, DataTables* data_table, long double* t_m, long double*
             // Unzigzag data unit
             unzigzag_vec(mcu.data_units + mcu_count);
 
+            // The pyramid levels come from the same coefficients, before the full IDCT replaces them
+            if (mcu.reduced_units != NULL) {
+                reduce_data_unit(mcu.data_units[mcu_count], mcu.reduced_units + mcu_count * REDUCED_UNIT_LENGTH);
+            }
+
             // Calculate the IDCT for each data units
             COMPUTE_IDCT(mcu.data_units + mcu_count, t_m, m);
         }
@@ -220,9 +296,78 @@ void decode_mcu(MCU mcu, DataTables* data_table, long double* t_m, long double*
     return;
 }
 
+// Offsets, in the RGB output, of the first pixel and of the steps along the rows and the columns of the source,
+// returns whether the sides of the image are swapped
+static bool get_placement_steps(ImageTransform transform, unsigned int width, unsigned int height, long long int* origin, long long int* step_x, long long int* step_y) {
+    // The destination coordinates are x' = ax * x + bx * y + cx and y' = ay * x + by * y + cy
+    long long int ax = 1, bx = 0, cx = 0, ay = 0, by = 1, cy = 0;
+    long long int last_x = (long long int) width - 1;
+    long long int last_y = (long long int) height - 1;
+    switch (transform) {
+        case TRANSFORM_NONE: break;
+        case TRANSFORM_FLIP_VERTICALLY: ax = -1; cx = last_x; break;
+        case TRANSFORM_FLIP_HORIZONTALLY: by = -1; cy = last_y; break;
+        case TRANSFORM_ROTATE_180: ax = -1; cx = last_x; by = -1; cy = last_y; break;
+        case TRANSFORM_TRANSPOSE: ax = 0; bx = 1; ay = 1; by = 0; break;
+        case TRANSFORM_ROTATE_90: ax = 0; bx = -1; cx = last_y; ay = 1; by = 0; break;
+        case TRANSFORM_ROTATE_270: ax = 0; bx = 1; ay = -1; by = 0; cy = last_x; break;
+        case TRANSFORM_TRANSVERSE: ax = 0; bx = -1; cx = last_y; ay = -1; by = 0; cy = last_x; break;
+    }
+
+    bool is_transposed = (transform == TRANSFORM_TRANSPOSE || transform == TRANSFORM_TRANSVERSE || transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ROTATE_270);
+    long long int output_width = is_transposed ? height : width;
+    *origin = 3 * (cy * output_width + cx);
+    *step_x = 3 * (ay * output_width + ax);
+    *step_y = 3 * (by * output_width + bx);
+
+    return is_transposed;
+}
+
+// Place the blocks of the MCU row r, whose data units converted to RGB are given from its first MCU: output_data
+// is the destination of the first pixel of the row, the others are step_x and step_y apart along the source
+static void place_mcu_row(JPEGImage* image, DataTables* data_table, RGB** rgbs, unsigned int r, unsigned char* output_data, long long int step_x, long long int step_y) {
+    unsigned int width = (image -> image_data).width;
+    unsigned int height = (image -> image_data).height;
+    unsigned int mcu_width = 8 * data_table -> max_sf_h;
+    unsigned int mcu_height = 8 * data_table -> max_sf_v;
+    unsigned int first_y = r * mcu_height;
+    unsigned int last_y = (height - first_y < mcu_height) ? height : first_y + mcu_height;
+
+    for (unsigned int block_y = first_y; block_y < last_y; block_y += 8) {
+        unsigned int du_y = (block_y % mcu_height) / 8;
+        unsigned int rows_count = (height - block_y < 8) ? height - block_y : 8;
+        for (unsigned int block_x = 0; block_x < width; block_x += 8) {
+            unsigned int c = block_x / mcu_width;
+            unsigned int du_x = (block_x % mcu_width) / 8;
+            unsigned int columns_count = (width - block_x < 8) ? width - block_x : 8;
+            RGB* rgb = &(rgbs[c][du_y * data_table -> max_sf_h + du_x]);
+            for (unsigned int i = 0; i < rows_count; ++i) {
+                unsigned char* output = output_data + (block_y - first_y + i) * step_y + block_x * step_x;
+                for (unsigned int j = 0; j < columns_count; ++j, output += step_x) {
+                    output[0] = (rgb -> R)[8 * i + j];
+                    output[1] = (rgb -> G)[8 * i + j];
+                    output[2] = (rgb -> B)[8 * i + j];
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+static void deallocate_rgbs(RGB* rgb, unsigned char max_du) {
+    for (unsigned char j = 0; j < max_du; ++j) {
+        free(rgb[j].R);
+        free(rgb[j].G);
+        free(rgb[j].B);
+    }
+    free(rgb);
+    return;
+}
+
 unsigned char mcus_to_image(JPEGImage* image, DataTables* data_table) {
     MCU* mcus = image -> mcus;
-    (image -> image_data).decoded_data = (unsigned char*) calloc(3 * ((image -> image_data).width * (image -> image_data).height + 1), sizeof(unsigned char));
+    (image -> image_data).decoded_data = allocate_image_buffer(3 * (image -> image_data).width * (image -> image_data).height);
     (image -> image_data).size = 0;
 
     if (image -> mcu_x * image -> mcu_y > image -> mcu_count) {
@@ -235,42 +380,123 @@ unsigned char mcus_to_image(JPEGImage* image, DataTables* data_table) {
         rgbs[i] = mcu_to_rgb(mcus[i], data_table);
     }
 
-    unsigned int mcu_x = image -> mcu_x;
-    for (unsigned int h = 0; h < (image -> image_data).height; ++h) {
-        unsigned int r = (h - (h % (8 * data_table -> max_sf_v))) / (8 * data_table -> max_sf_v);
-        unsigned int h1 = h - (8 * r * data_table -> max_sf_v);
-        unsigned int du_y = (h1 - (h1 % 8)) / 8;
-        for (unsigned int w = 0; w < (image -> image_data).width; ++w) {
-            unsigned int c = (w - (w % (8 * data_table -> max_sf_h))) / (8 * data_table -> max_sf_h);
-            unsigned int w1 = w - (8 * c * data_table -> max_sf_h);
-            unsigned int du_x = (w1 - (w1 % 8)) / 8;
-            ((image -> image_data).decoded_data)[(image -> image_data).size] = rgbs[r * mcu_x + c][du_y * data_table -> max_sf_h + du_x].R[8 * (h1 % 8) + (w1 % 8)];
-            ((image -> image_data).decoded_data)[(image -> image_data).size + 1] = rgbs[r * mcu_x + c][du_y * data_table -> max_sf_h + du_x].G[8 * (h1 % 8) + (w1 % 8)];
-            ((image -> image_data).decoded_data)[(image -> image_data).size + 2] = rgbs[r * mcu_x + c][du_y * data_table -> max_sf_h + du_x].B[8 * (h1 % 8) + (w1 % 8)];
-            ((image -> image_data).size) += 3;
-        }
+    // The destination of the pixel (x, y) is origin + x * step_x + y * step_y, so that the blocks are placed already transformed
+    unsigned int width = (image -> image_data).width;
+    unsigned int height = (image -> image_data).height;
+    long long int origin = 0;
+    long long int step_x = 0;
+    long long int step_y = 0;
+    bool is_transposed = get_placement_steps(image -> transform, width, height, &origin, &step_x, &step_y);
+
+    unsigned int mcu_height = 8 * data_table -> max_sf_v;
+    for (unsigned int r = 0; r * mcu_height < height; ++r) {
+        unsigned char* output_data = (image -> image_data).decoded_data + origin + (long long int) (r * mcu_height) * step_y;
+        place_mcu_row(image, data_table, rgbs + r * image -> mcu_x, r, output_data, step_x, step_y);
+    }
+
+    (image -> image_data).size = 3 * width * height;
+    if (is_transposed) {
+        (image -> image_data).width = height;
+        (image -> image_data).height = width;
     }
 
-    // Resize the decoded data
-    (image -> image_data).decoded_data = (unsigned char*) realloc((image -> image_data).decoded_data, (image -> image_data).size);
     for (unsigned int i = 0; i < image -> mcu_count; ++i) {
-    	for (unsigned int j = 0; j < mcus -> max_du; ++j) {
-		free(rgbs[i][j].R);
-		free(rgbs[i][j].G);
-		free(rgbs[i][j].B);
-	}
-	free(rgbs[i]);
+        deallocate_rgbs(rgbs[i], mcus -> max_du);
     }
     free(rgbs);
 
     return FALSE;
 }
 
+// Give the callback each MCU row completed since the last call, in a band as tall as the MCU, then release its MCUs
+void emit_mcu_rows(JPEGImage* image, DataTables* data_table) {
+    unsigned int width = (image -> image_data).width;
+    unsigned int height = (image -> image_data).height;
+    unsigned int mcu_height = 8 * data_table -> max_sf_v;
+    unsigned int mcu_x = image -> mcu_x;
+
+    for (; (image -> emitted_mcu_rows + 1) * mcu_x <= image -> mcu_count && image -> emitted_mcu_rows * mcu_height < height; (image -> emitted_mcu_rows)++) {
+        unsigned int r = image -> emitted_mcu_rows;
+        unsigned int rows_count = (height - r * mcu_height < mcu_height) ? height - r * mcu_height : mcu_height;
+        MCU* mcus = image -> mcus + r * mcu_x;
+        RGB** rgbs = (RGB**) calloc(mcu_x, sizeof(RGB*));
+        for (unsigned int i = 0; i < mcu_x; ++i) {
+            rgbs[i] = mcu_to_rgb(mcus[i], data_table);
+        }
+
+        unsigned char* band = (unsigned char*) calloc(3 * width * rows_count, sizeof(unsigned char));
+        place_mcu_row(image, data_table, rgbs, r, band, 3, 3 * width);
+        (image -> rows_callback)(r * mcu_height, rows_count, band, 3 * width, image -> rows_user_data);
+        free(band);
+
+        for (unsigned int i = 0; i < mcu_x; ++i) {
+            deallocate_rgbs(rgbs[i], mcus[i].max_du);
+            deallocate_mcu(mcus[i]);
+            mcus[i] = (MCU) {0};
+        }
+        free(rgbs);
+    }
+
+    return;
+}
+
+// Place the data units reduced to blocks of 8 >> level pixels, the chroma of each pixel is the one of the block that
+// covers it, and the image gets the same transform of the full one. Must run before mcus_to_image, which swaps the sides
+Image reduced_mcus_to_image(JPEGImage* image, DataTables* data_table, unsigned char level) {
+    unsigned int width = ((image -> image_data).width + (1 << level) - 1) >> level;
+    unsigned int height = ((image -> image_data).height + (1 << level) - 1) >> level;
+    Image reduced = {.width = width, .height = height, .components = 3, .size = 3 * width * height};
+
+    if (image -> mcu_x * image -> mcu_y > image -> mcu_count) {
+        error_print("invalid mcu_count size: %u, expected: %u\n", image -> mcu_count, image -> mcu_x * image -> mcu_y);
+        reduced.error = DECODING_ERROR;
+        reduced.size = 0;
+        return reduced;
+    }
+
+    reduced.decoded_data = (unsigned char*) calloc(reduced.size, sizeof(unsigned char));
+
+    long long int origin = 0;
+    long long int step_x = 0;
+    long long int step_y = 0;
+    if (get_placement_steps(image -> transform, width, height, &origin, &step_x, &step_y)) {
+        reduced.width = height;
+        reduced.height = width;
+    }
+
+    unsigned char block_size = 8 >> level;
+    unsigned char offset = reduced_unit_offsets[level];
+    unsigned int mcu_width = block_size * data_table -> max_sf_h;
+    unsigned int mcu_height = block_size * data_table -> max_sf_v;
+    for (unsigned int y = 0; y < height; ++y) {
+        unsigned int mcu_y = y % mcu_height;
+        unsigned char* output = reduced.decoded_data + origin + y * step_y;
+        for (unsigned int x = 0; x < width; ++x, output += step_x) {
+            unsigned int mcu_x = x % mcu_width;
+            MCU* mcu = image -> mcus + (y / mcu_height) * image -> mcu_x + x / mcu_width;
+            unsigned int du = ((mcu_y / block_size) * data_table -> max_sf_h + mcu_x / block_size) % (mcu -> comp_du_count)[0];
+            int luma = (mcu -> reduced_units)[du * REDUCED_UNIT_LENGTH + offset + (mcu_y % block_size) * block_size + mcu_x % block_size];
+            if (mcu -> components == 1) {
+                output[0] = output[1] = output[2] = CLAMP(luma + 128, 0, 255);
+                continue;
+            }
+
+            unsigned int chroma = (mcu_y / data_table -> max_sf_v) * block_size + mcu_x / data_table -> max_sf_h;
+            int* cb_unit = mcu -> reduced_units + (mcu -> comp_du_count)[0] * REDUCED_UNIT_LENGTH + offset;
+            int* cr_unit = mcu -> reduced_units + ((mcu -> comp_du_count)[0] + (mcu -> comp_du_count)[1]) * REDUCED_UNIT_LENGTH + offset;
+            ycbcr_to_pixel(luma, cb_unit[chroma], cr_unit[chroma], output);
+        }
+    }
+
+    return reduced;
+}
+
 void deallocate_mcu(MCU mcu) {
     for (unsigned char j = 0; j < mcu.data_units_count; ++j) {
         free(mcu.data_units[j]);
     }
     free(mcu.data_units);
+    free(mcu.reduced_units);
     return;
 }
 
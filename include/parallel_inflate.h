@@ -0,0 +1,202 @@
+#ifndef _PARALLEL_INFLATE_H_
+#define _PARALLEL_INFLATE_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./decompressor.h"
+
+#ifndef _NO_THREADS_
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#endif //_NO_THREADS_
+
+#ifndef MAX_DECODING_THREADS
+#define MAX_DECODING_THREADS 16
+#endif //MAX_DECODING_THREADS
+
+#define SEGMENT_INFLATE_STEP 0x10000
+
+typedef void (*ParallelTask)(void* task);
+
+typedef struct SegmentWorker {
+    InflateSegment* segment;
+    SegmentCallback on_inflated;
+    void* user_data;
+    void* has_failed; // Atomic flag that lets the other workers give up early
+} SegmentWorker;
+
+#ifndef _NO_THREADS_
+typedef struct TaskThread {
+    ParallelTask run_task;
+    void* task;
+} TaskThread;
+#endif //_NO_THREADS_
+
+/* -------------------------------------------------------------------------------------- */
+
+static void inflate_segment(InflateSegment* segment, SegmentCallback on_inflated, void* user_data, void* has_failed);
+static void segment_worker(void* task);
+#ifndef _NO_THREADS_
+static void* task_thread(void* arg);
+#endif //_NO_THREADS_
+void set_decoding_threads(unsigned int threads_count);
+unsigned int get_decoding_threads(void);
+void run_parallel_tasks(ParallelTask run_task, void* tasks, unsigned int task_size, unsigned int tasks_count);
+bool inflate_segments(InflateSegment* segments, unsigned int segments_count, SegmentCallback on_inflated, void* user_data);
+void deallocate_segments(InflateSegment* segments, unsigned int segments_count);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Threads used to decode a single image, zero means one for each online processor
+static unsigned int decoding_threads = 0;
+
+static void inflate_segment(InflateSegment* segment, SegmentCallback on_inflated, void* user_data, void* has_failed) {
+    Inflater* inflater = allocate_segment_inflater(segment -> span, segment -> next_span, segment -> source, segment -> is_stream_start);
+    inflater -> verify_adler = segment -> verify_adler;
+
+    if (segment -> capacity < SEGMENT_INFLATE_STEP) {
+        segment -> capacity = SEGMENT_INFLATE_STEP;
+    }
+    segment -> data = (unsigned char*) realloc(segment -> data, segment -> capacity);
+
+    while (!(inflater -> is_done) && inflater -> error == NULL) {
+#ifndef _NO_THREADS_
+        if (has_failed != NULL && atomic_load((atomic_bool*) has_failed)) {
+            inflater -> error = "another segment failed\n";
+            break;
+        }
+#else
+        NOT_USED(has_failed);
+#endif //_NO_THREADS_
+
+        if (segment -> capacity - segment -> length < SEGMENT_INFLATE_STEP) {
+            segment -> capacity *= 2;
+            segment -> data = (unsigned char*) realloc(segment -> data, segment -> capacity);
+        }
+        segment -> length += inflate_n_bytes(inflater, segment -> data + segment -> length, SEGMENT_INFLATE_STEP);
+    }
+
+    segment -> adler_register = inflater -> adler_register;
+    segment -> expected_adler = inflater -> expected_adler;
+    segment -> is_final = inflater -> is_final_block;
+    segment -> error = inflater -> error;
+    deallocate_inflater(inflater);
+
+    if (segment -> error == NULL && on_inflated != NULL) {
+        on_inflated(segment, user_data);
+    }
+
+#ifndef _NO_THREADS_
+    if (segment -> error != NULL && has_failed != NULL) {
+        atomic_store((atomic_bool*) has_failed, TRUE);
+    }
+#endif //_NO_THREADS_
+
+    return;
+}
+
+static void segment_worker(void* task) {
+    SegmentWorker* worker = (SegmentWorker*) task;
+    inflate_segment(worker -> segment, worker -> on_inflated, worker -> user_data, worker -> has_failed);
+    return;
+}
+
+#ifndef _NO_THREADS_
+
+static void* task_thread(void* arg) {
+    TaskThread* thread = (TaskThread*) arg;
+    (thread -> run_task)(thread -> task);
+    return NULL;
+}
+
+#endif //_NO_THREADS_
+
+void set_decoding_threads(unsigned int threads_count) {
+    decoding_threads = threads_count;
+    return;
+}
+
+unsigned int get_decoding_threads(void) {
+#ifdef _NO_THREADS_
+    return 1;
+#else
+    long int threads_count = decoding_threads;
+    if (threads_count == 0) {
+        threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    return CLAMP(threads_count, 1, MAX_DECODING_THREADS);
+#endif //_NO_THREADS_
+}
+
+// Run each task on its own thread, the calling thread takes the first one
+void run_parallel_tasks(ParallelTask run_task, void* tasks, unsigned int task_size, unsigned int tasks_count) {
+#ifdef _NO_THREADS_
+    for (unsigned int i = 0; i < tasks_count; ++i) {
+        run_task((unsigned char*) tasks + i * task_size);
+    }
+#else
+    pthread_t* threads = (pthread_t*) calloc(tasks_count, sizeof(pthread_t));
+    TaskThread* task_threads = (TaskThread*) calloc(tasks_count, sizeof(TaskThread));
+    bool* is_running = (bool*) calloc(tasks_count, sizeof(bool));
+
+    for (unsigned int i = 1; i < tasks_count; ++i) {
+        task_threads[i] = (TaskThread) {.run_task = run_task, .task = (unsigned char*) tasks + i * task_size};
+        is_running[i] = !pthread_create(threads + i, NULL, task_thread, task_threads + i);
+    }
+
+    if (tasks_count) run_task(tasks);
+
+    // The tasks whose thread couldn't be created run here
+    for (unsigned int i = 1; i < tasks_count; ++i) {
+        if (is_running[i]) pthread_join(threads[i], NULL);
+        else run_task((unsigned char*) tasks + i * task_size);
+    }
+
+    free(threads);
+    free(task_threads);
+    free(is_running);
+#endif //_NO_THREADS_
+
+    return;
+}
+
+// Inflate each segment on its own thread, the callback runs on the same thread right after the segment is inflated
+bool inflate_segments(InflateSegment* segments, unsigned int segments_count, SegmentCallback on_inflated, void* user_data) {
+    SegmentWorker* workers = (SegmentWorker*) calloc(segments_count, sizeof(SegmentWorker));
+
+#ifdef _NO_THREADS_
+    void* has_failed = NULL;
+#else
+    atomic_bool failed = FALSE;
+    void* has_failed = &failed;
+#endif //_NO_THREADS_
+
+    for (unsigned int i = 0; i < segments_count; ++i) {
+        workers[i] = (SegmentWorker) {.segment = segments + i, .on_inflated = on_inflated, .user_data = user_data, .has_failed = has_failed};
+    }
+
+    run_parallel_tasks(segment_worker, workers, sizeof(SegmentWorker), segments_count);
+    free(workers);
+
+    for (unsigned int i = 0; i < segments_count; ++i) {
+        if (segments[i].error != NULL) {
+            debug_print(YELLOW, "segment %u failed: %s", i, segments[i].error);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void deallocate_segments(InflateSegment* segments, unsigned int segments_count) {
+    for (unsigned int i = 0; i < segments_count; ++i) {
+        free(segments[i].data);
+    }
+    free(segments);
+    return;
+}
+
+#endif //_PARALLEL_INFLATE_H_
@@ -0,0 +1,110 @@
+#ifndef _PYRAMID_H_
+#define _PYRAMID_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+
+/* -------------------------------------------------------------------------------------- */
+
+static void reduce_row_pair(const unsigned char* first, const unsigned char* second, unsigned char* output, unsigned int width, unsigned char components);
+static void push_pyramid_row(Image* levels, unsigned int level, unsigned int y, unsigned int levels_count);
+unsigned int get_pyramid_levels_count(unsigned int width, unsigned int height);
+void fill_pyramid_levels(Image* levels, unsigned int first_level, unsigned int levels_count);
+Image* build_image_pyramid(Image image, unsigned int* levels_count);
+void deallocate_pyramid(Image* levels, unsigned int levels_count);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Average each 2x2 square of pixels of the two rows, the last column is repeated when the width is odd
+static void reduce_row_pair(const unsigned char* first, const unsigned char* second, unsigned char* output, unsigned int width, unsigned char components) {
+    unsigned int pairs_count = width / 2;
+    for (unsigned int x = 0; x < pairs_count; ++x) {
+        for (unsigned char c = 0; c < components; ++c) {
+            *output++ = (first[c] + first[components + c] + second[c] + second[components + c] + 2) >> 2;
+        }
+        first += 2 * components;
+        second += 2 * components;
+    }
+
+    if (width & 1) {
+        for (unsigned char c = 0; c < components; ++c) {
+            *output++ = (first[c] + second[c] + 1) >> 1;
+        }
+    }
+
+    return;
+}
+
+// Each row of a level completes, with the previous one, a row of the next level, which is pushed down right away:
+// the rows are reduced while they are still in cache, and the last row is repeated when the height is odd
+static void push_pyramid_row(Image* levels, unsigned int level, unsigned int y, unsigned int levels_count) {
+    Image* source = levels + level;
+    if (level + 1 >= levels_count || (!(y & 1) && y + 1 < source -> height)) {
+        return;
+    }
+
+    unsigned int row_length = source -> width * source -> components;
+    const unsigned char* second = source -> decoded_data + (unsigned long long int) y * row_length;
+    const unsigned char* first = (y & 1) ? second - row_length : second;
+    Image* destination = levels + level + 1;
+    unsigned char* output = destination -> decoded_data + (unsigned long long int) (y / 2) * destination -> width * destination -> components;
+    reduce_row_pair(first, second, output, source -> width, source -> components);
+
+    push_pyramid_row(levels, level + 1, y / 2, levels_count);
+
+    return;
+}
+
+// Levels from the full image down to 1 x 1, each one half the size of the previous one (rounded up)
+unsigned int get_pyramid_levels_count(unsigned int width, unsigned int height) {
+    unsigned int levels_count = 1;
+    while (width > 1 || height > 1) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        levels_count++;
+    }
+    return levels_count;
+}
+
+// Produce the levels after the first one, which is complete, reading each of its rows only once
+void fill_pyramid_levels(Image* levels, unsigned int first_level, unsigned int levels_count) {
+    for (unsigned int level = first_level + 1; level < levels_count; ++level) {
+        Image* previous = levels + level - 1;
+        levels[level] = (Image) {.width = (previous -> width + 1) / 2, .height = (previous -> height + 1) / 2, .components = previous -> components};
+        levels[level].size = levels[level].width * levels[level].height * levels[level].components;
+        levels[level].decoded_data = (unsigned char*) calloc(levels[level].size, sizeof(unsigned char));
+    }
+
+    for (unsigned int y = 0; y < levels[first_level].height; ++y) {
+        push_pyramid_row(levels, first_level, y, levels_count);
+    }
+
+    return;
+}
+
+// The image becomes the first level of the pyramid, the others are halved with a 2x2 box filter
+Image* build_image_pyramid(Image image, unsigned int* levels_count) {
+    *levels_count = (image.error || image.decoded_data == NULL) ? 1 : get_pyramid_levels_count(image.width, image.height);
+    Image* levels = (Image*) calloc(*levels_count, sizeof(Image));
+    levels[0] = image;
+
+    if (*levels_count > 1) {
+        debug_print(BLUE, "building %u pyramid levels...\n", *levels_count);
+        fill_pyramid_levels(levels, 0, *levels_count);
+    }
+
+    return levels;
+}
+
+void deallocate_pyramid(Image* levels, unsigned int levels_count) {
+    debug_print(BLUE, "deallocating pyramid...\n");
+    for (unsigned int i = 0; i < levels_count; ++i) {
+        free(levels[i].decoded_data);
+    }
+    free(levels);
+    return;
+}
+
+#endif //_PYRAMID_H_
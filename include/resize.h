@@ -0,0 +1,414 @@
+#ifndef _RESIZE_H_
+#define _RESIZE_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./simd.h"
+#include "./parallel_inflate.h"
+
+#ifndef PI
+#define PI 3.14159265358979323846L
+#endif //PI
+
+#define RESAMPLE_PRECISION 14 // Fractional bits of the weights, which sum to 1 << RESAMPLE_PRECISION
+#define MIN_RESIZE_BAND_ROWS 16 // Output rows below which a band isn't worth a thread
+
+// Radius of each filter, in input pixels, when the image isn't shrinked
+static const double filter_supports[] = {0.5, 1.0, 2.0, 3.0};
+
+/* -------------------------------------------------------------------------------------- */
+
+static double sinc(double x);
+static double evaluate_filter(ResampleFilter filter, double x);
+static void compute_resample_weights(ResampleWeights* weights, unsigned int input_size, unsigned int output_size, ResampleFilter filter);
+static void deallocate_resample_weights(ResampleWeights* weights);
+static void resample_row(const unsigned char* input, unsigned int input_length, unsigned char* output, const ResampleWeights* weights, unsigned int width, unsigned char components);
+static void resample_rows(const unsigned char** rows, const short int* weights, unsigned int count, unsigned char* output, unsigned int length);
+static void init_resize_band(Resizer* resizer, ResizeBand* band, unsigned int first_row, unsigned int last_row);
+static void push_band_row(ResizeBand* band, const unsigned char* row);
+static void resize_band(void* task);
+Resizer* allocate_resizer(unsigned int input_width, unsigned int input_height, unsigned char components, unsigned int width, unsigned int height, ResampleFilter filter);
+unsigned int push_resizer_rows(Resizer* resizer, const unsigned char* rows, unsigned int rows_count, unsigned int stride);
+Image finish_resizer(Resizer* resizer);
+Image resize_image(Image image, unsigned int width, unsigned int height, ResampleFilter filter);
+
+/* -------------------------------------------------------------------------------------- */
+
+static double sinc(double x) {
+    if (x == 0.0) return 1.0;
+    x *= PI;
+    return sin(x) / x;
+}
+
+static double evaluate_filter(ResampleFilter filter, double x) {
+    if (filter == RESAMPLE_BOX) {
+        return (x > -0.5 && x <= 0.5) ? 1.0 : 0.0;
+    }
+
+    x = fabs(x);
+    if (filter == RESAMPLE_BILINEAR) {
+        return (x < 1.0) ? 1.0 - x : 0.0;
+    } else if (filter == RESAMPLE_BICUBIC) {
+        // Keys cubic convolution, with a = -0.5
+        if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+        else if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+        return 0.0;
+    }
+
+    return (x < 3.0) ? sinc(x) * sinc(x / 3.0) : 0.0;
+}
+
+// The filter is stretched when shrinking, so that every input pixel contributes to the output: the weights of the
+// pixels outside the image are dropped and the others normalized, then rounded so that they still sum to one
+static void compute_resample_weights(ResampleWeights* weights, unsigned int input_size, unsigned int output_size, ResampleFilter filter) {
+    double scale = (double) input_size / output_size;
+    double filter_scale = (scale > 1.0) ? scale : 1.0;
+    double support = filter_supports[filter] * filter_scale;
+    unsigned int max_taps = (unsigned int) ceil(support) * 2 + 1;
+
+    weights -> taps = (max_taps + 3) & ~3;
+    weights -> starts = (unsigned int*) calloc(output_size, sizeof(unsigned int));
+    weights -> counts = (unsigned int*) calloc(output_size, sizeof(unsigned int));
+    weights -> weights = (short int*) calloc((unsigned long long int) output_size * weights -> taps, sizeof(short int));
+    double* values = (double*) calloc(max_taps, sizeof(double));
+
+    for (unsigned int i = 0; i < output_size; ++i) {
+        double center = (i + 0.5) * scale;
+        long long int first = (long long int) floor(center - support + 0.5);
+        long long int last = (long long int) floor(center + support + 0.5);
+        if (first < 0) first = 0;
+        if (last > input_size) last = input_size;
+        if (last - first > max_taps) last = first + max_taps;
+        if (last <= first) last = first + 1;
+
+        unsigned int count = last - first;
+        double total = 0.0;
+        for (unsigned int j = 0; j < count; ++j) {
+            values[j] = evaluate_filter(filter, (first + j - center + 0.5) / filter_scale);
+            total += values[j];
+        }
+
+        if (total == 0.0) {
+            values[0] = total = 1.0;
+        }
+
+        short int* output = weights -> weights + (unsigned long long int) i * weights -> taps;
+        int sum = 0;
+        unsigned int largest = 0;
+        for (unsigned int j = 0; j < count; ++j) {
+            output[j] = (short int) lround(values[j] / total * (1 << RESAMPLE_PRECISION));
+            sum += output[j];
+            if (output[j] > output[largest]) largest = j;
+        }
+        output[largest] += (1 << RESAMPLE_PRECISION) - sum;
+
+        (weights -> starts)[i] = first;
+        (weights -> counts)[i] = count;
+    }
+
+    free(values);
+
+    return;
+}
+
+static void deallocate_resample_weights(ResampleWeights* weights) {
+    free(weights -> starts);
+    free(weights -> counts);
+    free(weights -> weights);
+    return;
+}
+
+// Horizontal pass over a single row: the SIMD paths multiply two taps (four with AVX2) of every channel at once,
+// the pixels near the end of the row, whose padded taps would read past it, take the scalar path
+static void resample_row(const unsigned char* input, unsigned int input_length, unsigned char* output, const ResampleWeights* weights, unsigned int width, unsigned char components) {
+#ifndef _USE_SSE2_
+    (void) input_length; // Only the SIMD paths read past the taps
+#endif //_USE_SSE2_
+
+    for (unsigned int x = 0; x < width; ++x, output += components) {
+        const unsigned char* pixels = input + (unsigned long long int) (weights -> starts)[x] * components;
+        const short int* taps = weights -> weights + (unsigned long long int) x * weights -> taps;
+        unsigned int count = (weights -> counts)[x];
+
+#ifdef _USE_SSE2_
+        unsigned int padded_count = (count + 1) & ~1;
+        if ((unsigned long long int) ((weights -> starts)[x] + padded_count - 1) * components + 4 <= input_length) {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i sum = _mm_set1_epi32(1 << (RESAMPLE_PRECISION - 1));
+            unsigned int j = 0;
+            int pixel[4] = {0};
+            int pair[2] = {0};
+
+#ifdef _USE_AVX2_
+            __m256i wide_sum = _mm256_setzero_si256();
+            for (; j + 4 <= padded_count; j += 4) {
+                for (unsigned char k = 0; k < 4; ++k) memcpy(pixel + k, pixels + (j + k) * components, 4);
+                memcpy(pair, taps + j, 8);
+                __m256i even = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_cvtsi32_si128(pixel[0]), _mm_cvtsi32_si128(pixel[2])));
+                __m256i odd = _mm256_cvtepu8_epi16(_mm_unpacklo_epi64(_mm_cvtsi32_si128(pixel[1]), _mm_cvtsi32_si128(pixel[3])));
+                __m256i pair_weights = _mm256_setr_epi32(pair[0], pair[0], pair[0], pair[0], pair[1], pair[1], pair[1], pair[1]);
+                wide_sum = _mm256_add_epi32(wide_sum, _mm256_madd_epi16(_mm256_unpacklo_epi16(even, odd), pair_weights));
+            }
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm256_castsi256_si128(wide_sum), _mm256_extracti128_si256(wide_sum, 1)));
+#endif //_USE_AVX2_
+
+            // Interleave the channels of two pixels, so that each 32-bit lane sums a channel
+            for (; j < padded_count; j += 2) {
+                memcpy(pixel, pixels + j * components, 4);
+                memcpy(pixel + 1, pixels + (j + 1) * components, 4);
+                memcpy(pair, taps + j, 4);
+                __m128i even = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel[0]), zero);
+                __m128i odd = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel[1]), zero);
+                sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_unpacklo_epi16(even, odd), _mm_set1_epi32(pair[0])));
+            }
+
+            sum = _mm_srai_epi32(sum, RESAMPLE_PRECISION);
+            sum = _mm_packus_epi16(_mm_packs_epi32(sum, sum), zero);
+            pixel[0] = _mm_cvtsi128_si32(sum);
+            memcpy(output, pixel, components);
+            continue;
+        }
+#endif //_USE_SSE2_
+
+        for (unsigned char c = 0; c < components; ++c) {
+            int sum = 1 << (RESAMPLE_PRECISION - 1);
+            for (unsigned int j = 0; j < count; ++j) {
+                sum += pixels[j * components + c] * taps[j];
+            }
+            sum >>= RESAMPLE_PRECISION;
+            output[c] = CLAMP(sum, 0, 255);
+        }
+    }
+
+    return;
+}
+
+// Vertical pass: each output byte is the weighted sum of the bytes in the same column of the given rows.
+// The rows are taken two at a time, the weight after the last one is always a zero of the padding
+static void resample_rows(const unsigned char** rows, const short int* weights, unsigned int count, unsigned char* output, unsigned int length) {
+    unsigned int i = 0;
+
+#ifdef _USE_AVX2_
+    const __m256i wide_zero = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32) {
+        __m256i sums[4];
+        for (unsigned char k = 0; k < 4; ++k) sums[k] = _mm256_set1_epi32(1 << (RESAMPLE_PRECISION - 1));
+
+        for (unsigned int j = 0; j < count; j += 2) {
+            __m256i first = _mm256_loadu_si256((const __m256i*) (rows[j] + i));
+            __m256i second = (j + 1 < count) ? _mm256_loadu_si256((const __m256i*) (rows[j + 1] + i)) : wide_zero;
+            int pair = 0;
+            memcpy(&pair, weights + j, 4);
+            __m256i pair_weights = _mm256_set1_epi32(pair);
+
+            __m256i first_low = _mm256_unpacklo_epi8(first, wide_zero);
+            __m256i first_high = _mm256_unpackhi_epi8(first, wide_zero);
+            __m256i second_low = _mm256_unpacklo_epi8(second, wide_zero);
+            __m256i second_high = _mm256_unpackhi_epi8(second, wide_zero);
+            sums[0] = _mm256_add_epi32(sums[0], _mm256_madd_epi16(_mm256_unpacklo_epi16(first_low, second_low), pair_weights));
+            sums[1] = _mm256_add_epi32(sums[1], _mm256_madd_epi16(_mm256_unpackhi_epi16(first_low, second_low), pair_weights));
+            sums[2] = _mm256_add_epi32(sums[2], _mm256_madd_epi16(_mm256_unpacklo_epi16(first_high, second_high), pair_weights));
+            sums[3] = _mm256_add_epi32(sums[3], _mm256_madd_epi16(_mm256_unpackhi_epi16(first_high, second_high), pair_weights));
+        }
+
+        // The unpacks and the packs both work within the 128-bit lanes, so the bytes end up back in order
+        for (unsigned char k = 0; k < 4; ++k) sums[k] = _mm256_srai_epi32(sums[k], RESAMPLE_PRECISION);
+        __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(sums[0], sums[1]), _mm256_packs_epi32(sums[2], sums[3]));
+        _mm256_storeu_si256((__m256i*) (output + i), packed);
+    }
+#endif //_USE_AVX2_
+
+#ifdef _USE_SSE2_
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i sums[4];
+        for (unsigned char k = 0; k < 4; ++k) sums[k] = _mm_set1_epi32(1 << (RESAMPLE_PRECISION - 1));
+
+        for (unsigned int j = 0; j < count; j += 2) {
+            __m128i first = _mm_loadu_si128((const __m128i*) (rows[j] + i));
+            __m128i second = (j + 1 < count) ? _mm_loadu_si128((const __m128i*) (rows[j + 1] + i)) : zero;
+            int pair = 0;
+            memcpy(&pair, weights + j, 4);
+            __m128i pair_weights = _mm_set1_epi32(pair);
+
+            __m128i first_low = _mm_unpacklo_epi8(first, zero);
+            __m128i first_high = _mm_unpackhi_epi8(first, zero);
+            __m128i second_low = _mm_unpacklo_epi8(second, zero);
+            __m128i second_high = _mm_unpackhi_epi8(second, zero);
+            sums[0] = _mm_add_epi32(sums[0], _mm_madd_epi16(_mm_unpacklo_epi16(first_low, second_low), pair_weights));
+            sums[1] = _mm_add_epi32(sums[1], _mm_madd_epi16(_mm_unpackhi_epi16(first_low, second_low), pair_weights));
+            sums[2] = _mm_add_epi32(sums[2], _mm_madd_epi16(_mm_unpacklo_epi16(first_high, second_high), pair_weights));
+            sums[3] = _mm_add_epi32(sums[3], _mm_madd_epi16(_mm_unpackhi_epi16(first_high, second_high), pair_weights));
+        }
+
+        for (unsigned char k = 0; k < 4; ++k) sums[k] = _mm_srai_epi32(sums[k], RESAMPLE_PRECISION);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]), _mm_packs_epi32(sums[2], sums[3]));
+        _mm_storeu_si128((__m128i*) (output + i), packed);
+    }
+#endif //_USE_SSE2_
+
+    for (; i < length; ++i) {
+        int sum = 1 << (RESAMPLE_PRECISION - 1);
+        for (unsigned int j = 0; j < count; ++j) {
+            sum += rows[j][i] * weights[j];
+        }
+        sum >>= RESAMPLE_PRECISION;
+        output[i] = CLAMP(sum, 0, 255);
+    }
+
+    return;
+}
+
+static void init_resize_band(Resizer* resizer, ResizeBand* band, unsigned int first_row, unsigned int last_row) {
+    unsigned int row_length = (resizer -> image).width * (resizer -> image).components;
+    band -> resizer = resizer;
+    band -> ring = (unsigned char*) calloc((unsigned long long int) (resizer -> vertical).taps * row_length, sizeof(unsigned char));
+    band -> rows = (const unsigned char**) calloc((resizer -> vertical).taps, sizeof(unsigned char*));
+    band -> input_row = 0;
+    band -> output_row = first_row;
+    band -> last_row = last_row;
+    return;
+}
+
+// Resize the next input row horizontally into the ring, then produce every output row that doesn't need the
+// following ones: the ring holds as many rows as the vertical taps, so the rows it overwrites are no longer needed
+static void push_band_row(ResizeBand* band, const unsigned char* row) {
+    Resizer* resizer = band -> resizer;
+    ResampleWeights* vertical = &(resizer -> vertical);
+    unsigned char components = (resizer -> image).components;
+    unsigned int row_length = (resizer -> image).width * components;
+    unsigned int input_row = (band -> input_row)++;
+
+    if (band -> output_row >= band -> last_row || input_row < (vertical -> starts)[band -> output_row]) {
+        return;
+    }
+
+    unsigned char* ring_row = band -> ring + (unsigned long long int) (input_row % vertical -> taps) * row_length;
+    resample_row(row, resizer -> input_width * components, ring_row, &(resizer -> horizontal), (resizer -> image).width, components);
+
+    while (band -> output_row < band -> last_row && (vertical -> starts)[band -> output_row] + (vertical -> counts)[band -> output_row] <= input_row + 1) {
+        unsigned int start = (vertical -> starts)[band -> output_row];
+        unsigned int count = (vertical -> counts)[band -> output_row];
+        for (unsigned int j = 0; j < count; ++j) {
+            (band -> rows)[j] = band -> ring + (unsigned long long int) ((start + j) % vertical -> taps) * row_length;
+        }
+
+        unsigned char* output = (resizer -> image).decoded_data + (unsigned long long int) (band -> output_row) * row_length;
+        resample_rows(band -> rows, vertical -> weights + (unsigned long long int) (band -> output_row) * vertical -> taps, count, output, row_length);
+        (band -> output_row)++;
+    }
+
+    return;
+}
+
+// Each band streams only the input rows that its output rows need, which overlap a few rows with the next band
+static void resize_band(void* task) {
+    ResizeBand* band = (ResizeBand*) task;
+    ResampleWeights* vertical = &((band -> resizer) -> vertical);
+    band -> input_row = (vertical -> starts)[band -> output_row];
+    unsigned int last_input_row = (vertical -> starts)[band -> last_row - 1] + (vertical -> counts)[band -> last_row - 1];
+
+    while (band -> input_row < last_input_row) {
+        push_band_row(band, band -> input + (unsigned long long int) (band -> input_row) * band -> stride);
+    }
+
+    free(band -> ring);
+    free(band -> rows);
+
+    return;
+}
+
+// Resize a stream of rows with 1 to 4 components: the rows are pushed from top to bottom and each output row is
+// produced as soon as its last input row arrives
+Resizer* allocate_resizer(unsigned int input_width, unsigned int input_height, unsigned char components, unsigned int width, unsigned int height, ResampleFilter filter) {
+    if (input_width == 0 || input_height == 0 || width == 0 || height == 0 || components == 0 || components > 4 || filter > RESAMPLE_LANCZOS3) {
+        error_print("invalid resize from %u x %u to %u x %u!\n", input_width, input_height, width, height);
+        return NULL;
+    }
+
+    Resizer* resizer = (Resizer*) calloc(1, sizeof(Resizer));
+    resizer -> input_width = input_width;
+    resizer -> input_height = input_height;
+    resizer -> image = (Image) {.width = width, .height = height, .components = components, .size = width * height * components};
+    (resizer -> image).decoded_data = (unsigned char*) calloc((resizer -> image).size, sizeof(unsigned char));
+
+    compute_resample_weights(&(resizer -> horizontal), input_width, width, filter);
+    compute_resample_weights(&(resizer -> vertical), input_height, height, filter);
+    init_resize_band(resizer, &(resizer -> band), 0, height);
+
+    debug_print(BLUE, "resizing from %u x %u to %u x %u, with %u x %u taps\n", input_width, input_height, width, height, (resizer -> horizontal).taps, (resizer -> vertical).taps);
+
+    return resizer;
+}
+
+// Push the next rows, each one stride bytes after the previous one, and return the output rows produced so far
+unsigned int push_resizer_rows(Resizer* resizer, const unsigned char* rows, unsigned int rows_count, unsigned int stride) {
+    ResizeBand* band = &(resizer -> band);
+    if (rows_count > resizer -> input_height - band -> input_row) {
+        error_print("too many rows: %u, only %u are left!\n", rows_count, resizer -> input_height - band -> input_row);
+        rows_count = resizer -> input_height - band -> input_row;
+    }
+
+    for (unsigned int i = 0; i < rows_count; ++i) {
+        push_band_row(band, rows + (unsigned long long int) i * stride);
+    }
+
+    return band -> output_row;
+}
+
+Image finish_resizer(Resizer* resizer) {
+    Image image = resizer -> image;
+    if ((resizer -> band).output_row < image.height) {
+        error_print("only %u rows out of %u were pushed!\n", (resizer -> band).input_row, resizer -> input_height);
+        image.error = EXCEEDED_LENGTH;
+    }
+
+    deallocate_resample_weights(&(resizer -> horizontal));
+    deallocate_resample_weights(&(resizer -> vertical));
+    free((resizer -> band).ring);
+    free((resizer -> band).rows);
+    free(resizer);
+
+    return image;
+}
+
+// Resize a whole image, splitting the output rows in bands resized in parallel
+Image resize_image(Image image, unsigned int width, unsigned int height, ResampleFilter filter) {
+    if (image.decoded_data == NULL) {
+        error_print("invalid image to resize!\n");
+        return (Image) {.error = INVALID_IMAGE_SIZE};
+    }
+
+    Resizer* resizer = allocate_resizer(image.width, image.height, image.components, width, height, filter);
+    if (resizer == NULL) {
+        return (Image) {.error = INVALID_IMAGE_SIZE};
+    }
+
+    unsigned int threads_count = get_decoding_threads();
+    unsigned int bands_count = height / MIN_RESIZE_BAND_ROWS;
+    if (bands_count > threads_count) bands_count = threads_count;
+    if (bands_count == 0) bands_count = 1;
+
+    ResizeBand* bands = (ResizeBand*) calloc(bands_count, sizeof(ResizeBand));
+    for (unsigned int i = 0; i < bands_count; ++i) {
+        unsigned int first_row = (unsigned long long int) height * i / bands_count;
+        unsigned int last_row = (unsigned long long int) height * (i + 1) / bands_count;
+        init_resize_band(resizer, bands + i, first_row, last_row);
+        bands[i].input = image.decoded_data;
+        bands[i].stride = image.width * image.components;
+    }
+
+    debug_print(BLUE, "resizing %u bands...\n", bands_count);
+    run_parallel_tasks(resize_band, bands, sizeof(ResizeBand), bands_count);
+    free(bands);
+
+    // Every row was produced by the bands
+    (resizer -> band).output_row = height;
+
+    return finish_resizer(resizer);
+}
+
+#endif //_RESIZE_H_
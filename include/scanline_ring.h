@@ -0,0 +1,89 @@
+#ifndef _SCANLINE_RING_H_
+#define _SCANLINE_RING_H_
+
+#ifndef _NO_THREADS_
+
+#include <stdlib.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "./types.h"
+
+// Lock-free ring of scanlines between a single producer and a single consumer, each side waits while the other one is behind
+typedef struct ScanlineRing {
+    unsigned char* slots;
+    unsigned int slot_size;
+    unsigned int slots_count;
+    atomic_uint produced; // Scanlines written by the producer
+    atomic_uint released; // Scanlines the consumer is done with, their slots can be written again
+    atomic_bool is_closed; // The producer won't write other scanlines
+} ScanlineRing;
+
+/* -------------------------------------------------------------------------------------- */
+
+void init_scanline_ring(ScanlineRing* ring, unsigned int slot_size, unsigned int slots_count);
+unsigned char* reserve_scanline(ScanlineRing* ring);
+void commit_scanline(ScanlineRing* ring);
+void close_scanline_ring(ScanlineRing* ring);
+unsigned char* acquire_scanline(ScanlineRing* ring, unsigned int index);
+void release_scanlines(ScanlineRing* ring, unsigned int count);
+void deallocate_scanline_ring(ScanlineRing* ring);
+
+/* -------------------------------------------------------------------------------------- */
+
+void init_scanline_ring(ScanlineRing* ring, unsigned int slot_size, unsigned int slots_count) {
+    ring -> slots = (unsigned char*) calloc((unsigned long long int) slot_size * slots_count, sizeof(unsigned char));
+    ring -> slot_size = slot_size;
+    ring -> slots_count = slots_count;
+    atomic_init(&(ring -> produced), 0);
+    atomic_init(&(ring -> released), 0);
+    atomic_init(&(ring -> is_closed), FALSE);
+    return;
+}
+
+// Wait for a free slot, the scanline written there is published by commit_scanline
+unsigned char* reserve_scanline(ScanlineRing* ring) {
+    unsigned int produced = atomic_load_explicit(&(ring -> produced), memory_order_relaxed);
+    while (produced - atomic_load_explicit(&(ring -> released), memory_order_acquire) >= ring -> slots_count) {
+        sched_yield();
+    }
+    return ring -> slots + (unsigned long long int) (produced % ring -> slots_count) * ring -> slot_size;
+}
+
+void commit_scanline(ScanlineRing* ring) {
+    atomic_fetch_add_explicit(&(ring -> produced), 1, memory_order_release);
+    return;
+}
+
+void close_scanline_ring(ScanlineRing* ring) {
+    atomic_store_explicit(&(ring -> is_closed), TRUE, memory_order_release);
+    return;
+}
+
+// Wait for the scanline at index, returns NULL if the producer closed the ring before writing it
+unsigned char* acquire_scanline(ScanlineRing* ring, unsigned int index) {
+    while (atomic_load_explicit(&(ring -> produced), memory_order_acquire) <= index) {
+        if (atomic_load_explicit(&(ring -> is_closed), memory_order_acquire)) {
+            // The last scanlines may have been committed right before closing
+            if (atomic_load_explicit(&(ring -> produced), memory_order_acquire) > index) break;
+            return NULL;
+        }
+        sched_yield();
+    }
+    return ring -> slots + (unsigned long long int) (index % ring -> slots_count) * ring -> slot_size;
+}
+
+// Give back the slots of the scanlines before count
+void release_scanlines(ScanlineRing* ring, unsigned int count) {
+    atomic_store_explicit(&(ring -> released), count, memory_order_release);
+    return;
+}
+
+void deallocate_scanline_ring(ScanlineRing* ring) {
+    free(ring -> slots);
+    ring -> slots = NULL;
+    return;
+}
+
+#endif //_NO_THREADS_
+
+#endif //_SCANLINE_RING_H_
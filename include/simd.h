@@ -0,0 +1,35 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+// The SIMD paths are selected at compile time from the target flags (e.g. -mssse3, -mavx2 or -march=native),
+// defining _NO_SIMD_ forces the scalar implementations
+#ifndef _NO_SIMD_
+
+#if defined(__SSE2__)
+#define _USE_SSE2_
+#include <emmintrin.h>
+#endif //__SSE2__
+
+#if defined(__SSSE3__)
+#define _USE_SSSE3_
+#include <tmmintrin.h>
+#endif //__SSSE3__
+
+#if defined(__SSE4_1__)
+#define _USE_SSE41_
+#include <smmintrin.h>
+#endif //__SSE4_1__
+
+#if defined(__PCLMUL__) && defined(__SSE4_1__)
+#define _USE_PCLMUL_
+#include <wmmintrin.h>
+#endif //__PCLMUL__
+
+#if defined(__AVX2__)
+#define _USE_AVX2_
+#include <immintrin.h>
+#endif //__AVX2__
+
+#endif //_NO_SIMD_
+
+#endif //_SIMD_H_
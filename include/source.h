@@ -0,0 +1,298 @@
+#ifndef _SOURCE_H_
+#define _SOURCE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "./types.h"
+#include "./debug_print.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif //_WIN32
+
+#ifndef _NO_THREADS_
+#include <pthread.h>
+#endif //_NO_THREADS_
+
+#define SOURCE_BLOCK_LENGTH 0x10000 // Bytes asked to the source by each read
+
+typedef struct FdSource {
+    IdlSource source;
+    int fd;
+} FdSource;
+
+typedef struct FileSource {
+    IdlSource source;
+    FILE* file;
+} FileSource;
+
+typedef struct MemorySource {
+    IdlSource source;
+    const unsigned char* data;
+    unsigned int length;
+    unsigned int pos;
+} MemorySource;
+
+#ifndef _NO_THREADS_
+// Ring of bytes between a writer and the decoder reading from the other thread, each side waits while the other one is behind
+typedef struct PipeSource {
+    IdlSource source;
+    unsigned char* data;
+    unsigned int capacity;
+    unsigned int start; // Position of the first byte not read yet
+    unsigned int length; // Bytes written and not read yet
+    bool is_closed; // The writer won't write other bytes
+    bool is_released; // The reader is gone, so the writes are dropped
+    pthread_mutex_t lock;
+    pthread_cond_t has_data;
+    pthread_cond_t has_space;
+} PipeSource;
+#endif //_NO_THREADS_
+
+/* -------------------------------------------------------------------------------------- */
+
+static int read_fd_source(void* handle, unsigned char* buffer, unsigned int length);
+static bool skip_fd_source(void* handle, unsigned int length);
+static long long int get_fd_source_size(void* handle);
+static int read_file_source(void* handle, unsigned char* buffer, unsigned int length);
+static bool skip_file_source(void* handle, unsigned int length);
+static long long int get_file_source_size(void* handle);
+static int read_memory_source(void* handle, unsigned char* buffer, unsigned int length);
+static bool skip_memory_source(void* handle, unsigned int length);
+static long long int get_memory_source_size(void* handle);
+static inline bool skip_source(IdlSource* source, unsigned int length);
+IdlSource* open_fd_source(int fd);
+IdlSource* open_file_source(FILE* file);
+IdlSource* open_memory_source(const unsigned char* data, unsigned int length);
+void close_source(IdlSource* source);
+#ifndef _NO_THREADS_
+static void deallocate_pipe_source(PipeSource* pipe);
+static int read_pipe_source(void* handle, unsigned char* buffer, unsigned int length);
+static void release_pipe_source(void* handle);
+IdlSource* open_pipe_source(unsigned int capacity);
+bool write_pipe_source(IdlSource* source, const unsigned char* data, unsigned int length);
+void close_pipe_source(IdlSource* source);
+#endif //_NO_THREADS_
+
+/* -------------------------------------------------------------------------------------- */
+
+// Retry the interrupted reads, a short read doesn't mean the end of the stream for pipes and sockets
+static int read_fd_source(void* handle, unsigned char* buffer, unsigned int length) {
+    int fd = ((FdSource*) handle) -> fd;
+    while (TRUE) {
+#ifdef _WIN32
+        int count = _read(fd, buffer, length);
+#else
+        ssize_t count = read(fd, buffer, length);
+#endif //_WIN32
+        if (count < 0 && errno == EINTR) continue;
+        return (int) count;
+    }
+}
+
+// Pipes and sockets can't seek, so their bytes are read instead
+static bool skip_fd_source(void* handle, unsigned int length) {
+#ifdef _WIN32
+    return _lseeki64(((FdSource*) handle) -> fd, length, SEEK_CUR) >= 0;
+#else
+    return lseek(((FdSource*) handle) -> fd, length, SEEK_CUR) >= 0;
+#endif //_WIN32
+}
+
+// Only the regular files have a length
+static long long int get_fd_source_size(void* handle) {
+    int fd = ((FdSource*) handle) -> fd;
+#ifdef _WIN32
+    struct _stat64 info;
+    if (_fstat64(fd, &info) || !(info.st_mode & _S_IFREG)) return -1;
+    long long int pos = _lseeki64(fd, 0, SEEK_CUR);
+#else
+    struct stat info;
+    if (fstat(fd, &info) || !S_ISREG(info.st_mode)) return -1;
+    long long int pos = lseek(fd, 0, SEEK_CUR);
+#endif //_WIN32
+    return (pos < 0 || pos > info.st_size) ? -1 : info.st_size - pos;
+}
+
+static int read_file_source(void* handle, unsigned char* buffer, unsigned int length) {
+    FILE* file = ((FileSource*) handle) -> file;
+    unsigned int count = fread(buffer, sizeof(unsigned char), length, file);
+    return (count == 0 && ferror(file)) ? -1 : (int) count;
+}
+
+static bool skip_file_source(void* handle, unsigned int length) {
+    return !fseek(((FileSource*) handle) -> file, length, SEEK_CUR);
+}
+
+// Measured by seeking to the end and back, which fails on the streams that can't seek
+static long long int get_file_source_size(void* handle) {
+    FILE* file = ((FileSource*) handle) -> file;
+    long int pos = ftell(file);
+    if (pos < 0 || fseek(file, 0, SEEK_END)) return -1;
+    long int end = ftell(file);
+    fseek(file, pos, SEEK_SET);
+    return (end < pos) ? -1 : end - pos;
+}
+
+static int read_memory_source(void* handle, unsigned char* buffer, unsigned int length) {
+    MemorySource* memory = (MemorySource*) handle;
+    if (length > memory -> length - memory -> pos) length = memory -> length - memory -> pos;
+    memcpy(buffer, memory -> data + memory -> pos, length);
+    memory -> pos += length;
+    return length;
+}
+
+static bool skip_memory_source(void* handle, unsigned int length) {
+    MemorySource* memory = (MemorySource*) handle;
+    memory -> pos = (length > memory -> length - memory -> pos) ? memory -> length : memory -> pos + length;
+    return TRUE;
+}
+
+static long long int get_memory_source_size(void* handle) {
+    MemorySource* memory = (MemorySource*) handle;
+    return memory -> length - memory -> pos;
+}
+
+// FALSE when the source can't seek, so the bytes have to be read instead
+static inline bool skip_source(IdlSource* source, unsigned int length) {
+    return source -> skip != NULL && source -> skip(source -> handle, length);
+}
+
+// Pull the bytes from an open file descriptor, which is left open: the regular files can seek past the data that isn't needed
+IdlSource* open_fd_source(int fd) {
+    FdSource* fd_source = (FdSource*) calloc(1, sizeof(FdSource));
+    fd_source -> fd = fd;
+    fd_source -> source = (IdlSource) {.read = read_fd_source, .skip = skip_fd_source, .size = get_fd_source_size, .close = free, .handle = fd_source};
+    return &(fd_source -> source);
+}
+
+// Pull the bytes from an open stream, which is left open
+IdlSource* open_file_source(FILE* file) {
+    FileSource* file_source = (FileSource*) calloc(1, sizeof(FileSource));
+    file_source -> file = file;
+    file_source -> source = (IdlSource) {.read = read_file_source, .skip = skip_file_source, .size = get_file_source_size, .close = free, .handle = file_source};
+    return &(file_source -> source);
+}
+
+// Pull the bytes from a buffer, which isn't copied and must outlive the source
+IdlSource* open_memory_source(const unsigned char* data, unsigned int length) {
+    MemorySource* memory = (MemorySource*) calloc(1, sizeof(MemorySource));
+    memory -> data = data;
+    memory -> length = length;
+    memory -> source = (IdlSource) {.read = read_memory_source, .skip = skip_memory_source, .size = get_memory_source_size, .close = free, .handle = memory};
+    return &(memory -> source);
+}
+
+// Release a source, the sources filled by the caller are released only when they have a close function
+void close_source(IdlSource* source) {
+    if (source -> close != NULL) {
+        source -> close(source -> handle);
+    }
+    return;
+}
+
+#ifndef _NO_THREADS_
+
+static void deallocate_pipe_source(PipeSource* pipe) {
+    pthread_mutex_destroy(&(pipe -> lock));
+    pthread_cond_destroy(&(pipe -> has_data));
+    pthread_cond_destroy(&(pipe -> has_space));
+    free(pipe -> data);
+    free(pipe);
+    return;
+}
+
+// Wait for the writer, the stream ends once the pipe is closed and every byte written is read
+static int read_pipe_source(void* handle, unsigned char* buffer, unsigned int length) {
+    PipeSource* pipe = (PipeSource*) handle;
+    pthread_mutex_lock(&(pipe -> lock));
+    while (pipe -> length == 0 && !(pipe -> is_closed)) {
+        pthread_cond_wait(&(pipe -> has_data), &(pipe -> lock));
+    }
+
+    if (length > pipe -> length) length = pipe -> length;
+    unsigned int first_length = pipe -> capacity - pipe -> start;
+    if (first_length > length) first_length = length;
+    memcpy(buffer, pipe -> data + pipe -> start, first_length);
+    memcpy(buffer + first_length, pipe -> data, length - first_length);
+    pipe -> start = (pipe -> start + length) % pipe -> capacity;
+    pipe -> length -= length;
+
+    pthread_cond_signal(&(pipe -> has_space));
+    pthread_mutex_unlock(&(pipe -> lock));
+
+    return length;
+}
+
+// The reader is done, the pipe is released by whichever side is the last one to leave
+static void release_pipe_source(void* handle) {
+    PipeSource* pipe = (PipeSource*) handle;
+    pthread_mutex_lock(&(pipe -> lock));
+    pipe -> is_released = TRUE;
+    bool is_closed = pipe -> is_closed;
+    pthread_cond_signal(&(pipe -> has_space));
+    pthread_mutex_unlock(&(pipe -> lock));
+    if (is_closed) deallocate_pipe_source(pipe);
+    return;
+}
+
+// Pipe with room for capacity bytes, written from another thread (e.g. the one extracting an archive or receiving from a
+// socket) with write_pipe_source and closed with close_pipe_source, while the decoder reads it as any other source
+IdlSource* open_pipe_source(unsigned int capacity) {
+    PipeSource* pipe = (PipeSource*) calloc(1, sizeof(PipeSource));
+    pipe -> capacity = (capacity) ? capacity : 1;
+    pipe -> data = (unsigned char*) calloc(pipe -> capacity, sizeof(unsigned char));
+    pthread_mutex_init(&(pipe -> lock), NULL);
+    pthread_cond_init(&(pipe -> has_data), NULL);
+    pthread_cond_init(&(pipe -> has_space), NULL);
+    pipe -> source = (IdlSource) {.read = read_pipe_source, .close = release_pipe_source, .handle = pipe};
+    return &(pipe -> source);
+}
+
+// Wait while the pipe is full, returns FALSE when the reader is gone and the bytes are no longer needed
+bool write_pipe_source(IdlSource* source, const unsigned char* data, unsigned int length) {
+    PipeSource* pipe = (PipeSource*) (source -> handle);
+    pthread_mutex_lock(&(pipe -> lock));
+    while (length && !(pipe -> is_released)) {
+        if (pipe -> length == pipe -> capacity) {
+            pthread_cond_wait(&(pipe -> has_space), &(pipe -> lock));
+            continue;
+        }
+
+        unsigned int end = (pipe -> start + pipe -> length) % pipe -> capacity;
+        unsigned int count = (end >= pipe -> start) ? pipe -> capacity - end : pipe -> start - end;
+        if (count > length) count = length;
+        memcpy(pipe -> data + end, data, count);
+        pipe -> length += count;
+        data += count;
+        length -= count;
+        pthread_cond_signal(&(pipe -> has_data));
+    }
+
+    bool is_released = pipe -> is_released;
+    pthread_mutex_unlock(&(pipe -> lock));
+
+    return !is_released;
+}
+
+// The writer is done, the reader gets the end of the stream after the bytes left in the pipe
+void close_pipe_source(IdlSource* source) {
+    PipeSource* pipe = (PipeSource*) (source -> handle);
+    pthread_mutex_lock(&(pipe -> lock));
+    pipe -> is_closed = TRUE;
+    bool is_released = pipe -> is_released;
+    pthread_cond_signal(&(pipe -> has_data));
+    pthread_mutex_unlock(&(pipe -> lock));
+    if (is_released) deallocate_pipe_source(pipe);
+    return;
+}
+
+#endif //_NO_THREADS_
+
+#endif //_SOURCE_H_
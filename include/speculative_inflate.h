@@ -0,0 +1,364 @@
+#ifndef _SPECULATIVE_INFLATE_H_
+#define _SPECULATIVE_INFLATE_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./checksum.h"
+#include "./decompressor.h"
+#include "./parallel_inflate.h"
+
+#ifndef SPECULATIVE_MIN_LENGTH
+#define SPECULATIVE_MIN_LENGTH 0x100000 // Compressed bytes below which the stream is inflated sequentially
+#endif //SPECULATIVE_MIN_LENGTH
+
+#define SPECULATIVE_SEARCH_LENGTH 0x100000 // Compressed bytes scanned looking for the first block of a segment
+#define SPECULATIVE_TRIAL_SYMBOLS 0x4000 // Symbols a candidate block must decode without errors
+#define SPECULATIVE_INFLATE_STEP 0x10000
+#define WINDOW_MARKER 256 // Symbols from here on are references to the window preceding the segment
+
+static bool is_speculative_inflate_enabled = TRUE;
+
+// Counters of get_speculative_inflate_stats, updated atomically as the images can be decoded on several threads at once
+static atomic_uint speculative_attempts = 0;
+static atomic_uint speculative_fallbacks = 0;
+static atomic_uint speculative_segments = 0;
+static atomic_ullong speculative_inflated_bytes = 0;
+static atomic_ullong speculative_elapsed_ns = 0;
+
+/* -------------------------------------------------------------------------------------- */
+
+static unsigned long long int get_bit_position(Inflater* inflater, const unsigned char* data);
+static unsigned long long int peek_bits(const unsigned char* data, unsigned int length, unsigned long long int bit_pos);
+static bool is_complete_code(const unsigned char* lengths, unsigned short int count, unsigned char max_length);
+static bool is_plausible_block_header(const unsigned char* data, unsigned int length, unsigned long long int bit_pos);
+static Inflater* seek_inflater(unsigned char* data, unsigned int length, unsigned long long int bit_pos);
+static bool is_block_start(unsigned char* data, unsigned int length, unsigned long long int bit_pos);
+static void find_segment_start(void* task);
+static void push_symbol(SpeculativeSegment* segment, unsigned short int symbol);
+static void inflate_speculative_segment(void* task);
+static bool resolve_symbols(SpeculativeSegment* segment, unsigned int from, unsigned int to);
+static void resolve_segment_head(void* task);
+static unsigned long long int get_time_ns(void);
+void set_speculative_inflate(bool enable);
+SpeculativeInflateStats get_speculative_inflate_stats(void);
+unsigned char* speculative_inflate(unsigned char* data, unsigned int length, unsigned int threads_count, bool verify_adler, unsigned int* inflated_length);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Position in the compressed data starting at data, which must be a single span
+static unsigned long long int get_bit_position(Inflater* inflater, const unsigned char* data) {
+    return (unsigned long long int) ((inflater -> span).data - data + inflater -> span_pos) * 8 - inflater -> bit_count;
+}
+
+// Read the bits starting from bit_pos, at least 56 of them are returned (zero padded past the end of the data)
+static unsigned long long int peek_bits(const unsigned char* data, unsigned int length, unsigned long long int bit_pos) {
+    unsigned long long int bits = 0;
+    unsigned int pos = bit_pos / 8;
+    for (unsigned char i = 0; i < 8 && pos + i < length; ++i) {
+        bits |= ((unsigned long long int) data[pos + i]) << (8 * i);
+    }
+    return bits >> (bit_pos & 7);
+}
+
+// Check that the code lengths describe a complete prefix code
+static bool is_complete_code(const unsigned char* lengths, unsigned short int count, unsigned char max_length) {
+    unsigned int kraft_sum = 0;
+    for (unsigned short int i = 0; i < count; ++i) {
+        if (lengths[i]) kraft_sum += 1U << (max_length - lengths[i]);
+    }
+    return kraft_sum == (1U << max_length);
+}
+
+// Cheap check of a dynamic block header: code counts in range and a complete code lengths code
+static bool is_plausible_block_header(const unsigned char* data, unsigned int length, unsigned long long int bit_pos) {
+    unsigned int header = peek_bits(data, length, bit_pos);
+    if (((header >> 1) & 0x03) != 2 || ((header >> 3) & 0x1F) > 29 || ((header >> 8) & 0x1F) > 29) {
+        return FALSE;
+    }
+
+    unsigned char lengths_count = ((header >> 13) & 0x0F) + 4;
+    unsigned long long int code_lengths = peek_bits(data, length, bit_pos + 17);
+    unsigned char lengths[19] = {0};
+    for (unsigned char i = 0; i < lengths_count; ++i) {
+        lengths[i] = (code_lengths >> (3 * i)) & 0x07;
+    }
+
+    return is_complete_code(lengths, 19, 7);
+}
+
+static Inflater* seek_inflater(unsigned char* data, unsigned int length, unsigned long long int bit_pos) {
+    DataSpan span = (DataSpan) {.data = data + bit_pos / 8, .length = length - bit_pos / 8};
+    Inflater* inflater = create_inflater(span, NULL, NULL);
+    get_bits(inflater, bit_pos & 7);
+    return inflater;
+}
+
+// Decode a candidate block for a while: random bits rarely produce complete codes and valid symbols
+static bool is_block_start(unsigned char* data, unsigned int length, unsigned long long int bit_pos) {
+    if (!is_plausible_block_header(data, length, bit_pos)) {
+        return FALSE;
+    }
+
+    Inflater* inflater = seek_inflater(data, length, bit_pos);
+    open_block(inflater);
+
+    bool is_valid = inflater -> error == NULL && (inflater -> literals_hf).lengths[256] && is_complete_code((inflater -> literals_hf).lengths, 286, 15);
+
+    // A distance code with a single symbol is allowed to be incomplete
+    unsigned char distance_codes = 0;
+    for (unsigned char i = 0; is_valid && i < 30; ++i) {
+        distance_codes += ((inflater -> distance_hf).lengths[i] != 0);
+    }
+    is_valid = is_valid && (distance_codes <= 1 || is_complete_code((inflater -> distance_hf).lengths, 30, 15));
+
+    unsigned char byte = 0;
+    for (unsigned int i = 0; is_valid && i < SPECULATIVE_TRIAL_SYMBOLS && inflater -> is_block_open; ++i) {
+        inflate_symbol(inflater, &byte);
+        inflater -> copy_length = 0;
+        is_valid = inflater -> error == NULL;
+    }
+
+    deallocate_inflater(inflater);
+
+    return is_valid;
+}
+
+static void find_segment_start(void* task) {
+    SpeculativeSegment* segment = (SpeculativeSegment*) task;
+    for (unsigned long long int bit_pos = segment -> search_bit; bit_pos < segment -> search_end_bit; ++bit_pos) {
+        if (is_block_start(segment -> data, segment -> length, bit_pos)) {
+            segment -> start_bit = bit_pos;
+            return;
+        }
+    }
+    segment -> error = "no block start found\n";
+    return;
+}
+
+static void push_symbol(SpeculativeSegment* segment, unsigned short int symbol) {
+    if (segment -> count == segment -> capacity) {
+        segment -> capacity = (segment -> capacity) ? segment -> capacity * 2 : SPECULATIVE_INFLATE_STEP;
+        segment -> symbols = (unsigned short int*) realloc(segment -> symbols, sizeof(unsigned short int) * segment -> capacity);
+    }
+    (segment -> symbols)[(segment -> count)++] = symbol;
+    return;
+}
+
+// Inflate from start_bit up to the block starting at end_bit, the back-references that fall before the segment become window markers
+static void inflate_speculative_segment(void* task) {
+    SpeculativeSegment* segment = (SpeculativeSegment*) task;
+    Inflater* inflater = NULL;
+    if (segment -> is_stream_start) inflater = allocate_inflater((DataSpan) {.data = segment -> data, .length = segment -> length}, NULL, NULL);
+    else inflater = seek_inflater(segment -> data, segment -> length, segment -> start_bit);
+
+    unsigned char byte = 0;
+    while (inflater -> error == NULL) {
+        if (!(inflater -> is_block_open)) {
+            if (inflater -> is_final_block) break;
+
+            unsigned long long int bit_pos = get_bit_position(inflater, segment -> data);
+            if (segment -> end_bit && bit_pos == segment -> end_bit) {
+                break;
+            } else if (segment -> end_bit && bit_pos > segment -> end_bit) {
+                inflater -> error = "the segment overran the start of the next one\n";
+                break;
+            }
+
+            open_block(inflater);
+        } else if (inflater -> block_type == 0) {
+            if (!(inflater -> stored_length)) {
+                close_block(inflater);
+                continue;
+            }
+            push_symbol(segment, get_bits(inflater, 8));
+            (inflater -> stored_length)--;
+        } else if (inflate_symbol(inflater, &byte)) {
+            push_symbol(segment, byte);
+        } else {
+            unsigned short int distance = inflater -> copy_distance;
+            for (; inflater -> copy_length; --(inflater -> copy_length)) {
+                if (segment -> count >= distance) {
+                    push_symbol(segment, (segment -> symbols)[segment -> count - distance]);
+                } else if (!(segment -> is_stream_start) && distance - segment -> count <= SLIDING_WINDOW_SIZE) {
+                    push_symbol(segment, WINDOW_MARKER + SLIDING_WINDOW_SIZE - (distance - segment -> count));
+                } else {
+                    inflater -> error = "invalid distance too far back\n";
+                    break;
+                }
+            }
+        }
+    }
+
+    if (inflater -> error == NULL && inflater -> is_final_block) {
+        if (segment -> end_bit) {
+            inflater -> error = "final block found before the end of the segment\n";
+        } else {
+            align_to_byte(inflater);
+            unsigned int adler_crc = get_bits(inflater, 8) << 24;
+            adler_crc |= get_bits(inflater, 8) << 16;
+            adler_crc |= get_bits(inflater, 8) << 8;
+            adler_crc |= get_bits(inflater, 8);
+            segment -> expected_adler = adler_crc;
+        }
+    } else if (inflater -> error == NULL && !(segment -> end_bit)) {
+        inflater -> error = "missing final block\n";
+    }
+
+    segment -> error = inflater -> error;
+    deallocate_inflater(inflater);
+
+    return;
+}
+
+// Replace the window markers with the bytes they refer to, which must be already resolved
+static bool resolve_symbols(SpeculativeSegment* segment, unsigned int from, unsigned int to) {
+    unsigned char* output = segment -> output;
+
+    for (unsigned int i = from; i < to; ++i) {
+        unsigned short int symbol = (segment -> symbols)[i];
+        if (symbol < WINDOW_MARKER) {
+            output[i] = symbol;
+            continue;
+        }
+
+        unsigned short int distance = SLIDING_WINDOW_SIZE + WINDOW_MARKER - symbol;
+        if (distance > segment -> output_pos) {
+            segment -> error = "invalid distance too far back\n";
+            return FALSE;
+        }
+        output[i] = *(output - distance);
+    }
+
+    return TRUE;
+}
+
+static void resolve_segment_head(void* task) {
+    SpeculativeSegment* segment = (SpeculativeSegment*) task;
+    unsigned int head_length = (segment -> count > SLIDING_WINDOW_SIZE) ? segment -> count - SLIDING_WINDOW_SIZE : 0;
+    resolve_symbols(segment, 0, head_length);
+    return;
+}
+
+static unsigned long long int get_time_ns(void) {
+    struct timespec time = {0};
+    timespec_get(&time, TIME_UTC);
+    return (unsigned long long int) time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+void set_speculative_inflate(bool enable) {
+    is_speculative_inflate_enabled = enable;
+    return;
+}
+
+// Totals of every decoding since the start of the process: each counter is read atomically, but an attempt still running on
+// another thread may already be counted in some of them and not yet in the others
+SpeculativeInflateStats get_speculative_inflate_stats(void) {
+    SpeculativeInflateStats stats = {0};
+    stats.attempts = atomic_load_explicit(&speculative_attempts, memory_order_relaxed);
+    stats.fallbacks = atomic_load_explicit(&speculative_fallbacks, memory_order_relaxed);
+    stats.segments = atomic_load_explicit(&speculative_segments, memory_order_relaxed);
+    stats.inflated_bytes = atomic_load_explicit(&speculative_inflated_bytes, memory_order_relaxed);
+    stats.elapsed_ns = atomic_load_explicit(&speculative_elapsed_ns, memory_order_relaxed);
+    return stats;
+}
+
+// Inflate a zlib stream on multiple threads without flush points: each thread starts from a guessed block boundary,
+// the guesses are confirmed once the previous segment ends exactly there, returns NULL if the stream must be inflated sequentially
+unsigned char* speculative_inflate(unsigned char* data, unsigned int length, unsigned int threads_count, bool verify_adler, unsigned int* inflated_length) {
+    unsigned long long int start_time = get_time_ns();
+    atomic_fetch_add_explicit(&speculative_attempts, 1, memory_order_relaxed);
+
+    SpeculativeSegment* segments = (SpeculativeSegment*) calloc(threads_count, sizeof(SpeculativeSegment));
+    unsigned long long int total_bits = (unsigned long long int) length * 8;
+    for (unsigned int i = 0; i < threads_count; ++i) {
+        segments[i] = (SpeculativeSegment) {.data = data, .length = length, .is_stream_start = (i == 0)};
+        segments[i].search_bit = (total_bits * i) / threads_count;
+        segments[i].search_end_bit = (total_bits * (i + 1)) / threads_count;
+        if (segments[i].search_end_bit - segments[i].search_bit > SPECULATIVE_SEARCH_LENGTH * 8) {
+            segments[i].search_end_bit = segments[i].search_bit + SPECULATIVE_SEARCH_LENGTH * 8;
+        }
+    }
+
+    // The first segment starts with the stream, the others are dropped if no block start is found in their range
+    run_parallel_tasks(find_segment_start, segments + 1, sizeof(SpeculativeSegment), threads_count - 1);
+
+    unsigned int segments_count = 1;
+    for (unsigned int i = 1; i < threads_count; ++i) {
+        if (segments[i].error != NULL) continue;
+        segments[segments_count - 1].end_bit = segments[i].start_bit;
+        segments[segments_count++] = segments[i];
+    }
+
+    unsigned char* inflated_data = NULL;
+    *inflated_length = 0;
+
+    if (segments_count > 1) {
+        debug_print(BLUE, "inflating %u speculative segments in parallel...\n", segments_count);
+        run_parallel_tasks(inflate_speculative_segment, segments, sizeof(SpeculativeSegment), segments_count);
+
+        unsigned long long int total_length = 0;
+        const char* error = NULL;
+        for (unsigned int i = 0; i < segments_count && error == NULL; ++i) {
+            error = segments[i].error;
+            total_length += segments[i].count;
+        }
+
+        if (error != NULL) {
+            debug_print(YELLOW, "speculative inflate failed: %s", error);
+        } else if (total_length <= 0xFFFFFFFF) {
+            inflated_data = (unsigned char*) calloc(total_length ? total_length : 1, sizeof(unsigned char));
+            unsigned int output_pos = 0;
+            for (unsigned int i = 0; i < segments_count; ++i) {
+                segments[i].output = inflated_data + output_pos;
+                segments[i].output_pos = output_pos;
+                output_pos += segments[i].count;
+            }
+            *inflated_length = output_pos;
+
+            // The last window of each segment is resolved in order, then the heads only refer to resolved windows
+            bool is_resolved = TRUE;
+            for (unsigned int i = 0; i < segments_count && is_resolved; ++i) {
+                unsigned int head_length = (segments[i].count > SLIDING_WINDOW_SIZE) ? segments[i].count - SLIDING_WINDOW_SIZE : 0;
+                is_resolved = resolve_symbols(segments + i, head_length, segments[i].count);
+            }
+            if (is_resolved) run_parallel_tasks(resolve_segment_head, segments, sizeof(SpeculativeSegment), segments_count);
+            for (unsigned int i = 0; i < segments_count; ++i) {
+                is_resolved = is_resolved && segments[i].error == NULL;
+            }
+
+            unsigned int expected_adler = segments[segments_count - 1].expected_adler;
+            unsigned int adler_register = (is_resolved && verify_adler) ? update_adler32(1, inflated_data, *inflated_length) : expected_adler;
+            if (adler_register != expected_adler) {
+                error_print("adler_register: 0x%x, adler_crc: 0x%x\n", adler_register, expected_adler);
+            }
+
+            if (!is_resolved || adler_register != expected_adler) {
+                free(inflated_data);
+                inflated_data = NULL;
+            }
+        }
+    }
+
+    for (unsigned int i = 0; i < threads_count; ++i) {
+        free(segments[i].symbols);
+    }
+    free(segments);
+
+    if (inflated_data == NULL) {
+        atomic_fetch_add_explicit(&speculative_fallbacks, 1, memory_order_relaxed);
+        *inflated_length = 0;
+        return NULL;
+    }
+
+    atomic_fetch_add_explicit(&speculative_segments, segments_count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&speculative_inflated_bytes, *inflated_length, memory_order_relaxed);
+    atomic_fetch_add_explicit(&speculative_elapsed_ns, get_time_ns() - start_time, memory_order_relaxed);
+
+    return inflated_data;
+}
+
+#endif //_SPECULATIVE_INFLATE_H_
@@ -0,0 +1,311 @@
+#ifndef _TRANSFORM_H_
+#define _TRANSFORM_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "./types.h"
+#include "./debug_print.h"
+#include "./simd.h"
+#include "./dct.h"
+
+#define TRANSPOSE_BLOCK 8 // Pixels on each side of the blocks transposed in registers
+#define TRANSPOSE_TILE 64 // Pixels on each side of the tiles that keep the source and destination rows in cache
+
+/* -------------------------------------------------------------------------------------- */
+
+static void transpose_block(const unsigned char* src, long long int src_stride, unsigned char* dst, long long int dst_stride, unsigned char components);
+static void transpose_pixels(const unsigned char* src, long long int src_stride, unsigned char* dst, long long int dst_stride, unsigned int width, unsigned int height, unsigned char components);
+static void reverse_pixels(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned char components);
+static void swap_rows(unsigned char* first, unsigned char* second, unsigned int length);
+static bool is_transform_swapping_sides(ImageTransform transform);
+static void copy_transformed(Image image, ImageTransform transform, unsigned char* output);
+Image transform_image(Image image, ImageTransform transform, unsigned char* output);
+void transform_image_in_place(Image* image, ImageTransform transform);
+void flip_image_horizontally(Image image);
+void flip_image_vertically(Image image);
+
+/* -------------------------------------------------------------------------------------- */
+
+// Transpose a block of 8x8 pixels: the rows of the source become the columns of the destination
+static void transpose_block(const unsigned char* src, long long int src_stride, unsigned char* dst, long long int dst_stride, unsigned char components) {
+#ifdef _USE_SSE2_
+    if (components == 1) {
+        __m128i rows[8];
+        for (unsigned char i = 0; i < 8; ++i) rows[i] = _mm_loadl_epi64((const __m128i*) (src + i * src_stride));
+
+        __m128i a0 = _mm_unpacklo_epi8(rows[0], rows[1]);
+        __m128i a1 = _mm_unpacklo_epi8(rows[2], rows[3]);
+        __m128i a2 = _mm_unpacklo_epi8(rows[4], rows[5]);
+        __m128i a3 = _mm_unpacklo_epi8(rows[6], rows[7]);
+        __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+        __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+        __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+        __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+
+        // Each register holds two columns
+        __m128i columns[4] = {_mm_unpacklo_epi32(b0, b2), _mm_unpackhi_epi32(b0, b2), _mm_unpacklo_epi32(b1, b3), _mm_unpackhi_epi32(b1, b3)};
+        for (unsigned char i = 0; i < 4; ++i) {
+            _mm_storel_epi64((__m128i*) (dst + 2 * i * dst_stride), columns[i]);
+            _mm_storel_epi64((__m128i*) (dst + (2 * i + 1) * dst_stride), _mm_unpackhi_epi64(columns[i], columns[i]));
+        }
+        return;
+    } else if (components == 4) {
+#ifdef _USE_AVX2_
+        __m256i rows[8];
+        for (unsigned char i = 0; i < 8; ++i) rows[i] = _mm256_loadu_si256((const __m256i*) (src + i * src_stride));
+        transpose_8x8_epi32(rows);
+        for (unsigned char i = 0; i < 8; ++i) _mm256_storeu_si256((__m256i*) (dst + i * dst_stride), rows[i]);
+#else
+        // Four blocks of 4x4 pixels
+        for (unsigned char by = 0; by < 8; by += 4) {
+            for (unsigned char bx = 0; bx < 8; bx += 4) {
+                const unsigned char* block = src + by * src_stride + bx * 4;
+                __m128i r0 = _mm_loadu_si128((const __m128i*) block);
+                __m128i r1 = _mm_loadu_si128((const __m128i*) (block + src_stride));
+                __m128i r2 = _mm_loadu_si128((const __m128i*) (block + 2 * src_stride));
+                __m128i r3 = _mm_loadu_si128((const __m128i*) (block + 3 * src_stride));
+                __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+                __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+                __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+                __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+                unsigned char* output = dst + bx * dst_stride + by * 4;
+                _mm_storeu_si128((__m128i*) output, _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128((__m128i*) (output + dst_stride), _mm_unpackhi_epi64(t0, t1));
+                _mm_storeu_si128((__m128i*) (output + 2 * dst_stride), _mm_unpacklo_epi64(t2, t3));
+                _mm_storeu_si128((__m128i*) (output + 3 * dst_stride), _mm_unpackhi_epi64(t2, t3));
+            }
+        }
+#endif //_USE_AVX2_
+        return;
+    }
+#endif //_USE_SSE2_
+
+    for (unsigned char y = 0; y < 8; ++y) {
+        for (unsigned char x = 0; x < 8; ++x) {
+            memcpy(dst + x * dst_stride + y * components, src + y * src_stride + x * components, components);
+        }
+    }
+
+    return;
+}
+
+// The destination has a row for each column of the source, the strides may be negative to also flip the rows
+static void transpose_pixels(const unsigned char* src, long long int src_stride, unsigned char* dst, long long int dst_stride, unsigned int width, unsigned int height, unsigned char components) {
+    for (unsigned int tile_y = 0; tile_y < height; tile_y += TRANSPOSE_TILE) {
+        unsigned int tile_height = (height - tile_y < TRANSPOSE_TILE) ? height - tile_y : TRANSPOSE_TILE;
+        for (unsigned int tile_x = 0; tile_x < width; tile_x += TRANSPOSE_TILE) {
+            unsigned int tile_width = (width - tile_x < TRANSPOSE_TILE) ? width - tile_x : TRANSPOSE_TILE;
+
+            for (unsigned int y = tile_y; y < tile_y + tile_height; y += TRANSPOSE_BLOCK) {
+                for (unsigned int x = tile_x; x < tile_x + tile_width; x += TRANSPOSE_BLOCK) {
+                    const unsigned char* block = src + y * src_stride + (long long int) x * components;
+                    unsigned char* output = dst + x * dst_stride + (long long int) y * components;
+                    if (y + TRANSPOSE_BLOCK <= height && x + TRANSPOSE_BLOCK <= width) {
+                        transpose_block(block, src_stride, output, dst_stride, components);
+                        continue;
+                    }
+
+                    // The blocks on the right and bottom edges
+                    unsigned int block_height = (height - y < TRANSPOSE_BLOCK) ? height - y : TRANSPOSE_BLOCK;
+                    unsigned int block_width = (width - x < TRANSPOSE_BLOCK) ? width - x : TRANSPOSE_BLOCK;
+                    for (unsigned int i = 0; i < block_height; ++i) {
+                        for (unsigned int j = 0; j < block_width; ++j) {
+                            memcpy(output + j * dst_stride + i * components, block + i * src_stride + j * components, components);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+// Copy the pixels of a row in the opposite order, the source and the destination can't overlap
+static void reverse_pixels(const unsigned char* src, unsigned char* dst, unsigned int width, unsigned char components) {
+    unsigned int i = 0;
+
+#ifdef _USE_AVX2_
+    if (components == 4) {
+        const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+        for (; i + 8 <= width; i += 8) {
+            __m256i pixels = _mm256_loadu_si256((const __m256i*) (src + (width - i - 8) * 4));
+            _mm256_storeu_si256((__m256i*) (dst + i * 4), _mm256_permutevar8x32_epi32(pixels, reverse));
+        }
+    }
+#endif //_USE_AVX2_
+
+#ifdef _USE_SSE2_
+    unsigned char pixels_count = 16 / components;
+    if (components != 3) {
+        for (; i + pixels_count <= width; i += pixels_count) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*) (src + (width - i - pixels_count) * components));
+            pixels = _mm_shuffle_epi32(pixels, 0x1B);
+            if (components < 4) pixels = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, 0xB1), 0xB1);
+            if (components == 1) pixels = _mm_or_si128(_mm_slli_epi16(pixels, 8), _mm_srli_epi16(pixels, 8));
+            _mm_storeu_si128((__m128i*) (dst + i * components), pixels);
+        }
+    }
+#endif //_USE_SSE2_
+
+    for (; i < width; ++i) {
+        memcpy(dst + i * components, src + (width - i - 1) * components, components);
+    }
+
+    return;
+}
+
+static void swap_rows(unsigned char* first, unsigned char* second, unsigned int length) {
+    unsigned int i = 0;
+
+#if defined(_USE_AVX2_)
+    for (; i + 32 <= length; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*) (first + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*) (second + i));
+        _mm256_storeu_si256((__m256i*) (first + i), b);
+        _mm256_storeu_si256((__m256i*) (second + i), a);
+    }
+#elif defined(_USE_SSE2_)
+    for (; i + 16 <= length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (first + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (second + i));
+        _mm_storeu_si128((__m128i*) (first + i), b);
+        _mm_storeu_si128((__m128i*) (second + i), a);
+    }
+#endif //_USE_AVX2_
+
+    for (; i < length; ++i) {
+        unsigned char temp = first[i];
+        first[i] = second[i];
+        second[i] = temp;
+    }
+
+    return;
+}
+
+static bool is_transform_swapping_sides(ImageTransform transform) {
+    return transform == TRANSFORM_ROTATE_90 || transform == TRANSFORM_ROTATE_270 || transform == TRANSFORM_TRANSPOSE || transform == TRANSFORM_TRANSVERSE;
+}
+
+static void copy_transformed(Image image, ImageTransform transform, unsigned char* output) {
+    unsigned char components = image.components;
+    long long int row_length = (long long int) image.width * components;
+    long long int column_length = (long long int) image.height * components; // Length of the rows of the transposed image
+    const unsigned char* last_row = image.decoded_data + (image.height - 1) * row_length;
+    unsigned char* last_column = output + (image.width - 1) * column_length;
+
+    switch (transform) {
+        case TRANSFORM_NONE:
+            memcpy(output, image.decoded_data, image.height * row_length);
+            break;
+
+        case TRANSFORM_FLIP_HORIZONTALLY:
+            for (unsigned int y = 0; y < image.height; ++y) {
+                memcpy(output + (image.height - y - 1) * row_length, image.decoded_data + y * row_length, row_length);
+            }
+            break;
+
+        case TRANSFORM_FLIP_VERTICALLY:
+            for (unsigned int y = 0; y < image.height; ++y) {
+                reverse_pixels(image.decoded_data + y * row_length, output + y * row_length, image.width, components);
+            }
+            break;
+
+        case TRANSFORM_ROTATE_180:
+            for (unsigned int y = 0; y < image.height; ++y) {
+                reverse_pixels(image.decoded_data + y * row_length, output + (image.height - y - 1) * row_length, image.width, components);
+            }
+            break;
+
+        // The rotations are transposes of the image flipped upside down (clockwise) or of the flipped result (counterclockwise)
+        case TRANSFORM_TRANSPOSE:
+            transpose_pixels(image.decoded_data, row_length, output, column_length, image.width, image.height, components);
+            break;
+
+        case TRANSFORM_ROTATE_90:
+            transpose_pixels(last_row, -row_length, output, column_length, image.width, image.height, components);
+            break;
+
+        case TRANSFORM_ROTATE_270:
+            transpose_pixels(image.decoded_data, row_length, last_column, -column_length, image.width, image.height, components);
+            break;
+
+        case TRANSFORM_TRANSVERSE:
+            transpose_pixels(last_row, -row_length, last_column, -column_length, image.width, image.height, components);
+            break;
+    }
+
+    return;
+}
+
+// Write the transformed image into output, which must hold image.size bytes, or into a new buffer when it's NULL
+Image transform_image(Image image, ImageTransform transform, unsigned char* output) {
+    if (image.decoded_data == NULL || image.width == 0 || image.height == 0 || image.components == 0 || image.components > 4) {
+        error_print("invalid image to transform!\n");
+        image.error = INVALID_IMAGE_SIZE;
+        return image;
+    }
+
+    Image transformed = image;
+    transformed.decoded_data = (output == NULL) ? (unsigned char*) calloc(image.size, sizeof(unsigned char)) : output;
+    if (is_transform_swapping_sides(transform)) {
+        transformed.width = image.height;
+        transformed.height = image.width;
+    }
+
+    copy_transformed(image, transform, transformed.decoded_data);
+
+    return transformed;
+}
+
+// The flips and the half turn swap the pixels in place, the other transforms go through a temporary copy
+void transform_image_in_place(Image* image, ImageTransform transform) {
+    if (image -> decoded_data == NULL || image -> width == 0 || image -> height == 0 || image -> components == 0 || image -> components > 4) {
+        error_print("invalid image to transform!\n");
+        return;
+    }
+
+    unsigned int row_length = image -> width * image -> components;
+    unsigned char* data = image -> decoded_data;
+
+    if (transform == TRANSFORM_FLIP_HORIZONTALLY) {
+        for (unsigned int y = 0; y < image -> height / 2; ++y) {
+            swap_rows(data + (unsigned long long int) y * row_length, data + (unsigned long long int) (image -> height - y - 1) * row_length, row_length);
+        }
+    } else if (transform == TRANSFORM_FLIP_VERTICALLY || transform == TRANSFORM_ROTATE_180) {
+        unsigned char* temp = (unsigned char*) calloc(row_length, sizeof(unsigned char));
+        unsigned int last_row = (transform == TRANSFORM_ROTATE_180) ? (image -> height - 1) / 2 : image -> height - 1;
+        for (unsigned int y = 0; y <= last_row; ++y) {
+            unsigned char* row = data + (unsigned long long int) y * row_length;
+            unsigned char* opposite_row = (transform == TRANSFORM_ROTATE_180) ? data + (unsigned long long int) (image -> height - y - 1) * row_length : row;
+            reverse_pixels(row, temp, image -> width, image -> components);
+            if (opposite_row != row) reverse_pixels(opposite_row, row, image -> width, image -> components);
+            memcpy(opposite_row, temp, row_length);
+        }
+        free(temp);
+    } else if (transform != TRANSFORM_NONE) {
+        unsigned char* temp = (unsigned char*) calloc(image -> size, sizeof(unsigned char));
+        Image transformed = transform_image(*image, transform, temp);
+        memcpy(data, temp, image -> size);
+        free(temp);
+        image -> width = transformed.width;
+        image -> height = transformed.height;
+    }
+
+    return;
+}
+
+// Swap the rows top to bottom
+void flip_image_horizontally(Image image) {
+    transform_image_in_place(&image, TRANSFORM_FLIP_HORIZONTALLY);
+    return;
+}
+
+// Mirror the rows left to right
+void flip_image_vertically(Image image) {
+    transform_image_in_place(&image, TRANSFORM_FLIP_VERTICALLY);
+    return;
+}
+
+#endif //_TRANSFORM_H_
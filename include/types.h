@@ -6,13 +6,17 @@ typedef enum DecodeFlag {INVALID_BYTE_STUFFING = 0x0100, DNL_MARKER_DETECTED, LE
 typedef enum Colors {RED = 31, GREEN, YELLOW, BLUE, PURPLE, CYAN, WHITE} Colors;
 typedef enum JPEGType {BASELINE, SEQUENTIAL_EXTENDED_HUFFMAN, PROGRESSIVE_HUFFMAN, LOSSLESS_HUFFMAN, DIFFERENTIAL_SEQUENTIAL_EXTENDED_HUFFMAN = 5, DIFFERENTIAL_PROGRESSIVE_HUFFMAN, DIFFERENTIAL_LOSSLESS_HUFFMAN, SEQUENTIAL_EXTENDED_ARITHMETIC = 9, PROGRESSIVE_ARITHMETIC, LOSSLESS_ARITHMETIC, DIFFERENTIAL_SEQUENTIAL_EXTENDED_ARITHMETIC = 13, DIFFERENTIAL_PROGRESSIVE_ARITHMETIC, DIFFERENTIAL_LOSSLESS_ARITHMETIC} JPEGType;
 typedef enum PNGType {GREYSCALE = 0, TRUECOLOR = 2, INDEXED_COLOR = 3, GREYSCALE_ALPHA = 4, TRUECOLOR_ALPHA = 6} PNGType;
-typedef enum FileType {JPEG, PNG, PPM} FileType;
+typedef enum FileType {JPEG, PNG, PPM, QOI} FileType;
+typedef enum ChecksumPolicy {VERIFY_ALL_CHECKSUMS, VERIFY_CRITICAL_CHECKSUMS, SKIP_CHECKSUMS} ChecksumPolicy;
+typedef enum ChromaSubsampling {SUBSAMPLING_444, SUBSAMPLING_422, SUBSAMPLING_420} ChromaSubsampling;
+typedef enum ImageTransform {TRANSFORM_NONE, TRANSFORM_FLIP_HORIZONTALLY, TRANSFORM_FLIP_VERTICALLY, TRANSFORM_ROTATE_90, TRANSFORM_ROTATE_180, TRANSFORM_ROTATE_270, TRANSFORM_TRANSPOSE, TRANSFORM_TRANSVERSE} ImageTransform;
+typedef enum ResampleFilter {RESAMPLE_BOX, RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3} ResampleFilter;
 typedef unsigned char bool;
 
 const char* err_codes[] = {"NO_ERROR", "FILE_NOT_FOUND", "INVALID_FILE_TYPE", "FILE_ERROR", "INVALID_MARKER_LENGTH", "INVALID_QUANTIZATION_TABLE_NUM", "INVALID_HUFFMAN_TABLE_NUM", "INVALID_IMAGE_SIZE", "EXCEEDED_LENGTH", "UNSUPPORTED_JPEG_TYPE", "INVALID_DEPTH_COLOR_COMBINATION", "INVALID_CHUNK_LENGTH", "INVALID_COMPRESSION_METHOD", "INVALID_FILTER_METHOD", "INVALID_INTERLACE_METHOD", "INVALID_IEND_CHUNK_SIZE", "DECODING_ERROR"};
 const char* jpeg_types[] = {"BASELINE", "SEQUENTIAL_EXTENDED_HUFFMAN", "PROGRESSIVE_HUFFMAN", "LOSSLESS_HUFFMAN", "", "DIFFERENTIAL_SEQUENTIAL_EXTENDED_HUFFMAN", "DIFFERENTIAL_PROGRESSIVE_HUFFMAN", "DIFFERENTIAL_LOSSLESS_HUFFMAN", "", "SEQUENTIAL_EXTENDED_ARITHMETIC", "PROGRESSIVE_ARITHMETIC", "LOSSLESS_ARITHMETIC", "", "DIFFERENTIAL_SEQUENTIAL_EXTENDED_ARITHMETIC", "DIFFERENTIAL_PROGRESSIVE_ARITHMETIC", "DIFFERENTIAL_LOSSLESS_ARITHMETIC"};
 const char* png_types[] = {"GREYSCALE", "", "TRUECOLOR/RGB_TRIPLE", "INDEXED_COLOR/PALETTE", "GREYSCALE_ALPHA", "", "TRUECOLOR_ALPHA/RGB_TRIPLE_ALPHA"};
-const char* file_types[] = {"JPEG", "PNG", "PPM"};
+const char* file_types[] = {"JPEG", "PNG", "PPM", "QOI"};
 
 const JPEGType type_supported[] = { BASELINE };
 const unsigned char type_supported_count = 1;
@@ -23,6 +27,7 @@ typedef struct MCU {
     unsigned char data_units_count; // Total number of data units
     unsigned char* comp_du_count; // Number of data units per component
     unsigned char max_du;
+    int* reduced_units; // Each data unit scaled to 4x4, 2x2 and 1x1 for the pyramid levels, NULL otherwise
 } MCU;
 
 typedef struct HuffmanData {
@@ -43,6 +48,7 @@ typedef struct BitStream {
     unsigned int size;
     unsigned char current_byte;
     ImageError error;
+    bool is_input_open; // More bytes can still be appended, so running out of them isn't reported
 } BitStream;
 
 typedef struct Component {
@@ -106,6 +112,9 @@ typedef struct Image {
     ImageError error;
 } Image;
 
+// Band of decoded rows, starting at first_row, each one stride bytes after the previous one
+typedef void (*RowsCallback)(unsigned int first_row, unsigned int rows_count, const unsigned char* pixels, unsigned int stride, void* user_data);
+
 typedef struct JPEGImage {
     Image image_data;
     BitStream* bit_stream;
@@ -117,8 +126,20 @@ typedef struct JPEGImage {
     unsigned int mcu_x;
     unsigned int mcu_y;
     JPEGType jpeg_type;
+    unsigned char orientation; // From the Exif segment, 1 when upright
+    ImageTransform transform; // Applied while the blocks are placed in the decoded data
+    bool is_pyramid; // Keep the data units scaled down for the pyramid levels
+    RowsCallback rows_callback; // Given each MCU row as soon as it's decoded, instead of keeping the image
+    void* rows_user_data;
+    unsigned int emitted_mcu_rows;
 } JPEGImage;
 
+typedef struct ExifInfo {
+    unsigned char orientation;
+    unsigned int thumbnail_offset; // From the start of the payload
+    unsigned int thumbnail_length; // 0 when there's no JPEG thumbnail
+} ExifInfo;
+
 typedef struct Chunk {
     unsigned int pos;
     unsigned char chunk_type[5];
@@ -131,6 +152,24 @@ typedef struct Chunks {
     unsigned char invalid_chunks;
 } Chunks;
 
+// Reused by the images decoded with idl_decode_with, instead of being allocated again for each one
+typedef struct IdlDecoder {
+    long double* m; // Cosine matrix of the IDCT and its transpose, computed by the first JPEG image
+    long double* t_m;
+    unsigned char* window; // Sliding window lent to one inflater at a time
+    bool is_window_lent;
+    Chunk* chunks; // Array of the PNG chunks, kept with its capacity
+    unsigned int chunks_capacity;
+    unsigned char** pool_buffers; // Buffers of the images released with idl_release_image, taken by the next images
+    unsigned int* pool_sizes;
+    unsigned int pool_count;
+    unsigned int pool_capacity;
+    unsigned char** lent_buffers; // Buffers taken by the images still held by the caller, with the size they were allocated with
+    unsigned int* lent_sizes;
+    unsigned int lent_count;
+    unsigned int lent_capacity;
+} IdlDecoder;
+
 typedef struct DynamicHF {
     unsigned short int** values;
     unsigned short int* min_codes;
@@ -145,7 +184,114 @@ typedef struct SlidingWindow {
     unsigned short int out_pos;
 } SlidingWindow;
 
-typedef struct PNGImage {
+typedef void (*ProgressiveCallback)(Image preview, unsigned char pass, void* user_data);
+
+typedef struct DataSpan {
+    unsigned char* data;
+    unsigned int length;
+} DataSpan;
+
+typedef bool (*NextSpanCallback)(void* source, DataSpan* span);
+
+typedef struct Inflater {
+    DataSpan span; // Compressed data currently read, the following spans are requested through next_span
+    unsigned int span_pos;
+    NextSpanCallback next_span;
+    void* source;
+    unsigned long long int bit_buffer;
+    unsigned char bit_count;
+    SlidingWindow sliding_window;
+    IdlDecoder* window_owner; // Decoder context whose sliding window is lent to the inflater, NULL when the window is its own
+    DynamicHF literals_hf;
+    DynamicHF distance_hf;
+    unsigned char block_type;
+    bool is_final_block;
+    bool is_block_open;
+    bool is_done;
+    unsigned int stored_length; // Bytes left in the current uncompressed block
+    bool is_flush_block; // The last block opened is an empty stored block, as the one ending a sync or full flush
+    unsigned short int copy_length; // Bytes left to copy from the current back-reference
+    unsigned short int copy_distance;
+    unsigned int adler_register;
+    unsigned int expected_adler; // Read after the final block
+    bool verify_adler;
+    bool is_segment; // Stops at the end of the compressed data right after a flush, see allocate_segment_inflater
+    bool is_input_open; // More compressed data can still be appended to the span, so it waits instead of running out of it
+    unsigned int total_out;
+    const char* error;
+} Inflater;
+
+typedef struct InflateSegment InflateSegment;
+typedef void (*SegmentCallback)(InflateSegment* segment, void* user_data);
+
+struct InflateSegment {
+    DataSpan span; // First compressed span of the segment, the following ones are requested through next_span
+    NextSpanCallback next_span;
+    void* source;
+    bool is_stream_start;
+    unsigned char* data; // Inflated data
+    unsigned int length;
+    unsigned int capacity;
+    unsigned int adler_register;
+    unsigned int expected_adler;
+    bool verify_adler;
+    bool is_final; // The segment ends with the final block of the stream
+    bool is_processed; // Set by the callback once it consumed the inflated data
+    const char* error;
+};
+
+typedef struct IdatReader {
+    unsigned char* file_data;
+    unsigned int file_length;
+    unsigned int next_chunk_pos; // Position of the chunk following the IDAT span being inflated
+    unsigned int end_pos; // Position where the compressed data of a segment ends, zero to read until the last IDAT chunk
+    bool verify_crc; // Verify the crc of each IDAT chunk when the inflater reaches it
+} IdatReader;
+
+typedef struct FlushPoint {
+    unsigned int pos; // Position in the file of the compressed data following the flush
+    unsigned int chunk_end; // End of the data of the IDAT chunk containing pos
+    unsigned int offset; // Offset of pos in the compressed stream
+} FlushPoint;
+
+typedef struct SpeculativeSegment {
+    unsigned char* data; // Whole compressed stream, shared by all the segments
+    unsigned int length;
+    unsigned long long int search_bit; // Where to look for the first block of the segment
+    unsigned long long int search_end_bit;
+    unsigned long long int start_bit;
+    unsigned long long int end_bit; // Start of the next segment, zero for the last one
+    bool is_stream_start;
+    unsigned short int* symbols; // Inflated bytes, or references to the window preceding the segment
+    unsigned int count;
+    unsigned int capacity;
+    unsigned char* output; // Where the resolved bytes are written
+    unsigned int output_pos; // Bytes inflated by the previous segments
+    unsigned int expected_adler;
+    const char* error;
+} SpeculativeSegment;
+
+typedef struct SpeculativeInflateStats {
+    unsigned int attempts;
+    unsigned int fallbacks; // Attempts that had to be inflated sequentially
+    unsigned int segments; // Segments inflated in parallel by the successful attempts
+    unsigned long long int inflated_bytes;
+    unsigned long long int elapsed_ns; // Spent by the successful attempts
+} SpeculativeInflateStats;
+
+typedef struct IdatCrcCheck {
+    unsigned char* file_data;
+    unsigned int file_length;
+    unsigned int pos; // Position of the data of the first IDAT chunk
+    bool is_valid;
+} IdatCrcCheck;
+
+typedef void (*DefilterKernel)(unsigned char* scanline, const unsigned char* previous_scanline, unsigned int length);
+
+typedef struct PNGImage PNGImage;
+typedef void (*ScanlineConverter)(PNGImage* image, const unsigned char* scanline, unsigned char* dest, unsigned int width);
+
+struct PNGImage {
     Image image_data;
     BitStream* bit_stream;
     unsigned char bit_depth;
@@ -153,19 +299,266 @@ typedef struct PNGImage {
     unsigned char compression_method;
     unsigned char filter_method;
     unsigned char interlace_method;
-    RGB palette;
+    unsigned char palette[256][4]; // RGBA entries, the ones not defined by the PLTE chunk are left zeroed
     unsigned char filter_interval;
+    unsigned int scanline_length; // Bytes of a scanline without the filter type byte
+    DefilterKernel defilter_kernels[5]; // Indexed by filter type, specialized for filter_interval
+    ScanlineConverter convert_scanline; // Specialized for the color type and the bit depth
+    unsigned char unpack_lut[256][8]; // Samples packed in each byte value, for bit depths below 8
     bool is_palette_defined;
-    unsigned int idat_chunk_count;
-    unsigned int current_idat_chunk;
-    BitStream* compressed_stream;
-} PNGImage;
+    bool is_idat_decoded;
+    bool is_idat_crc_deferred; // Verified by check_idat_chunks while the IDAT chunks are decoded
+    bool is_idat_crc_lazy; // Verified only for the IDAT chunks the inflater reaches, as the ones after the last row aren't read
+    IdatReader idat_reader;
+    unsigned int target_width; // Size the image is resized to while it's decoded, zero to keep it as it is
+    unsigned int target_height;
+    struct Resizer* resizer; // Fed with each converted row when decoding to the target size, NULL otherwise
+    unsigned int first_row; // Range of rows decoded, all of them when rows_count is zero
+    unsigned int rows_count;
+    RowsCallback rows_callback; // Given each row as soon as it's converted, instead of keeping the image
+    void* rows_user_data;
+};
+
+typedef struct PNGDecoder {
+    PNGImage image;
+    unsigned char header[8]; // The signature, then the length and the type of each chunk
+    unsigned char header_length;
+    bool is_signature_read;
+    Chunk chunk; // Chunk being received
+    unsigned int chunk_received; // Bytes of its data and of its crc received so far
+    unsigned int chunk_crc;
+    unsigned char* chunk_data; // Data of the chunks decoded once complete, NULL for IDAT and the ignored ones
+    unsigned char crc_bytes[4];
+    bool is_idat_started;
+    bool is_idat_ended; // A chunk followed the IDAT chunks, so the compressed data is complete
+    unsigned char* compressed; // IDAT data not yet read by the inflater
+    unsigned int compressed_length;
+    Inflater* inflater;
+    unsigned char* scanline; // Scanline being inflated, filled across the pushes
+    unsigned char* previous_scanline;
+    unsigned char* pass_row;
+    unsigned int scanline_size; // Of the current pass, with the filter type byte
+    unsigned int scanline_filled;
+    unsigned char pass; // 7 when the image isn't interlaced
+    unsigned int pass_height;
+    unsigned int pass_row_index; // Next row of the reduced image of the pass
+    unsigned int decoded_rows; // Complete rows at the top of the image
+    bool is_scanlines_done;
+    bool is_done;
+} PNGDecoder;
+
+typedef struct BitWriter {
+    unsigned char* data;
+    unsigned int length;
+    unsigned int capacity;
+    unsigned long long int bit_buffer;
+    unsigned char bit_count;
+} BitWriter;
+
+typedef struct HuffmanCode {
+    unsigned short int codes[288]; // Bit reversed, so that they're written as they are
+    unsigned char lengths[288];
+} HuffmanCode;
+
+typedef struct DynamicHeader {
+    HuffmanCode lengths_code;
+    unsigned short int literals_count;
+    unsigned char distances_count;
+    unsigned char lengths_count; // Code lengths of lengths_code that are written
+    unsigned char symbols[316]; // Run-length encoded code lengths of the literals and distances codes
+    unsigned char extra_bits[316];
+    unsigned short int symbols_count;
+} DynamicHeader;
+
+typedef struct Deflater {
+    BitWriter writer;
+    const unsigned char* data;
+    unsigned int length;
+    unsigned char level;
+    int* head; // Last position of each hash
+    int* previous; // Previous position with the same hash, indexed by position in the window
+    unsigned int inserted; // Positions before this one are in the hash chains
+    unsigned short int* symbols; // Literals, or lengths of the matches
+    unsigned short int* distances; // Zero for the literals
+    unsigned int symbols_count;
+    unsigned int block_start; // Position of the first byte of the current block
+    unsigned int literals_freqs[286];
+    unsigned int distances_freqs[30];
+    HuffmanCode fixed_literals;
+    HuffmanCode fixed_distances;
+} Deflater;
+
+typedef struct PNGBand {
+    Image image;
+    unsigned int first_row;
+    unsigned int rows_count;
+    unsigned char level;
+    bool is_final; // The band ends the zlib stream, the others end with a full flush
+    unsigned char* data; // Compressed data
+    unsigned int length;
+    unsigned int adler_register;
+    unsigned int filtered_length;
+} PNGBand;
+
+typedef struct JPEGHuffmanTable {
+    unsigned char bits[17]; // Number of codes of each length
+    unsigned char values[256]; // Symbols sorted by code length
+    unsigned short int codes[256]; // Indexed by symbol
+    unsigned char lengths[256];
+} JPEGHuffmanTable;
+
+typedef struct JPEGEncoder {
+    Image image;
+    unsigned char components_count;
+    unsigned char sampling_factor_h[3];
+    unsigned char sampling_factor_v[3];
+    unsigned char max_sf_h;
+    unsigned char max_sf_v;
+    unsigned int mcu_x; // MCUs for each row
+    unsigned int mcu_y;
+    unsigned char blocks_per_mcu;
+    unsigned char quantization_tables[2][64]; // Natural order
+    unsigned short int divisors[2][64]; // Quantization steps scaled like the DCT coefficients
+    short int* coefficients; // Quantized blocks in zigzag order, stored MCU after MCU
+    unsigned short int restart_interval; // MCUs for each restart interval, zero for a single interval
+    unsigned int intervals_count;
+    JPEGHuffmanTable dc_tables[2];
+    JPEGHuffmanTable ac_tables[2];
+} JPEGEncoder;
+
+typedef struct JPEGBand {
+    JPEGEncoder* encoder;
+    unsigned int first_row; // In MCU rows
+    unsigned int rows_count;
+} JPEGBand;
+
+typedef struct JPEGIntervals {
+    JPEGEncoder* encoder;
+    unsigned int first_interval;
+    unsigned int intervals_count;
+    bool is_counting; // Collect the symbol frequencies for the optimized tables instead of writing
+    BitWriter writer;
+    unsigned int dc_freqs[2][257];
+    unsigned int ac_freqs[2][257];
+} JPEGIntervals;
+
+typedef struct JPEGDecoder {
+    JPEGImage image;
+    DataTables* data_tables;
+    BitWriter buffer; // Bytes received and not decoded yet
+    BitStream segment; // Over the buffer, read by the decoders of the segments
+    BitStream interval; // Over the entropy coded data of the restart interval being decoded, from interval_start
+    unsigned int interval_start;
+    unsigned int pos; // Where the next marker is looked for
+    unsigned int mcus_count; // MCUs decoded by the end of the restart interval
+    long double* m;
+    long double* t_m;
+    unsigned int decoded_rows; // Complete rows at the top of the image, only at the end when the Exif orientation is applied
+    bool is_in_scan; // The buffer holds entropy coded data following a SOS or a RST marker
+    bool is_stream_ended; // Nothing else is coming, so the last MCUs don't wait for the marker ending their data
+    bool is_done;
+} JPEGDecoder;
+
+typedef struct QOIDecoder {
+    Image image;
+    unsigned char header[14];
+    unsigned char header_length;
+    unsigned char pending[5]; // Operation split between two pushes
+    unsigned char pending_length;
+    unsigned char index[64][4]; // Recently seen pixels, indexed by their hash
+    unsigned char pixel[4]; // Previous pixel, always RGBA
+    unsigned long long int pixels_count;
+    unsigned long long int decoded_pixels;
+    bool is_done;
+} QOIDecoder;
+
+typedef enum DecoderStatus {NEED_MORE_DATA, ROWS_READY, DONE, DECODING_FAILED} DecoderStatus;
+
+typedef struct ImageDecoder {
+    unsigned char header[8]; // First bytes of the stream, which tell the type of the image
+    unsigned char header_length;
+    FileType file_type;
+    PNGDecoder* png_decoder;
+    QOIDecoder* qoi_decoder;
+    JPEGDecoder* jpeg_decoder;
+    BitWriter buffer; // PPM bytes, decoded once complete
+    Image image; // PPM image once decoded
+    unsigned int reported_rows; // Rows available at the end of the previous push
+    bool is_done;
+    ImageError error;
+} ImageDecoder;
+
+// Where the bytes of an image are pulled from: read returns how many bytes it read, 0 at the end of the stream and a
+// negative value on error, skip returns FALSE when the source can't seek and size returns -1 when the length left isn't known
+typedef struct IdlSource {
+    int (*read)(void* handle, unsigned char* buffer, unsigned int length);
+    bool (*skip)(void* handle, unsigned int length); // NULL when the source can't seek
+    long long int (*size)(void* handle); // NULL when the length is never known
+    void (*close)(void* handle); // Releases the handle, NULL when there's nothing to release
+    void* handle;
+} IdlSource;
+
+typedef struct QOIEncoder {
+    Image image;
+    BitWriter writer;
+    unsigned char index[64][4];
+    unsigned char pixel[4];
+    unsigned char run;
+    unsigned char channels; // 4 when the image has an alpha channel, 3 otherwise
+    unsigned long long int pixels_count;
+    unsigned long long int encoded_pixels;
+} QOIEncoder;
+
+typedef void (*PPMRowCallback)(unsigned int y, unsigned char* row, void* user_data);
+
+typedef struct PPMWriter {
+    int fd; // Negative to write into the memory buffer
+    BitWriter buffer;
+    unsigned int width;
+    unsigned int height;
+    unsigned char components;
+    unsigned int written_rows;
+    char header[96];
+    unsigned char header_length; // Zero once the header is written
+    bool error;
+} PPMWriter;
 
 typedef struct PPMImage {
     Image image_data;
-    BitStream* bit_stream;
+    unsigned int max_value;
+    unsigned char sample_length; // 2 bytes when the max value doesn't fit in one
+    unsigned int payload_offset; // Position of the first sample
 } PPMImage;
 
+typedef struct ResampleWeights {
+    unsigned int* starts; // First input pixel of each output pixel
+    unsigned int* counts; // Input pixels that contribute to each output pixel
+    short int* weights; // Fixed-point, taps for each output pixel, padded with zeros
+    unsigned int taps;
+} ResampleWeights;
+
+typedef struct Resizer Resizer;
+
+typedef struct ResizeBand {
+    Resizer* resizer;
+    const unsigned char* input; // Rows of the source image, when the whole image is resized at once
+    unsigned int stride;
+    unsigned char* ring; // Last rows resized horizontally, as many as the vertical taps
+    const unsigned char** rows; // Ring rows that contribute to the current output row
+    unsigned int input_row; // Next input row expected
+    unsigned int output_row; // Next output row to produce
+    unsigned int last_row; // End of the output rows of the band
+} ResizeBand;
+
+struct Resizer {
+    Image image;
+    unsigned int input_width;
+    unsigned int input_height;
+    ResampleWeights horizontal;
+    ResampleWeights vertical;
+    ResizeBand band; // Used by the rows pushed one band at a time
+};
+
 #define CLAMP(x, low, high)  (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
 #define SET_COLOR(color) printf("\033[%d;1m", color)
 #define RESET_COLOR() printf("\033[0m")